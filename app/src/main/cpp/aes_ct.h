@@ -0,0 +1,40 @@
+/* aes_ct.h - constant-time bitsliced AES-128, four blocks at a time */
+#ifndef AES_CT_H
+#define AES_CT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * No table lookups and no data-dependent branches: the state of four
+ * blocks is transposed into eight 64-bit words (one per bit of each byte)
+ * and S-boxes are computed as a boolean circuit. Each of the four lanes
+ * has its own key, which suits Skylander tags where every block has one.
+ * On 32-bit ARM the compiler lowers the 64-bit words to register pairs.
+ */
+
+#define AES_CT_LANES 4
+#define AES_CT_ROUNDS 10
+
+typedef struct {
+    uint64_t rk[AES_CT_ROUNDS + 1][8];  /* bitsliced round keys, all lanes */
+} aes_ct_schedule;
+
+/* Expand count (1-4) keys into lanes 0..count-1; unused lanes get a zero
+ * key. The same schedule serves encryption and decryption. */
+void aes_ct_setup(aes_ct_schedule *s, const uint8_t keys[][16], int count);
+
+/* count (1-4) consecutive 16-byte blocks, block i under lane i's key.
+ * in and out may alias. */
+void aes_ct_encrypt(const aes_ct_schedule *s, const uint8_t *in, uint8_t *out, int count);
+void aes_ct_decrypt(const aes_ct_schedule *s, const uint8_t *in, uint8_t *out, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AES_CT_H */
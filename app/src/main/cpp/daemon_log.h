@@ -0,0 +1,33 @@
+#ifndef DAEMON_LOG_H
+#define DAEMON_LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+
+// Logging for the standalone executable (printf instead of Android log).
+//
+// A thread may install a sink to take its lines instead: the real-time
+// service thread queues them for a logging thread rather than block on a
+// pipe the app reads when it gets round to it (see portal_rt.h).
+typedef void (*DaemonLogSink)(FILE *stream, const char *prefix, const char *fmt, va_list ap);
+inline thread_local DaemonLogSink t_log_sink = nullptr;
+
+__attribute__((format(printf, 3, 4)))
+static inline void daemon_log(FILE *stream, const char *prefix, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (t_log_sink) {
+        t_log_sink(stream, prefix, fmt, ap);
+    } else {
+        fputs(prefix, stream);
+        vfprintf(stream, fmt, ap);
+        fputc('\n', stream);
+        fflush(stream);
+    }
+    va_end(ap);
+}
+
+#define LOGI(...) daemon_log(stdout, "[INFO] ", __VA_ARGS__)
+#define LOGE(...) daemon_log(stderr, "[ERROR] ", __VA_ARGS__)
+
+#endif // DAEMON_LOG_H
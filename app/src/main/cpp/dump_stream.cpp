@@ -0,0 +1,312 @@
+// dump_stream.cpp - overlapped read / convert / write of dump libraries
+#include "dump_stream.h"
+#include "figure_generator.h"
+#include "skylander_crypto.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum SlotState {
+    SLOT_FREE,
+    SLOT_READ,
+    SLOT_CONVERTED,
+};
+
+struct StreamSlot {
+    std::vector<uint8_t> data;
+    uint8_t ok[DUMP_STREAM_BATCH];
+    size_t count;
+    SlotState state;
+};
+
+// Batch b lives in slots[b % slots.size()]; the reader only refills a slot
+// once the writer has freed it, so a slot holds batch b once b < batches_read
+struct Stream {
+    const DumpStreamIo *io;
+    DumpDirection dir;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<StreamSlot> slots;
+    size_t batches_read;
+    size_t next_convert;
+    bool read_done;
+    int error;
+    DumpStreamStats *stats;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void stream_fail(Stream *s, int err) {
+    std::lock_guard<std::mutex> guard(s->lock);
+    if (!s->error) s->error = err;
+    s->changed.notify_all();
+}
+
+static void reader_main(Stream *s) {
+    for (size_t b = 0;; b++) {
+        StreamSlot &slot = s->slots[b % s->slots.size()];
+        {
+            std::unique_lock<std::mutex> guard(s->lock);
+            s->changed.wait(guard, [&] { return slot.state == SLOT_FREE || s->error; });
+            if (s->error) return;
+        }
+
+        double start = now_seconds();
+        ssize_t n = s->io->read(s->io->ctx, b * DUMP_STREAM_BATCH, slot.data.data(), slot.ok,
+                                DUMP_STREAM_BATCH);
+        double busy = now_seconds() - start;
+        if (n < 0) {
+            stream_fail(s, (int)n);
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(s->lock);
+        s->stats->read_seconds += busy;
+        if (n == 0) {
+            s->read_done = true;
+            s->changed.notify_all();
+            return;
+        }
+        slot.count = (size_t)n;
+        slot.state = SLOT_READ;
+        s->batches_read = b + 1;
+        s->changed.notify_all();
+    }
+}
+
+static void convert_main(Stream *s) {
+    for (;;) {
+        size_t b;
+        StreamSlot *slot;
+        {
+            std::unique_lock<std::mutex> guard(s->lock);
+            b = s->next_convert++;
+            slot = &s->slots[b % s->slots.size()];
+            s->changed.wait(guard, [&] {
+                return s->error || b < s->batches_read || s->read_done;
+            });
+            if (s->error || b >= s->batches_read) return;
+        }
+
+        double start = now_seconds();
+        for (size_t i = 0; i < slot->count; i++) {
+            if (!slot->ok[i]) continue;
+            uint8_t *dump = slot->data.data() + i * FIGURE_IMAGE_SIZE;
+            if (s->dir == DUMP_DECRYPT) skylander_decrypt_tag(dump, dump);
+            else skylander_encrypt_tag(dump, dump);
+        }
+        double busy = now_seconds() - start;
+
+        std::lock_guard<std::mutex> guard(s->lock);
+        s->stats->crypt_seconds += busy;
+        slot->state = SLOT_CONVERTED;
+        s->changed.notify_all();
+    }
+}
+
+static void writer_main(Stream *s) {
+    for (size_t b = 0;; b++) {
+        StreamSlot &slot = s->slots[b % s->slots.size()];
+        {
+            std::unique_lock<std::mutex> guard(s->lock);
+            s->changed.wait(guard, [&] {
+                return s->error || (b < s->batches_read && slot.state == SLOT_CONVERTED) ||
+                       (s->read_done && b >= s->batches_read);
+            });
+            if (s->error || b >= s->batches_read) return;
+        }
+
+        double start = now_seconds();
+        int ret = s->io->write(s->io->ctx, b * DUMP_STREAM_BATCH, slot.data.data(), slot.ok,
+                               slot.count);
+        double busy = now_seconds() - start;
+        if (ret < 0) {
+            stream_fail(s, ret);
+            return;
+        }
+
+        size_t written = 0;
+        for (size_t i = 0; i < slot.count; i++) written += slot.ok[i] != 0;
+
+        std::lock_guard<std::mutex> guard(s->lock);
+        s->stats->write_seconds += busy;
+        s->stats->dumps += written;
+        s->stats->skipped += slot.count - written;
+        slot.state = SLOT_FREE;
+        s->changed.notify_all();
+    }
+}
+
+int dump_stream_run(const DumpStreamIo *io, DumpDirection dir, unsigned threads,
+                    DumpStreamStats *stats) {
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+
+    Stream s;
+    s.io = io;
+    s.dir = dir;
+    s.batches_read = 0;
+    s.next_convert = 0;
+    s.read_done = false;
+    s.error = 0;
+    s.stats = stats;
+    memset(stats, 0, sizeof(*stats));
+    stats->workers = threads;
+
+    // Enough batches in flight for every worker plus one being read and
+    // one being written
+    s.slots.resize(threads + 2);
+    for (StreamSlot &slot : s.slots) {
+        slot.data.resize(DUMP_STREAM_BATCH * FIGURE_IMAGE_SIZE);
+        slot.count = 0;
+        slot.state = SLOT_FREE;
+    }
+
+    double start = now_seconds();
+    std::vector<std::thread> pool;
+    pool.reserve(threads + 1);
+    pool.emplace_back(reader_main, &s);
+    for (unsigned i = 0; i < threads; i++) pool.emplace_back(convert_main, &s);
+    writer_main(&s);
+    for (std::thread &t : pool) t.join();
+    stats->elapsed_seconds = now_seconds() - start;
+    return s.error;
+}
+
+// ---- One file per dump ----
+
+struct FileSet {
+    const char *const *paths;
+    size_t count;
+    const char *out_dir;
+};
+
+static ssize_t files_read(void *ctx, size_t first, uint8_t *data, uint8_t *ok, size_t cap) {
+    FileSet *set = (FileSet *)ctx;
+    if (first >= set->count) return 0;
+    size_t n = set->count - first < cap ? set->count - first : cap;
+
+    for (size_t i = 0; i < n; i++) {
+        ok[i] = 0;
+        int fd = open(set->paths[first + i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        // One byte more than an image, to tell a full image from a longer file
+        uint8_t image[FIGURE_IMAGE_SIZE + 1];
+        ssize_t len = read(fd, image, sizeof(image));
+        close(fd);
+        if (len == FIGURE_IMAGE_SIZE) {
+            memcpy(data + i * FIGURE_IMAGE_SIZE, image, FIGURE_IMAGE_SIZE);
+            ok[i] = 1;
+        }
+    }
+    return (ssize_t)n;
+}
+
+static int files_write(void *ctx, size_t first, const uint8_t *data, const uint8_t *ok,
+                       size_t count) {
+    FileSet *set = (FileSet *)ctx;
+    char path[4096];
+    for (size_t i = 0; i < count; i++) {
+        if (!ok[i]) continue;
+        const char *name = strrchr(set->paths[first + i], '/');
+        name = name ? name + 1 : set->paths[first + i];
+        if (snprintf(path, sizeof(path), "%s/%s", set->out_dir, name) >= (int)sizeof(path)) {
+            return -ENAMETOOLONG;
+        }
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return -errno;
+        ssize_t n = write(fd, data + i * FIGURE_IMAGE_SIZE, FIGURE_IMAGE_SIZE);
+        int err = (n < 0) ? errno : 0;
+        close(fd);
+        if (n < 0) return -err;
+        if (n != FIGURE_IMAGE_SIZE) return -EIO;
+    }
+    return 0;
+}
+
+int dump_stream_files(const char *const *paths, size_t count, const char *out_dir,
+                      DumpDirection dir, unsigned threads, DumpStreamStats *stats) {
+    FileSet set = { paths, count, out_dir };
+    DumpStreamIo io = { &set, files_read, files_write };
+    return dump_stream_run(&io, dir, threads, stats);
+}
+
+// ---- Packed library ----
+
+struct PackedFiles {
+    int in_fd;
+    int out_fd;
+};
+
+static ssize_t packed_read(void *ctx, size_t first, uint8_t *data, uint8_t *ok, size_t cap) {
+    PackedFiles *p = (PackedFiles *)ctx;
+    size_t want = cap * FIGURE_IMAGE_SIZE;
+    off_t offset = (off_t)first * FIGURE_IMAGE_SIZE;
+    size_t got = 0;
+    while (got < want) {
+        ssize_t n = pread(p->in_fd, data + got, want - got, offset + got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+
+    size_t dumps = got / FIGURE_IMAGE_SIZE;
+    memset(ok, 1, dumps);
+    if (got % FIGURE_IMAGE_SIZE) ok[dumps++] = 0;      // counted as skipped, not written
+    return (ssize_t)dumps;
+}
+
+static int packed_write(void *ctx, size_t first, const uint8_t *data, const uint8_t *ok,
+                        size_t count) {
+    PackedFiles *p = (PackedFiles *)ctx;
+    size_t full = 0;
+    while (full < count && ok[full]) full++;
+    size_t len = full * FIGURE_IMAGE_SIZE;
+    off_t offset = (off_t)first * FIGURE_IMAGE_SIZE;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(p->out_fd, data + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+int dump_stream_packed(const char *in_path, const char *out_path, DumpDirection dir,
+                       unsigned threads, DumpStreamStats *stats) {
+    PackedFiles p = { -1, -1 };
+    p.in_fd = open(in_path, O_RDONLY | O_CLOEXEC);
+    if (p.in_fd < 0) return -errno;
+    p.out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (p.out_fd < 0) {
+        int err = errno;
+        close(p.in_fd);
+        return -err;
+    }
+    posix_fadvise(p.in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    DumpStreamIo io = { &p, packed_read, packed_write };
+    int ret = dump_stream_run(&io, dir, threads, stats);
+    close(p.in_fd);
+    if (close(p.out_fd) < 0 && ret == 0) ret = -errno;
+    return ret;
+}
@@ -0,0 +1,59 @@
+#ifndef DUMP_STREAM_H
+#define DUMP_STREAM_H
+
+// Streaming encrypt/decrypt of dump libraries. A reader thread fills
+// batches of dumps, worker threads convert them in place and a writer
+// thread writes them back in order, all through a small ring of batch
+// buffers, so reading, crypto and writing overlap and the slowest of the
+// three sets the pace. Each dump is converted with the whole-tag
+// functions, which derive every block key of a dump once.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define DUMP_STREAM_BATCH 64            // dumps per read, crypto and write unit
+
+enum DumpDirection {
+    DUMP_DECRYPT,
+    DUMP_ENCRYPT,
+};
+
+struct DumpStreamStats {
+    size_t dumps;           // converted and written
+    size_t skipped;         // inputs that are not full tag images
+    double read_seconds;    // time each stage spent working, not waiting
+    double crypt_seconds;   // summed over the workers
+    double write_seconds;
+    double elapsed_seconds;
+    unsigned workers;       // crypto threads used
+};
+
+// Where dumps come from and go to. read() fills data (count *
+// FIGURE_IMAGE_SIZE bytes) and ok[] for up to cap dumps starting at dump
+// index first, and returns how many it filled, 0 at the end or -errno.
+// Dumps with ok[i] == 0 are neither converted nor written. write() gets
+// the batch back, in order, and returns 0 or -errno.
+struct DumpStreamIo {
+    void *ctx;
+    ssize_t (*read)(void *ctx, size_t first, uint8_t *data, uint8_t *ok, size_t cap);
+    int (*write)(void *ctx, size_t first, const uint8_t *data, const uint8_t *ok, size_t count);
+};
+
+// Run the pipeline with threads crypto workers (0 = one per CPU).
+// Returns 0 or the first -errno from io.
+int dump_stream_run(const DumpStreamIo *io, DumpDirection dir, unsigned threads,
+                    DumpStreamStats *stats);
+
+// One file per dump: convert paths[0..count) into out_dir under the same
+// base names. Files that are not FIGURE_IMAGE_SIZE bytes are skipped.
+int dump_stream_files(const char *const *paths, size_t count, const char *out_dir,
+                      DumpDirection dir, unsigned threads, DumpStreamStats *stats);
+
+// Packed library (dumps back to back in one file): convert in_path into
+// out_path with large sequential reads and writes. A trailing partial
+// dump is skipped.
+int dump_stream_packed(const char *in_path, const char *out_path, DumpDirection dir,
+                       unsigned threads, DumpStreamStats *stats);
+
+#endif // DUMP_STREAM_H
@@ -0,0 +1,107 @@
+// ep0_cache.cpp - precomputed control request replies
+#include "ep0_cache.h"
+
+#include <string.h>
+#include <endian.h>
+
+#define EP0_TABLE_SIZE 64   // power of two, well above the entry count
+#define EP0_REPORT_SIZE 32
+
+#define HID_REQ_GET_REPORT 0x01
+#define HID_REQ_GET_PROTOCOL 0x03
+#define HID_REQ_SET_REPORT 0x09
+#define HID_REQ_SET_IDLE 0x0A
+#define HID_REQ_SET_PROTOCOL 0x0B
+
+static Ep0Response g_table[EP0_TABLE_SIZE];
+static uint8_t g_hid_desc[9];
+
+static const uint8_t zero_status[2] = { 0x00, 0x00 };
+static const uint8_t config_value[1] = { 0x01 };
+static const uint8_t alt_setting[1] = { 0x00 };
+static const uint8_t report_protocol[1] = { 0x01 };
+static const uint8_t sense_report[EP0_REPORT_SIZE] = { 0x53 };
+
+static inline uint32_t make_key(uint8_t type, uint8_t request, uint16_t value) {
+    return ((uint32_t)type << 24) | ((uint32_t)request << 16) | value;
+}
+
+static inline uint32_t slot_of(uint32_t key) {
+    return (key * 0x9E3779B1u) >> (32 - 6);
+}
+
+static void add(uint8_t type, uint8_t request, uint16_t value, uint8_t action,
+                uint8_t flags, const uint8_t *data, size_t len) {
+    if (flags & EP0_ANY_VALUE) value = 0;
+    uint32_t key = make_key(type, request, value);
+
+    uint32_t i = slot_of(key);
+    while (g_table[i].action != EP0_EMPTY) {
+        i = (i + 1) & (EP0_TABLE_SIZE - 1);
+    }
+    g_table[i].key = key;
+    g_table[i].action = action;
+    g_table[i].flags = flags;
+    g_table[i].len = (uint16_t)len;
+    g_table[i].data = data;
+}
+
+static const Ep0Response *probe(uint32_t key, bool any_value) {
+    uint32_t i = slot_of(key);
+    for (int n = 0; n < EP0_TABLE_SIZE; n++) {
+        const Ep0Response *e = &g_table[i];
+        if (e->action == EP0_EMPTY) return NULL;
+        if (e->key == key && (!any_value || (e->flags & EP0_ANY_VALUE))) return e;
+        i = (i + 1) & (EP0_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+void ep0_cache_init(const uint8_t *hid_report, size_t hid_report_len) {
+    memset(g_table, 0, sizeof(g_table));
+
+    g_hid_desc[0] = 0x09;                           // bLength
+    g_hid_desc[1] = 0x21;                           // bDescriptorType (HID)
+    g_hid_desc[2] = 0x11;                           // bcdHID (1.11)
+    g_hid_desc[3] = 0x01;
+    g_hid_desc[4] = 0x00;                           // bCountryCode
+    g_hid_desc[5] = 0x01;                           // bNumDescriptors
+    g_hid_desc[6] = 0x22;                           // bDescriptorType (Report)
+    g_hid_desc[7] = hid_report_len & 0xFF;
+    g_hid_desc[8] = (hid_report_len >> 8) & 0xFF;
+
+    // Standard requests; hosts address these to the device, interface or endpoint
+    for (uint8_t recip = USB_RECIP_DEVICE; recip <= USB_RECIP_ENDPOINT; recip++) {
+        uint8_t in = USB_DIR_IN | USB_TYPE_STANDARD | recip;
+        uint8_t out = USB_DIR_OUT | USB_TYPE_STANDARD | recip;
+
+        if (hid_report) {
+            add(in, USB_REQ_GET_DESCRIPTOR, 0x2100, EP0_DATA, 0, g_hid_desc, sizeof(g_hid_desc));
+            add(in, USB_REQ_GET_DESCRIPTOR, 0x2200, EP0_DATA, 0, hid_report, hid_report_len);
+        }
+        add(in, USB_REQ_GET_STATUS, 0, EP0_DATA, 0, zero_status, sizeof(zero_status));
+        add(in, USB_REQ_GET_CONFIGURATION, 0, EP0_DATA, 0, config_value, sizeof(config_value));
+        add(in, USB_REQ_GET_INTERFACE, 0, EP0_DATA, 0, alt_setting, sizeof(alt_setting));
+        add(out, USB_REQ_SET_CONFIGURATION, 0, EP0_ACK, EP0_ANY_VALUE, NULL, 0);
+        add(out, USB_REQ_SET_INTERFACE, 0, EP0_ACK, EP0_ANY_VALUE, NULL, 0);
+    }
+
+    // HID class requests
+    uint8_t class_in = USB_DIR_IN | USB_TYPE_CLASS | USB_RECIP_INTERFACE;
+    uint8_t class_out = USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE;
+
+    add(class_in, HID_REQ_GET_REPORT, 0, EP0_DATA, EP0_ANY_VALUE, sense_report, sizeof(sense_report));
+    add(class_in, HID_REQ_GET_PROTOCOL, 0, EP0_DATA, 0, report_protocol, sizeof(report_protocol));
+    add(class_out, HID_REQ_SET_REPORT, 0, EP0_ACK, EP0_ANY_VALUE | EP0_FORWARD_REPORT, NULL, 0);
+    add(class_out, HID_REQ_SET_IDLE, 0, EP0_ACK, EP0_ANY_VALUE, NULL, 0);
+    add(class_out, HID_REQ_SET_PROTOCOL, 0, EP0_ACK, EP0_ANY_VALUE, NULL, 0);
+}
+
+const Ep0Response *ep0_cache_lookup(const struct usb_ctrlrequest *setup) {
+    uint16_t value = le16toh(setup->wValue);
+
+    const Ep0Response *e = probe(make_key(setup->bRequestType, setup->bRequest, value), false);
+    if (e) return e;
+    if (value == 0) return NULL;
+    return probe(make_key(setup->bRequestType, setup->bRequest, 0), true);
+}
@@ -0,0 +1,38 @@
+#ifndef EP0_CACHE_H
+#define EP0_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/usb/ch9.h>
+
+// Every control request the portal answers is constant, so the replies are
+// built once at startup and a SETUP is served with one table probe and one
+// ep0 read/write.
+
+enum Ep0Action : uint8_t {
+    EP0_EMPTY,      // unused table slot
+    EP0_DATA,       // IN request: write data (clamped to wLength)
+    EP0_ACK,        // OUT request: read the data stage (or a ZLP) to ACK
+};
+
+enum Ep0Flags : uint8_t {
+    EP0_ANY_VALUE = 1 << 0,     // match regardless of wValue
+    EP0_FORWARD_REPORT = 1 << 1, // SET_REPORT payload is a portal command
+};
+
+struct Ep0Response {
+    uint32_t key;
+    uint8_t action;
+    uint8_t flags;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+// Build the table. hid_report must stay valid for the life of the daemon;
+// pass NULL for a non-HID portal.
+void ep0_cache_init(const uint8_t *hid_report, size_t hid_report_len);
+
+// NULL means STALL.
+const Ep0Response *ep0_cache_lookup(const struct usb_ctrlrequest *setup);
+
+#endif // EP0_CACHE_H
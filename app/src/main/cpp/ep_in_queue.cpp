@@ -0,0 +1,78 @@
+// ep_in_queue.cpp - bounded per-class queues for IN reports
+#include "ep_in_queue.h"
+#include "portal_mem.h"
+
+struct EpInPolicy {
+    uint8_t depth;
+    uint16_t ttl_ms;
+};
+
+static const EpInPolicy k_policy[EP_IN_CLASSES] = {
+    { EP_IN_QUEUE_DEPTH, 250 },     // EP_IN_REPLY
+    { 1, 1000 },                    // EP_IN_SENSE
+    { 4, 100 },                     // EP_IN_ECHO
+};
+
+static_assert(EP_IN_QUEUE_DEPTH + 1 + 4 == EP_IN_QUEUE_REPORTS, "EP_IN_QUEUE_REPORTS");
+
+static PortalReport *ring_take(EpInRing *ring) {
+    PortalReport *report = ring->items[ring->head];
+    ring->head = (ring->head + 1) % EP_IN_QUEUE_DEPTH;
+    ring->count--;
+    return report;
+}
+
+void ep_in_queue_reserve(EpInQueue *q, MemPool *pool, EpInClass cls) {
+    EpInRing *ring = &q->rings[cls];
+    if (ring->count < k_policy[cls].depth) return;
+    // A sense replaces its predecessor; elsewhere the oldest is the one
+    // the game is least likely still to want
+    mem_pool_put(pool, ring_take(ring));
+    if (cls == EP_IN_SENSE) q->stats.replaced++;
+    else q->stats.overflow++;
+}
+
+void ep_in_queue_push(EpInQueue *q, MemPool *pool, EpInClass cls, PortalReport *report,
+                      uint64_t now_ms) {
+    EpInRing *ring = &q->rings[cls];
+    ep_in_queue_reserve(q, pool, cls);
+    report->deadline_ms = now_ms + k_policy[cls].ttl_ms;
+    report->seq = q->next_seq++;
+    ring->items[(ring->head + ring->count) % EP_IN_QUEUE_DEPTH] = report;
+    ring->count++;
+    q->stats.queued++;
+}
+
+PortalReport *ep_in_queue_front(EpInQueue *q, MemPool *pool, uint64_t now_ms, EpInClass *cls) {
+    PortalReport *front = NULL;
+    for (int c = 0; c < EP_IN_CLASSES; c++) {
+        EpInRing *ring = &q->rings[c];
+        while (ring->count && ring->items[ring->head]->deadline_ms < now_ms) {
+            mem_pool_put(pool, ring_take(ring));
+            q->stats.expired++;
+        }
+        if (!ring->count) continue;
+        // Each ring is in order, so the oldest report is one of the heads
+        PortalReport *head = ring->items[ring->head];
+        if (!front || (int32_t)(head->seq - front->seq) < 0) {
+            front = head;
+            *cls = (EpInClass)c;
+        }
+    }
+    return front;
+}
+
+void ep_in_queue_pop(EpInQueue *q, EpInClass cls) {
+    ring_take(&q->rings[cls]);
+}
+
+void ep_in_queue_clear(EpInQueue *q, MemPool *pool) {
+    for (int c = 0; c < EP_IN_CLASSES; c++) {
+        EpInRing *ring = &q->rings[c];
+        while (ring->count) {
+            mem_pool_put(pool, ring_take(ring));
+            q->stats.expired++;
+        }
+        ring->head = 0;
+    }
+}
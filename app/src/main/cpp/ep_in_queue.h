@@ -0,0 +1,95 @@
+#ifndef EP_IN_QUEUE_H
+#define EP_IN_QUEUE_H
+
+// IN reports the host has not taken yet. A write to ep_in fails with
+// EAGAIN while the host is not polling the endpoint; instead of dropping
+// the report it waits here until the endpoint takes writes again. Each
+// class of report has its own bounded queue and policy:
+//
+//   EP_IN_REPLY   answers to commands; the game waits for them. 16 deep,
+//                 the oldest goes when full, 250 ms to live.
+//   EP_IN_SENSE   0x53 status. Only the newest says anything, so a new
+//                 one replaces the one waiting. 1 s to live.
+//   EP_IN_ECHO    echoes of LED commands nobody waits for. 4 deep, 100 ms.
+//
+// A report past its time to live is dropped when its turn comes: the game
+// has asked again or given up by then. Whatever is left goes out in the
+// order it was sent, across classes, so the host sees reports in the same
+// order it would have without the stall. Queued reports are PortalReports
+// from the daemon's pool; nothing here does I/O or allocates.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct MemPool;
+
+#define MAX_REPORT_SIZE 64
+#define EP_IN_QUEUE_DEPTH 16        // of the deepest class
+#define EP_IN_QUEUE_REPORTS 21      // all classes full
+#define EP_IN_RETRY_MS 2            // wait after an EAGAIN before writing again
+
+// An IN report built ahead of the write that sends it
+struct PortalReport {
+    uint16_t len;
+    uint32_t seq;                   // order it was queued in, across classes
+    uint64_t deadline_ms;           // CLOCK_MONOTONIC; set when it is queued
+    uint8_t data[MAX_REPORT_SIZE];
+};
+
+enum EpInClass : uint8_t {
+    EP_IN_REPLY,
+    EP_IN_SENSE,
+    EP_IN_ECHO,
+    EP_IN_CLASSES,
+};
+
+struct EpInRing {
+    PortalReport *items[EP_IN_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+};
+
+struct EpInStats {
+    uint64_t direct;                // written at once
+    uint64_t queued;                // had to wait for the host
+    uint64_t retried;               // written from a queue
+    uint64_t replaced;              // sense reports a newer one replaced
+    uint64_t expired;               // past their time to live, or the host went away
+    uint64_t overflow;              // pushed out of a full queue
+    uint64_t no_buffer;             // pool empty, dropped at once
+    uint64_t failed;                // write errors other than EAGAIN
+};
+
+struct EpInQueue {
+    EpInRing rings[EP_IN_CLASSES];
+    uint64_t retry_ms;              // earliest time to write to ep_in again
+    uint32_t next_seq;
+    EpInStats stats;
+};
+
+static inline bool ep_in_queue_empty(const EpInQueue *q) {
+    return !q->rings[EP_IN_REPLY].count && !q->rings[EP_IN_SENSE].count &&
+           !q->rings[EP_IN_ECHO].count;
+}
+
+// Make room for one more report of class cls, dropping the oldest if its
+// queue is full. Call before taking the buffer for it from pool, or a full
+// pool drops the new report instead of the old one. Dropped reports go
+// back to pool, here and below.
+void ep_in_queue_reserve(EpInQueue *q, MemPool *pool, EpInClass cls);
+
+// Queue report (from pool, taken over) behind everything waiting
+void ep_in_queue_push(EpInQueue *q, MemPool *pool, EpInClass cls, PortalReport *report,
+                      uint64_t now_ms);
+
+// The report to write next, the oldest of any class; drops expired ones
+// on the way. NULL when nothing is left.
+PortalReport *ep_in_queue_front(EpInQueue *q, MemPool *pool, uint64_t now_ms, EpInClass *cls);
+
+// Remove the report front() returned; it is the caller's again
+void ep_in_queue_pop(EpInQueue *q, EpInClass cls);
+
+// Drop everything queued, counted as expired (the host went away)
+void ep_in_queue_clear(EpInQueue *q, MemPool *pool);
+
+#endif // EP_IN_QUEUE_H
@@ -0,0 +1,67 @@
+// ffs_wait.cpp - wait for FunctionFS files without sleep loops
+#include "ffs_wait.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// functionfs creates its files from inside the kernel, which does not always
+// raise an inotify event, so still look again this often without one
+#define FFS_RECHECK_MS 100
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool still_missing(int err) {
+    return err == ENOENT || err == ENODEV;
+}
+
+int ffs_open_wait(const char *dir, const char *name, int flags, int timeout_ms) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    int fd = open(path, flags);
+    if (fd >= 0) return fd;
+    if (!still_missing(errno)) return -errno;
+
+    // A mount shows up as POLLPRI on mountinfo; files inside the directory
+    // (or the directory itself being populated) through inotify
+    int notify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (notify_fd >= 0) inotify_add_watch(notify_fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+    int mounts_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+
+    uint64_t deadline = monotonic_ms() + timeout_ms;
+    int err;
+    for (;;) {
+        // Try again only after the watches are armed, so nothing is missed
+        fd = open(path, flags);
+        err = errno;
+        if (fd >= 0 || !still_missing(err)) break;
+
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) {
+            err = ETIMEDOUT;
+            break;
+        }
+        uint64_t wait = deadline - now;
+        if (wait > FFS_RECHECK_MS) wait = FFS_RECHECK_MS;
+
+        struct pollfd fds[2] = { { notify_fd, POLLIN, 0 }, { mounts_fd, POLLPRI, 0 } };
+        if (poll(fds, 2, (int)wait) > 0 && (fds[0].revents & POLLIN)) {
+            char events[1024];
+            while (read(notify_fd, events, sizeof(events)) > 0) {}
+        }
+    }
+
+    if (notify_fd >= 0) close(notify_fd);
+    if (mounts_fd >= 0) close(mounts_fd);
+    return fd >= 0 ? fd : -err;
+}
@@ -0,0 +1,16 @@
+#ifndef FFS_WAIT_H
+#define FFS_WAIT_H
+
+// Event-driven waits for FunctionFS files. ep0 appears once functionfs is
+// mounted on the directory and the data endpoints once the descriptors are
+// written to ep0. Instead of sleeping between open() attempts we block on
+// inotify for the directory and on the mount table, and retry when either
+// changes.
+
+#define FFS_DIR "/dev/usb-ffs/portal0"
+
+// open(dir/name, flags), waiting up to timeout_ms for the file to appear.
+// Returns the fd or -errno (-ETIMEDOUT if it never did).
+int ffs_open_wait(const char *dir, const char *name, int flags, int timeout_ms);
+
+#endif // FFS_WAIT_H
@@ -0,0 +1,132 @@
+// figure_editor.cpp - transactional figure stat edits
+#include "figure_editor.h"
+
+#include <errno.h>
+#include <string.h>
+
+// Area blocks feeding each checksum (sector trailers at +3 and +7 are
+// skipped): 0x30 bytes for CRC2, 0x30 plus 0xE0 zero bytes for CRC3
+static const uint8_t CRC2_BLOCKS[] = { 1, 2, 4 };
+static const uint8_t CRC3_BLOCKS[] = { 5, 6, 8 };
+#define CRC3_ZERO_PAD 0xE0
+
+static void store_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void store_le24(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+}
+
+static void store_le32(uint8_t *p, uint32_t v) {
+    store_le24(p, v);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint64_t area_mask(uint8_t area_first, const uint8_t *blocks, size_t count) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < count; i++) mask |= 1ULL << (area_first + blocks[i]);
+    return mask;
+}
+
+uint16_t figure_area_crc1(const uint8_t *block0) {
+    uint8_t copy[SKYLANDER_BLOCK_SIZE];
+    memcpy(copy, block0, sizeof(copy));
+    copy[FIGURE_CRC1_OFFSET] = 0x05;
+    copy[FIGURE_CRC1_OFFSET + 1] = 0x00;
+    return skylander_crc16(copy, sizeof(copy));
+}
+
+uint16_t figure_plain_crc2(const uint8_t *area) {
+    uint16_t crc = 0xFFFF;
+    for (uint8_t b : CRC2_BLOCKS) {
+        crc = skylander_crc16_update(crc, area + b * SKYLANDER_BLOCK_SIZE, SKYLANDER_BLOCK_SIZE);
+    }
+    return crc;
+}
+
+uint16_t figure_plain_crc3(const uint8_t *area) {
+    static const uint8_t zero[CRC3_ZERO_PAD] = { 0 };
+    uint16_t crc = 0xFFFF;
+    for (uint8_t b : CRC3_BLOCKS) {
+        crc = skylander_crc16_update(crc, area + b * SKYLANDER_BLOCK_SIZE, SKYLANDER_BLOCK_SIZE);
+    }
+    return skylander_crc16_update(crc, zero, sizeof(zero));
+}
+
+uint16_t figure_area_crc2(SkylanderFigure *fig, uint8_t area_first) {
+    for (uint8_t b : CRC2_BLOCKS) figure_plain_block(fig, area_first + b);
+    return figure_plain_crc2(fig->plain[area_first]);
+}
+
+uint16_t figure_area_crc3(SkylanderFigure *fig, uint8_t area_first) {
+    for (uint8_t b : CRC3_BLOCKS) figure_plain_block(fig, area_first + b);
+    return figure_plain_crc3(fig->plain[area_first]);
+}
+
+int figure_edit_stage(SkylanderFigure *fig, const FigureEdit *edit,
+                      uint8_t *stage, uint64_t *changed) {
+    *changed = 0;
+    if (!fig->raw) return -ENODEV;
+    if (fig->active_area < 0) return -ENODATA;     // blank figure: nothing to edit
+    if (!edit->fields) return 0;
+    if ((edit->fields & FIGURE_EDIT_XP) && edit->xp > FIGURE_XP_MAX) return -EINVAL;
+    if (fig->type == FIGURE_TRAP && (edit->fields & (FIGURE_EDIT_HAT | FIGURE_EDIT_UPGRADES))) {
+        return -EINVAL;     // those bytes are villain records on a trap
+    }
+
+    uint8_t first = FIGURE_AREA_START[fig->active_area];
+    uint64_t touched = 1ULL << first;   // block 0 always: sequence and CRC1
+
+    // Every plaintext block is decrypted at most once, by figure_edit_block
+    uint8_t *header = figure_edit_block(fig, first);
+    if (edit->fields & FIGURE_EDIT_XP) store_le24(header + FIGURE_XP_OFFSET, edit->xp);
+    if (edit->fields & FIGURE_EDIT_GOLD) store_le16(header + FIGURE_GOLD_OFFSET, edit->gold);
+    if (edit->fields & FIGURE_EDIT_PLAYTIME) store_le32(header + FIGURE_PLAYTIME_OFFSET, edit->playtime);
+
+    if (edit->fields & (FIGURE_EDIT_HAT | FIGURE_EDIT_UPGRADES)) {
+        uint8_t *b = figure_edit_block(fig, first + FIGURE_HAT_BLOCK);
+        if (edit->fields & FIGURE_EDIT_HAT) b[FIGURE_HAT_OFFSET] = edit->hat;
+        if (edit->fields & FIGURE_EDIT_UPGRADES) store_le16(b + FIGURE_UPGRADES_OFFSET, edit->upgrades);
+        touched |= 1ULL << (first + FIGURE_HAT_BLOCK);
+    }
+
+    if (edit->fields & FIGURE_EDIT_NICKNAME) {
+        uint8_t *a = figure_edit_block(fig, first + FIGURE_NICKNAME_BLOCK_A);
+        uint8_t *b = figure_edit_block(fig, first + FIGURE_NICKNAME_BLOCK_B);
+        for (int i = 0; i < FIGURE_NICKNAME_CHARS; i++) {
+            store_le16((i < 8) ? a + i * 2 : b + (i - 8) * 2, edit->nickname[i]);
+        }
+        touched |= 1ULL << (first + FIGURE_NICKNAME_BLOCK_A);
+        touched |= 1ULL << (first + FIGURE_NICKNAME_BLOCK_B);
+    }
+
+    // Only checksums whose inputs changed are recomputed; CRC1 covers
+    // block 0 including the other two, so it goes last
+    if (touched & area_mask(first, CRC3_BLOCKS, sizeof(CRC3_BLOCKS))) {
+        store_le16(header + FIGURE_CRC3_OFFSET, figure_area_crc3(fig, first));
+    }
+    if (touched & area_mask(first, CRC2_BLOCKS, sizeof(CRC2_BLOCKS))) {
+        store_le16(header + FIGURE_CRC2_OFFSET, figure_area_crc2(fig, first));
+    }
+    header[FIGURE_SEQUENCE_OFFSET]++;
+    fig->area_sequence[fig->active_area] = header[FIGURE_SEQUENCE_OFFSET];
+    store_le16(header + FIGURE_CRC1_OFFSET, figure_area_crc1(header));
+
+    // Encrypt straight into the staging image; the live image is untouched
+    // until the caller swaps it in
+    uint64_t pending = touched;
+    while (pending) {
+        int block = __builtin_ctzll(pending);
+        skylander_encrypt_tag_block(fig->raw, (uint8_t)block, fig->plain[block],
+                                    stage + block * SKYLANDER_BLOCK_SIZE);
+        fig->encrypts++;
+        pending &= pending - 1;
+    }
+    fig->cipher_stale &= ~touched;
+    *changed = touched;
+    return 0;
+}
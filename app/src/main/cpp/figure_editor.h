@@ -0,0 +1,57 @@
+#ifndef FIGURE_EDITOR_H
+#define FIGURE_EDITOR_H
+
+// Transactional stat edits on a live figure.
+//
+// A FigureEdit names any set of fields. figure_edit_stage() applies all of
+// them to the active area's plaintext in one pass, recomputes only the
+// checksums whose blocks changed, bumps the area sequence and encrypts the
+// touched blocks into a staging copy of the tag. The caller then publishes
+// the staging copy with a single pointer swap (slot_publish), so the
+// console reads either the old figure or the new one, never a mix.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "skylander_figure.h"
+
+enum FigureEditField : uint32_t {
+    FIGURE_EDIT_XP = 1 << 0,
+    FIGURE_EDIT_GOLD = 1 << 1,
+    FIGURE_EDIT_HAT = 1 << 2,
+    FIGURE_EDIT_NICKNAME = 1 << 3,
+    FIGURE_EDIT_UPGRADES = 1 << 4,
+    FIGURE_EDIT_PLAYTIME = 1 << 5,
+};
+
+#define FIGURE_XP_MAX 0xFFFFFFu
+
+// Plain data; sent as-is over the control socket
+struct FigureEdit {
+    uint32_t fields;        // FigureEditField mask
+    uint32_t xp;
+    uint32_t playtime;
+    uint16_t gold;
+    uint16_t upgrades;
+    uint8_t hat;
+    uint8_t reserved[3];
+    uint16_t nickname[FIGURE_NICKNAME_CHARS];   // UTF-16, NUL-padded
+};
+
+// stage must hold a copy of the current tag image (with no stale blocks).
+// On success *changed is the mask of blocks rewritten in stage and the
+// figure's plaintext already reflects the edit. Returns 0 or -errno; on
+// error neither the figure nor stage has been modified.
+int figure_edit_stage(SkylanderFigure *fig, const FigureEdit *edit,
+                      uint8_t *stage, uint64_t *changed);
+
+// Area checksums over the plaintext of the area starting at area_first
+uint16_t figure_area_crc1(const uint8_t *block0);
+uint16_t figure_area_crc2(SkylanderFigure *fig, uint8_t area_first);
+uint16_t figure_area_crc3(SkylanderFigure *fig, uint8_t area_first);
+
+// The same over a plaintext area already in memory (area block 0 at area,
+// the rest following it), e.g. a tag image before it is encrypted
+uint16_t figure_plain_crc2(const uint8_t *area);
+uint16_t figure_plain_crc3(const uint8_t *area);
+
+#endif // FIGURE_EDITOR_H
@@ -0,0 +1,130 @@
+// figure_generator.cpp - build and clone encrypted figure images
+#include "figure_generator.h"
+#include "figure_editor.h"
+
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Figures handed to a worker at a time; big enough to keep the shared
+// counter off the hot path, small enough to balance the tail
+#define GENERATE_CHUNK 64
+
+// Access bits as found on retail tags
+static const uint8_t SECTOR0_ACCESS[4] = { 0x0F, 0x0F, 0x0F, 0x69 };
+static const uint8_t SECTOR_ACCESS[4] = { 0x7F, 0x0F, 0x08, 0x69 };
+
+static void store_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void write_header(uint8_t *tag, uint32_t uid, uint16_t character_id, uint16_t variant) {
+    uint8_t *b0 = tag;
+    uint8_t *b1 = tag + SKYLANDER_BLOCK_SIZE;
+    memset(tag, 0, SKYLANDER_HEADER_SIZE);
+
+    b0[0] = (uint8_t)uid;
+    b0[1] = (uint8_t)(uid >> 8);
+    b0[2] = (uint8_t)(uid >> 16);
+    b0[3] = (uint8_t)(uid >> 24);
+    b0[4] = b0[0] ^ b0[1] ^ b0[2] ^ b0[3];     // BCC
+    b0[5] = 0x81;                               // SAK / ATQA / manufacturer
+    b0[6] = 0x01;
+    b0[7] = 0x0F;
+
+    store_le16(b1 + 0x00, character_id);
+    store_le16(b1 + 0x0C, variant);
+    store_le16(b1 + 0x0E, skylander_crc16(tag, 0x1E));
+}
+
+static void write_trailers(uint8_t *tag) {
+    for (uint8_t sector = 0; sector < SKYLANDER_BLOCK_COUNT / 4; sector++) {
+        uint8_t *t = tag + (sector * 4 + 3) * SKYLANDER_BLOCK_SIZE;
+        memset(t, 0, SKYLANDER_BLOCK_SIZE);
+        skylander_sector_key(tag, sector, t);
+        memcpy(t + 6, sector ? SECTOR_ACCESS : SECTOR0_ACCESS, 4);
+    }
+}
+
+// Area 0 of a new figure: sequence 1 and the checksums of its empty blocks
+static void write_first_area(uint8_t *plain) {
+    uint8_t *header = plain + FIGURE_AREA_START[0] * SKYLANDER_BLOCK_SIZE;
+
+    header[FIGURE_SEQUENCE_OFFSET] = 1;
+    store_le16(header + FIGURE_CRC3_OFFSET, figure_plain_crc3(header));
+    store_le16(header + FIGURE_CRC2_OFFSET, figure_plain_crc2(header));
+    store_le16(header + FIGURE_CRC1_OFFSET, figure_area_crc1(header));
+}
+
+void figure_generate(const FigureTemplate *t, uint8_t *out) {
+    memset(out, 0, FIGURE_IMAGE_SIZE);
+    write_header(out, t->uid, t->character_id, t->variant);
+    write_trailers(out);
+    write_first_area(out);
+    skylander_encrypt_tag(out, out);
+}
+
+int figure_clone(const uint8_t *src, size_t len, uint32_t uid, uint8_t *out) {
+    if (len < FIGURE_IMAGE_SIZE) return -EINVAL;
+
+    uint8_t plain[FIGURE_IMAGE_SIZE];
+    skylander_decrypt_tag(src, plain);
+
+    uint16_t character_id = (uint16_t)(plain[0x10] | (plain[0x11] << 8));
+    uint16_t variant = (uint16_t)(plain[0x1C] | (plain[0x1D] << 8));
+    uint8_t block1[SKYLANDER_BLOCK_SIZE];
+    memcpy(block1, plain + SKYLANDER_BLOCK_SIZE, sizeof(block1));
+
+    write_header(plain, uid, character_id, variant);
+    // Keep whatever else block 1 carried, then re-seal it
+    memcpy(plain + SKYLANDER_BLOCK_SIZE, block1, 0x0E);
+    store_le16(plain + 0x1E, skylander_crc16(plain, 0x1E));
+    write_trailers(plain);
+
+    skylander_encrypt_tag(plain, out);
+    return 0;
+}
+
+size_t figure_generate_batch(const FigureTemplate *templates, size_t count,
+                             uint8_t *out, unsigned threads) {
+    if (!count) return 0;
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    size_t chunks = (count + GENERATE_CHUNK - 1) / GENERATE_CHUNK;
+    if (threads > chunks) threads = (unsigned)chunks;
+
+    std::atomic<size_t> next_chunk(0);
+    auto worker = [&]() {
+        for (;;) {
+            size_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= chunks) return;
+            size_t first = chunk * GENERATE_CHUNK;
+            size_t last = first + GENERATE_CHUNK < count ? first + GENERATE_CHUNK : count;
+            for (size_t i = first; i < last; i++) {
+                figure_generate(&templates[i], out + i * FIGURE_IMAGE_SIZE);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool) t.join();
+    return count;
+}
+
+uint32_t figure_make_uid(uint64_t seed, uint64_t index) {
+    // splitmix64 step
+    uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    uint32_t uid = (uint32_t)z;
+    if ((uid & 0xFF) == 0x88) uid ^= 0x01;      // 0x88 marks a cascade on ISO 14443
+    return uid;
+}
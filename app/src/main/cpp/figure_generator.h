@@ -0,0 +1,37 @@
+#ifndef FIGURE_GENERATOR_H
+#define FIGURE_GENERATOR_H
+
+// Builds complete tag images: header with UID/BCC, character and variant
+// IDs and header CRC, sector trailers with their per-UID keys, and a first
+// data area with valid checksums, all encrypted with the tag's own keys.
+// A generated figure loads in the game as a new, unused figure.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "skylander_crypto.h"
+
+#define FIGURE_IMAGE_SIZE (SKYLANDER_BLOCK_COUNT * SKYLANDER_BLOCK_SIZE)
+
+struct FigureTemplate {
+    uint32_t uid;
+    uint16_t character_id;
+    uint16_t variant;
+};
+
+// One figure into out (FIGURE_IMAGE_SIZE bytes)
+void figure_generate(const FigureTemplate *t, uint8_t *out);
+
+// Copy of an existing dump under a new UID: the data is re-keyed for the
+// new header and the header CRC and trailer keys are recomputed.
+// Returns 0 or -EINVAL if src is not a full tag image.
+int figure_clone(const uint8_t *src, size_t len, uint32_t uid, uint8_t *out);
+
+// Generate count figures into out (count * FIGURE_IMAGE_SIZE bytes) on
+// threads workers (0 = one per CPU). Returns the number generated.
+size_t figure_generate_batch(const FigureTemplate *templates, size_t count,
+                             uint8_t *out, unsigned threads);
+
+// Deterministic, well-formed UID for index under seed (never 0x88 cascade tag)
+uint32_t figure_make_uid(uint64_t seed, uint64_t index);
+
+#endif // FIGURE_GENERATOR_H
@@ -0,0 +1,168 @@
+// figure_index.cpp - UID and character lookup over loaded and cataloged figures
+#include "figure_index.h"
+#include "skylander_crypto.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Integer finalizer (Wellons' lowbias32): UIDs and IDs are far from random
+static uint32_t mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t character_key(uint16_t character_id, uint16_t variant) {
+    return ((uint32_t)character_id << 16) | variant;
+}
+
+static uint32_t uid_key(const FigureIndexEntry *e) {
+    return e->uid;
+}
+
+static uint32_t entry_character_key(const FigureIndexEntry *e) {
+    return character_key(e->character_id, e->variant);
+}
+
+typedef uint32_t (*KeyOf)(const FigureIndexEntry *e);
+
+static uint32_t table_size(uint32_t capacity) {
+    uint32_t size = 16;
+    while (size < capacity * 2) size <<= 1;
+    return size;
+}
+
+// entries, then free_list, by_uid and by_character
+size_t figure_index_bytes(uint32_t capacity) {
+    return capacity * (sizeof(FigureIndexEntry) + sizeof(uint32_t)) +
+           2 * (size_t)table_size(capacity) * sizeof(uint32_t);
+}
+
+void figure_index_init_at(FigureIndex *index, uint32_t capacity, void *storage) {
+    uint32_t size = table_size(capacity);
+    memset(index, 0, sizeof(*index));
+    index->entries = (FigureIndexEntry *)storage;
+    index->free_list = (uint32_t *)(index->entries + capacity);
+    index->by_uid = index->free_list + capacity;
+    index->by_character = index->by_uid + size;
+    index->capacity = capacity;
+    index->mask = size - 1;
+    figure_index_clear(index);
+}
+
+int figure_index_init(FigureIndex *index, uint32_t capacity) {
+    void *storage = malloc(figure_index_bytes(capacity));
+    if (!storage) {
+        memset(index, 0, sizeof(*index));
+        return -ENOMEM;
+    }
+    figure_index_init_at(index, capacity, storage);
+    index->owned = true;
+    return 0;
+}
+
+void figure_index_free(FigureIndex *index) {
+    if (index->owned) free(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+void figure_index_clear(FigureIndex *index) {
+    if (!index->by_uid) return;
+    memset(index->by_uid, 0, (index->mask + 1) * sizeof(uint32_t));
+    memset(index->by_character, 0, (index->mask + 1) * sizeof(uint32_t));
+    // Hand out low entry numbers first
+    for (uint32_t i = 0; i < index->capacity; i++) index->free_list[i] = index->capacity - 1 - i;
+    index->count = 0;
+}
+
+static void table_insert(FigureIndex *index, uint32_t *table, uint32_t key, uint32_t slot_value) {
+    uint32_t pos = mix32(key) & index->mask;
+    while (table[pos]) pos = (pos + 1) & index->mask;
+    table[pos] = slot_value;
+}
+
+// Take entry number n out of table, shifting later members of the probe
+// run back so no lookup stops early at the hole
+static void table_remove(FigureIndex *index, uint32_t *table, KeyOf key_of, uint32_t n) {
+    uint32_t mask = index->mask;
+    uint32_t hole = mix32(key_of(&index->entries[n])) & mask;
+    while (table[hole] != n + 1) hole = (hole + 1) & mask;
+
+    for (uint32_t next = (hole + 1) & mask; table[next]; next = (next + 1) & mask) {
+        uint32_t home = mix32(key_of(&index->entries[table[next] - 1])) & mask;
+        // Move it unless its home lies cyclically in (hole, next]
+        bool stays = (hole <= next) ? (home > hole && home <= next)
+                                    : (home > hole || home <= next);
+        if (stays) continue;
+        table[hole] = table[next];
+        hole = next;
+    }
+    table[hole] = 0;
+}
+
+int figure_index_add(FigureIndex *index, const FigureIndexEntry *entry) {
+    if (index->count >= index->capacity) return -ENOSPC;
+    uint32_t n = index->free_list[index->capacity - 1 - index->count];
+    index->count++;
+    index->entries[n] = *entry;
+    table_insert(index, index->by_uid, uid_key(entry), n + 1);
+    table_insert(index, index->by_character, entry_character_key(entry), n + 1);
+    return 0;
+}
+
+bool figure_index_remove(FigureIndex *index, uint32_t uid, int32_t ref) {
+    if (!index->count) return false;
+    uint32_t pos = mix32(uid) & index->mask;
+    for (; index->by_uid[pos]; pos = (pos + 1) & index->mask) {
+        uint32_t n = index->by_uid[pos] - 1;
+        const FigureIndexEntry *e = &index->entries[n];
+        if (e->uid != uid || e->ref != ref) continue;
+
+        table_remove(index, index->by_uid, uid_key, n);
+        table_remove(index, index->by_character, entry_character_key, n);
+        index->count--;
+        index->free_list[index->capacity - 1 - index->count] = n;
+        return true;
+    }
+    return false;
+}
+
+static size_t table_find(const FigureIndex *index, const uint32_t *table, KeyOf key_of,
+                         uint32_t key, const FigureIndexEntry **out, size_t max) {
+    if (!table) return 0;
+    size_t found = 0;
+    for (uint32_t pos = mix32(key) & index->mask; table[pos]; pos = (pos + 1) & index->mask) {
+        const FigureIndexEntry *e = &index->entries[table[pos] - 1];
+        if (key_of(e) != key) continue;
+        if (found < max) out[found] = e;
+        found++;
+    }
+    return found;
+}
+
+size_t figure_index_find_uid(const FigureIndex *index, uint32_t uid,
+                             const FigureIndexEntry **out, size_t max) {
+    return table_find(index, index->by_uid, uid_key, uid, out, max);
+}
+
+size_t figure_index_find_character(const FigureIndex *index, uint16_t character_id,
+                                   uint16_t variant, const FigureIndexEntry **out, size_t max) {
+    return table_find(index, index->by_character, entry_character_key,
+                      character_key(character_id, variant), out, max);
+}
+
+bool figure_index_entry_from_header(const uint8_t *header, size_t len, int32_t ref,
+                                    FigureIndexEntry *entry) {
+    if (len < SKYLANDER_HEADER_SIZE) return false;
+    // Same fields figure_attach() decodes
+    entry->uid = (uint32_t)header[0] | ((uint32_t)header[1] << 8) |
+                 ((uint32_t)header[2] << 16) | ((uint32_t)header[3] << 24);
+    entry->character_id = (uint16_t)(header[0x10] | (header[0x11] << 8));
+    entry->variant = (uint16_t)(header[0x1C] | (header[0x1D] << 8));
+    entry->ref = ref;
+    return true;
+}
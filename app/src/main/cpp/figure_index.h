@@ -0,0 +1,65 @@
+#ifndef FIGURE_INDEX_H
+#define FIGURE_INDEX_H
+
+// In-memory index of figures by UID and by (character ID, variant), so the
+// daemon can refuse a second copy of a figure already on the portal and the
+// app can label and look up its catalog without re-reading headers.
+//
+// Two open-addressing (linear probing) tables point into one entry array.
+// Both keys may repeat (a catalog can hold two backups of one figure), so
+// lookups return every match. Removal shifts the following run back
+// instead of leaving tombstones, so probe lengths stay short however many
+// loads and unloads there are. Storage is allocated once, by
+// figure_index_init() or by the caller for figure_index_init_at(); add,
+// remove and lookups never allocate.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct FigureIndexEntry {
+    uint32_t uid;
+    uint16_t character_id;
+    uint16_t variant;
+    int32_t ref;            // the caller's handle: slot number, catalog position
+};
+
+struct FigureIndex {
+    FigureIndexEntry *entries;
+    uint32_t *free_list;    // unused entry numbers
+    uint32_t *by_uid;       // entry number + 1, 0 = empty
+    uint32_t *by_character;
+    uint32_t capacity;
+    uint32_t mask;          // table size - 1; tables are at most half full
+    uint32_t count;
+    bool owned;             // storage came from figure_index_init()
+};
+
+// Room for capacity figures. Returns 0 or -ENOMEM.
+int figure_index_init(FigureIndex *index, uint32_t capacity);
+
+// Same, in figure_index_bytes(capacity) bytes of 4-byte aligned storage
+// the caller keeps (and frees) itself
+size_t figure_index_bytes(uint32_t capacity);
+void figure_index_init_at(FigureIndex *index, uint32_t capacity, void *storage);
+void figure_index_free(FigureIndex *index);
+void figure_index_clear(FigureIndex *index);
+
+// Returns 0 or -ENOSPC
+int figure_index_add(FigureIndex *index, const FigureIndexEntry *entry);
+
+// Remove the entry with this uid and ref; false if there is none
+bool figure_index_remove(FigureIndex *index, uint32_t uid, int32_t ref);
+
+// Matching entries, up to max of them into out (which may be NULL when
+// max is 0). Returns the total number of matches.
+size_t figure_index_find_uid(const FigureIndex *index, uint32_t uid,
+                             const FigureIndexEntry **out, size_t max);
+size_t figure_index_find_character(const FigureIndex *index, uint16_t character_id,
+                                   uint16_t variant, const FigureIndexEntry **out, size_t max);
+
+// Header fields of a tag image (blocks 0-1, never encrypted); false if
+// header is shorter than the two blocks
+bool figure_index_entry_from_header(const uint8_t *header, size_t len, int32_t ref,
+                                    FigureIndexEntry *entry);
+
+#endif // FIGURE_INDEX_H
@@ -0,0 +1,425 @@
+// gadget_config.cpp - configfs gadget and functionfs mount management
+#include "gadget_config.h"
+#include "daemon_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#if defined(__ANDROID__)
+#include <sys/system_properties.h>
+#endif
+
+#define GADGET_PATH_MAX 256
+#define GADGET_MAX_UNDO 20
+#define CONFIGFS_MAGIC 0x62656570
+#define FFS_MOUNT_OPTIONS "rmode=0755,fmode=0666"
+
+enum UndoKind : uint8_t {
+    UNDO_RMDIR,
+    UNDO_UNLINK,
+    UNDO_UMOUNT,
+};
+
+struct UndoStep {
+    UndoKind kind;
+    char path[GADGET_PATH_MAX];
+};
+
+// Everything one gadget_up() call created, to be undone if a later step fails
+struct GadgetTxn {
+    bool configfs;          // false for a plain directory tree
+    int count;
+    UndoStep steps[GADGET_MAX_UNDO];
+};
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const char *ffs_instance(const GadgetConfig *cfg) {
+    const char *slash = strrchr(cfg->ffs_dir, '/');
+    return slash ? slash + 1 : cfg->ffs_dir;
+}
+
+static bool on_configfs(const char *path) {
+    struct statfs fs;
+    return statfs(path, &fs) == 0 && (unsigned long)fs.f_type == CONFIGFS_MAGIC;
+}
+
+static bool is_mounted(const char *dir) {
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    if (!f) return false;
+    char line[512];
+    char point[GADGET_PATH_MAX];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f)) {
+        // "<id> <parent> <major:minor> <root> <mount point> ..."
+        if (sscanf(line, "%*s %*s %*s %*s %255s", point) == 1 && strcmp(point, dir) == 0) {
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// configfs attributes always exist and must not be truncated; in a plain
+// tree they are ordinary files that may need creating
+static int write_attr(bool configfs, const char *dir, const char *attr, const char *value) {
+    char path[GADGET_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    int flags = configfs ? O_WRONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+    int fd = open(path, flags | O_CLOEXEC, 0644);
+    if (fd < 0) return -errno;
+    ssize_t n = write(fd, value, strlen(value));
+    int err = (n < 0) ? errno : 0;
+    close(fd);
+    if (err) LOGE("Cannot write %s: %s", path, strerror(err));
+    return -err;
+}
+
+// Attribute value without the trailing newline; "" if missing
+static void read_attr(const char *dir, const char *attr, char *out, size_t size) {
+    char path[GADGET_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    out[0] = '\0';
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, out, size - 1);
+    close(fd);
+    if (n < 0) n = 0;
+    while (n > 0 && (out[n - 1] == '\n' || out[n - 1] == ' ')) n--;
+    out[n] = '\0';
+}
+
+static void record(GadgetTxn *txn, UndoKind kind, const char *path) {
+    if (txn->count >= GADGET_MAX_UNDO) return;
+    txn->steps[txn->count].kind = kind;
+    snprintf(txn->steps[txn->count].path, GADGET_PATH_MAX, "%s", path);
+    txn->count++;
+}
+
+static int txn_mkdir(GadgetTxn *txn, const char *path) {
+    if (mkdir(path, 0755) == 0) {
+        record(txn, UNDO_RMDIR, path);
+        return 0;
+    }
+    if (errno == EEXIST) return 0;
+    int err = errno;
+    LOGE("Cannot create %s: %s", path, strerror(err));
+    return -err;
+}
+
+static int txn_symlink(GadgetTxn *txn, const char *target, const char *link) {
+    if (symlink(target, link) == 0) {
+        record(txn, UNDO_UNLINK, link);
+        return 0;
+    }
+    if (errno != EEXIST) {
+        int err = errno;
+        LOGE("Cannot link %s: %s", link, strerror(err));
+        return -err;
+    }
+
+    // Already linked is fine, as long as it points at our function
+    char current[GADGET_PATH_MAX];
+    ssize_t n = readlink(link, current, sizeof(current) - 1);
+    if (n < 0) return -errno;
+    current[n] = '\0';
+    const char *name = strrchr(target, '/');
+    const char *have = strrchr(current, '/');
+    if (strcmp(name ? name : target, have ? have : current) != 0) {
+        LOGE("%s already links to %s", link, current);
+        return -EEXIST;
+    }
+    return 0;
+}
+
+static int txn_mount(GadgetTxn *txn, const char *source, const char *dir) {
+    if (is_mounted(dir)) return 0;
+    if (mount(source, dir, "functionfs", 0, FFS_MOUNT_OPTIONS) < 0) {
+        int err = errno;
+        LOGE("Cannot mount functionfs %s on %s: %s", source, dir, strerror(err));
+        return -err;
+    }
+    record(txn, UNDO_UMOUNT, dir);
+    return 0;
+}
+
+// rmdir that also clears out the attribute files a plain tree accumulates;
+// configfs removes those itself
+static int remove_dir(bool configfs, const char *path) {
+    if (rmdir(path) == 0 || errno == ENOENT) return 0;
+    if (configfs || errno != ENOTEMPTY) return -errno;
+
+    DIR *dir = opendir(path);
+    if (!dir) return -errno;
+    struct dirent *e;
+    char child[GADGET_PATH_MAX];
+    while ((e = readdir(dir))) {
+        if (e->d_type == DT_DIR) continue;
+        if (snprintf(child, sizeof(child), "%s/%s", path, e->d_name) >= (int)sizeof(child)) continue;
+        unlink(child);
+    }
+    closedir(dir);
+    return rmdir(path) == 0 ? 0 : -errno;
+}
+
+static void rollback(GadgetTxn *txn) {
+    for (int i = txn->count - 1; i >= 0; i--) {
+        const UndoStep *step = &txn->steps[i];
+        int ret = 0;
+        switch (step->kind) {
+            case UNDO_UMOUNT:
+                ret = umount2(step->path, MNT_DETACH) < 0 ? -errno : 0;
+                break;
+            case UNDO_UNLINK:
+                ret = unlink(step->path) < 0 ? -errno : 0;
+                break;
+            case UNDO_RMDIR:
+                ret = remove_dir(txn->configfs, step->path);
+                break;
+        }
+        if (ret < 0) LOGE("Rollback of %s failed: %s", step->path, strerror(-ret));
+    }
+    txn->count = 0;
+}
+
+static void android_usb_release(void) {
+#if defined(__ANDROID__)
+    __system_property_set("ctl.stop", "adbd");
+    __system_property_set("sys.usb.config", "none");
+    __system_property_set("sys.usb.state", "none");
+
+    // The control socket is reached from the app's domain
+    int fd = open("/sys/fs/selinux/enforce", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (write(fd, "0", 1) < 0) LOGE("Could not set SELinux permissive: %s", strerror(errno));
+        close(fd);
+    }
+#endif
+}
+
+static void android_usb_restore(void) {
+#if defined(__ANDROID__)
+    __system_property_set("sys.usb.config", "mtp,adb");
+    __system_property_set("ctl.start", "adbd");
+#endif
+}
+
+// Configfs refuses ID changes on a bound gadget and a UDC takes one gadget,
+// so unbind ours and any other gadget (Android's own) first
+static void release_udcs(const GadgetConfig *cfg) {
+    char parent[GADGET_PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", cfg->gadget_dir);
+    const char *root = dirname(parent);
+
+    DIR *dir = opendir(root);
+    if (!dir) return;
+    struct dirent *e;
+    char gadget[GADGET_PATH_MAX];
+    char udc[GADGET_PATH_MAX];
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.') continue;
+        if (snprintf(gadget, sizeof(gadget), "%s/%s", root, e->d_name) >= (int)sizeof(gadget)) continue;
+        read_attr(gadget, "UDC", udc, sizeof(udc));
+        if (!udc[0]) continue;
+        LOGI("Unbinding gadget %s from %s", e->d_name, udc);
+        write_attr(on_configfs(gadget), gadget, "UDC", "\n");
+    }
+    closedir(dir);
+}
+
+int gadget_up(const GadgetConfig *cfg, const PortalProfile *profile) {
+    uint64_t start = monotonic_ms();
+    if (cfg->android_usb) android_usb_release();
+    release_udcs(cfg);
+
+    GadgetTxn txn;
+    memset(&txn, 0, sizeof(txn));
+    const char *g = cfg->gadget_dir;
+    const char *instance = ffs_instance(cfg);
+    char path[GADGET_PATH_MAX];
+    char target[GADGET_PATH_MAX];
+    char value[16];
+    int ret = txn_mkdir(&txn, g);
+    if (ret < 0) return ret;
+    txn.configfs = on_configfs(g);
+
+    // Device descriptor
+    struct { const char *attr; unsigned value; } ids[] = {
+        { "idVendor", profile->vid },
+        { "idProduct", profile->pid },
+        { "bcdDevice", profile->bcd_device },
+        { "bcdUSB", 0x0200 },
+        { "bDeviceClass", 0 },
+        { "bDeviceSubClass", 0 },
+        { "bDeviceProtocol", 0 },
+        { "bMaxPacketSize0", 64 },
+    };
+    for (const auto &id : ids) {
+        snprintf(value, sizeof(value), "0x%04x", id.value);
+        if ((ret = write_attr(txn.configfs, g, id.attr, value)) < 0) goto fail;
+    }
+
+    // Device strings - what the host shows
+    snprintf(path, sizeof(path), "%s/strings", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    snprintf(path, sizeof(path), "%s/strings/0x409", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    if ((ret = write_attr(txn.configfs, path, "manufacturer", profile->manufacturer)) < 0 ||
+        (ret = write_attr(txn.configfs, path, "product", profile->product)) < 0 ||
+        (ret = write_attr(txn.configfs, path, "serialnumber", profile->serial)) < 0) {
+        goto fail;
+    }
+
+    // Configuration
+    snprintf(path, sizeof(path), "%s/configs", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    snprintf(path, sizeof(path), "%s/configs/c.1", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    if ((ret = write_attr(txn.configfs, path, "MaxPower", "250")) < 0 ||
+        (ret = write_attr(txn.configfs, path, "bmAttributes", "0x80")) < 0) {
+        goto fail;
+    }
+    snprintf(path, sizeof(path), "%s/configs/c.1/strings", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    snprintf(path, sizeof(path), "%s/configs/c.1/strings/0x409", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    if ((ret = write_attr(txn.configfs, path, "configuration", "Portal Config")) < 0) goto fail;
+
+    // FunctionFS function, linked into the config
+    snprintf(path, sizeof(path), "%s/functions", g);
+    if ((ret = txn_mkdir(&txn, path)) < 0) goto fail;
+    snprintf(target, sizeof(target), "%s/functions/ffs.%s", g, instance);
+    if ((ret = txn_mkdir(&txn, target)) < 0) goto fail;
+    snprintf(path, sizeof(path), "%s/configs/c.1/ffs.%s", g, instance);
+    if ((ret = txn_symlink(&txn, target, path)) < 0) goto fail;
+
+    if (cfg->mount_ffs) {
+        snprintf(path, sizeof(path), "%s", cfg->ffs_dir);
+        if ((ret = txn_mkdir(&txn, dirname(path))) < 0) goto fail;
+        if ((ret = txn_mkdir(&txn, cfg->ffs_dir)) < 0) goto fail;
+        if ((ret = txn_mount(&txn, instance, cfg->ffs_dir)) < 0) goto fail;
+    }
+
+    LOGI("Gadget up in %llu ms (%d entries created)",
+         (unsigned long long)(monotonic_ms() - start), txn.count);
+    return 0;
+
+fail:
+    LOGE("Gadget setup failed (%s), rolling back %d entries", strerror(-ret), txn.count);
+    rollback(&txn);
+    return ret;
+}
+
+// UDC number n in name order, like `ls /sys/class/udc | sed -n (n+1)p`
+static int nth_udc(const char *udc_dir, int n, char *out, size_t size) {
+    DIR *dir = opendir(udc_dir);
+    if (!dir) return -errno;
+    out[0] = '\0';
+    struct dirent *e;
+    char prev[GADGET_PATH_MAX] = "";
+    // n + 1 passes for the smallest name above the previous one; there are
+    // only ever a handful of UDCs
+    for (int i = 0; i <= n; i++) {
+        rewinddir(dir);
+        out[0] = '\0';
+        while ((e = readdir(dir))) {
+            if (e->d_name[0] == '.') continue;
+            if (i > 0 && strcmp(e->d_name, prev) <= 0) continue;
+            if (!out[0] || strcmp(e->d_name, out) < 0) snprintf(out, size, "%s", e->d_name);
+        }
+        if (!out[0]) break;
+        snprintf(prev, sizeof(prev), "%s", out);
+    }
+    closedir(dir);
+    return out[0] ? 0 : -ENODEV;
+}
+
+int gadget_bind(const GadgetConfig *cfg) {
+    char udc[GADGET_PATH_MAX];
+    int ret = nth_udc(cfg->udc_dir, cfg->udc_index, udc, sizeof(udc));
+    if (ret < 0) {
+        LOGE("No UDC %d in %s", cfg->udc_index, cfg->udc_dir);
+        return ret;
+    }
+
+    char current[GADGET_PATH_MAX];
+    read_attr(cfg->gadget_dir, "UDC", current, sizeof(current));
+    if (strcmp(current, udc) == 0) return 0;
+    if (current[0]) gadget_unbind(cfg);
+
+    ret = write_attr(on_configfs(cfg->gadget_dir), cfg->gadget_dir, "UDC", udc);
+    if (ret == 0) LOGI("Gadget bound to %s", udc);
+    return ret;
+}
+
+int gadget_unbind(const GadgetConfig *cfg) {
+    char current[GADGET_PATH_MAX];
+    read_attr(cfg->gadget_dir, "UDC", current, sizeof(current));
+    if (!current[0]) return 0;
+    return write_attr(on_configfs(cfg->gadget_dir), cfg->gadget_dir, "UDC", "\n");
+}
+
+int gadget_down(const GadgetConfig *cfg, bool restore_android_usb) {
+    uint64_t start = monotonic_ms();
+    const char *g = cfg->gadget_dir;
+    const char *instance = ffs_instance(cfg);
+    bool configfs = on_configfs(g);
+    char path[GADGET_PATH_MAX];
+    int first_err = 0;
+    int ret;
+
+    struct stat st;
+    if (stat(g, &st) == 0) {
+        ret = gadget_unbind(cfg);
+        if (ret < 0) first_err = ret;
+    }
+
+    if (cfg->mount_ffs) {
+        if (is_mounted(cfg->ffs_dir) && umount2(cfg->ffs_dir, 0) < 0) {
+            // Still open somewhere: detach now, the instance goes with the last fd
+            LOGE("Unmount of %s: %s, detaching", cfg->ffs_dir, strerror(errno));
+            umount2(cfg->ffs_dir, MNT_DETACH);
+        }
+        rmdir(cfg->ffs_dir);
+    }
+
+    // Children before parents. configs/c.1/strings and the top-level groups
+    // are configfs defaults that go away with their parent.
+    snprintf(path, sizeof(path), "%s/configs/c.1/ffs.%s", g, instance);
+    if (unlink(path) < 0 && errno != ENOENT && !first_err) first_err = -errno;
+
+    const char *dirs[] = {
+        "functions/ffs.%s", "configs/c.1/strings/0x409", "configs/c.1/strings",
+        "configs/c.1", "strings/0x409", "configs", "functions", "strings",
+    };
+    for (const char *rel : dirs) {
+        bool default_group = strcmp(rel, "configs/c.1/strings") == 0 ||
+                             strchr(rel, '/') == NULL;
+        if (configfs && default_group) continue;
+        char fmt[GADGET_PATH_MAX];
+        snprintf(fmt, sizeof(fmt), "%%s/%s", rel);
+        snprintf(path, sizeof(path), fmt, g, instance);
+        ret = remove_dir(configfs, path);
+        if (ret < 0 && !first_err) first_err = ret;
+    }
+    ret = remove_dir(configfs, g);
+    if (ret < 0 && !first_err) first_err = ret;
+
+    if (restore_android_usb) android_usb_restore();
+    if (first_err) LOGE("Gadget teardown incomplete: %s", strerror(-first_err));
+    LOGI("Gadget down in %llu ms", (unsigned long long)(monotonic_ms() - start));
+    return first_err;
+}
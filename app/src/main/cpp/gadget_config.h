@@ -0,0 +1,47 @@
+#ifndef GADGET_CONFIG_H
+#define GADGET_CONFIG_H
+
+// configfs/FunctionFS management for the portal gadget, done with direct
+// syscalls from the (already root) daemon instead of one "su -c" shell per
+// step from the app.
+//
+// gadget_up() creates the gadget, writes the profile's IDs and strings,
+// creates the config and the ffs function, links them and mounts
+// functionfs. It is idempotent - whatever already exists is reused - and
+// transactional: if any step fails, everything that call created is
+// removed again in reverse order. gadget_bind() attaches the UDC once the
+// descriptors are on ep0. gadget_down() tears it all down and treats
+// anything already gone as done.
+//
+// All paths come from GadgetConfig, so the same code runs against a plain
+// directory tree standing in for configfs, /sys/class/udc and the mount
+// point (use mount_ffs = false there).
+
+#include <stdbool.h>
+#include "portal_profile.h"
+
+#define GADGET_UDC_CLASS_DIR "/sys/class/udc"
+
+struct GadgetConfig {
+    const char *gadget_dir;     // configfs gadget directory
+    const char *ffs_dir;        // functionfs mount point; its basename names the instance
+    const char *udc_dir;        // directory listing the available UDCs
+    bool mount_ffs;             // mount/unmount functionfs on ffs_dir
+    bool android_usb;           // stop adbd and the Android USB config first
+    int udc_index;              // bind to this UDC in name order (0: the first)
+};
+
+// Build the gadget for profile. Returns 0 or -errno (with nothing left behind).
+int gadget_up(const GadgetConfig *cfg, const PortalProfile *profile);
+
+// Bind the gadget to its UDC. Returns 0 or -errno (-ENODEV: no such UDC).
+int gadget_bind(const GadgetConfig *cfg);
+
+// Detach the gadget from its UDC, if bound.
+int gadget_unbind(const GadgetConfig *cfg);
+
+// Unbind, unmount and remove everything gadget_up() creates; optionally
+// hand USB back to Android (MTP + adb). Returns 0 or the first -errno.
+int gadget_down(const GadgetConfig *cfg, bool restore_android_usb);
+
+#endif // GADGET_CONFIG_H
@@ -0,0 +1,29 @@
+/* md5.h - RFC 1321 MD5, used for Skylander per-block key derivation */
+#ifndef MD5_H
+#define MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;        /* bytes hashed so far */
+    uint8_t buffer[64];
+} md5_ctx;
+
+void md5_init(md5_ctx *ctx);
+void md5_update(md5_ctx *ctx, const uint8_t *data, size_t len);
+void md5_final(md5_ctx *ctx, uint8_t digest[16]);
+
+/* One-shot convenience wrapper */
+void md5(const uint8_t *data, size_t len, uint8_t digest[16]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MD5_H */
@@ -0,0 +1,202 @@
+// portal_audio.cpp - speaker audio ingest and decode
+#include "portal_audio.h"
+#include "spsc_ring.h"
+#include "daemon_log.h"
+#include "portal_rt.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <thread>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define AUDIO_FRAME_QUEUE 64            // 256 ms of 64-byte PCM frames
+#define AUDIO_IDLE_SLEEP_US 2000
+
+struct AudioFrame {
+    uint8_t len;
+    uint8_t data[PORTAL_AUDIO_FRAME_MAX];
+};
+
+static SpscRing<AudioFrame, AUDIO_FRAME_QUEUE> g_frames;
+static PortalShared *g_shm;
+static PortalAudioFormat g_format;
+static std::thread g_decoder;
+static std::atomic<bool> g_running;
+static std::atomic<bool> g_reset;
+
+static std::atomic<uint64_t> g_frames_in;
+static std::atomic<uint64_t> g_frames_dropped_ingest;
+static std::atomic<uint64_t> g_frames_dropped_playback;
+static std::atomic<uint64_t> g_samples_out;
+
+// IMA ADPCM decoder state, owned by the decoder thread
+static int32_t g_adpcm_predictor;
+static int32_t g_adpcm_index;
+
+static const int16_t ima_step_table[89] = {
+        7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+        50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+        253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+        1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+        3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+        11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+        32767
+};
+
+static const int8_t ima_index_table[16] = {
+        -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// PCM16 with Q15 volume: 8 samples per NEON instruction, otherwise a loop the
+// compiler vectorizes
+static size_t decode_pcm16(const uint8_t *in, size_t len, int16_t *out, int32_t gain) {
+    size_t count = len / 2;
+    size_t i = 0;
+#if defined(__ARM_NEON)
+    int16_t g = (int16_t)gain;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vreinterpretq_s16_u8(vld1q_u8(in + i * 2));
+        vst1q_s16(out + i, vqrdmulhq_n_s16(v, g));
+    }
+#endif
+    for (; i < count; i++) {
+        int32_t s = (int16_t)(in[i * 2] | (in[i * 2 + 1] << 8));
+        s = (s * gain + 0x4000) >> 15;
+        out[i] = (int16_t)(s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+    }
+    return count;
+}
+
+// Each sample depends on the previous one, so ADPCM stays scalar
+static size_t decode_ima_adpcm(const uint8_t *in, size_t len, int16_t *out, int32_t gain) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int shift = 0; shift <= 4; shift += 4) {
+            uint8_t nibble = (in[i] >> shift) & 0x0F;
+            int32_t step = ima_step_table[g_adpcm_index];
+
+            int32_t diff = step >> 3;
+            if (nibble & 4) diff += step;
+            if (nibble & 2) diff += step >> 1;
+            if (nibble & 1) diff += step >> 2;
+            g_adpcm_predictor += (nibble & 8) ? -diff : diff;
+            if (g_adpcm_predictor > 32767) g_adpcm_predictor = 32767;
+            if (g_adpcm_predictor < -32768) g_adpcm_predictor = -32768;
+
+            g_adpcm_index += ima_index_table[nibble];
+            if (g_adpcm_index < 0) g_adpcm_index = 0;
+            if (g_adpcm_index > 88) g_adpcm_index = 88;
+
+            out[n++] = (int16_t)((g_adpcm_predictor * gain + 0x4000) >> 15);
+        }
+    }
+    return n;
+}
+
+static void publish_samples(const int16_t *samples, size_t count) {
+    PortalAudioRing *ring = &g_shm->audio;
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->tail.load(std::memory_order_acquire);
+
+    // Bounded latency: if the app is this far behind, drop instead of queueing
+    if ((head - tail) + count > PORTAL_AUDIO_MAX_LATENCY_SAMPLES) {
+        ring->dropped_frames.fetch_add(1, std::memory_order_relaxed);
+        g_frames_dropped_playback.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint32_t at = head & (PORTAL_AUDIO_RING_SAMPLES - 1);
+    size_t first = PORTAL_AUDIO_RING_SAMPLES - at;
+    if (first > count) first = count;
+    memcpy(&ring->samples[at], samples, first * sizeof(int16_t));
+    memcpy(&ring->samples[0], samples + first, (count - first) * sizeof(int16_t));
+
+    ring->head.store(head + (uint32_t)count, std::memory_order_release);
+    g_samples_out.fetch_add(count, std::memory_order_relaxed);
+}
+
+static void decoder_loop(void) {
+    // Audio is best effort; leave the CPU to the endpoint loop
+    rt_helper_thread_init();
+    setpriority(PRIO_PROCESS, 0, 10);
+
+    AudioFrame frame;
+    int16_t pcm[PORTAL_AUDIO_FRAME_MAX * 2];
+
+    while (g_running.load(std::memory_order_relaxed)) {
+        if (g_reset.exchange(false, std::memory_order_acq_rel)) {
+            while (g_frames.pop(frame)) {}
+            g_adpcm_predictor = 0;
+            g_adpcm_index = 0;
+        }
+
+        if (!g_frames.pop(frame)) {
+            usleep(AUDIO_IDLE_SLEEP_US);
+            continue;
+        }
+
+        int32_t gain = g_shm->audio.volume_q15.load(std::memory_order_relaxed);
+        size_t count = (g_format == PORTAL_AUDIO_IMA_ADPCM)
+                       ? decode_ima_adpcm(frame.data, frame.len, pcm, gain)
+                       : decode_pcm16(frame.data, frame.len, pcm, gain);
+        publish_samples(pcm, count);
+    }
+}
+
+int audio_start(PortalShared *shm, PortalAudioFormat format) {
+    if (g_running.load()) return -EBUSY;
+
+    g_shm = shm;
+    g_format = format;
+    g_reset.store(true);
+    g_running.store(true);
+
+    try {
+        g_decoder = std::thread(decoder_loop);
+    } catch (...) {
+        g_running.store(false);
+        return -EAGAIN;
+    }
+    LOGI("Audio decoder started (%s)", format == PORTAL_AUDIO_IMA_ADPCM ? "IMA ADPCM" : "PCM16");
+    return 0;
+}
+
+void audio_stop(void) {
+    if (!g_running.exchange(false)) return;
+    if (g_decoder.joinable()) g_decoder.join();
+}
+
+void audio_reset(void) {
+    g_reset.store(true, std::memory_order_release);
+}
+
+bool audio_ingest(const uint8_t *data, size_t len) {
+    if (!g_running.load(std::memory_order_relaxed)) return false;
+
+    AudioFrame frame;
+    frame.len = (uint8_t)(len < PORTAL_AUDIO_FRAME_MAX ? len : PORTAL_AUDIO_FRAME_MAX);
+    memcpy(frame.data, data, frame.len);
+
+    g_frames_in.fetch_add(1, std::memory_order_relaxed);
+    if (!g_frames.push(frame)) {
+        g_frames_dropped_ingest.fetch_add(1, std::memory_order_relaxed);
+        if (g_shm) g_shm->audio.dropped_frames.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+PortalAudioStats audio_stats(void) {
+    PortalAudioStats stats;
+    stats.frames_in = g_frames_in.load(std::memory_order_relaxed);
+    stats.frames_dropped_ingest = g_frames_dropped_ingest.load(std::memory_order_relaxed);
+    stats.frames_dropped_playback = g_frames_dropped_playback.load(std::memory_order_relaxed);
+    stats.samples_out = g_samples_out.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,41 @@
+#ifndef PORTAL_AUDIO_H
+#define PORTAL_AUDIO_H
+
+// Trap Team speaker audio. The I/O loop hands raw OUT packets to
+// audio_ingest(), which only copies them into an SPSC ring; a decoder thread
+// turns them into 8 kHz PCM in the shared playback ring the app drains.
+// When either ring is full the audio frame is dropped - the command path
+// never waits on audio.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "portal_shm.h"
+
+#define PORTAL_AUDIO_FRAME_MAX 64
+#define PORTAL_AUDIO_MAX_LATENCY_SAMPLES 1600   // 200 ms queued for playback
+
+enum PortalAudioFormat : uint8_t {
+    PORTAL_AUDIO_PCM16 = 0,     // signed 16-bit little endian
+    PORTAL_AUDIO_IMA_ADPCM = 1, // 4-bit IMA ADPCM, low nibble first
+};
+
+struct PortalAudioStats {
+    uint64_t frames_in;
+    uint64_t frames_dropped_ingest;     // decoder fell behind
+    uint64_t frames_dropped_playback;   // app fell behind (latency cap)
+    uint64_t samples_out;
+};
+
+// Start the decoder thread writing into shm->audio. Returns 0 or -errno.
+int audio_start(PortalShared *shm, PortalAudioFormat format);
+void audio_stop(void);
+
+// Speaker switched on/off: forget queued frames and decoder state.
+void audio_reset(void);
+
+// Called from the I/O loop. Never blocks; false if the frame was dropped.
+bool audio_ingest(const uint8_t *data, size_t len);
+
+PortalAudioStats audio_stats(void);
+
+#endif // PORTAL_AUDIO_H
@@ -0,0 +1,407 @@
+// portal_commands.cpp - portal command and control request handlers
+#include "portal_commands.h"
+#include "ep0_cache.h"
+#include "portal_led.h"
+#include "portal_audio.h"
+#include "portal_mem.h"
+#include "daemon_log.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Commands name a slot as 0x10/0x20 + index; anything past the portal's
+// slots comes back as MAX_SLOTS
+static uint8_t command_slot(uint8_t query) {
+    uint8_t slot = query & 0x0F;
+    return slot < MAX_SLOTS ? slot : MAX_SLOTS;
+}
+
+// 1 written, 0 the host is not taking reports (EAGAIN), -1 failed
+static int write_in(PortalDevice *dev, const uint8_t *report, int len) {
+    const PortalTransport *t = &dev->transport;
+    ssize_t ret = t->ep_in_write(t->ctx, report, len);
+    if (ret >= 0) {
+        LOGI("Sent response: %zd bytes (cmd 0x%02x)", ret, report[0]);
+        return 1;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+    dev->in.stats.failed++;
+    LOGE("Failed to write response: %d (%s)", errno, strerror(errno));
+    return -1;
+}
+
+// Queue report behind what is waiting, then write whatever ep_in takes
+static void enqueue(PortalDevice *dev, EpInClass cls, PortalReport *report, uint64_t now) {
+    ep_in_queue_push(&dev->in, dev->reports, cls, report, now);
+    if (now >= dev->in.retry_ms) portal_flush_in(dev);
+}
+
+// Reports go out in the order they are sent: straight to ep_in while
+// nothing waits, else (or when the host is not taking them) into a copy
+// in the queue
+static void send_report(PortalDevice *dev, EpInClass cls, const uint8_t *report, int len) {
+    uint64_t now = now_ms();
+    if (ep_in_queue_empty(&dev->in)) {
+        int ret = write_in(dev, report, len);
+        if (ret > 0) dev->in.stats.direct++;
+        if (ret != 0) return;
+        dev->in.retry_ms = now + EP_IN_RETRY_MS;
+    }
+
+    // Room first: the buffer a full queue gives up is the one to copy into
+    PortalReport *copy = NULL;
+    if (dev->reports) {
+        ep_in_queue_reserve(&dev->in, dev->reports, cls);
+        copy = (PortalReport *)mem_pool_get(dev->reports);
+    }
+    if (!copy) {
+        dev->in.stats.no_buffer++;
+        LOGE("Dropped response 0x%02x: ep_in busy and no buffer to queue it", report[0]);
+        return;
+    }
+    memcpy(copy->data, report, len);
+    copy->len = len;
+    enqueue(dev, cls, copy, now);
+}
+
+// send_report() for a report already in a pool buffer, which it takes over
+static void send_owned(PortalDevice *dev, EpInClass cls, PortalReport *report) {
+    uint64_t now = now_ms();
+    if (ep_in_queue_empty(&dev->in)) {
+        int ret = write_in(dev, report->data, report->len);
+        if (ret > 0) dev->in.stats.direct++;
+        if (ret != 0) {
+            mem_pool_put(dev->reports, report);
+            return;
+        }
+        dev->in.retry_ms = now + EP_IN_RETRY_MS;
+    }
+    enqueue(dev, cls, report, now);
+}
+
+void portal_flush_in(PortalDevice *dev) {
+    uint64_t now = now_ms();
+    EpInClass cls;
+    PortalReport *report;
+    while ((report = ep_in_queue_front(&dev->in, dev->reports, now, &cls))) {
+        int ret = write_in(dev, report->data, report->len);
+        if (ret == 0) {
+            dev->in.retry_ms = now + EP_IN_RETRY_MS;
+            return;
+        }
+        ep_in_queue_pop(&dev->in, cls);
+        mem_pool_put(dev->reports, report);
+        if (ret > 0) dev->in.stats.retried++;
+    }
+}
+
+int portal_in_wait_ms(const PortalDevice *dev) {
+    if (ep_in_queue_empty(&dev->in)) return -1;
+    uint64_t now = now_ms();
+    return now >= dev->in.retry_ms ? 0 : (int)(dev->in.retry_ms - now);
+}
+
+void portal_drop_in(PortalDevice *dev) {
+    ep_in_queue_clear(&dev->in, dev->reports);
+    dev->in.retry_ms = 0;
+}
+
+// Fill a 0x51 reply (report_size bytes); false if block is past the figure
+static bool build_read_reply(PortalDevice *dev, uint8_t slot, uint8_t block, uint8_t *report,
+                             bool staged) {
+    memset(report, 0, dev->profile->report_size);
+    report[0] = 0x51;
+    report[1] = 0x10 + slot;        // Response format: 0x10/0x11
+    report[2] = block;
+    PortalSlot *s = &dev->slots[slot];
+    return staged ? slot_copy_block(s, block, &report[3]) : slot_read_block(s, block, &report[3]);
+}
+
+void portal_drop_staged(PortalDevice *dev, int slot) {
+    PortalReadStream *s = &dev->streams[slot];
+    for (; s->count; s->count--) {
+        mem_pool_put(dev->reports, s->staged[s->head]);
+        s->head = (s->head + 1) % PRESTAGE_DEPTH;
+        dev->prestage.dropped++;
+    }
+    s->head = 0;
+}
+
+// Answer block from what was staged; false (and nothing staged any more)
+// if the stream went elsewhere
+static bool send_staged(PortalDevice *dev, uint8_t slot, uint8_t block) {
+    PortalReadStream *s = &dev->streams[slot];
+    if (!s->count) return false;
+    PortalReport *report = s->staged[s->head];
+    if (report->data[2] != block) {
+        portal_drop_staged(dev, slot);
+        return false;
+    }
+
+    s->head = (s->head + 1) % PRESTAGE_DEPTH;
+    s->count--;
+    slot_note_read(&dev->slots[slot], block);
+    send_owned(dev, EP_IN_REPLY, report);
+    dev->prestage.hits++;
+    return true;
+}
+
+// Build replies for the blocks after the last read, up to PRESTAGE_DEPTH
+static void stage_ahead(PortalDevice *dev, uint8_t slot) {
+    PortalReadStream *s = &dev->streams[slot];
+    if (!dev->reports || s->run < PRESTAGE_TRIGGER) return;
+
+    unsigned block = s->next + s->count;
+    while (s->count < PRESTAGE_DEPTH && block < PORTAL_BLOCK_COUNT) {
+        PortalReport *report = (PortalReport *)mem_pool_get(dev->reports);
+        if (!report) break;
+        if (!build_read_reply(dev, slot, (uint8_t)block, report->data, true)) {
+            mem_pool_put(dev->reports, report);
+            break;
+        }
+        report->len = dev->profile->report_size;
+        s->staged[(s->head + s->count) % PRESTAGE_DEPTH] = report;
+        s->count++;
+        block++;
+        dev->prestage.staged++;
+    }
+}
+
+// Answer a 0x51, from a staged reply when the stream predicted it
+static void read_block(PortalDevice *dev, uint8_t slot, uint8_t block) {
+    uint8_t response[MAX_REPORT_SIZE];
+    int report_size = dev->profile->report_size;
+    if (slot >= MAX_SLOTS || !dev->slots[slot].present) {
+        memset(response, 0, report_size);
+        response[0] = 0x51;
+        response[1] = 0x01;             // No figure
+        response[2] = block;
+        send_report(dev, EP_IN_REPLY, response, report_size);
+        return;
+    }
+
+    uint64_t start = now_ns();
+    PortalReadStream *s = &dev->streams[slot];
+    s->run = (s->next && block == s->next) ? (s->run < 255 ? s->run + 1 : 255) : 1;
+    s->next = block + 1;
+
+    if (send_staged(dev, slot, block)) {
+        latency_record(&dev->prestage.staged_latency, now_ns() - start);
+    } else {
+        if (!build_read_reply(dev, slot, block, response, false)) {
+            response[1] = 0x01;         // Block past the tag
+            memset(&response[3], 0, 16);
+        }
+        send_report(dev, EP_IN_REPLY, response, report_size);
+        latency_record(&dev->prestage.built_latency, now_ns() - start);
+    }
+    stage_ahead(dev, slot);
+}
+
+int build_sense_report(const PortalDevice *dev, uint8_t *report) {
+    memset(report, 0, dev->profile->report_size);
+    report[0] = 0x53;
+
+    // Bitmask (little endian, 4 bytes)
+    uint32_t mask = 0;
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (dev->slots[i].present) mask |= (1 << i);
+    }
+    report[1] = mask & 0xFF;
+    report[2] = (mask >> 8) & 0xFF;
+    report[3] = (mask >> 16) & 0xFF;
+    report[4] = (mask >> 24) & 0xFF;
+    report[5] = 0x00;  // Counter
+    report[6] = 0x01;
+    return dev->profile->report_size;
+}
+
+void portal_send_sense(PortalDevice *dev) {
+    uint8_t sense[MAX_REPORT_SIZE];
+    int sense_len = build_sense_report(dev, sense);
+    send_report(dev, EP_IN_SENSE, sense, sense_len);
+}
+
+void handle_setup_request(PortalDevice *dev, const struct usb_ctrlrequest *setup) {
+    const PortalTransport *t = &dev->transport;
+    const Ep0Response *r = ep0_cache_lookup(setup);
+    uint16_t length = le16toh(setup->wLength);
+    bool dir_in = (setup->bRequestType & USB_DIR_IN) != 0;
+
+    if (!r) {
+        LOGI("STALL: bmRequestType=0x%02x bRequest=0x%02x wValue=0x%04x wIndex=0x%04x wLength=%d",
+             setup->bRequestType, setup->bRequest, le16toh(setup->wValue),
+             le16toh(setup->wIndex), length);
+        // FunctionFS stalls ep0 when the transfer goes against the request direction
+        if (dir_in) {
+            t->ep0_read(t->ctx, NULL, 0);
+        } else {
+            t->ep0_write(t->ctx, NULL, 0);
+        }
+        return;
+    }
+
+    if (r->action == EP0_DATA) {
+        size_t len = (length < r->len) ? length : r->len;
+        if (t->ep0_write(t->ctx, r->data, len) < 0) {
+            LOGE("Failed to write ep0 response: %d (%s)", errno, strerror(errno));
+        }
+        return;
+    }
+
+    // OUT requests are acknowledged by reading the data stage
+    uint8_t buffer[256];
+    size_t want = (length < sizeof(buffer)) ? length : sizeof(buffer);
+    ssize_t n = t->ep0_read(t->ctx, buffer, want);
+    if (n < 0) {
+        LOGE("Failed to ACK ep0 request 0x%02x: %d (%s)", setup->bRequest, errno, strerror(errno));
+    } else if (n > 0 && (r->flags & EP0_FORWARD_REPORT)) {
+        handle_portal_command(dev, buffer, (size_t)n < want ? (size_t)n : want);
+    }
+}
+
+void handle_portal_command(PortalDevice *dev, const uint8_t *data, size_t len) {
+    if (len < 1) return;
+
+    const PortalProfile *profile = dev->profile;
+    uint8_t cmd = data[0];
+    uint8_t response[MAX_REPORT_SIZE];
+    memset(response, 0, sizeof(response));
+    int response_len = 0;
+    int report_size = profile->report_size;
+
+    if (!is_led_command(cmd)) LOGI("Portal command: 0x%02x, len=%zu", cmd, len);
+
+    switch (cmd) {
+        case 0x41: // Activate
+            LOGI("Activate portal");
+            memcpy(response, profile->activate_reply, report_size);
+            response_len = report_size;
+            break;
+
+        case 0x43: // Set LED color
+            if (len >= 4) {
+                if (dev->feedback) led_set_all(data[1], data[2], data[3], now_ms());
+                response[0] = 0x43;
+                response[1] = data[1];
+                response[2] = data[2];
+                response[3] = data[3];
+                response_len = report_size;
+            }
+            break;
+
+        case 0x4A: // Fade one side: side, R, G, B, duration (ms, LE)
+            if (len >= 7 && dev->feedback) {
+                led_set_side(data[1], data[2], data[3], data[4],
+                             (uint16_t)(data[5] | (data[6] << 8)), now_ms());
+            }
+            response[0] = 0x4A;
+            response_len = report_size;
+            break;
+
+        case 0x4C: // Traptanium portal LED control
+            if (len >= 5 && (profile->flags & PORTAL_PROFILE_SIDE_LEDS) && dev->feedback) {
+                // side 0x00=right, 0x01=trap, 0x02=left
+                led_set_side(data[1], data[2], data[3], data[4], 0, now_ms());
+                // No response
+            }
+            break;
+
+        case 0x4D: // Speaker control
+            if (len >= 2 && data[1] > 0) {
+                LOGI("Activate speaker");
+                dev->speaker_on = (profile->flags & PORTAL_PROFILE_AUDIO) != 0;
+                if (dev->feedback) audio_reset();
+                response[0] = 0x4D;
+                response[1] = (profile->flags & PORTAL_PROFILE_AUDIO) ? 0x01 : 0x00;  // Has speaker
+                response_len = report_size;
+            } else {
+                if (dev->feedback) {
+                    PortalAudioStats audio = audio_stats();
+                    LOGI("Deactivate speaker (audio frames=%llu dropped=%llu/%llu)",
+                         (unsigned long long)audio.frames_in,
+                         (unsigned long long)audio.frames_dropped_ingest,
+                         (unsigned long long)audio.frames_dropped_playback);
+                    audio_reset();
+                }
+                dev->speaker_on = false;
+                response[0] = 0x4D;
+                response_len = report_size;
+            }
+            break;
+
+        case 0x51: // Read Skylander
+            if (len >= 3) {
+                uint8_t slot_query = data[1];
+                uint8_t block = data[2];
+                uint8_t slot = command_slot(slot_query);
+
+                LOGI("Read Skylander: query=0x%02x block=%d slot=%d", slot_query, block, slot);
+                read_block(dev, slot, block);   // sends its own reply
+            }
+            break;
+
+        case 0x52: // Shutdown/restart
+            LOGI("Shutdown/restart");
+            memcpy(response, profile->restart_reply, report_size);
+            response_len = report_size;
+            break;
+
+        case 0x53: // Sense (manual query)
+            LOGI("Manual sense query");
+            response_len = build_sense_report(dev, response);
+            break;
+
+        case 0x56: // Unknown V command
+            LOGI("V command");
+            response[0] = 0x56;
+            response_len = report_size;
+            break;
+
+        case 0x57: // Write Skylander
+            if (len >= 19) {
+                uint8_t slot_query = data[1];
+                uint8_t block = data[2];
+                uint8_t slot = command_slot(slot_query);
+
+                LOGI("Write Skylander: query=0x%02x block=%d slot=%d", slot_query, block, slot);
+
+                response[0] = 0x57;
+                response[2] = block;
+                response_len = report_size;
+                if (slot < MAX_SLOTS) portal_drop_staged(dev, slot);
+                if (slot < MAX_SLOTS && dev->slots[slot].present &&
+                    slot_write_block(&dev->slots[slot], block, &data[3])) {
+                    response[1] = 0x10 + slot;
+                    memcpy(&response[3], &data[3], 16);
+                } else {
+                    LOGE("Rejected write to slot %d block %d", slot, block);
+                    response[1] = 0x01;
+                }
+            }
+            break;
+
+        default:
+            LOGI("Unknown command: 0x%02x", cmd);
+            break;
+    }
+
+    if (response_len > 0) {
+        EpInClass cls = (cmd == 0x53) ? EP_IN_SENSE : is_led_command(cmd) ? EP_IN_ECHO : EP_IN_REPLY;
+        send_report(dev, cls, response, response_len);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef PORTAL_COMMANDS_H
+#define PORTAL_COMMANDS_H
+
+// The portal protocol: 0x41-0x57 commands from the host and ep0 SETUP
+// requests. The handlers only see the portal through a PortalDevice, so
+// the daemon runs them against its FunctionFS endpoints and the fuzz
+// harnesses (tools/portal_fuzz.cpp) against buffers.
+//
+// Everything in data comes from the host. Slot numbers and block numbers
+// are range-checked here or in slot_store before they index anything.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/usb/ch9.h>
+#include "slot_store.h"
+#include "portal_profile.h"
+#include "ep_in_queue.h"
+#include "portal_rt.h"
+
+struct MemPool;
+
+#define PRESTAGE_DEPTH 8        // 0x51 replies built ahead of a sequential read stream
+#define PRESTAGE_TRIGGER 2      // reads of consecutive blocks that make a stream
+
+// Endpoint I/O. ep0_read/ep0_write with len 0 against the direction of a
+// request stall it, as on FunctionFS. Each returns bytes moved or -1;
+// ep_in_write fails with EAGAIN while the host is not taking reports.
+struct PortalTransport {
+    void *ctx;
+    ssize_t (*ep0_read)(void *ctx, void *buf, size_t len);
+    ssize_t (*ep0_write)(void *ctx, const void *buf, size_t len);
+    ssize_t (*ep_in_write)(void *ctx, const void *buf, size_t len);
+};
+
+// A game that has just seen a figure reads it with 0x51 block after block.
+// Once PRESTAGE_TRIGGER reads in a row were sequential, the replies for
+// the next PRESTAGE_DEPTH blocks are built after each reply goes out, in
+// the time the host takes to ask again, and the next 0x51 is answered by
+// writing one of them. Any other read, a write to the slot or a change of
+// figure drops what was staged.
+struct PortalReadStream {
+    uint16_t next;                  // block after the last one read; 0 before any read
+    uint8_t run;                    // sequential reads so far
+    uint8_t head;                   // staged[head] answers block next
+    uint8_t count;
+    PortalReport *staged[PRESTAGE_DEPTH];
+};
+
+struct PortalPrestageStats {
+    uint64_t staged;
+    uint64_t hits;                  // reads answered with a staged reply
+    uint64_t dropped;               // staged replies nobody asked for
+    // From a 0x51 for a figure to its reply written, split by where the
+    // reply came from, so the stats line shows what staging saves
+    LatencyHistogram staged_latency;
+    LatencyHistogram built_latency;
+};
+
+struct PortalDevice {
+    const PortalProfile *profile;
+    PortalSlot *slots;              // MAX_SLOTS of them
+    PortalTransport transport;
+    bool speaker_on;                // OUT packets longer than a report are audio
+    bool feedback;                  // LED and speaker commands reach the app (one portal does)
+    MemPool *reports;               // staged and queued reports; NULL turns both off
+    PortalReadStream streams[MAX_SLOTS];
+    PortalPrestageStats prestage;
+    EpInQueue in;                   // reports ep_in has not taken yet
+};
+
+// Colour commands arrive many times a second; they only update the LED model
+static inline bool is_led_command(uint8_t cmd) {
+    return cmd == 0x43 || cmd == 0x4A || cmd == 0x4C;
+}
+
+// Fill a 0x53 status report (MAX_REPORT_SIZE bytes); returns its length
+int build_sense_report(const PortalDevice *dev, uint8_t *report);
+
+// One command report from the host; the response, if any, goes to ep_in
+void handle_portal_command(PortalDevice *dev, const uint8_t *data, size_t len);
+
+// Replies come from ep0_cache; nothing is built or logged on the hit path
+void handle_setup_request(PortalDevice *dev, const struct usb_ctrlrequest *setup);
+
+// Send a 0x53 status report, replacing one still waiting for the host
+void portal_send_sense(PortalDevice *dev);
+
+// Write queued reports until ep_in is busy again. Call when it is
+// writable or portal_in_wait_ms() says 0.
+void portal_flush_in(PortalDevice *dev);
+
+// -1 while nothing is queued, else ms until portal_flush_in() should run
+int portal_in_wait_ms(const PortalDevice *dev);
+
+// The host went away (DISABLE, UNBIND): drop what it never took
+void portal_drop_in(PortalDevice *dev);
+
+// Drop the replies staged for slot; call whenever its figure or its bytes
+// change other than through a 0x57
+void portal_drop_staged(PortalDevice *dev, int slot);
+
+#endif // PORTAL_COMMANDS_H
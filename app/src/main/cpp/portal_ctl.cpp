@@ -0,0 +1,224 @@
+// portal_ctl.cpp - control socket thread
+#include "portal_ctl.h"
+#include "stage_queue.h"
+#include "portal_rt.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CTL_QUEUE_DEPTH 16
+#define CTL_STACK_BYTES (128 * 1024)
+
+struct CtlReply {
+    uint32_t client;
+    PortalIpcMsg msg;
+    int fd;                 // not owned; the I/O thread keeps it open
+};
+
+static StageQueue<CtlRequest, CTL_QUEUE_DEPTH> g_requests;     // control -> I/O
+static StageQueue<CtlReply, CTL_QUEUE_DEPTH> g_replies;        // I/O -> control
+static int g_listen_fd = -1;
+static uid_t g_client_uid;
+static int g_clients[MAX_CTL_CLIENTS];
+static uint16_t g_generation[MAX_CTL_CLIENTS];
+static std::atomic<bool> g_stopping;
+static bool g_running;
+static pthread_t g_thread;
+
+int ctl_listen(void) {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_un addr;
+    socklen_t len = portal_ipc_addr(&addr);
+    if (bind(sock, (struct sockaddr *)&addr, len) < 0 || listen(sock, MAX_CTL_CLIENTS) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void client_close(int index) {
+    close(g_clients[index]);
+    g_clients[index] = -1;
+    g_generation[index]++;
+}
+
+static void client_accept(void) {
+    int client = accept4(g_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) return;
+
+    struct ucred cred = { 0, (uid_t)-1, (gid_t)-1 };
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 ||
+        (cred.uid != 0 && cred.uid != g_client_uid)) {
+        LOGE("Refused control client pid=%d uid=%d", (int)cred.pid, (int)cred.uid);
+        close(client);
+        return;
+    }
+
+    for (int i = 0; i < MAX_CTL_CLIENTS; i++) {
+        if (g_clients[i] < 0) {
+            g_clients[i] = client;
+            LOGI("Control client connected: fd=%d", client);
+            return;
+        }
+    }
+    LOGE("Too many control clients, dropping fd=%d", client);
+    close(client);
+}
+
+static void client_service(int index) {
+    CtlRequest req;
+    size_t payload_len = sizeof(req.payload);
+    req.fd = -1;
+
+    ssize_t n = portal_ipc_recv_payload(g_clients[index], &req.msg, req.payload, &payload_len,
+                                        &req.fd);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        LOGI("Control client disconnected: fd=%d", g_clients[index]);
+        client_close(index);
+        return;
+    }
+
+    req.client = ((uint32_t)index << 16) | g_generation[index];
+    req.payload_len = (uint32_t)payload_len;
+    if (!g_requests.push(req)) {
+        if (req.fd >= 0) close(req.fd);
+        req.msg.status = -EBUSY;
+        portal_ipc_send(g_clients[index], &req.msg, -1);
+    }
+}
+
+static void send_replies(void) {
+    CtlReply reply;
+    while (g_replies.pop(reply)) {
+        uint32_t index = reply.client >> 16;
+        if (index >= MAX_CTL_CLIENTS || g_clients[index] < 0 ||
+            g_generation[index] != (reply.client & 0xFFFF)) {
+            continue;   // asker went away
+        }
+        portal_ipc_send(g_clients[index], &reply.msg, reply.fd);
+    }
+}
+
+static void *ctl_main(void *) {
+    rt_helper_thread_init();
+    uint64_t next_report = stage_now_ns() / 1000000 + STAGE_REPORT_MS;
+
+    while (!g_stopping.load(std::memory_order_acquire)) {
+        struct pollfd fds[2 + MAX_CTL_CLIENTS];
+        int owner[2 + MAX_CTL_CLIENTS];
+        int count = 0;
+        fds[count] = { g_replies.wake_fd(), POLLIN, 0 };
+        owner[count++] = -2;
+        fds[count] = { g_listen_fd, POLLIN, 0 };
+        owner[count++] = -1;
+        for (int i = 0; i < MAX_CTL_CLIENTS; i++) {
+            if (g_clients[i] < 0) continue;
+            fds[count] = { g_clients[i], POLLIN, 0 };
+            owner[count++] = i;
+        }
+
+        uint64_t now = stage_now_ns() / 1000000;
+        int timeout = (now < next_report) ? (int)(next_report - now) : 0;
+        if (poll(fds, count, timeout) < 0 && errno != EINTR) {
+            LOGE("Control poll failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (!fds[i].revents) continue;
+            if (owner[i] == -2) {
+                g_replies.clear_wake();
+                send_replies();
+            } else if (owner[i] == -1) {
+                client_accept();
+            } else if (g_clients[owner[i]] == fds[i].fd) {
+                client_service(owner[i]);
+            }
+        }
+
+        now = stage_now_ns() / 1000000;
+        if (now >= next_report) {
+            g_replies.report();
+            next_report = now + STAGE_REPORT_MS;
+        }
+    }
+
+    // Answer what the I/O thread finished before stopping (a shutdown request)
+    send_replies();
+    for (int i = 0; i < MAX_CTL_CLIENTS; i++) {
+        if (g_clients[i] >= 0) client_close(i);
+    }
+    return NULL;
+}
+
+int ctl_start(int listen_fd, uid_t client_uid) {
+    if (g_running) return 0;
+    for (int i = 0; i < MAX_CTL_CLIENTS; i++) g_clients[i] = -1;
+    g_listen_fd = listen_fd;
+    g_client_uid = client_uid;
+
+    int ret = g_requests.open("control->io");
+    if (ret == 0) ret = g_replies.open("io->control");
+    if (ret == 0) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, CTL_STACK_BYTES);
+        g_stopping.store(false);
+        ret = -pthread_create(&g_thread, &attr, ctl_main, NULL);
+        pthread_attr_destroy(&attr);
+    }
+    if (ret < 0) {
+        g_requests.close_wake();
+        g_replies.close_wake();
+        return ret;
+    }
+    g_running = true;
+    return 0;
+}
+
+void ctl_stop(void) {
+    if (!g_running) return;
+    g_stopping.store(true, std::memory_order_release);
+    g_replies.wake();
+    pthread_join(g_thread, NULL);
+
+    CtlRequest req;
+    while (g_requests.pop(req)) {
+        if (req.fd >= 0) close(req.fd);
+    }
+    g_requests.close_wake();
+    g_replies.close_wake();
+    g_running = false;
+}
+
+int ctl_request_fd(void) {
+    return g_requests.wake_fd();
+}
+
+bool ctl_next(CtlRequest *req) {
+    if (g_requests.pop(*req)) return true;
+    // Clear, then look again: a push between the two is not lost
+    g_requests.clear_wake();
+    return g_requests.pop(*req);
+}
+
+void ctl_reply(const CtlRequest *req, int status, int reply_fd) {
+    CtlReply reply;
+    reply.client = req->client;
+    reply.msg = req->msg;
+    reply.msg.status = status;
+    reply.fd = reply_fd;
+    if (!g_replies.push(reply)) LOGE("Control reply queue full, op %u unanswered", req->msg.op);
+}
+
+void ctl_report(void) {
+    g_requests.report();
+}
@@ -0,0 +1,50 @@
+#ifndef PORTAL_CTL_H
+#define PORTAL_CTL_H
+
+// Control plane thread: accepts the app's connections on the control
+// socket, receives requests and sends replies, so the I/O thread never
+// touches a socket a client could stall. Requests are queued to the I/O
+// thread, which owns the slots and executes them between packets, and the
+// replies are queued back. A reply to a client that disconnected in the
+// meantime is dropped (clients are matched by index and generation).
+//
+// The socket name is well known and the daemon runs as root, so only
+// root and the app's uid may connect; other peers are closed on accept.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "portal_ipc.h"
+
+#define MAX_CTL_CLIENTS 4
+
+struct CtlRequest {
+    uint32_t client;        // index << 16 | generation
+    PortalIpcMsg msg;
+    int fd;                 // passed descriptor, owned by the request; -1 if none
+    uint32_t payload_len;
+    uint8_t payload[PORTAL_IPC_MAX_PAYLOAD];
+};
+
+// Bind and listen on the abstract control socket. Returns the fd or -1.
+int ctl_listen(void);
+
+// Start the control thread on listen_fd (which stays the caller's),
+// serving root and client_uid. Returns 0 or -errno.
+int ctl_start(int listen_fd, uid_t client_uid);
+
+// Stop the thread, drop its clients and close fds of unserved requests.
+void ctl_stop(void);
+
+// I/O thread: readable when requests are waiting; call ctl_next() until
+// it returns false.
+int ctl_request_fd(void);
+bool ctl_next(CtlRequest *req);
+
+// I/O thread: answer req with status, passing reply_fd (not taken over) if >= 0
+void ctl_reply(const CtlRequest *req, int status, int reply_fd);
+
+// I/O thread: log the request queue's depth and wait times
+void ctl_report(void);
+
+#endif // PORTAL_CTL_H
@@ -1,4 +1,5 @@
 // portal_daemon.cpp - Runs with root privileges
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -12,541 +13,893 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "skylander_crypto.h"
-
-#define MAX_SLOTS 2
-#define PORTAL_BUFFER_SIZE 1024
-
-// Logging macros for standalone executable (uses printf instead of Android log)
-#define LOGI(...) do { printf("[INFO] "); printf(__VA_ARGS__); printf("\n"); fflush(stdout); } while(0)
-#define LOGE(...) do { fprintf(stderr, "[ERROR] "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); fflush(stderr); } while(0)
-
-#define MAX_SLOTS 2
-#define PORTAL_BUFFER_SIZE 1024
-
-// Endianness conversion (same as your original)
-#ifndef htole32
-#define htole32(x) (x)
-#endif
-#ifndef htole16
-#define htole16(x) (x)
-#endif
-
-static const uint8_t hid_report_descriptor[] = {
-        0x06, 0x00, 0xFF,
-        0x09, 0x01,
-        0xA1, 0x01,
-        0x19, 0x01,
-        0x29, 0x40,
-        0x15, 0x00,
-        0x26, 0xFF, 0x00,
-        0x75, 0x08,
-        0x95, 0x20,
-        0x81, 0x00,
-        0x19, 0x01,
-        0x29, 0xFF,
-        0x91, 0x00,
-        0xC0
-};
-
-// Portal state
-struct PortalSlot {
-    uint8_t data[PORTAL_BUFFER_SIZE];
-    size_t size;
-    bool present;
-    bool loaded;
+#include "daemon_log.h"
+#include "portal_ipc.h"
+#include "slot_store.h"
+#include "ep0_cache.h"
+#include "portal_profile.h"
+#include "portal_shm.h"
+#include "portal_audio.h"
+#include "portal_led.h"
+#include "figure_editor.h"
+#include "figure_index.h"
+#include "portal_supervisor.h"
+#include "ffs_wait.h"
+#include "gadget_config.h"
+#include "portal_rt.h"
+#include "portal_ctl.h"
+#include "portal_pipeline.h"
+#include "portal_mem.h"
+#include "portal_commands.h"
+
+#define DEFAULT_GADGET_DIR "/config/usb_gadget/kaos_portal"
+#define EP0_WAIT_MS 15000
+#define DATA_EP_WAIT_MS 30000
+#define STATS_INTERVAL_MS 10000
+#define DAEMON_MEM_BYTES (64 * 1024)    // besides the portals themselves
+#define MAX_PORTALS 8
+#define PORTAL_PATH_MAX 128
+#define CTL_DEFERRED 1                  // control request answered later (writes_settled)
+// Report buffers per portal: staged 0x51 replies and the ep_in queues
+#define PORTAL_REPORTS (MAX_SLOTS * PRESTAGE_DEPTH + EP_IN_QUEUE_REPORTS)
+
+// FLUSH and UNLOAD requests for a slot, answered once the writes they
+// queued for the persistence thread have finished
+struct SlotWaiters {
+    uint32_t client[MAX_CTL_CLIENTS];
+    PortalIpcMsg msg[MAX_CTL_CLIENTS];
+    int count;
+    bool unload;                        // detach the slot once they finish
 };
 
-struct PortalState {
+// One emulated portal: a FunctionFS instance (portal0, portal1, ...) with
+// its own endpoints, slots and host state. Every portal runs on the one
+// select() loop of the I/O thread; the portals live in g_mem.
+struct PortalInstance {
+    int id;
     PortalSlot slots[MAX_SLOTS];
-    bool running;
     int ep0_fd;
     int ep_in_fd;
     int ep_out_fd;
+    bool enabled;                       // between FUNCTIONFS_ENABLE and DISABLE
+    bool unbound;                       // FUNCTIONFS_UNBIND came; the daemon exits once all are
+    uint64_t next_sense_ms;
+    PortalDevice device;                // what the command handlers see (portal_commands.h)
+    FigureIndex index;                  // figures by UID, to refuse a second copy of one
+    SlotWaiters waiters[MAX_SLOTS];
+    GadgetConfig gadget;
+    char gadget_dir[PORTAL_PATH_MAX];
+    char ffs_dir[PORTAL_PATH_MAX];
+    LatencyHistogram latency;           // time from reading a request to having written its response
+    uint64_t latency_reported;          // latency.count at the last stats line
+    uint64_t staged_reported;           // device.prestage.staged at the last stats line
+    EpInStats in_reported;              // device.in.stats at the last stats line
+};
+
+// Daemon state
+struct PortalState {
+    PortalInstance *portals;
+    int count;
+    int turn;                           // portal served first on the next pass
+    bool running;
+    int ctl_listen_fd;
+    int shared_fd;
+    PortalShared *shared;               // LEDs and audio of portal 0
+    int supervisor_fd;                  // -1 unless running as a supervised worker
+    PortalWorkerState *worker_state;
 };
 
 static PortalState g_portal;
+static const PortalProfile *g_profile;
 
-static int write_descriptors(int fd) {
+// Where portal 0's gadget lives; with --manage-gadget the daemon also
+// builds, binds and removes it. Further portals number both paths on.
+static GadgetConfig g_gadget = {
+    DEFAULT_GADGET_DIR, FFS_DIR, GADGET_UDC_CLASS_DIR, true, true, 0,
+};
+static bool g_manage_gadget;
+
+// --rt-priority and friends; off unless asked for
+static PortalRtConfig g_rt = { 0, -1, -1 };
+// Locked region everything after startup is allocated from (portal_mem.h)
+static MemArena g_mem;
+// 0x51 replies staged ahead of sequential reads and IN reports waiting for
+// the host (portal_commands.h)
+static MemPool g_reports;
+
+static ssize_t ep0_read(void *ctx, void *buf, size_t len) {
+    return read(((PortalInstance *)ctx)->ep0_fd, buf, len);
+}
+
+static ssize_t ep0_write(void *ctx, const void *buf, size_t len) {
+    return write(((PortalInstance *)ctx)->ep0_fd, buf, len);
+}
+
+static ssize_t ep_in_write(void *ctx, const void *buf, size_t len) {
+    return write(((PortalInstance *)ctx)->ep_in_fd, buf, len);
+}
+
+static int write_descriptors(int fd, const PortalDescriptorBlob *blob) {
     LOGI("Writing USB descriptors...");
 
-    struct {
-        struct usb_functionfs_descs_head_v2 header;
-        __le32 fs_count;
-        __le32 hs_count;
-
-        // FS descriptors
-        struct usb_interface_descriptor fs_intf;
-        struct {
-            __u8 bLength;
-            __u8 bDescriptorType;
-            __le16 bcdHID;
-            __u8 bCountryCode;
-            __u8 bNumDescriptors;
-            __u8 bDescriptorType2;
-            __le16 wDescriptorLength;
-        } __attribute__((packed)) fs_hid;
-        struct usb_endpoint_descriptor_no_audio fs_ep_in;
-        struct usb_endpoint_descriptor_no_audio fs_ep_out;
-
-        // HS descriptors
-        struct usb_interface_descriptor hs_intf;
-        struct {
-            __u8 bLength;
-            __u8 bDescriptorType;
-            __le16 bcdHID;
-            __u8 bCountryCode;
-            __u8 bNumDescriptors;
-            __u8 bDescriptorType2;
-            __le16 wDescriptorLength;
-        } __attribute__((packed)) hs_hid;
-        struct usb_endpoint_descriptor_no_audio hs_ep_in;
-        struct usb_endpoint_descriptor_no_audio hs_ep_out;
-    } __attribute__((packed)) descs = {
-            .header = {
-                    .magic = htole32(FUNCTIONFS_DESCRIPTORS_MAGIC_V2),
-                    .length = htole32(sizeof(descs)),
-                    .flags = htole32(FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC),
-            },
-            .fs_count = htole32(4),
-            .hs_count = htole32(4),
-
-            // FS Interface
-            .fs_intf = {
-                    .bLength = 9,
-                    .bDescriptorType = USB_DT_INTERFACE,
-                    .bInterfaceNumber = 0,
-                    .bAlternateSetting = 0,
-                    .bNumEndpoints = 2,
-                    .bInterfaceClass = 0x03,    // HID
-                    .bInterfaceSubClass = 0x00,
-                    .bInterfaceProtocol = 0x00,
-                    .iInterface = 0,
-            },
-
-            // FS HID Descriptor
-            .fs_hid = {
-                    .bLength = 9,
-                    .bDescriptorType = 0x21,
-                    .bcdHID = htole16(0x0111),
-                    .bCountryCode = 0x00,
-                    .bNumDescriptors = 1,
-                    .bDescriptorType2 = 0x22,
-                    .wDescriptorLength = htole16(sizeof(hid_report_descriptor)),  // 29 bytes
-            },
-
-            // FS IN Endpoint
-            .fs_ep_in = {
-                    .bLength = 7,
-                    .bDescriptorType = USB_DT_ENDPOINT,
-                    .bEndpointAddress = 0x81,
-                    .bmAttributes = 0x03,
-                    .wMaxPacketSize = htole16(0x0040),  // 64 bytes
-                    .bInterval = 0x01,
-            },
-
-            // FS OUT Endpoint
-            .fs_ep_out = {
-                    .bLength = 7,
-                    .bDescriptorType = USB_DT_ENDPOINT,
-                    .bEndpointAddress = 0x02,
-                    .bmAttributes = 0x03,
-                    .wMaxPacketSize = htole16(0x0040),  // 64 bytes
-                    .bInterval = 0x01,
-            },
-
-            // HS Interface
-            .hs_intf = {
-                    .bLength = 9,
-                    .bDescriptorType = USB_DT_INTERFACE,
-                    .bInterfaceNumber = 0,
-                    .bAlternateSetting = 0,
-                    .bNumEndpoints = 2,
-                    .bInterfaceClass = 0x03,
-                    .bInterfaceSubClass = 0x00,
-                    .bInterfaceProtocol = 0x00,
-                    .iInterface = 0,
-            },
-
-            .hs_hid = {
-                    .bLength = 9,
-                    .bDescriptorType = 0x21,
-                    .bcdHID = htole16(0x0111),
-                    .bCountryCode = 0x00,
-                    .bNumDescriptors = 1,
-                    .bDescriptorType2 = 0x22,
-                    .wDescriptorLength = htole16(sizeof(hid_report_descriptor)),
-            },
-
-            // HS Endpoints
-            .hs_ep_in = {
-                    .bLength = 7,
-                    .bDescriptorType = USB_DT_ENDPOINT,
-                    .bEndpointAddress = 0x81,
-                    .bmAttributes = 0x03,
-                    .wMaxPacketSize = htole16(0x0040),
-                    .bInterval = 0x01,
-            },
-
-            .hs_ep_out = {
-                    .bLength = 7,
-                    .bDescriptorType = USB_DT_ENDPOINT,
-                    .bEndpointAddress = 0x02,
-                    .bmAttributes = 0x03,
-                    .wMaxPacketSize = htole16(0x0040),
-                    .bInterval = 0x01,
-            },
-    };
-
-    int ret = write(fd, &descs, sizeof(descs));
+    int ret = write(fd, blob->descriptors, blob->descriptors_len);
     if (ret < 0) {
         LOGE("Failed to write descriptors: %d (%s)", errno, strerror(errno));
         return -1;
     }
+    LOGI("Descriptors written: %d bytes (expected %zu)", ret, blob->descriptors_len);
 
-    LOGI("Descriptors written: %d bytes (expected %zu)", ret, sizeof(descs));
-
-    // Log descriptor details
-    LOGI("Interface: class=0x%02x subclass=0x%02x protocol=0x%02x",
-         descs.fs_intf.bInterfaceClass,
-         descs.fs_intf.bInterfaceSubClass,
-         descs.fs_intf.bInterfaceProtocol);
-
-    LOGI("EP IN: addr=0x%02x attr=0x%02x maxpkt=%d interval=%d",
-         descs.fs_ep_in.bEndpointAddress,
-         descs.fs_ep_in.bmAttributes,
-         descs.fs_ep_in.wMaxPacketSize,
-         descs.fs_ep_in.bInterval);
-
-    LOGI("EP OUT: addr=0x%02x attr=0x%02x maxpkt=%d interval=%d",
-         descs.fs_ep_out.bEndpointAddress,
-         descs.fs_ep_out.bmAttributes,
-         descs.fs_ep_out.wMaxPacketSize,
-         descs.fs_ep_out.bInterval);
-
-    // Write strings
-    struct {
-        struct usb_functionfs_strings_head header;
-        __le16 lang;
-        char manufacturer[12];
-        char product[12];
-        char serial[12];
-    } __attribute__((packed)) strings = {
-            .header = {
-                    .magic = htole32(FUNCTIONFS_STRINGS_MAGIC),
-                    .length = htole32(sizeof(strings)),
-                    .str_count = htole32(3),
-                    .lang_count = htole32(1),
-            },
-            .lang = htole16(0x0409),
-            .manufacturer = "Activision",
-            .product = "Spyro Porta",
-            .serial = "99B3f9C9E6",
-    };
-    LOGI("sizeof(descs)=%zu, fs_count=%u, hs_count=%u, hid_len=%zu", sizeof(descs), descs.fs_count, descs.hs_count, sizeof(hid_report_descriptor));
-    ret = write(fd, &strings, sizeof(strings));
+    ret = write(fd, blob->strings, blob->strings_len);
     if (ret < 0) {
         LOGE("Failed to write strings: %d (%s)", errno, strerror(errno));
         return -1;
     }
-
     LOGI("Strings written: %d bytes", ret);
-    LOGI("Manufacturer: '%s'", strings.manufacturer);
-    LOGI("Product: '%s'", strings.product);
     LOGI("=== DESCRIPTORS COMPLETE ===");
     return 0;
 }
 
-static void handle_setup_request(const struct usb_ctrlrequest *setup) {
-    LOGI("=== SETUP REQUEST ===");
-    LOGI("bmRequestType=0x%02x bRequest=0x%02x wValue=0x%04x wIndex=0x%04x wLength=%d",
-         setup->bRequestType, setup->bRequest, setup->wValue, setup->wIndex, setup->wLength);
-
-    uint8_t response[256];
-    memset(response, 0, sizeof(response));
-    int response_len = -1;
-
-    uint8_t request_type = setup->bRequestType & USB_TYPE_MASK;
-    uint8_t direction = setup->bRequestType & USB_DIR_IN;
-
-    if (request_type == USB_TYPE_STANDARD) {
-        if (setup->bRequest == USB_REQ_GET_DESCRIPTOR) {
-            uint8_t desc_type = (setup->wValue >> 8) & 0xFF;
-
-            LOGI("GET_DESCRIPTOR: type=0x%02x", desc_type);
-            if (desc_type == 0x21) {  // HID Descriptor
-                LOGI("Sending HID Descriptor");
-                // Construct HID descriptor
-                uint8_t hid_desc[] = {
-                        0x09,        // bLength
-                        0x21,        // bDescriptorType (HID)
-                        0x11, 0x01,  // bcdHID (1.11)
-                        0x00,        // bCountryCode
-                        0x01,        // bNumDescriptors
-                        0x22,        // bDescriptorType (Report)
-                        sizeof(hid_report_descriptor) & 0xFF,
-                        (sizeof(hid_report_descriptor) >> 8) & 0xFF
-                };
-                int len = (setup->wLength < sizeof(hid_desc)) ? setup->wLength : sizeof(hid_desc);
-                memcpy(response, hid_desc, len);
-                response_len = len;
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void log_latency_stats(const PortalInstance *p) {
+    const LatencyHistogram *h = &p->latency;
+    if (!h->count) return;
+    LOGI("Portal %d: %llu responses, latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us",
+         p->id, (unsigned long long)h->count,
+         latency_percentile(h, 0.5) / 1000.0,
+         latency_percentile(h, 0.99) / 1000.0,
+         latency_percentile(h, 0.999) / 1000.0,
+         h->max_ns / 1000.0);
+}
+
+static void log_prestage_stats(const PortalInstance *p) {
+    const PortalPrestageStats *s = &p->device.prestage;
+    if (!s->staged) return;
+    LOGI("Portal %d prestage: %llu replies staged, %llu sent, %llu dropped; reply written "
+         "p50 %.2f us, p99 %.2f us staged vs p50 %.2f us, p99 %.2f us built", p->id,
+         (unsigned long long)s->staged, (unsigned long long)s->hits,
+         (unsigned long long)s->dropped,
+         latency_percentile(&s->staged_latency, 0.5) / 1000.0,
+         latency_percentile(&s->staged_latency, 0.99) / 1000.0,
+         latency_percentile(&s->built_latency, 0.5) / 1000.0,
+         latency_percentile(&s->built_latency, 0.99) / 1000.0);
+}
+
+static void log_in_stats(const PortalInstance *p) {
+    const EpInStats *s = &p->device.in.stats;
+    if (!s->queued && !s->no_buffer && !s->failed) return;
+    LOGI("Portal %d ep_in: %llu sent at once, %llu queued (%llu sent later, %llu sense replaced, "
+         "%llu expired, %llu overflowed), %llu dropped without a buffer, %llu failed", p->id,
+         (unsigned long long)s->direct, (unsigned long long)s->queued,
+         (unsigned long long)s->retried, (unsigned long long)s->replaced,
+         (unsigned long long)s->expired, (unsigned long long)s->overflow,
+         (unsigned long long)s->no_buffer, (unsigned long long)s->failed);
+}
+
+static void log_figure(int index, PortalSlot *slot) {
+    if (!slot->typed) {
+        LOGI("Slot %d: not a full tag image, served as raw blocks", index);
+        return;
+    }
+
+    SkylanderFigure *fig = &slot->figure;
+    LOGI("Slot %d: %s id=%u variant=0x%04x uid=%08x area=%d",
+         index, figure_type_name(fig->type), fig->character_id, fig->variant,
+         fig->uid, fig->active_area);
+    if (fig->type == FIGURE_TRAP) {
+        FigureVillain villains[FIGURE_TRAP_VILLAINS];
+        int count = figure_trap_villains(fig, villains);
+        for (int i = 0; i < count; i++) {
+            LOGI("  villain %d: id=%u variant=%u%s", i, villains[i].villain_id,
+                 villains[i].variant, villains[i].evolved ? " (evolved)" : "");
+        }
+    } else if (fig->active_area >= 0) {
+        LOGI("  xp=%u gold=%u hat=%u", figure_xp(fig), figure_gold(fig), figure_hat(fig));
+    }
+}
+
+static void index_drop(PortalInstance *p, int index) {
+    PortalSlot *slot = &p->slots[index];
+    if (slot->typed) figure_index_remove(&p->index, slot->figure.uid, index);
+}
+
+// Index the figure just attached to slot index. -EEXIST if the other slot
+// holds the same UID: the game would see one figure in two places. Each
+// portal has its own game, so the same figure may sit on two portals.
+static int index_add(PortalInstance *p, int index) {
+    PortalSlot *slot = &p->slots[index];
+    if (!slot->typed) return 0;
+
+    const FigureIndexEntry *other;
+    if (figure_index_find_uid(&p->index, slot->figure.uid, &other, 1)) {
+        LOGE("Slot %d: figure uid=%08x is already in slot %d", index, slot->figure.uid,
+             other->ref);
+        return -EEXIST;
+    }
+    FigureIndexEntry entry = { slot->figure.uid, slot->figure.character_id,
+                               slot->figure.variant, index };
+    return figure_index_add(&p->index, &entry);
+}
+
+// Apply an edit transaction to a figure on the portal and swap it in
+static int edit_figure(int index, PortalSlot *slot, const void *payload, size_t len) {
+    static_assert(sizeof(FigureEdit) <= PORTAL_IPC_MAX_PAYLOAD, "edit must fit one message");
+    if (len != sizeof(FigureEdit)) return -EINVAL;
+    if (!slot->present || !slot->typed) return -ENODEV;
+
+    FigureEdit edit;
+    memcpy(&edit, payload, sizeof(edit));
+
+    uint8_t *stage = slot_stage(slot);
+    uint64_t changed = 0;
+    int ret = figure_edit_stage(&slot->figure, &edit, stage, &changed);
+    if (ret < 0) return ret;
+
+    slot_publish(slot, stage, changed);
+    LOGI("Slot %d edited: fields=0x%x blocks=0x%016llx sequence=%u", index, edit.fields,
+         (unsigned long long)changed, slot->figure.area_sequence[slot->figure.active_area]);
+    return 0;
+}
+
+// Detach a slot UNLOAD took off the portal; its queued writes have finished
+static int finish_unload(PortalInstance *p, int index) {
+    PortalSlot *slot = &p->slots[index];
+    uint32_t decrypts = slot->figure.decrypts;
+    uint32_t encrypts = slot->figure.encrypts;
+    int ret = slot_detach(slot);
+    supervisor_report_slot(g_portal.supervisor_fd, index, -1);
+    LOGI("Portal %d slot %d unloaded (AES blocks: %u decrypted, %u encrypted)",
+         p->id, index, decrypts, encrypts);
+    return ret;
+}
+
+// Status for FLUSH/UNLOAD once nothing is queued for the slot. A failed
+// queued write left its blocks dirty: FLUSH reports it, UNLOAD writes them
+// once more itself.
+static int settle_slot(PortalInstance *p, int index) {
+    SlotWaiters *w = &p->waiters[index];
+    int status = p->slots[index].write_error;
+    p->slots[index].write_error = 0;
+    if (w->unload) {
+        w->unload = false;
+        status = finish_unload(p, index);
+    }
+    return status;
+}
+
+// Answer now if nothing is queued for the slot, else from writes_settled()
+static int answer_after_writes(PortalInstance *p, int index, uint32_t client,
+                               const PortalIpcMsg *msg) {
+    SlotWaiters *w = &p->waiters[index];
+    if (!p->slots[index].writing) return settle_slot(p, index);
+    if (w->count == MAX_CTL_CLIENTS) return -EBUSY;
+    w->client[w->count] = client;
+    w->msg[w->count] = *msg;
+    w->count++;
+    return CTL_DEFERRED;
+}
+
+// Queued writes finished (pipeline_reap): answer the slot's waiters if
+// that was the last of them
+static void writes_settled(PortalInstance *p, int index) {
+    SlotWaiters *w = &p->waiters[index];
+    PortalSlot *slot = &p->slots[index];
+    if (slot->writing || (!w->count && !w->unload)) return;
+
+    // Runs a full journal kept back go out now, unless writing just failed
+    if (!w->unload && slot->dirty && !slot->write_error) {
+        slot_flush(slot);
+        if (slot->writing) return;
+    }
+    int status = settle_slot(p, index);
+    for (int i = 0; i < w->count; i++) {
+        CtlRequest req;
+        req.client = w->client[i];
+        req.msg = w->msg[i];
+        ctl_reply(&req, status, -1);
+    }
+    w->count = 0;
+}
+
+static int handle_ctl_message(const PortalIpcMsg *msg, uint32_t client, int fd,
+                              const void *payload, size_t payload_len, int *reply_fd) {
+    if (msg->op == PORTAL_IPC_MAP_SHARED) {
+        if (fd >= 0) close(fd);
+        if (g_portal.shared_fd < 0) return -ENODEV;
+        *reply_fd = g_portal.shared_fd;
+        return 0;
+    }
+    if (msg->op == PORTAL_IPC_SHUTDOWN) {
+        if (fd >= 0) close(fd);
+        LOGI("Shutdown requested over the control socket");
+        g_portal.running = false;
+        return 0;
+    }
+
+    if (msg->portal >= (uint32_t)g_portal.count || msg->slot < 0 || msg->slot >= MAX_SLOTS) {
+        if (fd >= 0) close(fd);
+        return -EINVAL;
+    }
+    PortalInstance *p = &g_portal.portals[msg->portal];
+    PortalSlot *slot = &p->slots[msg->slot];
+
+    switch (msg->op) {
+        case PORTAL_IPC_LOAD_SLOT: {
+            if (fd < 0) return -EBADF;
+            if (slot->writing || p->waiters[msg->slot].unload) {
+                close(fd);      // the old figure is still being written out
+                return -EBUSY;
             }
-            else if (desc_type == 0x22) {  // HID Report Descriptor
-                LOGI("Sending HID Report Descriptor");
-                int len = (setup->wLength < sizeof(hid_report_descriptor)) ?
-                          setup->wLength : sizeof(hid_report_descriptor);
-                memcpy(response, hid_report_descriptor, len);
-                response_len = len;
+            if (slot->data) slot_log_access(msg->slot, slot, true);
+            portal_drop_staged(&p->device, msg->slot);
+            index_drop(p, msg->slot);
+            int ret = slot_attach_fd(slot, fd);
+            if (ret < 0) return ret;
+            ret = index_add(p, msg->slot);
+            if (ret < 0) {
+                slot_detach(slot);
+                supervisor_report_slot(g_portal.supervisor_fd, msg->slot, -1);
+                return ret;
             }
+            slot->present = true;
+            slot->loaded = true;
+            supervisor_report_slot(g_portal.supervisor_fd, msg->slot, slot->fd);
+            LOGI("Portal %d slot %d loaded: %zu bytes mapped", p->id, msg->slot, slot->size);
+            log_figure(msg->slot, slot);
+            return 0;
         }
-        else if (setup->bRequest == USB_REQ_GET_STATUS) {
-            LOGI("GET_STATUS");
-            response[0] = 0x00;
-            response[1] = 0x00;
-            response_len = 2;
-        }
-        else if (setup->bRequest == USB_REQ_SET_CONFIGURATION) {
-            LOGI("SET_CONFIGURATION: value=%d", setup->wValue & 0xFF);
-            response_len = 0;  // ACK
-        }
-        else if (setup->bRequest == USB_REQ_GET_CONFIGURATION) {
-            LOGI("GET_CONFIGURATION");
-            response[0] = 0x01;
-            response_len = 1;
-        }
-        else if (setup->bRequest == USB_REQ_SET_INTERFACE) {
-            LOGI("SET_INTERFACE: interface=%d alt=%d",
-                 setup->wIndex, setup->wValue);
-            response_len = 0;  // ACK
+        case PORTAL_IPC_UNLOAD_SLOT: {
+            if (fd >= 0) close(fd);
+            SlotWaiters *w = &p->waiters[msg->slot];
+            if (!w->unload) {
+                // Off the portal at once; detached when its writes are done
+                if (slot->data) slot_log_access(msg->slot, slot, true);
+                portal_drop_staged(&p->device, msg->slot);
+                index_drop(p, msg->slot);
+                slot->present = false;
+                slot->loaded = false;
+                w->unload = true;
+                slot_flush(slot);
+            }
+            return answer_after_writes(p, msg->slot, client, msg);
         }
-        else if (setup->bRequest == USB_REQ_GET_INTERFACE) {
-            LOGI("GET_INTERFACE");
-            response[0] = 0x00;
-            response_len = 1;
+        case PORTAL_IPC_FLUSH_SLOT: {
+            if (fd >= 0) close(fd);
+            int ret = slot_flush(slot);
+            if (ret < 0 && ret != -EAGAIN) return ret;
+            return answer_after_writes(p, msg->slot, client, msg);
         }
+        case PORTAL_IPC_EDIT_FIGURE:
+            if (fd >= 0) close(fd);
+            portal_drop_staged(&p->device, msg->slot);
+            return edit_figure(msg->slot, slot, payload, payload_len);
+        default:
+            if (fd >= 0) close(fd);
+            return -EINVAL;
+    }
+}
+
+// Run the requests the control thread queued; the slots are ours alone
+static void ctl_drain(void) {
+    CtlRequest req;
+    while (ctl_next(&req)) {
+        int reply_fd = -1;
+        int status = handle_ctl_message(&req.msg, req.client, req.fd, req.payload,
+                                        req.payload_len, &reply_fd);
+        if (status != CTL_DEFERRED) ctl_reply(&req, status, reply_fd);
     }
-    else if (request_type == USB_TYPE_CLASS) {
-        LOGI("CLASS request: 0x%02x", setup->bRequest);
+}
 
-        if (setup->bRequest == 0x01) {  // GET_REPORT
-            LOGI("GET_REPORT");
-            memset(response, 0, 32);
-            response[0] = 0x53;
-            response_len = (setup->wLength < 32) ? setup->wLength : 32;
-        }
-        else if (setup->bRequest == 0x09) {  // SET_REPORT
-            LOGI("SET_REPORT");
-            response_len = 0;
-        }
-        else if (setup->bRequest == 0x0A) {  // SET_IDLE
-            LOGI("SET_IDLE");
-            response_len = 0;
-        }
-        else if (setup->bRequest == 0x0B) {  // SET_PROTOCOL
-            LOGI("SET_PROTOCOL");
-            response_len = 0;
-        }
-        else if (setup->bRequest == 0x03) {  // GET_PROTOCOL
-            LOGI("GET_PROTOCOL");
-            response[0] = 0x01;
-            response_len = 1;
-        }
-        else {
-            LOGI("Unknown HID class request: 0x%02x", setup->bRequest);
+static int shared_map(int fd) {
+    void *map = mmap(NULL, sizeof(PortalShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    g_portal.shared = (PortalShared *)map;
+    g_portal.shared_fd = fd;
+    return 0;
+}
+
+// One memfd holds everything the app reads without IPC round trips
+static int shared_create(void) {
+    int fd = (int)syscall(__NR_memfd_create, "kaos_portal_shared", MFD_CLOEXEC);
+    if (fd < 0) return -errno;
+    if (ftruncate(fd, sizeof(PortalShared)) < 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    int ret = shared_map(fd);
+    if (ret < 0) return ret;
+    g_portal.shared->magic = PORTAL_SHM_MAGIC;
+    g_portal.shared->version = PORTAL_SHM_VERSION;
+    g_portal.shared->audio.volume_q15.store(32767, std::memory_order_relaxed);
+    return 0;
+}
+
+static void write_gadget_attr(const char *dir, const char *attr, const char *value) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (write(fd, value, strlen(value)) < 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+    }
+    close(fd);
+}
+
+// The gadget is not bound yet when the daemon starts, so the profile's IDs
+// and strings can still be applied to it
+static void apply_profile_to_gadget(const char *gadget_dir) {
+    struct stat st;
+    if (stat(gadget_dir, &st) < 0 || !S_ISDIR(st.st_mode)) return;
+
+    char value[16];
+    snprintf(value, sizeof(value), "0x%04x", g_profile->vid);
+    write_gadget_attr(gadget_dir, "idVendor", value);
+    snprintf(value, sizeof(value), "0x%04x", g_profile->pid);
+    write_gadget_attr(gadget_dir, "idProduct", value);
+    snprintf(value, sizeof(value), "0x%04x", g_profile->bcd_device);
+    write_gadget_attr(gadget_dir, "bcdDevice", value);
+    write_gadget_attr(gadget_dir, "strings/0x409/manufacturer", g_profile->manufacturer);
+    write_gadget_attr(gadget_dir, "strings/0x409/product", g_profile->product);
+    write_gadget_attr(gadget_dir, "strings/0x409/serialnumber", g_profile->serial);
+}
+
+// Signal handler for clean shutdown
+void signal_handler(int signum) {
+    printf("Received signal %d, shutting down...\n", signum);
+    g_portal.running = false;
+}
+
+// portal0 -> portal<id>; a path not ending in a number gets one for id > 0
+static void instance_path(char *out, size_t size, const char *base, int id) {
+    size_t len = strlen(base);
+    size_t stem = len;
+    while (stem > 0 && isdigit((unsigned char)base[stem - 1])) stem--;
+    if (stem == len && id == 0) snprintf(out, size, "%s", base);
+    else snprintf(out, size, "%.*s%d", (int)stem, base, id);
+}
+
+// Gadget of portal id, with its paths in gadget_dir and ffs_dir. Portal 0
+// may hand USB over from Android; the others each take the next UDC.
+static void instance_gadget(GadgetConfig *cfg, char *gadget_dir, char *ffs_dir, int id) {
+    *cfg = g_gadget;
+    instance_path(gadget_dir, PORTAL_PATH_MAX, g_gadget.gadget_dir, id);
+    instance_path(ffs_dir, PORTAL_PATH_MAX, g_gadget.ffs_dir, id);
+    cfg->gadget_dir = gadget_dir;
+    cfg->ffs_dir = ffs_dir;
+    cfg->android_usb = g_gadget.android_usb && id == 0;
+    cfg->udc_index = g_gadget.udc_index + id;
+}
+
+// Reset portal id; the figure index goes in index_storage
+static void portal_init(PortalInstance *p, int id, void *index_storage) {
+    memset(p, 0, sizeof(*p));
+    p->id = id;
+    p->ep0_fd = -1;
+    p->ep_in_fd = -1;
+    p->ep_out_fd = -1;
+    for (int i = 0; i < MAX_SLOTS; i++) slot_init(&p->slots[i]);
+    figure_index_init_at(&p->index, MAX_SLOTS, index_storage);
+    instance_gadget(&p->gadget, p->gadget_dir, p->ffs_dir, id);
+
+    p->device.profile = g_profile;
+    p->device.slots = p->slots;
+    p->device.transport = { p, ep0_read, ep0_write, ep_in_write };
+    p->device.feedback = (id == 0);
+}
+
+static void portal_close(PortalInstance *p) {
+    if (p->ep_in_fd >= 0) close(p->ep_in_fd);
+    if (p->ep_out_fd >= 0) close(p->ep_out_fd);
+    if (p->ep0_fd >= 0) close(p->ep0_fd);
+    p->ep_in_fd = p->ep_out_fd = p->ep0_fd = -1;
+}
+
+// Open ep0 of one portal and write its descriptors
+static int portal_open_ep0(PortalInstance *p, const PortalDescriptorBlob *descriptors) {
+    if (g_manage_gadget) {
+        int ret = gadget_up(&p->gadget, g_profile);
+        if (ret < 0) {
+            fprintf(stderr, "FATAL: Cannot set up gadget %s: %s\n", p->gadget_dir, strerror(-ret));
+            return -1;
         }
     }
 
-    // Send response
-    if (response_len >= 0) {
-        if (response_len == 0) {
-            int ret = write(g_portal.ep0_fd, NULL, 0);  // or write(g_portal.ep0_fd, "", 0);
-            LOGI("Sent ZLP ACK (ret=%d)", ret);
-        } else {
-            int ret = write(g_portal.ep0_fd, response, response_len);
-            if (ret < 0) {
-                LOGE("Failed to write response: %d (%s)", errno, strerror(errno));
-            } else {
-                LOGI("Sent %d bytes", ret);
-            }
+    // Open ep0 as soon as functionfs is mounted
+    printf("Opening ep0 of %s...\n", p->ffs_dir);
+    fflush(stdout);
+    uint64_t start = now_ms();
+    int fd = ffs_open_wait(p->ffs_dir, "ep0", O_RDWR | O_CLOEXEC, EP0_WAIT_MS);
+    if (fd < 0) {
+        fprintf(stderr, "FATAL: Failed to open ep0 of %s: %s\n", p->ffs_dir, strerror(-fd));
+        return -1;
+    }
+    p->ep0_fd = fd;
+    printf("ep0 opened successfully: fd=%d (%llu ms)\n", fd,
+           (unsigned long long)(now_ms() - start));
+    fflush(stdout);
+
+    // A gadget we built already carries the profile
+    if (!g_manage_gadget) apply_profile_to_gadget(p->gadget_dir);
+
+    // Write descriptors
+    printf("Writing descriptors...\n");
+    fflush(stdout);
+    if (write_descriptors(p->ep0_fd, descriptors) < 0) {
+        fprintf(stderr, "FATAL: Failed to write descriptors\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Bind one portal's gadget and open the data endpoints functionfs created
+// for it
+static int portal_open_data(PortalInstance *p) {
+    // The UDC only takes a function that has its descriptors
+    if (g_manage_gadget) {
+        int ret = gadget_bind(&p->gadget);
+        if (ret < 0) {
+            fprintf(stderr, "FATAL: Cannot bind gadget %s: %s\n", p->gadget_dir, strerror(-ret));
+            return -1;
         }
-    } else {
-        LOGI("STALL");
     }
+
+    // functionfs creates ep1/ep2 once it has the descriptors, normally
+    // before write() above returns; the host talks to them after BIND/ENABLE
+    printf("Opening data endpoints of %s...\n", p->ffs_dir);
+    fflush(stdout);
+    uint64_t start = now_ms();
+    int in_fd = ffs_open_wait(p->ffs_dir, "ep1", O_RDWR | O_NONBLOCK | O_CLOEXEC, DATA_EP_WAIT_MS);
+    int out_fd = (in_fd < 0) ? in_fd :
+                 ffs_open_wait(p->ffs_dir, "ep2", O_RDWR | O_NONBLOCK | O_CLOEXEC, DATA_EP_WAIT_MS);
+    if (in_fd < 0 || out_fd < 0) {
+        fprintf(stderr, "FATAL: Failed to open data endpoints: %s\n",
+                strerror(in_fd < 0 ? -in_fd : -out_fd));
+        if (in_fd >= 0) close(in_fd);
+        return -1;
+    }
+    p->ep_in_fd = in_fd;
+    p->ep_out_fd = out_fd;
+    printf("ep1 opened: fd=%d, ep2 opened: fd=%d (%llu ms)\n", in_fd, out_fd,
+           (unsigned long long)(now_ms() - start));
+    fflush(stdout);
+    return 0;
 }
 
-static void handle_portal_command(const uint8_t *data, size_t len) {
-    if (len < 1) return;
+// Open the control socket and every portal's endpoints and write the
+// descriptors: everything the hosts and the app see of the daemon. All
+// the gadgets are built before any is bound, since building one releases
+// the UDCs.
+static int portal_setup(void) {
+    // Figures arrive as fds from the app over this socket
+    g_portal.ctl_listen_fd = ctl_listen();
+    if (g_portal.ctl_listen_fd < 0) {
+        fprintf(stderr, "Failed to open control socket: %d (%s)\n", errno, strerror(errno));
+    }
 
-    uint8_t cmd = data[0];
-    uint8_t response[32];
-    memset(response, 0, sizeof(response));
-    int response_len = 0;
+    PortalDescriptorBlob descriptors = profile_descriptors(g_profile);
+    ep0_cache_init(descriptors.hid_report, descriptors.hid_report_len);
+    for (int i = 0; i < g_portal.count; i++) {
+        if (portal_open_ep0(&g_portal.portals[i], &descriptors) < 0) return -1;
+    }
 
-    LOGI("Portal command: 0x%02x, len=%zu", cmd, len);
+    int shared_ret = shared_create();
+    if (shared_ret < 0) {
+        fprintf(stderr, "Failed to create shared state: %s\n", strerror(-shared_ret));
+    }
 
-    switch (cmd) {
-        case 0x41: // Activate
-            LOGI("Activate portal");
-            response[0] = 0x41;
-            response[1] = 0x01;
-            response[2] = 0xFF;
-            response[3] = 0x77;
-            response_len = 32;  // Pad to 64 bytes
-            break;
+    printf("READY\n");
+    fflush(stdout);
 
-        case 0x43: // Set LED color
-            if (len >= 4) {
-                uint8_t r = data[1];
-                uint8_t g = data[2];
-                uint8_t b = data[3];
-                LOGI("Set LED: R=%d G=%d B=%d", r, g, b);
-                response[0] = 0x43;
-                response[1] = r;
-                response[2] = g;
-                response[3] = b;
-                response_len = 32;
-            }
-            break;
+    for (int i = 0; i < g_portal.count; i++) {
+        if (portal_open_data(&g_portal.portals[i]) < 0) return -1;
+    }
 
-        case 0x4A: // Query (sound related?)
-            LOGI("Query command");
-            response[0] = 0x4A;
-            response_len = 32;
-            break;
+    printf("ALL_READY\n");
+    fflush(stdout);
+    return 0;
+}
 
-        case 0x4C: // Traptanium portal LED control
-            if (len >= 5) {
-                uint8_t side = data[1];  // 0x00=right, 0x02=left
-                LOGI("Traptanium LED control: side=%d", side);
-                // No response
-            }
-            break;
+// Supervised worker: pick up what the supervisor holds instead of opening
+// anything, including the figures a previous worker had loaded. The
+// supervisor only ever runs a single portal.
+static int portal_adopt(void) {
+    PortalInstance *p = &g_portal.portals[0];
+    PortalHandoff h;
+    int ret = supervisor_adopt(&h, &g_portal.worker_state);
+    if (ret < 0) {
+        fprintf(stderr, "FATAL: Cannot adopt supervisor state: %s\n", strerror(-ret));
+        return -1;
+    }
 
-        case 0x4D: // Speaker control
-            if (len >= 2 && data[1] > 0) {
-                LOGI("Activate speaker");
-                response[0] = 0x4D;
-                response[1] = 0x01;  // Has speaker
-                response_len = 32;
-            } else {
-                LOGI("Deactivate speaker");
-                response[0] = 0x4D;
-                response_len = 32;
-            }
-            break;
+    p->ep0_fd = h.fds[HANDOFF_EP0];
+    p->ep_in_fd = h.fds[HANDOFF_EP_IN];
+    p->ep_out_fd = h.fds[HANDOFF_EP_OUT];
+    g_portal.ctl_listen_fd = h.fds[HANDOFF_CTL_LISTEN];
+    g_portal.supervisor_fd = h.fds[HANDOFF_SUPERVISOR];
+    // The previous worker saw ENABLE; a disabled host just fails the writes
+    p->enabled = true;
+    if (p->ep_in_fd < 0 || p->ep_out_fd < 0) {
+        fprintf(stderr, "FATAL: Supervisor passed no data endpoints\n");
+        return -1;
+    }
+    if (h.fds[HANDOFF_SHARED] >= 0 && shared_map(h.fds[HANDOFF_SHARED]) < 0) {
+        fprintf(stderr, "Cannot map shared state: %s\n", strerror(errno));
+    }
 
-        case 0x51: // Read Skylander
-            if (len >= 3) {
-                uint8_t slot_query = data[1];
-                uint8_t block = data[2];
-                // Convert query format (0x20/0x21) to slot index (0/1)
-                uint8_t slot = (slot_query & 0x0F) - 0;
-                if (slot_query == 0x20) slot = 0;
-                else if (slot_query == 0x21) slot = 1;
-
-                LOGI("Read Skylander: query=0x%02x block=%d slot=%d", slot_query, block, slot);
-
-                if (slot < MAX_SLOTS && g_portal.slots[slot].present) {
-                    response[0] = 0x51;
-                    response[1] = 0x10 + slot;  // Response format: 0x10/0x11
-                    response[2] = block;
-
-                    size_t offset = block * 16;
-                    if (offset + 16 <= g_portal.slots[slot].size) {
-                        memcpy(&response[3], &g_portal.slots[slot].data[offset], 16);
-                    }
-                    response_len = 32;
-                }
-            }
-            break;
+    PortalDescriptorBlob descriptors = profile_descriptors(g_profile);
+    ep0_cache_init(descriptors.hid_report, descriptors.hid_report_len);
 
-        case 0x52: { // Shutdown/restart
-            LOGI("Shutdown/restart");
-            response[0] = 0x52;
-            response[1] = 0x02;
-            response[2] = 0x0A;
-            response[3] = 0x05;
-            response[4] = 0x08;
-            response_len = 32;
-            break;
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        PortalSlot *slot = &p->slots[i];
+        slot->save = &g_portal.worker_state->slots[i];
+        int fd = h.fds[HANDOFF_SLOT0 + i];
+        if (fd < 0) {
+            if (slot->save->size) LOGE("Slot %d: saved image has no dump fd, dropped", i);
+            slot->save->size = 0;
+            continue;
+        }
 
-        case 0x53: // Sense (manual query)
-            LOGI("Manual sense query");
-            response[0] = 0x53;
-            // Bitmask (little endian, 4 bytes)
-            uint32_t mask = 0;
-            for (int i = 0; i < MAX_SLOTS; i++) {
-                if (g_portal.slots[i].present) {
-                    mask |= (1 << i);
-                }
-            }
-            response[1] = mask & 0xFF;
-            response[2] = (mask >> 8) & 0xFF;
-            response[3] = (mask >> 16) & 0xFF;
-            response[4] = (mask >> 24) & 0xFF;
-            response[5] = 0x00;  // Counter
-            response[6] = 0x01;
-            response_len = 32;
-            break;
+        ret = slot_restore(slot, fd);
+        if (ret < 0) {
+            LOGE("Slot %d: cannot restore: %s", i, strerror(-ret));
+            slot->save->size = 0;
+            supervisor_report_slot(g_portal.supervisor_fd, i, -1);
+            continue;
         }
-        case 0x56: // Unknown V command
-            LOGI("V command");
-            response[0] = 0x56;
-            response_len = 32;
-            break;
+        slot->present = true;
+        slot->loaded = true;
+        index_add(p, i);    // a duplicate that made it this far stays
+        LOGI("Slot %d restored: %zu bytes, %d unflushed blocks", i, slot->size,
+             __builtin_popcountll(slot->dirty));
+        log_figure(i, slot);
+    }
 
-        case 0x57: // Write Skylander
-            if (len >= 19) {
-                uint8_t slot_query = data[1];
-                uint8_t block = data[2];
-                uint8_t slot = (slot_query == 0x20) ? 0 : 1;
-
-                LOGI("Write Skylander: query=0x%02x block=%d slot=%d", slot_query, block, slot);
-
-                if (slot < MAX_SLOTS && g_portal.slots[slot].present) {
-                    size_t offset = block * 16;
-                    if (offset + 16 <= g_portal.slots[slot].size) {
-                        memcpy(&g_portal.slots[slot].data[offset], &data[3], 16);
-                    }
-                    response[0] = 0x57;
-                    response[1] = 0x10 + slot;
-                    response[2] = block;
-                    memcpy(&response[3], &data[3], 16);
-                    response_len = 32;
-                }
-            }
-            break;
+    LOGI("Worker %d resumed (restart %u)", getpid(), g_portal.worker_state->restarts);
+    return 0;
+}
 
-        default:
-            LOGI("Unknown command: 0x%02x", cmd);
-            break;
+// One ep0 event of portal p. Returns false if ep0 failed for good.
+static bool portal_ep0_event(PortalInstance *p) {
+    struct usb_functionfs_event event;
+    int n = read(p->ep0_fd, &event, sizeof(event));
+
+    if (n == sizeof(event)) {
+        switch (event.type) {
+            case FUNCTIONFS_SETUP: {
+                uint64_t start = now_ns();
+                handle_setup_request(&p->device, &event.u.setup);
+                latency_record(&p->latency, now_ns() - start);
+                break;
+            }
+            case FUNCTIONFS_BIND:
+                LOGI("Portal %d: function BOUND to UDC", p->id);
+                p->unbound = false;
+                break;
+            case FUNCTIONFS_ENABLE: {
+                LOGI("Portal %d: device ENABLED by host - sending initial sense", p->id);
+
+                // Send initial sense, then keep to the profile's cadence
+                portal_send_sense(&p->device);
+                p->enabled = true;
+                p->next_sense_ms = now_ms() + g_profile->sense_interval_ms;
+                break;
+            }
+            case FUNCTIONFS_DISABLE:
+                LOGI("Portal %d: device DISABLED by host", p->id);
+                p->enabled = false;
+                portal_drop_in(&p->device);
+                break;
+            case FUNCTIONFS_UNBIND: {
+                p->enabled = false;
+                portal_drop_in(&p->device);
+                p->unbound = true;
+                // The daemon goes once no portal is left bound
+                bool any_bound = false;
+                for (int i = 0; i < g_portal.count; i++) any_bound |= !g_portal.portals[i].unbound;
+                LOGI("Portal %d: device UNBOUND%s", p->id, any_bound ? "" : " - exiting");
+                if (!any_bound) g_portal.running = false;
+                break;
+            }
+            default:
+                LOGI("Unknown event: %d", event.type);
+                break;
+        }
+    } else if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            LOGE("Portal %d: ep0 read error: %d (%s)", p->id, errno, strerror(errno));
+            return false;
+        }
     }
+    return true;
+}
 
-    if (response_len > 0) {
-        int ret = write(g_portal.ep_in_fd, response, response_len);
-        if (ret < 0) {
-            LOGE("Failed to write response: %d (%s)", errno, strerror(errno));
-        } else {
-            LOGI("Sent response: %d bytes (cmd 0x%02x)", ret, response[0]);
+// One packet from portal p's OUT endpoint
+static void portal_out_report(PortalInstance *p, uint8_t *buffer, size_t size) {
+    int n = read(p->ep_out_fd, buffer, size);
+    if (n > g_profile->report_size && p->device.speaker_on) {
+        // Full-size packets while the speaker is on are audio, not 32-byte
+        // commands; only the app's portal has anywhere to play them
+        if (p->device.feedback) audio_ingest(buffer, n);
+    } else if (n > 0) {
+        uint64_t start = now_ns();
+        if (!is_led_command(buffer[0])) LOGI("Received %d bytes from host", n);
+        handle_portal_command(&p->device, buffer, n);
+        latency_record(&p->latency, now_ns() - start);
+    } else if (n < 0) {
+        if (errno == ESHUTDOWN || errno == ECONNRESET || errno == ENOTCONN) {
+            LOGE("Portal %d: transport shutdown - host disconnected", p->id);
+            // Don't exit - wait for reconnect
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE("Portal %d: ep_out read error: %d (%s)", p->id, errno, strerror(errno));
         }
     }
 }
 
-// Signal handler for clean shutdown
-void signal_handler(int signum) {
-    printf("Received signal %d, shutting down...\n", signum);
-    g_portal.running = false;
+// Notice an endpoint going away
+static bool portal_fds_ok(const PortalInstance *p) {
+    struct stat st;
+    if (fstat(p->ep0_fd, &st) < 0) {
+        LOGE("FATAL: portal %d ep0_fd invalid: %s", p->id, strerror(errno));
+        return false;
+    }
+    if (fstat(p->ep_in_fd, &st) < 0) {
+        LOGE("FATAL: portal %d ep_in_fd invalid: %s", p->id, strerror(errno));
+        return false;
+    }
+    if (fstat(p->ep_out_fd, &st) < 0) {
+        LOGE("FATAL: portal %d ep_out_fd invalid: %s", p->id, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Stats lines for whatever changed on portal p since the last ones.
+// Returns whether it staged replies in the meantime.
+static bool portal_log_stats(PortalInstance *p) {
+    if (p->latency.count != p->latency_reported) log_latency_stats(p);
+    p->latency_reported = p->latency.count;
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (p->slots[i].data) slot_log_access(i, &p->slots[i], false);
+    }
+    const EpInStats *in = &p->device.in.stats;
+    if (memcmp(in, &p->in_reported, sizeof(*in)) != 0) {
+        log_in_stats(p);
+        p->in_reported = *in;
+    }
+    if (p->device.prestage.staged == p->staged_reported) return false;
+    log_prestage_stats(p);
+    p->staged_reported = p->device.prestage.staged;
+    return true;
 }
 
 int main(int argc, char *argv[]) {
-    // Redirect stderr to a log file for debugging
-    FILE* log_file = fopen("/data/local/tmp/portal_daemon.log", "w");
+    const char *profile_name = "wii";
+    const char *gadget_dir = DEFAULT_GADGET_DIR;
+    const char *gadget_cmd = NULL;
+    bool restore_usb = false;
+    bool supervise = false;
+    bool worker = false;
+    int portals = 1;
+    // Control clients besides root: the app, which extracted this binary
+    // and so owns it, unless --ctl-uid names another uid
+    uid_t ctl_uid = 0;
+    struct stat exe;
+    if (stat("/proc/self/exe", &exe) == 0) ctl_uid = exe.st_uid;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_name = argv[++i];
+        } else if (strcmp(argv[i], "--gadget-dir") == 0 && i + 1 < argc) {
+            gadget_dir = argv[++i];
+        } else if (strcmp(argv[i], "--manage-gadget") == 0) {
+            g_manage_gadget = true;
+        } else if (strcmp(argv[i], "--gadget") == 0 && i + 1 < argc) {
+            // portal_daemon --gadget up|down: build or remove the gadget and exit
+            gadget_cmd = argv[++i];
+        } else if (strcmp(argv[i], "--ffs-dir") == 0 && i + 1 < argc) {
+            g_gadget.ffs_dir = argv[++i];
+        } else if (strcmp(argv[i], "--udc-dir") == 0 && i + 1 < argc) {
+            g_gadget.udc_dir = argv[++i];
+        } else if (strcmp(argv[i], "--restore-usb") == 0) {
+            // With --gadget down: hand USB back to Android (MTP + adb)
+            restore_usb = true;
+        } else if (strcmp(argv[i], "--no-mount") == 0) {
+            // Test tree: plain directories, no functionfs and no Android USB changes
+            g_gadget.mount_ffs = false;
+            g_gadget.android_usb = false;
+        } else if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+            // SCHED_FIFO priority for the endpoint loop (see portal_rt.h)
+            g_rt.priority = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rt-cpu") == 0 && i + 1 < argc) {
+            g_rt.cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--helper-cpu") == 0 && i + 1 < argc) {
+            g_rt.helper_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--portals") == 0 && i + 1 < argc) {
+            // Portals 0..n-1 on ffs dirs portal0..portal<n-1>, one UDC each
+            portals = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ctl-uid") == 0 && i + 1 < argc) {
+            ctl_uid = (uid_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--supervise") == 0) {
+            supervise = true;
+        } else if (strcmp(argv[i], "--worker") == 0) {
+            // Internal: exec'd by the supervisor with the descriptors it holds
+            worker = true;
+        } else if (strcmp(argv[i], "--write-profile") == 0 && i + 2 < argc) {
+            // portal_daemon --write-profile <name> <path>: export a built-in profile image
+            const PortalProfile *profile = profile_builtin(argv[i + 1]);
+            int ret = profile ? profile_write(profile, argv[i + 2]) : -ENOENT;
+            if (ret < 0) fprintf(stderr, "Failed to write profile: %s\n", strerror(-ret));
+            return ret < 0 ? 1 : 0;
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+        }
+    }
+    if (worker) supervise = false;
+    g_gadget.gadget_dir = gadget_dir;
+    if (portals < 1 || portals > MAX_PORTALS) {
+        fprintf(stderr, "--portals takes 1 to %d\n", MAX_PORTALS);
+        return 2;
+    }
+    if (portals > 1 && (supervise || worker)) {
+        // The handoff carries one portal's endpoints and slots
+        fprintf(stderr, "--supervise runs a single portal\n");
+        return 2;
+    }
+
+    if (gadget_cmd) {
+        const PortalProfile *profile = NULL;
+        if (strcmp(gadget_cmd, "up") == 0) {
+            profile = profile_load(profile_name);
+            if (!profile) return 1;
+        } else if (strcmp(gadget_cmd, "down") != 0) {
+            fprintf(stderr, "Unknown gadget command: %s\n", gadget_cmd);
+            return 2;
+        }
+        int failed = 0;
+        for (int i = 0; i < portals; i++) {
+            GadgetConfig cfg;
+            char dir[PORTAL_PATH_MAX];
+            char ffs_dir[PORTAL_PATH_MAX];
+            instance_gadget(&cfg, dir, ffs_dir, i);
+            int ret = profile ? gadget_up(&cfg, profile) :
+                                gadget_down(&cfg, restore_usb && cfg.android_usb);
+            if (ret < 0) failed++;
+        }
+        return failed ? 1 : 0;
+    }
+
+    // Redirect stderr to a log file for debugging. A worker keeps appending
+    // to the one its supervisor opened.
+    FILE* log_file = worker ? NULL : fopen("/data/local/tmp/portal_daemon.log", "w");
     if (log_file) {
         dup2(fileno(log_file), STDERR_FILENO);
         setbuf(stderr, NULL); // Unbuffered
     }
 
-    fprintf(stderr, "=== Portal Daemon Starting ===\n");
+    fprintf(stderr, "=== Portal Daemon Starting%s ===\n",
+            worker ? " (worker)" : (supervise ? " (supervisor)" : ""));
     fprintf(stderr, "PID: %d, UID: %d, EUID: %d\n", getpid(), getuid(), geteuid());
 
     if (geteuid() != 0) {
@@ -554,269 +907,287 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    g_profile = profile_load(profile_name);
+    if (!g_profile) {
+        fprintf(stderr, "FATAL: Cannot load profile '%s'\n", profile_name);
+        return 1;
+    }
+    fprintf(stderr, "Profile: %s (%04x:%04x)\n", g_profile->name, g_profile->vid, g_profile->pid);
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     signal(SIGPIPE, SIG_IGN);  // ADD THIS - ignore broken pipe
 
     memset(&g_portal, 0, sizeof(g_portal));
     g_portal.running = true;
-    g_portal.ep0_fd = -1;
-    g_portal.ep_in_fd = -1;
-    g_portal.ep_out_fd = -1;
-
-    // Open ep0
-    printf("Opening ep0...\n");
-    fflush(stdout);
-    for (int retry = 0; retry < 15; retry++) {
-        g_portal.ep0_fd = open("/dev/usb-ffs/portal0/ep0", O_RDWR);
-        if (g_portal.ep0_fd >= 0) {
-            printf("ep0 opened successfully: fd=%d\n", g_portal.ep0_fd);
-            fflush(stdout);
+    g_portal.shared_fd = -1;
+    g_portal.supervisor_fd = -1;
+    // Pool objects round up to 16 bytes and carry a free-list link
+    size_t portal_bytes = sizeof(PortalInstance) + figure_index_bytes(MAX_SLOTS) + 64 +
+                          PORTAL_REPORTS * (sizeof(PortalReport) + 16 + sizeof(uint32_t));
+    int mem_ret = mem_region_init(&g_mem, "daemon", DAEMON_MEM_BYTES + portals * portal_bytes);
+    g_portal.portals = (mem_ret < 0) ? NULL :
+        (PortalInstance *)arena_alloc(&g_mem, portals * sizeof(PortalInstance), 64);
+    for (int i = 0; g_portal.portals && i < portals; i++) {
+        void *index_storage = arena_alloc(&g_mem, figure_index_bytes(MAX_SLOTS), sizeof(uint32_t));
+        if (!index_storage) {
+            g_portal.portals = NULL;
             break;
         }
-        fprintf(stderr, "Failed to open ep0 (attempt %d/15): %d (%s)\n",
-                retry + 1, errno, strerror(errno));
-        sleep(1);
+        portal_init(&g_portal.portals[i], i, index_storage);
     }
-
-    if (g_portal.ep0_fd < 0) {
-        fprintf(stderr, "FATAL: Failed to open ep0\n");
+    if (!g_portal.portals) {
+        fprintf(stderr, "FATAL: Cannot allocate daemon memory: %s\n",
+                strerror(mem_ret < 0 ? -mem_ret : ENOMEM));
         return 1;
     }
+    g_portal.count = portals;
+    fprintf(stderr, "Portals: %d (%zu bytes each)\n", portals, portal_bytes);
+    if (mem_pool_init(&g_reports, &g_mem, "reports", sizeof(PortalReport),
+                      portals * PORTAL_REPORTS) == 0) {
+        for (int i = 0; i < portals; i++) g_portal.portals[i].device.reports = &g_reports;
+    } else {
+        LOGE("No room for report buffers; nothing is staged or queued for ep_in");
+    }
 
-    // Write descriptors
-    printf("Writing descriptors...\n");
-    fflush(stdout);
-    if (write_descriptors(g_portal.ep0_fd) < 0) {
-        fprintf(stderr, "FATAL: Failed to write descriptors\n");
-        close(g_portal.ep0_fd);
+    if (worker ? portal_adopt() < 0 : portal_setup() < 0) {
+        for (int i = 0; i < portals; i++) {
+            portal_close(&g_portal.portals[i]);
+            if (g_manage_gadget && !worker) gadget_down(&g_portal.portals[i].gadget, false);
+        }
         return 1;
     }
 
-    printf("READY\n");
-    fflush(stdout);
-
-    // Wait for data endpoints
-    printf("Waiting for data endpoints...\n");
-    fflush(stdout);
-    for (int i = 0; i < 30; i++) {
-        if (access("/dev/usb-ffs/portal0/ep1", F_OK) == 0 &&
-            access("/dev/usb-ffs/portal0/ep2", F_OK) == 0) {
-            printf("Data endpoints detected!\n");
-            fflush(stdout);
-            break;
-        }
-        if (i == 29) {
-            fprintf(stderr, "FATAL: Data endpoints never appeared\n");
-            close(g_portal.ep0_fd);
+    int exit_code = 0;
+    if (supervise) {
+        PortalHandoff handoff;
+        PortalWorkerState *state;
+        int ret = supervisor_prepare(&handoff, &state);
+        if (ret < 0) {
+            fprintf(stderr, "FATAL: Cannot prepare supervisor: %s\n", strerror(-ret));
             return 1;
         }
-        sleep(1);
-    }
-
-    // Open data endpoints
-    printf("Opening data endpoints...\n");
-    fflush(stdout);
-    for (int retry = 0; retry < 15; retry++) {
-        g_portal.ep_in_fd = open("/dev/usb-ffs/portal0/ep1", O_RDWR | O_NONBLOCK);
-        if (g_portal.ep_in_fd >= 0) {
-            printf("ep1 opened: fd=%d\n", g_portal.ep_in_fd);
-            fflush(stdout);
-            break;
+        handoff.fds[HANDOFF_EP0] = g_portal.portals[0].ep0_fd;
+        handoff.fds[HANDOFF_EP_IN] = g_portal.portals[0].ep_in_fd;
+        handoff.fds[HANDOFF_EP_OUT] = g_portal.portals[0].ep_out_fd;
+        handoff.fds[HANDOFF_CTL_LISTEN] = g_portal.ctl_listen_fd;
+        handoff.fds[HANDOFF_SHARED] = g_portal.shared_fd;
+
+        // Same command line, with --worker in place of --supervise
+        char **worker_argv = (char **)calloc(argc + 1, sizeof(char *));
+        int n = 0;
+        for (int i = 0; i < argc; i++) {
+            if (strcmp(argv[i], "--supervise") != 0) worker_argv[n++] = argv[i];
         }
-        usleep(2000000);
-    }
+        worker_argv[n] = (char *)"--worker";
 
-    for (int retry = 0; retry < 15; retry++) {
-        g_portal.ep_out_fd = open("/dev/usb-ffs/portal0/ep2", O_RDWR | O_NONBLOCK);
-        if (g_portal.ep_out_fd >= 0) {
-            printf("ep2 opened: fd=%d\n", g_portal.ep_out_fd);
-            fflush(stdout);
-            break;
+        exit_code = supervisor_run(&handoff, state, worker_argv);
+        free(worker_argv);
+        g_portal.running = false;
+    } else {
+        // Before any other thread starts, so they all land on the helper cores
+        rt_enter(&g_rt);
+        int ret = pipeline_start(&g_mem);
+        if (ret < 0) LOGE("Cannot start logging/persistence threads: %s", strerror(-ret));
+        if (g_portal.ctl_listen_fd >= 0) {
+            ret = ctl_start(g_portal.ctl_listen_fd, ctl_uid);
+            if (ret < 0) LOGE("Cannot start control thread: %s", strerror(-ret));
+            else LOGI("Control clients: root and uid %d", (int)ctl_uid);
         }
-        usleep(2000000);
-    }
-
-    if (g_portal.ep_in_fd < 0 || g_portal.ep_out_fd < 0) {
-        fprintf(stderr, "FATAL: Failed to open data endpoints\n");
-        if (g_portal.ep_in_fd >= 0) close(g_portal.ep_in_fd);
-        close(g_portal.ep0_fd);
-        return 1;
+        if (g_portal.shared) led_init(g_portal.shared, worker);
+        if (g_portal.shared && (g_profile->flags & PORTAL_PROFILE_AUDIO)) {
+            audio_start(g_portal.shared, (g_profile->flags & PORTAL_PROFILE_AUDIO_ADPCM) ?
+                                         PORTAL_AUDIO_IMA_ADPCM : PORTAL_AUDIO_PCM16);
+        }
+        printf("Entering main loop...\n");
+        fflush(stdout);
     }
 
-    printf("ALL_READY\n");
-    fflush(stdout);
-
-    printf("Entering main loop...\n");
-    fflush(stdout);
-
     uint8_t buffer[256];
     fd_set rfds;
+    fd_set wfds;
     struct timeval tv;
     int idle_count = 0;
-    time_t last_report_time = time(NULL);  // ADD THIS
+    uint64_t next_stats_ms = now_ms() + STATS_INTERVAL_MS;
+    // Steady state is allocation-free; builds with PORTAL_MALLOC_AUDIT check
+    uint64_t loop_allocations = 0;
+    uint64_t stats_allocations = mem_thread_allocations();
+    uint64_t next_fd_check_ms = now_ms() + 1000;
+    for (int i = 0; i < g_portal.count; i++) {
+        g_portal.portals[i].next_sense_ms = now_ms() + g_profile->sense_interval_ms;
+    }
 
     while (g_portal.running) {
         FD_ZERO(&rfds);
-        FD_SET(g_portal.ep0_fd, &rfds);
-        FD_SET(g_portal.ep_out_fd, &rfds);
-
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-
-        int maxfd = (g_portal.ep0_fd > g_portal.ep_out_fd) ?
-                    g_portal.ep0_fd : g_portal.ep_out_fd;
-        int ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+        FD_ZERO(&wfds);
+        int maxfd = -1;
+
+        // Wake for the next periodic sense (of a portal its host has
+        // enabled) or LED frame, or after a second to tick the idle counter.
+        // A portal with reports queued waits for ep_in to be writable; as
+        // FunctionFS endpoints do not poll, select() says it always is, so
+        // after an EAGAIN it waits out EP_IN_RETRY_MS first.
+        uint64_t wait_ms = 1000;
+        uint64_t now = now_ms();
+        for (int i = 0; i < g_portal.count; i++) {
+            PortalInstance *p = &g_portal.portals[i];
+            FD_SET(p->ep0_fd, &rfds);
+            FD_SET(p->ep_out_fd, &rfds);
+            if (p->ep0_fd > maxfd) maxfd = p->ep0_fd;
+            if (p->ep_out_fd > maxfd) maxfd = p->ep_out_fd;
+            int in_wait = portal_in_wait_ms(&p->device);
+            if (in_wait == 0) {
+                FD_SET(p->ep_in_fd, &wfds);
+                if (p->ep_in_fd > maxfd) maxfd = p->ep_in_fd;
+            } else if (in_wait > 0 && (uint64_t)in_wait < wait_ms) {
+                wait_ms = in_wait;
+            }
+            if (!p->enabled) continue;
+            if (p->next_sense_ms <= now) wait_ms = 0;
+            else if (p->next_sense_ms - now < wait_ms) wait_ms = p->next_sense_ms - now;
+        }
+        int led_wait = led_tick(now);
+        if (led_wait >= 0 && (uint64_t)led_wait < wait_ms) wait_ms = led_wait;
+        bool idle_tick = (wait_ms == 1000);
+        tv.tv_sec = wait_ms / 1000;
+        tv.tv_usec = (wait_ms % 1000) * 1000;
+
+        int ctl_fd = ctl_request_fd();
+        if (ctl_fd >= 0) {
+            FD_SET(ctl_fd, &rfds);
+            if (ctl_fd > maxfd) maxfd = ctl_fd;
+        }
+        int done_fd = pipeline_done_fd();
+        if (done_fd >= 0) {
+            FD_SET(done_fd, &rfds);
+            if (done_fd > maxfd) maxfd = done_fd;
+        }
+        int ret = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
 
         if (ret < 0) {
             if (errno == EINTR) continue;
-            fprintf(stderr, "select error: %d (%s)\n", errno, strerror(errno));
+            LOGE("select error: %d (%s)", errno, strerror(errno));
+            exit_code = 1;
             break;
         }
 
         // CRITICAL: Send periodic sense reports to keep Windows happy
-        time_t now = time(NULL);
-        if (now - last_report_time >= 5) {  // Every 5 seconds
-            printf("Sending periodic sense report...\n");
-            fflush(stdout);
-
-            uint8_t sense[32];
-            memset(sense, 0, sizeof(sense));
-            sense[0] = 0x53;
-
-            uint32_t mask = 0;
-            for (int i = 0; i < MAX_SLOTS; i++) {
-                if (g_portal.slots[i].present) mask |= (1 << i);
+        now = now_ms();
+        if (g_portal.worker_state) {
+            g_portal.worker_state->heartbeat_ms.store(now, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < g_portal.count; i++) {
+            PortalInstance *p = &g_portal.portals[i];
+            // The periodic sense keeps Windows hosts from dropping the portal
+            if (p->enabled && now >= p->next_sense_ms) {  // Profile's sense interval
+                LOGI("Sending periodic sense report...");
+                portal_send_sense(&p->device);
+                p->next_sense_ms = now + g_profile->sense_interval_ms;
             }
-            sense[1] = mask & 0xFF;
-            sense[2] = (mask >> 8) & 0xFF;
-            sense[3] = (mask >> 16) & 0xFF;
-            sense[4] = (mask >> 24) & 0xFF;
-            sense[5] = 0x00;
-            sense[6] = 0x01;
-
-            int write_ret = write(g_portal.ep_in_fd, sense, 32);
-            if (write_ret < 0) {
-                fprintf(stderr, "Failed to send periodic report: %d (%s)\n",
-                        errno, strerror(errno));
-            } else {
-                printf("Periodic sense sent: %d bytes\n", write_ret);
+        }
+
+        if (now >= next_stats_ms) {
+            uint64_t allocations = mem_thread_allocations();
+            if (allocations != stats_allocations) {
+                LOGE("%llu heap allocations on the I/O thread in the last %d s",
+                     (unsigned long long)(allocations - stats_allocations),
+                     STATS_INTERVAL_MS / 1000);
+                loop_allocations += allocations - stats_allocations;
+                stats_allocations = allocations;
             }
+            bool staged = false;
+            for (int i = 0; i < g_portal.count; i++) staged |= portal_log_stats(&g_portal.portals[i]);
+            if (staged) mem_pool_report(&g_reports);
+            ctl_report();
+            pipeline_report();
+            next_stats_ms = now + STATS_INTERVAL_MS;
+        }
 
-            last_report_time = now;
+        // Once a second is plenty to notice an endpoint going away
+        if (now >= next_fd_check_ms) {
+            for (int i = 0; i < g_portal.count && exit_code == 0; i++) {
+                if (!portal_fds_ok(&g_portal.portals[i])) exit_code = 1;
+            }
+            if (exit_code) break;
+            next_fd_check_ms = now + 1000;
         }
 
         if (ret == 0) {
+            if (!idle_tick) continue;
             idle_count++;
             if (idle_count % 10 == 0) {
-                printf("Still alive (idle for %d seconds)...\n", idle_count);
-                fflush(stdout);
+                LOGI("Still alive (idle for %d seconds)...", idle_count);
             }
             continue;
         }
 
         idle_count = 0;
 
-        // Handle ep0 events
-        if (FD_ISSET(g_portal.ep0_fd, &rfds)) {
-            struct usb_functionfs_event event;
-            int n = read(g_portal.ep0_fd, &event, sizeof(event));
-
-            if (n == sizeof(event)) {
-                printf("ep0 event: type=%d\n", event.type);
-                fflush(stdout);
-
-                switch (event.type) {
-                    case FUNCTIONFS_SETUP:
-                        printf("SETUP request\n");
-                        fflush(stdout);
-                        handle_setup_request(&event.u.setup);
-                        break;
-                    case FUNCTIONFS_ENABLE: {
-                        printf("Device ENABLED by host - sending initial sense\n");
-                        fflush(stdout);
-
-                        // Send initial sense
-                        uint8_t sense[32];
-                        memset(sense, 0, sizeof(sense));
-                        sense[0] = 0x53;
-
-                        uint32_t mask = 0;
-                        for (int i = 0; i < MAX_SLOTS; i++) {
-                            if (g_portal.slots[i].present) mask |= (1 << i);
-                        }
-                        sense[1] = mask & 0xFF;
-                        sense[2] = (mask >> 8) & 0xFF;
-                        sense[3] = (mask >> 16) & 0xFF;
-                        sense[4] = (mask >> 24) & 0xFF;
-                        sense[5] = 0x00;
-                        sense[6] = 0x01;
-
-                        write(g_portal.ep_in_fd, sense, 32);
-                        break;
-                    }
-                    case FUNCTIONFS_DISABLE:
-                        printf("Device DISABLED by host\n");
-                        fflush(stdout);
-                        break;
-                    case FUNCTIONFS_UNBIND:
-                        printf("Device UNBOUND - exiting\n");
-                        fflush(stdout);
-                        g_portal.running = false;
-                        break;
-                    default:
-                        printf("Unknown event: %d\n", event.type);
-                        fflush(stdout);
-                        break;
-                }
-            } else if (n < 0) {
-                if (errno != EAGAIN && errno != EINTR) {
-                    fprintf(stderr, "ep0 read error: %d (%s)\n", errno, strerror(errno));
-                    break;
-                }
-            }
+        // At most one ep0 event and one OUT packet per portal per pass, and
+        // a different portal goes first each time: a host flooding its
+        // portal holds every other portal up by one packet at most. Queued
+        // reports go first, so they stay ahead of the replies to new commands.
+        int first = g_portal.turn;
+        g_portal.turn = (first + 1) % g_portal.count;
+        for (int k = 0; k < g_portal.count && exit_code == 0; k++) {
+            PortalInstance *p = &g_portal.portals[(first + k) % g_portal.count];
+            if (FD_ISSET(p->ep_in_fd, &wfds)) portal_flush_in(&p->device);
+            if (FD_ISSET(p->ep0_fd, &rfds) && !portal_ep0_event(p)) exit_code = 1;
+            if (FD_ISSET(p->ep_out_fd, &rfds)) portal_out_report(p, buffer, sizeof(buffer));
         }
+        if (exit_code) break;
 
-        // Handle OUT endpoint
-        if (FD_ISSET(g_portal.ep_out_fd, &rfds)) {
-            int n = read(g_portal.ep_out_fd, buffer, sizeof(buffer));
-            if (n > 0) {
-                printf("Received %d bytes from host\n", n);
-                fflush(stdout);
-                handle_portal_command(buffer, n);
-            } else if (n < 0) {
-                if (errno == ESHUTDOWN || errno == ECONNRESET || errno == ENOTCONN) {
-                    fprintf(stderr, "Transport shutdown - host disconnected\n");
-                    // Don't exit - wait for reconnect
-                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    fprintf(stderr, "ep_out read error: %d (%s)\n", errno, strerror(errno));
-                }
-            }
+        // Requests the control thread received
+        if (ctl_fd >= 0 && FD_ISSET(ctl_fd, &rfds)) {
+            ctl_drain();
         }
 
-        struct stat st;
-        if (fstat(g_portal.ep0_fd, &st) < 0) {
-            fprintf(stderr, "FATAL: ep0_fd invalid: %s\n", strerror(errno));
-            break;
-        }
-        if (fstat(g_portal.ep_in_fd, &st) < 0) {
-            fprintf(stderr, "FATAL: ep_in_fd invalid: %s\n", strerror(errno));
-            break;
-        }
-        if (fstat(g_portal.ep_out_fd, &st) < 0) {
-            fprintf(stderr, "FATAL: ep_out_fd invalid: %s\n", strerror(errno));
-            break;
+        // Dump writes the persistence thread finished
+        if (done_fd >= 0 && FD_ISSET(done_fd, &rfds) && pipeline_reap()) {
+            for (int i = 0; i < g_portal.count; i++) {
+                for (int j = 0; j < MAX_SLOTS; j++) writes_settled(&g_portal.portals[i], j);
+            }
         }
     }
 
+    loop_allocations += mem_thread_allocations() - stats_allocations;
+
     // Cleanup
     printf("Shutting down...\n");
     fflush(stdout);
-    if (g_portal.ep_in_fd >= 0) close(g_portal.ep_in_fd);
-    if (g_portal.ep_out_fd >= 0) close(g_portal.ep_out_fd);
-    if (g_portal.ep0_fd >= 0) close(g_portal.ep0_fd);
+    for (int i = 0; i < g_portal.count; i++) portal_close(&g_portal.portals[i]);
+    ctl_stop();
+    if (g_portal.ctl_listen_fd >= 0) close(g_portal.ctl_listen_fd);
+    if (g_portal.supervisor_fd >= 0) close(g_portal.supervisor_fd);
+    pipeline_drain();
+    for (int i = 0; i < g_portal.count; i++) {
+        PortalInstance *p = &g_portal.portals[i];
+        for (int j = 0; j < MAX_SLOTS; j++) {
+            if (p->slots[j].data && !p->waiters[j].unload) slot_log_access(j, &p->slots[j], true);
+            slot_detach(&p->slots[j]);
+        }
+    }
+    audio_stop();
+    for (int i = 0; i < g_portal.count; i++) {
+        log_latency_stats(&g_portal.portals[i]);
+        log_prestage_stats(&g_portal.portals[i]);
+        log_in_stats(&g_portal.portals[i]);
+    }
+    if (mem_audit_enabled()) {
+        LOGI("Heap allocations in the main loop: %llu", (unsigned long long)loop_allocations);
+    }
+    arena_report(&g_mem);
+    pipeline_stop();
+    if (g_portal.shared) munmap(g_portal.shared, sizeof(PortalShared));
+    if (g_portal.shared_fd >= 0) close(g_portal.shared_fd);
+
+    // Workers leave the gadget to the supervisor
+    for (int i = 0; g_manage_gadget && !worker && i < g_portal.count; i++) {
+        gadget_down(&g_portal.portals[i].gadget, false);
+    }
+    mem_region_free(&g_mem);
 
     fprintf(stderr, "=== Daemon Exiting: running=%d ===\n", g_portal.running);
-    fclose(log_file);
-    return 0;
+    if (log_file) fclose(log_file);
+    return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#ifndef PORTAL_DESCRIPTORS_H
+#define PORTAL_DESCRIPTORS_H
+
+// FunctionFS descriptor sets for each portal variant, generated at compile time.
+
+#include "usb_descriptors.h"
+
+enum PortalVariant : uint8_t {
+    PORTAL_VARIANT_WII = 0,
+    PORTAL_VARIANT_PS = 1,
+    PORTAL_VARIANT_TRAPTANIUM = 2,
+    PORTAL_VARIANT_XBOX360 = 3,
+    PORTAL_VARIANT_COUNT
+};
+
+namespace portal_desc {
+
+constexpr uint8_t hid_report_descriptor[] = {
+        0x06, 0x00, 0xFF,
+        0x09, 0x01,
+        0xA1, 0x01,
+        0x19, 0x01,
+        0x29, 0x40,
+        0x15, 0x00,
+        0x26, 0xFF, 0x00,
+        0x75, 0x08,
+        0x95, 0x20,
+        0x81, 0x00,
+        0x19, 0x01,
+        0x29, 0xFF,
+        0x91, 0x00,
+        0xC0
+};
+static_assert(sizeof(hid_report_descriptor) == 29, "HID report descriptor changed size");
+
+constexpr uint8_t EP_IN = 0x81;
+constexpr uint8_t EP_OUT = 0x02;
+constexpr uint8_t EP_INTERRUPT = 0x03;
+constexpr uint16_t EP_MAX_PACKET = 64;
+
+// HID portals (Wii, PS3/PS4, Traptanium): HID interface with interrupt IN/OUT
+constexpr auto hid_set(uint8_t interval) {
+    return usbdesc::interface(0, 2, 0x03) +
+           usbdesc::hid(sizeof(hid_report_descriptor)) +
+           usbdesc::endpoint(EP_IN, EP_INTERRUPT, EP_MAX_PACKET, interval) +
+           usbdesc::endpoint(EP_OUT, EP_INTERRUPT, EP_MAX_PACKET, interval);
+}
+
+// Xbox 360 portal: XUSB-style vendor interface (0xFF/0x5D/0x01), same endpoints,
+// no HID class descriptor
+constexpr auto vendor_set(uint8_t interval) {
+    return usbdesc::interface(0, 2, 0xFF, 0x5D, 0x01) +
+           usbdesc::endpoint(EP_IN, EP_INTERRUPT, EP_MAX_PACKET, interval) +
+           usbdesc::endpoint(EP_OUT, EP_INTERRUPT, EP_MAX_PACKET, interval);
+}
+
+constexpr auto hid_fs = hid_set(1);
+constexpr auto hid_hs = hid_set(1);
+constexpr auto vendor_fs = vendor_set(1);
+constexpr auto vendor_hs = vendor_set(1);
+
+static_assert(decltype(hid_fs)::count == 4 && decltype(hid_fs)::size == 9 + 9 + 7 + 7, "HID set layout");
+static_assert(decltype(vendor_fs)::count == 3 && decltype(vendor_fs)::size == 9 + 7 + 7, "vendor set layout");
+static_assert(usbdesc::well_formed(hid_fs) && usbdesc::well_formed(vendor_fs), "descriptor chain");
+
+constexpr auto hid_descriptors = usbdesc::ffs_descriptors(hid_fs, hid_hs);
+constexpr auto xbox360_descriptors = usbdesc::ffs_descriptors(vendor_fs, vendor_hs);
+
+static_assert(decltype(hid_descriptors)::size == 12 + 8 + 2 * 32, "HID blob size");
+static_assert(decltype(xbox360_descriptors)::size == 12 + 8 + 2 * 23, "Xbox 360 blob size");
+
+constexpr auto strings = usbdesc::ffs_strings(0x0409, "Activision", "Spyro Porta", "99B3f9C9E6");
+static_assert(decltype(strings)::size == 18 + 11 + 12 + 11, "string blob size");
+
+} // namespace portal_desc
+
+struct PortalDescriptorBlob {
+    const uint8_t *descriptors;
+    size_t descriptors_len;
+    const uint8_t *strings;
+    size_t strings_len;
+    const uint8_t *hid_report;   // NULL for the non-HID Xbox 360 portal
+    size_t hid_report_len;
+};
+
+// Wii, PS and Traptanium portals enumerate identically; only the Xbox 360 portal differs
+inline PortalDescriptorBlob portal_descriptors(PortalVariant variant) {
+    using namespace portal_desc;
+    if (variant == PORTAL_VARIANT_XBOX360) {
+        return { xbox360_descriptors.data(), xbox360_descriptors.size,
+                 strings.data(), strings.size, NULL, 0 };
+    }
+    return { hid_descriptors.data(), hid_descriptors.size,
+             strings.data(), strings.size,
+             hid_report_descriptor, sizeof(hid_report_descriptor) };
+}
+
+#endif // PORTAL_DESCRIPTORS_H
@@ -1,31 +1,94 @@
 // portal_emulator.cpp - Simplified to just slot management
 #include <jni.h>
 #include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include <android/log.h>
+#include <atomic>
+#include "portal_ipc.h"
+#include "portal_shm.h"
+#include "figure_editor.h"
+#include "figure_index.h"
+#include "skylander_crypto.h"
 
 #define LOG_TAG "PortalEmulator"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 #define MAX_SLOTS 2
-#define PORTAL_BUFFER_SIZE 1024
 
+// The app only keeps the open dump; the daemon maps it when the slot loads
 struct PortalSlot {
-    uint8_t data[PORTAL_BUFFER_SIZE];
-    size_t size;
-    bool present;
+    int fd;
     bool loaded;
 };
 
-static PortalSlot g_slots[MAX_SLOTS];
+static PortalSlot g_slots[MAX_SLOTS] = { { -1, false }, { -1, false } };
+static int g_ctl_fd = -1;
+static PortalShared *g_shared = nullptr;
+static uint32_t g_led_front = 2;    // triple-buffer frame the app owns
+// Dump files of the selected directory; ref is the position in the list
+static FigureIndex g_catalog;
+static std::vector<int32_t> g_catalog_entry;   // entry number by position, -1 if none
+
+// Send one request to the daemon, reconnecting once if it restarted.
+// Only a request that never went out is retried: once sent, the daemon may
+// have run it (an edit applied twice is not the same edit), so a lost reply
+// fails with -ECONNRESET. A descriptor in the reply is returned through
+// reply_fd, or closed if NULL.
+static int ctl_request(uint32_t op, int slot, int fd, int *reply_fd,
+                       const void *payload = nullptr, size_t payload_len = 0) {
+    PortalIpcMsg req;
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.slot = slot;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (g_ctl_fd < 0) {
+            g_ctl_fd = portal_ipc_connect();
+            if (g_ctl_fd < 0) {
+                if (errno == ECONNREFUSED && attempt == 0) continue;
+                return -errno;
+            }
+        }
+
+        ssize_t sent = portal_ipc_send_payload(g_ctl_fd, &req, payload, payload_len, fd);
+        if (sent < 0) {
+            // Stale connection from before a daemon restart: nothing was delivered
+            close(g_ctl_fd);
+            g_ctl_fd = -1;
+            continue;
+        }
+
+        PortalIpcMsg reply;
+        int passed = -1;
+        if (sent == (ssize_t)(sizeof(req) + payload_len) &&
+            portal_ipc_recv(g_ctl_fd, &reply, &passed) == sizeof(reply)) {
+            if (reply_fd) *reply_fd = passed;
+            else if (passed >= 0) close(passed);
+            return reply.status;
+        }
+        close(g_ctl_fd);
+        g_ctl_fd = -1;
+        return -ECONNRESET;
+    }
+    return -ECONNRESET;
+}
 
 // Keep only these functions - no threading, no emulator
 extern "C" JNIEXPORT jint JNICALL
 Java_com_kaos_portalemulator_MainActivity_nativeInit(JNIEnv*, jobject) {
     LOGI("Native init called");
-    memset(g_slots, 0, sizeof(g_slots));
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (g_slots[i].fd >= 0) close(g_slots[i].fd);
+        g_slots[i].fd = -1;
+        g_slots[i].loaded = false;
+    }
     return 0;
 }
 
@@ -36,19 +99,17 @@ Java_com_kaos_portalemulator_MainActivity_nativeSetSlotFile(
     if (slot < 0 || slot >= MAX_SLOTS) return -1;
 
     const char* path_str = env->GetStringUTFChars(path, nullptr);
-    LOGI("Loading file into slot %d: %s", slot, path_str);
+    LOGI("Opening file for slot %d: %s", slot, path_str);
 
-    int fd = open(path_str, O_RDONLY);
+    // Read-write so the daemon can flush figure writes back into the dump
+    int fd = open(path_str, O_RDWR | O_CLOEXEC);
+    if (fd < 0) fd = open(path_str, O_RDONLY | O_CLOEXEC);
     env->ReleaseStringUTFChars(path, path_str);
 
     if (fd < 0) return -1;
 
-    ssize_t bytes_read = read(fd, g_slots[slot].data, PORTAL_BUFFER_SIZE);
-    close(fd);
-
-    if (bytes_read < 0) return -1;
-
-    g_slots[slot].size = bytes_read;
+    if (g_slots[slot].fd >= 0) close(g_slots[slot].fd);
+    g_slots[slot].fd = fd;
     return 0;
 }
 
@@ -56,8 +117,17 @@ extern "C" JNIEXPORT jint JNICALL
 Java_com_kaos_portalemulator_MainActivity_nativeLoadSlot(
         JNIEnv*, jobject, jint slot) {
     if (slot < 0 || slot >= MAX_SLOTS) return -1;
-    g_slots[slot].present = true;
+    if (g_slots[slot].fd < 0) return -1;
     g_slots[slot].loaded = true;
+
+    // The daemon may not be running yet; nativeSyncSlots() hands it over later
+    int ret = ctl_request(PORTAL_IPC_LOAD_SLOT, slot, g_slots[slot].fd, nullptr);
+    if (ret == -EEXIST) {
+        // The same figure is already in the other slot
+        g_slots[slot].loaded = false;
+        return ret;
+    }
+    if (ret < 0) LOGI("Slot %d not sent to daemon yet: %s", slot, strerror(-ret));
     return 0;
 }
 
@@ -65,10 +135,208 @@ extern "C" JNIEXPORT jint JNICALL
 Java_com_kaos_portalemulator_MainActivity_nativeUnloadSlot(
         JNIEnv*, jobject, jint slot) {
     if (slot < 0 || slot >= MAX_SLOTS) return -1;
-    g_slots[slot].present = false;
     g_slots[slot].loaded = false;
+    ctl_request(PORTAL_IPC_UNLOAD_SLOT, slot, -1, nullptr);
     return 0;
 }
 
-// Remove all the nativeStartEmulator, nativeAreEndpointsReady, etc.
-// The daemon will handle that
\ No newline at end of file
+// Pass every loaded slot to a daemon that has just come up
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeSyncSlots(JNIEnv*, jobject) {
+    int failures = 0;
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (!g_slots[i].loaded || g_slots[i].fd < 0) continue;
+        int ret = ctl_request(PORTAL_IPC_LOAD_SLOT, i, g_slots[i].fd, nullptr);
+        if (ret < 0) {
+            LOGE("Failed to hand slot %d to daemon: %s", i, strerror(-ret));
+            failures++;
+        }
+    }
+    return failures ? -1 : 0;
+}
+
+// Ask the daemon to exit; one started with --manage-gadget removes the
+// gadget on the way out
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeShutdownDaemon(JNIEnv*, jobject) {
+    int ret = ctl_request(PORTAL_IPC_SHUTDOWN, 0, -1, nullptr);
+    if (g_ctl_fd >= 0) {
+        close(g_ctl_fd);
+        g_ctl_fd = -1;
+    }
+    return ret;
+}
+
+// Map the daemon's shared state (speaker audio) once it is running
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeAttachShared(JNIEnv*, jobject) {
+    if (g_shared) return 0;
+
+    int fd = -1;
+    int ret = ctl_request(PORTAL_IPC_MAP_SHARED, 0, -1, &fd);
+    if (ret < 0 || fd < 0) {
+        if (fd >= 0) close(fd);
+        LOGE("Daemon shared state unavailable: %s", strerror(ret < 0 ? -ret : EBADF));
+        return -1;
+    }
+
+    void *map = mmap(nullptr, sizeof(PortalShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    PortalShared *shared = (PortalShared *)map;
+    if (shared->magic != PORTAL_SHM_MAGIC || shared->version != PORTAL_SHM_VERSION) {
+        munmap(map, sizeof(PortalShared));
+        return -1;
+    }
+    g_shared = shared;
+    g_led_front = 2;
+    return 0;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeDetachShared(JNIEnv*, jobject) {
+    if (!g_shared) return;
+    munmap(g_shared, sizeof(PortalShared));
+    g_shared = nullptr;
+}
+
+// Drain decoded speaker samples; returns how many were copied
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeReadAudio(
+        JNIEnv* env, jobject, jshortArray out) {
+    if (!g_shared) return -1;
+
+    PortalAudioRing *ring = &g_shared->audio;
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t head = ring->head.load(std::memory_order_acquire);
+    uint32_t avail = head - tail;
+    if (avail > PORTAL_AUDIO_RING_SAMPLES) {
+        // Daemon restarted underneath us; resynchronise
+        ring->tail.store(head, std::memory_order_release);
+        return 0;
+    }
+
+    jsize cap = env->GetArrayLength(out);
+    uint32_t count = avail < (uint32_t)cap ? avail : (uint32_t)cap;
+    uint32_t at = tail & (PORTAL_AUDIO_RING_SAMPLES - 1);
+    uint32_t first = PORTAL_AUDIO_RING_SAMPLES - at;
+    if (first > count) first = count;
+
+    env->SetShortArrayRegion(out, 0, first, &ring->samples[at]);
+    env->SetShortArrayRegion(out, first, count - first, &ring->samples[0]);
+    ring->tail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+// Latest LED colours as 0xRRGGBB (right, trap, left). Returns the frame
+// sequence number, or 0 if nothing changed since the last call.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeReadLeds(
+        JNIEnv* env, jobject, jintArray out) {
+    if (!g_shared) return -1;
+
+    // Only swap for a frame index that is one; the daemon starts a broken
+    // buffer over on its next publish
+    PortalLedBuffer *leds = &g_shared->leds;
+    uint32_t latest = leds->latest.load(std::memory_order_relaxed);
+    uint32_t index;
+    do {
+        if (!(latest & PORTAL_LED_FRESH)) return 0;
+        index = portal_led_index(latest);
+        if (index >= PORTAL_LED_FRAMES || index == g_led_front) return 0;
+    } while (!leds->latest.compare_exchange_weak(latest, g_led_front, std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed));
+    g_led_front = index;
+
+    const PortalLedFrame *frame = &leds->frames[g_led_front];
+    jint colors[PORTAL_LED_SIDES];
+    for (int i = 0; i < PORTAL_LED_SIDES; i++) {
+        colors[i] = (frame->rgb[i][0] << 16) | (frame->rgb[i][1] << 8) | frame->rgb[i][2];
+    }
+    jsize count = env->GetArrayLength(out);
+    env->SetIntArrayRegion(out, 0, count < PORTAL_LED_SIDES ? count : PORTAL_LED_SIDES, colors);
+    return (jint)frame->seq;
+}
+
+// Edit stats of the figure in a slot; only fields set in mask are changed.
+// Returns 0 or -errno from the daemon.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeEditFigure(
+        JNIEnv* env, jobject, jint slot, jint mask, jint xp, jint gold, jint hat,
+        jint upgrades, jint playtime, jstring nickname) {
+    if (slot < 0 || slot >= MAX_SLOTS) return -EINVAL;
+
+    FigureEdit edit;
+    memset(&edit, 0, sizeof(edit));
+    edit.fields = (uint32_t)mask;
+    edit.xp = (uint32_t)xp;
+    edit.gold = (uint16_t)gold;
+    edit.hat = (uint8_t)hat;
+    edit.upgrades = (uint16_t)upgrades;
+    edit.playtime = (uint32_t)playtime;
+
+    if ((edit.fields & FIGURE_EDIT_NICKNAME) && nickname) {
+        jsize n = env->GetStringLength(nickname);
+        if (n > FIGURE_NICKNAME_CHARS) n = FIGURE_NICKNAME_CHARS;
+        env->GetStringRegion(nickname, 0, n, (jchar *)edit.nickname);
+    }
+
+    int ret = ctl_request(PORTAL_IPC_EDIT_FIGURE, slot, -1, nullptr, &edit, sizeof(edit));
+    if (ret < 0) LOGE("Edit of slot %d failed: %s", slot, strerror(-ret));
+    return ret;
+}
+
+// Index the headers of the dump files at paths (in list order) for
+// nativeCatalogLabel(). Returns how many of them share a UID with another.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeIndexCatalog(
+        JNIEnv* env, jobject, jobjectArray paths) {
+    jsize count = env->GetArrayLength(paths);
+    figure_index_free(&g_catalog);
+    g_catalog_entry.assign(count, -1);
+    if (figure_index_init(&g_catalog, (uint32_t)count) < 0) return -ENOMEM;
+
+    for (jsize i = 0; i < count; i++) {
+        jstring path = (jstring)env->GetObjectArrayElement(paths, i);
+        const char *path_str = env->GetStringUTFChars(path, nullptr);
+        int fd = open(path_str, O_RDONLY | O_CLOEXEC);
+        env->ReleaseStringUTFChars(path, path_str);
+        env->DeleteLocalRef(path);
+        if (fd < 0) continue;
+
+        uint8_t header[SKYLANDER_HEADER_SIZE];
+        ssize_t n = pread(fd, header, sizeof(header), 0);
+        close(fd);
+        FigureIndexEntry entry;
+        if (n > 0 && figure_index_entry_from_header(header, (size_t)n, i, &entry)) {
+            // Nothing was removed, so entries are numbered in insertion order
+            g_catalog_entry[i] = (int32_t)g_catalog.count;
+            figure_index_add(&g_catalog, &entry);
+        }
+    }
+
+    jint duplicates = 0;
+    for (uint32_t i = 0; i < g_catalog.count; i++) {
+        if (figure_index_find_uid(&g_catalog, g_catalog.entries[i].uid, nullptr, 0) > 1) {
+            duplicates++;
+        }
+    }
+    return duplicates;
+}
+
+// Header summary of the catalog file at position, or null if it was not
+// readable as a figure
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_kaos_portalemulator_MainActivity_nativeCatalogLabel(
+        JNIEnv* env, jobject, jint position) {
+    if (position < 0 || (size_t)position >= g_catalog_entry.size()) return nullptr;
+    if (g_catalog_entry[position] < 0) return nullptr;
+    const FigureIndexEntry *entry = &g_catalog.entries[g_catalog_entry[position]];
+
+    size_t copies = figure_index_find_uid(&g_catalog, entry->uid, nullptr, 0);
+    char label[96];
+    snprintf(label, sizeof(label), "UID %08X, id %u/0x%04X%s", entry->uid,
+             entry->character_id, entry->variant, copies > 1 ? ", duplicate UID" : "");
+    return env->NewStringUTF(label);
+}
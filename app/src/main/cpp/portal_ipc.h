@@ -0,0 +1,130 @@
+#ifndef PORTAL_IPC_H
+#define PORTAL_IPC_H
+
+// Control channel between the app (portal_emulator.so) and portal_daemon.
+//
+// The app opens figure dumps itself and hands the open fd to the daemon with
+// SCM_RIGHTS, so the daemon never resolves a path while running as root.
+// SOCK_SEQPACKET keeps one request per message.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Abstract namespace socket: no filesystem node to create or chmod
+#define PORTAL_IPC_SOCKET_NAME "kaos_portal_ctl"
+
+enum PortalIpcOp : uint32_t {
+    PORTAL_IPC_LOAD_SLOT = 1,   // carries the dump fd
+    PORTAL_IPC_UNLOAD_SLOT = 2, // flush written blocks back, then drop the figure
+    PORTAL_IPC_FLUSH_SLOT = 3,  // flush written blocks back, keep the figure
+    PORTAL_IPC_MAP_SHARED = 4,  // reply carries the PortalShared memfd
+    PORTAL_IPC_EDIT_FIGURE = 5, // payload is a FigureEdit for the slot
+    PORTAL_IPC_SHUTDOWN = 6,    // stop the daemon (and remove a gadget it manages)
+};
+
+// Largest payload that may follow the header in one message
+#define PORTAL_IPC_MAX_PAYLOAD 128
+
+struct PortalIpcMsg {
+    uint32_t op;
+    int32_t slot;
+    int32_t status;     // reply: 0 or -errno
+    uint32_t portal;    // which of the daemon's portals the slot is on (--portals)
+};
+
+static inline socklen_t portal_ipc_addr(struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // sun_path[0] stays '\0' for the abstract namespace
+    memcpy(addr->sun_path + 1, PORTAL_IPC_SOCKET_NAME, sizeof(PORTAL_IPC_SOCKET_NAME) - 1);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + sizeof(PORTAL_IPC_SOCKET_NAME) - 1;
+}
+
+static inline int portal_ipc_connect(void) {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_un addr;
+    socklen_t len = portal_ipc_addr(&addr);
+    if (connect(sock, (struct sockaddr *)&addr, len) < 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+// Send one message with an optional payload, optionally passing fd (-1 for none)
+static inline ssize_t portal_ipc_send_payload(int sock, const PortalIpcMsg *msg,
+                                              const void *payload, size_t len, int fd) {
+    struct iovec iov[2] = { { (void *)msg, sizeof(*msg) }, { (void *)payload, len } };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (payload && len) ? 2 : 1;
+
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &mh, MSG_NOSIGNAL);
+}
+
+static inline ssize_t portal_ipc_send(int sock, const PortalIpcMsg *msg, int fd) {
+    return portal_ipc_send_payload(sock, msg, NULL, 0, fd);
+}
+
+// Receive one message; *fd_out is -1 unless the peer passed a descriptor.
+// Up to *len payload bytes land in payload and *len is set to the count.
+// A short or truncated message fails with EBADMSG, and so does one whose
+// control data was cut (MSG_CTRUNC): the kernel dropped a passed descriptor.
+static inline ssize_t portal_ipc_recv_payload(int sock, PortalIpcMsg *msg,
+                                              void *payload, size_t *len, int *fd_out) {
+    struct iovec iov[2] = { { msg, sizeof(*msg) }, { payload, payload ? *len : 0 } };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = payload ? 2 : 1;
+
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    *fd_out = -1;
+    if (len) *len = 0;
+    ssize_t n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    if (n <= 0) return n;
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            memcpy(fd_out, CMSG_DATA(cm), sizeof(int));
+        }
+    }
+    if ((size_t)n < sizeof(*msg) || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (*fd_out >= 0) close(*fd_out);
+        *fd_out = -1;
+        errno = EBADMSG;
+        return -1;
+    }
+    if (len) *len = (size_t)n - sizeof(*msg);
+    return n;
+}
+
+static inline ssize_t portal_ipc_recv(int sock, PortalIpcMsg *msg, int *fd_out) {
+    return portal_ipc_recv_payload(sock, msg, NULL, NULL, fd_out);
+}
+
+#endif // PORTAL_IPC_H
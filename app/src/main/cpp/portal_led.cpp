@@ -0,0 +1,143 @@
+// portal_led.cpp - LED colour/fade state and publishing
+#include "portal_led.h"
+#include "daemon_log.h"
+
+#include <string.h>
+
+struct LedChannel {
+    uint8_t from[3];
+    uint8_t to[3];
+    uint8_t now[3];
+    uint64_t start_ms;
+    uint16_t duration_ms;   // 0 = steady at `to`
+};
+
+static LedChannel g_leds[PORTAL_LED_SIDES];
+static PortalShared *g_shm;
+static uint32_t g_back;         // frame index only the daemon writes
+static uint32_t g_seq;
+static uint64_t g_last_publish_ms;
+static bool g_dirty;
+
+// Frame 0 starts as "latest", the app owns none until its first swap,
+// and the daemon writes frame 1
+static void led_buffer_reset(void) {
+    memset(g_shm->leds.frames, 0, sizeof(g_shm->leds.frames));
+    g_shm->leds.latest.store(0, std::memory_order_release);
+    g_back = 1;
+    g_shm->leds.back = g_back;
+}
+
+void led_init(PortalShared *shm, bool resume) {
+    memset(g_leds, 0, sizeof(g_leds));
+    g_shm = shm;
+    g_seq = 0;
+    g_dirty = false;
+    g_last_publish_ms = 0;
+    if (!g_shm) return;
+
+    if (resume) {
+        uint32_t latest = portal_led_index(g_shm->leds.latest.load());
+        uint32_t back = portal_led_index(g_shm->leds.back);
+        if (latest < PORTAL_LED_FRAMES && back < PORTAL_LED_FRAMES && latest != back) {
+            // Carry on from the colours last published
+            const PortalLedFrame *last = &g_shm->leds.frames[latest];
+            for (int i = 0; i < PORTAL_LED_SIDES; i++) {
+                memcpy(g_leds[i].now, last->rgb[i], 3);
+                memcpy(g_leds[i].to, last->rgb[i], 3);
+            }
+            g_seq = last->seq;
+            g_back = back;
+            return;
+        }
+        LOGE("LED buffer indices %u/%u are not frames, starting it over",
+             g_shm->leds.latest.load(), g_shm->leds.back);
+    }
+    led_buffer_reset();
+}
+
+static bool channel_step(LedChannel *c, uint64_t now_ms);
+
+static void channel_start(LedChannel *c, uint8_t r, uint8_t g, uint8_t b,
+                          uint16_t duration_ms, uint64_t now_ms) {
+    // A new fade starts from wherever the current one has got to
+    channel_step(c, now_ms);
+    memcpy(c->from, c->now, 3);
+    c->to[0] = r;
+    c->to[1] = g;
+    c->to[2] = b;
+    c->start_ms = now_ms;
+    c->duration_ms = duration_ms;
+    if (!duration_ms) memcpy(c->now, c->to, 3);
+    g_dirty = true;
+}
+
+void led_set_all(uint8_t r, uint8_t g, uint8_t b, uint64_t now_ms) {
+    channel_start(&g_leds[PORTAL_LED_RIGHT], r, g, b, 0, now_ms);
+    channel_start(&g_leds[PORTAL_LED_LEFT], r, g, b, 0, now_ms);
+}
+
+bool led_set_side(uint8_t side, uint8_t r, uint8_t g, uint8_t b,
+                  uint16_t duration_ms, uint64_t now_ms) {
+    if (side >= PORTAL_LED_SIDES) return false;
+    channel_start(&g_leds[side], r, g, b, duration_ms, now_ms);
+    return true;
+}
+
+// Returns true while the fade is still running
+static bool channel_step(LedChannel *c, uint64_t now_ms) {
+    if (!c->duration_ms) return false;
+
+    uint64_t elapsed = now_ms - c->start_ms;
+    if (elapsed >= c->duration_ms) {
+        memcpy(c->now, c->to, 3);
+        c->duration_ms = 0;
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        int delta = (int)c->to[i] - (int)c->from[i];
+        c->now[i] = (uint8_t)(c->from[i] + delta * (int)elapsed / (int)c->duration_ms);
+    }
+    return true;
+}
+
+// Returns false if the buffer had to be started over and the frame is lost
+static bool publish(uint32_t fading) {
+    PortalLedFrame *frame = &g_shm->leds.frames[g_back];
+    frame->seq = ++g_seq;
+    frame->fading = fading;
+    for (int i = 0; i < PORTAL_LED_SIDES; i++) memcpy(frame->rgb[i], g_leds[i].now, 3);
+
+    uint32_t prev = g_shm->leds.latest.exchange(g_back | PORTAL_LED_FRESH,
+                                                std::memory_order_acq_rel);
+    uint32_t index = portal_led_index(prev);
+    if (index >= PORTAL_LED_FRAMES || index == g_back) {
+        LOGE("LED buffer swapped in %u, starting it over", prev);
+        led_buffer_reset();
+        return false;
+    }
+    g_back = index;
+    g_shm->leds.back = g_back;
+    return true;
+}
+
+int led_tick(uint64_t now_ms) {
+    bool fading = false;
+    for (int i = 0; i < PORTAL_LED_SIDES; i++) {
+        if (g_leds[i].duration_ms) fading = true;
+    }
+    if (!g_dirty && !fading) return -1;
+
+    // Coalesce bursts of colour commands into one frame per display tick
+    uint64_t since = now_ms - g_last_publish_ms;
+    if (since < PORTAL_LED_FRAME_MS) return (int)(PORTAL_LED_FRAME_MS - since);
+
+    uint32_t fading_mask = 0;
+    for (int i = 0; i < PORTAL_LED_SIDES; i++) {
+        if (channel_step(&g_leds[i], now_ms)) fading_mask |= 1u << i;
+    }
+    // A frame lost to a buffer reset goes out again on the next tick
+    g_dirty = g_shm && !publish(fading_mask);
+    g_last_publish_ms = now_ms;
+    return (fading_mask || g_dirty) ? PORTAL_LED_FRAME_MS : -1;
+}
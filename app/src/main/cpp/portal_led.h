@@ -0,0 +1,30 @@
+#ifndef PORTAL_LED_H
+#define PORTAL_LED_H
+
+// Portal LED model. 0x43/0x4C/0x4A only update the per-side colour and fade
+// here; led_tick() interpolates fades and publishes at most one frame per
+// PORTAL_LED_FRAME_MS into the shared triple buffer for the app to draw.
+
+#include <stdint.h>
+#include "portal_shm.h"
+
+#define PORTAL_LED_FRAME_MS 16
+
+// shm may be NULL: colours are still tracked, nothing is published.
+// resume keeps the frames and indices a previous worker left in shm, since
+// the app may still own one of them.
+void led_init(PortalShared *shm, bool resume);
+
+// 0x43: the whole ring (left and right halves)
+void led_set_all(uint8_t r, uint8_t g, uint8_t b, uint64_t now_ms);
+
+// 0x4C / 0x4A: one side, optionally fading over duration_ms.
+// Returns false for an unknown side.
+bool led_set_side(uint8_t side, uint8_t r, uint8_t g, uint8_t b,
+                  uint16_t duration_ms, uint64_t now_ms);
+
+// Advance fades and publish if anything changed. Returns the ms until the
+// next tick is needed, or -1 when nothing is pending.
+int led_tick(uint64_t now_ms);
+
+#endif // PORTAL_LED_H
@@ -0,0 +1,180 @@
+// portal_mem.cpp - locked region, arenas and pools for the daemon
+#include "portal_mem.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define POOL_ALIGN 16
+
+int mem_region_init(MemArena *root, const char *name, size_t bytes) {
+    memset(root, 0, sizeof(*root));
+    void *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (map == MAP_FAILED) return -errno;
+
+    // MAP_POPULATE already faulted the pages in; mlock() keeps them there
+    if (mlock(map, bytes) < 0) LOGE("Cannot lock %zu bytes of %s: %s", bytes, name, strerror(errno));
+    root->base = (uint8_t *)map;
+    root->size = bytes;
+    root->name = name;
+    return 0;
+}
+
+void mem_region_free(MemArena *root) {
+    if (root->base) munmap(root->base, root->size);
+    memset(root, 0, sizeof(*root));
+}
+
+void *arena_alloc(MemArena *arena, size_t size, size_t align) {
+    size_t start = (arena->used + align - 1) & ~(align - 1);
+    if (start > arena->size || size > arena->size - start) return NULL;
+    arena->used = start + size;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return arena->base + start;
+}
+
+int arena_sub(MemArena *parent, MemArena *child, const char *name, size_t bytes) {
+    memset(child, 0, sizeof(*child));
+    void *base = arena_alloc(parent, bytes, POOL_ALIGN);
+    if (!base) return -ENOMEM;
+    child->base = (uint8_t *)base;
+    child->size = bytes;
+    child->name = name;
+    return 0;
+}
+
+int mem_pool_init(MemPool *pool, MemArena *arena, const char *name, size_t object_size,
+                  uint32_t count) {
+    size_t size = (object_size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->base = (uint8_t *)arena_alloc(arena, size * count, POOL_ALIGN);
+    pool->next = (uint32_t *)arena_alloc(arena, count * sizeof(uint32_t), sizeof(uint32_t));
+    if (!pool->base || !pool->next) return -ENOMEM;
+
+    pool->object_size = (uint32_t)size;
+    pool->count = count;
+    pool->name = name;
+    for (uint32_t i = 0; i < count; i++) pool->next[i] = (i + 1 < count) ? i + 2 : 0;
+    pool->head.store(count ? 1 : 0, std::memory_order_relaxed);
+    pool->in_use.store(0, std::memory_order_relaxed);
+    pool->peak.store(0, std::memory_order_relaxed);
+    pool->exhausted.store(0, std::memory_order_relaxed);
+    return 0;
+}
+
+// A Treiber stack of object numbers. The tag in the top half of head
+// changes on every push and pop, so a pop that read a stale next link
+// fails its compare-exchange instead of corrupting the list.
+void *mem_pool_get(MemPool *pool) {
+    uint64_t head = pool->head.load(std::memory_order_acquire);
+    for (;;) {
+        uint32_t top = (uint32_t)head;
+        if (!top) {
+            pool->exhausted.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        uint32_t next = __atomic_load_n(&pool->next[top - 1], __ATOMIC_RELAXED);
+        uint64_t desired = (((head >> 32) + 1) << 32) | next;
+        if (pool->head.compare_exchange_weak(head, desired, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+            uint32_t used = pool->in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (used > pool->peak.load(std::memory_order_relaxed)) {
+                pool->peak.store(used, std::memory_order_relaxed);
+            }
+            return pool->base + (size_t)(top - 1) * pool->object_size;
+        }
+    }
+}
+
+void mem_pool_put(MemPool *pool, void *object) {
+    uint32_t n = (uint32_t)(((uint8_t *)object - pool->base) / pool->object_size);
+    uint64_t head = pool->head.load(std::memory_order_relaxed);
+    do {
+        __atomic_store_n(&pool->next[n], (uint32_t)head, __ATOMIC_RELAXED);
+    } while (!pool->head.compare_exchange_weak(head, (((head >> 32) + 1) << 32) | (n + 1),
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    pool->in_use.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void mem_pool_report(MemPool *pool) {
+    uint32_t exhausted = pool->exhausted.exchange(0, std::memory_order_relaxed);
+    uint32_t in_use = pool->in_use.load(std::memory_order_relaxed);
+    uint32_t peak = pool->peak.exchange(in_use, std::memory_order_relaxed);
+    if (!peak && !exhausted) return;
+    LOGI("Pool %s: %u of %u in use (max %u), %u requests found it empty",
+         pool->name, in_use, pool->count, peak, exhausted);
+}
+
+void arena_report(const MemArena *arena) {
+    LOGI("Arena %s: %zu of %zu bytes used (max %zu)", arena->name, arena->used, arena->size,
+         arena->peak);
+}
+
+#ifdef PORTAL_MALLOC_AUDIT
+// The linker sends the daemon's own malloc() calls through these (see
+// PORTAL_MALLOC_AUDIT in CMakeLists.txt); operator new is replaced below,
+// so allocations inside a shared C++ runtime are counted too
+static thread_local uint64_t t_allocations;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **out, size_t align, size_t size);
+void *__real_aligned_alloc(size_t align, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    t_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    t_allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    t_allocations++;
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **out, size_t align, size_t size) {
+    t_allocations++;
+    return __real_posix_memalign(out, align, size);
+}
+
+void *__wrap_aligned_alloc(size_t align, size_t size) {
+    t_allocations++;
+    return __real_aligned_alloc(align, size);
+}
+}
+
+void *operator new(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) abort();    // nothing in the daemon expects bad_alloc
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+uint64_t mem_thread_allocations(void) {
+    return t_allocations;
+}
+
+bool mem_audit_enabled(void) {
+    return true;
+}
+#else
+uint64_t mem_thread_allocations(void) {
+    return 0;
+}
+
+bool mem_audit_enabled(void) {
+    return false;
+}
+#endif
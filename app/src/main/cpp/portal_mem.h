@@ -0,0 +1,76 @@
+#ifndef PORTAL_MEM_H
+#define PORTAL_MEM_H
+
+// Daemon memory. Everything the I/O thread touches after startup comes out
+// of one region that mem_region_init() maps, pre-faults and locks before
+// the endpoints open, so the packet path never calls malloc() or takes a
+// page fault:
+//
+//   MemArena   bump allocator for data that lives as long as the daemon
+//              or a figure on the portal; arena_reset() drops it all
+//   MemPool    fixed-size objects (queued reports, journal records) that
+//              travel between threads; get and put are lock-free and may
+//              run on different threads
+//
+// Sizes are fixed when the daemon starts. An exhausted pool or arena
+// returns NULL and the caller degrades (drops, or does the work inline);
+// nothing grows.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+struct MemArena {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+    const char *name;
+};
+
+// Map, pre-fault and mlock() bytes as the root arena. A failed mlock() is
+// only logged. Returns 0 or -errno.
+int mem_region_init(MemArena *root, const char *name, size_t bytes);
+void mem_region_free(MemArena *root);
+
+// Carve a child arena of bytes out of parent. Returns 0 or -ENOMEM.
+int arena_sub(MemArena *parent, MemArena *child, const char *name, size_t bytes);
+
+// align must be a power of two. NULL when the arena is full.
+void *arena_alloc(MemArena *arena, size_t size, size_t align);
+
+// Everything allocated after mark was taken is freed by arena_reset(mark)
+static inline size_t arena_mark(const MemArena *arena) { return arena->used; }
+static inline void arena_reset(MemArena *arena, size_t mark) { arena->used = mark; }
+
+struct MemPool {
+    uint8_t *base;
+    uint32_t object_size;       // rounded up to 16 bytes
+    uint32_t count;
+    uint32_t *next;             // free-list links, object number + 1 (0 = end)
+    std::atomic<uint64_t> head; // change tag << 32 | first free object + 1
+    std::atomic<uint32_t> in_use;
+    std::atomic<uint32_t> peak;
+    std::atomic<uint32_t> exhausted;
+    const char *name;
+};
+
+// count objects of object_size from arena. Returns 0 or -ENOMEM.
+int mem_pool_init(MemPool *pool, MemArena *arena, const char *name, size_t object_size,
+                  uint32_t count);
+
+// An object, or NULL when all count are out (counted in exhausted)
+void *mem_pool_get(MemPool *pool);
+void mem_pool_put(MemPool *pool, void *object);
+
+// Log use and high-water marks since the last report
+void mem_pool_report(MemPool *pool);
+void arena_report(const MemArena *arena);
+
+// Heap allocations (malloc, calloc, realloc, aligned) made by the calling
+// thread so far. Only counted when built with PORTAL_MALLOC_AUDIT, which
+// links the daemon with -Wl,--wrap for each of them; always 0 otherwise.
+uint64_t mem_thread_allocations(void);
+bool mem_audit_enabled(void);
+
+#endif // PORTAL_MEM_H
@@ -0,0 +1,241 @@
+// portal_pipeline.cpp - logging and persistence stages behind the I/O thread
+#include "portal_pipeline.h"
+#include "stage_queue.h"
+#include "slot_store.h"
+#include "portal_rt.h"
+#include "portal_mem.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_LINE_MAX 200
+#define LOG_QUEUE_LINES 256
+#define PERSIST_QUEUE_JOBS 16
+#define HELPER_STACK_BYTES (128 * 1024)     // real-time mode locks every stack page
+
+struct LogLine {
+    FILE *stream;
+    char text[LOG_LINE_MAX];
+};
+
+// A journal record: one run of dirty blocks on its way to the dump. Records
+// come from a pool in the daemon's locked region and only their pointers
+// go through the queues: to the persistence thread, and back once written
+// so the I/O thread can tell the slot.
+struct PersistJob {
+    int fd;             // our own dup, closed once written
+    uint32_t offset;
+    uint32_t len;
+    int status;         // 0 or -errno from the pwrite
+    PortalSlot *slot;
+    uint64_t blocks;
+    uint8_t data[PORTAL_BUFFER_SIZE];
+};
+
+static StageQueue<LogLine, LOG_QUEUE_LINES> g_log_queue;
+static StageQueue<PersistJob *, PERSIST_QUEUE_JOBS> g_persist_queue;
+// As deep as the journal pool, so a finished job always fits
+static StageQueue<PersistJob *, PERSIST_QUEUE_JOBS> g_done_queue;
+static MemPool g_journal;
+static uint32_t g_in_flight;        // jobs queued and not reaped (I/O thread)
+static std::atomic<bool> g_stopping;
+static bool g_running;
+static pthread_t g_log_thread;
+static pthread_t g_persist_thread;
+
+// Sink for the I/O thread: format into a queue entry, never block
+static void queue_log_line(FILE *stream, const char *prefix, const char *fmt, va_list ap) {
+    LogLine line;
+    line.stream = stream;
+    size_t n = strlen(prefix);
+    if (n >= sizeof(line.text)) n = sizeof(line.text) - 1;
+    memcpy(line.text, prefix, n);
+    vsnprintf(line.text + n, sizeof(line.text) - n, fmt, ap);
+    g_log_queue.push(line);
+}
+
+// Writer for slot_flush(): copy the run out for the persistence thread
+static int queue_write(PortalSlot *slot, size_t offset, size_t len, uint64_t blocks) {
+    if (len > PORTAL_BUFFER_SIZE || g_persist_queue.full()) return -EAGAIN;
+
+    PersistJob *job = (PersistJob *)mem_pool_get(&g_journal);
+    if (!job) return -EAGAIN;
+    job->fd = fcntl(slot->fd, F_DUPFD_CLOEXEC, 0);
+    if (job->fd < 0) {
+        int err = errno;
+        mem_pool_put(&g_journal, job);
+        return -err;
+    }
+    job->offset = (uint32_t)offset;
+    job->len = (uint32_t)len;
+    job->status = 0;
+    job->slot = slot;
+    job->blocks = blocks;
+    memcpy(job->data, slot->data + offset, len);
+    if (!g_persist_queue.push(job)) {
+        close(job->fd);
+        mem_pool_put(&g_journal, job);
+        return -EAGAIN;
+    }
+    g_in_flight++;
+    return 0;
+}
+
+static uint64_t monotonic_ms(void) {
+    return stage_now_ns() / 1000000;
+}
+
+// Sleep until woken or the next report is due; true once stopped and drained
+template <class Q>
+static bool stage_wait(Q *queue, uint64_t *next_report) {
+    if (g_stopping.load(std::memory_order_acquire) && queue->depth() == 0) return true;
+
+    uint64_t now = monotonic_ms();
+    if (now >= *next_report) {
+        queue->report();
+        *next_report = now + STAGE_REPORT_MS;
+    }
+    struct pollfd pfd = { queue->wake_fd(), POLLIN, 0 };
+    poll(&pfd, 1, (int)(*next_report - now));
+    queue->clear_wake();
+    return false;
+}
+
+static void *log_main(void *) {
+    rt_helper_thread_init();
+    LogLine line;
+    uint64_t next_report = monotonic_ms() + STAGE_REPORT_MS;
+    do {
+        while (g_log_queue.pop(line)) {
+            fputs(line.text, line.stream);
+            fputc('\n', line.stream);
+            fflush(line.stream);
+        }
+    } while (!stage_wait(&g_log_queue, &next_report));
+    g_log_queue.report();
+    return NULL;
+}
+
+static void *persist_main(void *) {
+    rt_helper_thread_init();
+    PersistJob *job;
+    uint64_t next_report = monotonic_ms() + STAGE_REPORT_MS;
+    do {
+        while (g_persist_queue.pop(job)) {
+            ssize_t n = pwrite(job->fd, job->data, job->len, job->offset);
+            if (n < 0) job->status = -errno;
+            else if ((size_t)n != job->len) job->status = -EIO;
+            close(job->fd);
+            g_done_queue.push(job);
+        }
+    } while (!stage_wait(&g_persist_queue, &next_report));
+    g_persist_queue.report();
+    return NULL;
+}
+
+static int start_thread(pthread_t *thread, void *(*fn)(void *)) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, HELPER_STACK_BYTES);
+    int ret = pthread_create(thread, &attr, fn, NULL);
+    pthread_attr_destroy(&attr);
+    return -ret;
+}
+
+int pipeline_start(MemArena *arena) {
+    if (g_running) return 0;
+
+    int ret = mem_pool_init(&g_journal, arena, "journal", sizeof(PersistJob), PERSIST_QUEUE_JOBS);
+    if (ret < 0) return ret;
+    ret = g_log_queue.open("log");
+    if (ret == 0) ret = g_persist_queue.open("persist");
+    if (ret == 0) ret = g_done_queue.open("persist->io");
+    if (ret < 0) {
+        g_log_queue.close_wake();
+        g_persist_queue.close_wake();
+        return ret;
+    }
+
+    g_stopping.store(false);
+    ret = start_thread(&g_log_thread, log_main);
+    if (ret < 0) {
+        g_log_queue.close_wake();
+        g_persist_queue.close_wake();
+        g_done_queue.close_wake();
+        return ret;
+    }
+    ret = start_thread(&g_persist_thread, persist_main);
+    if (ret < 0) {
+        g_stopping.store(true, std::memory_order_release);
+        g_log_queue.wake();
+        pthread_join(g_log_thread, NULL);
+        g_log_queue.close_wake();
+        g_persist_queue.close_wake();
+        g_done_queue.close_wake();
+        return ret;
+    }
+
+    g_running = true;
+    slot_set_writer(queue_write);
+    t_log_sink = queue_log_line;
+    return 0;
+}
+
+void pipeline_stop(void) {
+    if (!g_running) return;
+
+    // Both threads drain their queue before they look at the stop flag
+    g_stopping.store(true, std::memory_order_release);
+    g_log_queue.wake();
+    g_persist_queue.wake();
+    pthread_join(g_persist_thread, NULL);
+    pthread_join(g_log_thread, NULL);
+    t_log_sink = nullptr;
+    slot_set_writer(NULL);
+    pipeline_reap();
+
+    g_log_queue.close_wake();
+    g_persist_queue.close_wake();
+    g_done_queue.close_wake();
+    g_running = false;
+}
+
+int pipeline_done_fd(void) {
+    return g_running ? g_done_queue.wake_fd() : -1;
+}
+
+int pipeline_reap(void) {
+    int count = 0;
+    PersistJob *job;
+    for (;;) {
+        if (!g_done_queue.pop(job)) {
+            // Clear, then look again: a push between the two is not lost
+            g_done_queue.clear_wake();
+            if (!g_done_queue.pop(job)) break;
+        }
+        slot_write_done(job->slot, job->blocks, job->status);
+        mem_pool_put(&g_journal, job);
+        g_in_flight--;
+        count++;
+    }
+    return count;
+}
+
+void pipeline_drain(void) {
+    while (g_running && g_in_flight) {
+        struct pollfd pfd = { g_done_queue.wake_fd(), POLLIN, 0 };
+        poll(&pfd, 1, 100);
+        pipeline_reap();
+    }
+}
+
+void pipeline_report(void) {
+    if (!g_running) return;
+    mem_pool_report(&g_journal);
+    g_done_queue.report();
+}
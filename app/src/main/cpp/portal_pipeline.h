@@ -0,0 +1,40 @@
+#ifndef PORTAL_PIPELINE_H
+#define PORTAL_PIPELINE_H
+
+// The daemon's threads:
+//
+//   I/O thread     owns ep0 and the data endpoints and every slot; the only
+//                  thread on the packet path (portal_daemon.cpp main loop)
+//   control        owns the control socket and its clients (portal_ctl.h);
+//                  requests reach the I/O thread, replies come back, each
+//                  over a StageQueue
+//   persistence    pwrite()s the blocks slot_flush() hands it and reports
+//                  each write back to the I/O thread (pipeline_reap())
+//   logging        writes the I/O thread's LOGI/LOGE lines to stdout/stderr
+//
+// so a slow log pipe, dump file or control client never holds up a figure
+// read. Every hop reports its depth and wait time every STAGE_REPORT_MS.
+
+struct MemArena;
+
+// Start the persistence and logging threads and route the calling (I/O)
+// thread's logging and slot flushes through them. Journal records for the
+// persistence thread come out of arena. Returns 0 or -errno.
+int pipeline_start(MemArena *arena);
+
+// Write out everything queued and stop both threads (from the I/O thread).
+// Every queued write has been reported to its slot when this returns.
+void pipeline_stop(void);
+
+// I/O thread: readable when writes have finished; pipeline_reap() passes
+// them to slot_write_done() and returns how many there were.
+int pipeline_done_fd(void);
+int pipeline_reap(void);
+
+// I/O thread: wait until every queued write has finished and been reaped
+void pipeline_drain(void);
+
+// Log journal pool use and the completion queue (from the I/O thread)
+void pipeline_report(void);
+
+#endif // PORTAL_PIPELINE_H
@@ -0,0 +1,167 @@
+// portal_profile.cpp - built-in portal profiles and profile image loading
+#include "portal_profile.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+struct ProfileSpec {
+    const char *name;
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t flags;
+    uint16_t sense_interval_ms;
+    PortalVariant variant;
+};
+
+template <size_t N>
+constexpr void copy_str(char (&dst)[N], const char *src) {
+    for (size_t i = 0; i + 1 < N && src[i]; i++) dst[i] = src[i];
+}
+
+// Fixed-size string fields are used as C strings (configfs, logs, lookups)
+template <size_t N>
+constexpr bool terminated(const char (&field)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (!field[i]) return true;
+    }
+    return false;
+}
+
+template <size_t N, class Blob>
+constexpr uint16_t copy_blob(uint8_t (&dst)[N], const Blob &blob) {
+    static_assert(Blob::size <= N, "blob does not fit the profile image");
+    for (size_t i = 0; i < Blob::size; i++) dst[i] = blob.bytes[i];
+    return (uint16_t)Blob::size;
+}
+
+template <class Descriptors>
+constexpr PortalProfile make_profile(const ProfileSpec &spec, const Descriptors &descriptors, bool hid) {
+    PortalProfile p{};
+    p.magic = PORTAL_PROFILE_MAGIC;
+    p.version = PORTAL_PROFILE_VERSION;
+    p.size = sizeof(PortalProfile);
+    copy_str(p.name, spec.name);
+
+    p.vid = spec.vid;
+    p.pid = spec.pid;
+    p.bcd_device = 0x0100;
+    p.flags = spec.flags;
+    p.sense_interval_ms = spec.sense_interval_ms;
+    p.variant = spec.variant;
+    p.report_size = 32;
+
+    copy_str(p.manufacturer, "Activision");
+    copy_str(p.product, "Spyro Porta");
+    copy_str(p.serial, "99B3f9C9E6");
+
+    const uint8_t activate[] = { 0x41, 0x01, 0xFF, 0x77 };
+    const uint8_t restart[] = { 0x52, 0x02, 0x0A, 0x05, 0x08 };
+    for (size_t i = 0; i < sizeof(activate); i++) p.activate_reply[i] = activate[i];
+    for (size_t i = 0; i < sizeof(restart); i++) p.restart_reply[i] = restart[i];
+
+    p.descriptors_len = copy_blob(p.descriptors, descriptors);
+    p.strings_len = copy_blob(p.strings, portal_desc::strings);
+    if (hid) {
+        for (size_t i = 0; i < sizeof(portal_desc::hid_report_descriptor); i++) {
+            p.hid_report[i] = portal_desc::hid_report_descriptor[i];
+        }
+        p.hid_report_len = sizeof(portal_desc::hid_report_descriptor);
+    }
+    return p;
+}
+
+constexpr PortalProfile builtin_profiles[] = {
+    make_profile({ "wii", 0x1430, 0x0150, 0, 5000, PORTAL_VARIANT_WII },
+                 portal_desc::hid_descriptors, true),
+    make_profile({ "ps", 0x1430, 0x0150, 0, 5000, PORTAL_VARIANT_PS },
+                 portal_desc::hid_descriptors, true),
+    make_profile({ "traptanium", 0x1430, 0x0150,
+                   PORTAL_PROFILE_AUDIO | PORTAL_PROFILE_SIDE_LEDS, 5000, PORTAL_VARIANT_TRAPTANIUM },
+                 portal_desc::hid_descriptors, true),
+    make_profile({ "xbox360", 0x1430, 0x1F17, 0, 5000, PORTAL_VARIANT_XBOX360 },
+                 portal_desc::xbox360_descriptors, false),
+};
+
+static_assert(builtin_profiles[0].descriptors_len == decltype(portal_desc::hid_descriptors)::size,
+              "descriptor length recorded in profile");
+static_assert(builtin_profiles[3].hid_report_len == 0, "Xbox 360 portal is not HID");
+
+bool profile_valid(const PortalProfile *p, size_t mapped) {
+    return mapped >= sizeof(PortalProfile) &&
+           p->magic == PORTAL_PROFILE_MAGIC &&
+           p->version == PORTAL_PROFILE_VERSION &&
+           p->size == sizeof(PortalProfile) &&
+           p->variant < PORTAL_VARIANT_COUNT &&
+           p->report_size > 0 && p->report_size <= sizeof(p->activate_reply) &&
+           p->descriptors_len <= sizeof(p->descriptors) &&
+           p->strings_len <= sizeof(p->strings) &&
+           p->hid_report_len <= sizeof(p->hid_report) &&
+           p->sense_interval_ms > 0 &&
+           terminated(p->name) && terminated(p->manufacturer) &&
+           terminated(p->product) && terminated(p->serial);
+}
+
+} // namespace
+
+const PortalProfile *profile_builtin(const char *name) {
+    for (const PortalProfile &p : builtin_profiles) {
+        if (strncmp(p.name, name, sizeof(p.name)) == 0) return &p;
+    }
+    return NULL;
+}
+
+const PortalProfile *profile_load(const char *name_or_path) {
+    const PortalProfile *builtin = profile_builtin(name_or_path);
+    if (builtin) return builtin;
+
+    int fd = open(name_or_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("No built-in profile or file named '%s': %s", name_or_path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(PortalProfile)) {
+        LOGE("Profile file '%s' is too small", name_or_path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, sizeof(PortalProfile), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOGE("Failed to map profile '%s': %s", name_or_path, strerror(errno));
+        return NULL;
+    }
+
+    const PortalProfile *profile = (const PortalProfile *)map;
+    if (!profile_valid(profile, (size_t)st.st_size)) {
+        LOGE("Profile file '%s' is not a valid version %d profile image", name_or_path, PORTAL_PROFILE_VERSION);
+        munmap(map, sizeof(PortalProfile));
+        return NULL;
+    }
+    return profile;
+}
+
+int profile_write(const PortalProfile *profile, const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -errno;
+
+    ssize_t ret = write(fd, profile, sizeof(*profile));
+    int err = (ret == (ssize_t)sizeof(*profile)) ? 0 : (ret < 0 ? errno : EIO);
+    close(fd);
+    return -err;
+}
+
+PortalDescriptorBlob profile_descriptors(const PortalProfile *profile) {
+    return { profile->descriptors, profile->descriptors_len,
+             profile->strings, profile->strings_len,
+             profile->hid_report_len ? profile->hid_report : NULL, profile->hid_report_len };
+}
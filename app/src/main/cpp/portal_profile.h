@@ -0,0 +1,75 @@
+#ifndef PORTAL_PROFILE_H
+#define PORTAL_PROFILE_H
+
+// Portal personality: everything that differs between the portals a console
+// or game expects (IDs, descriptors, strings, reply templates, sense cadence,
+// speaker/LED capabilities).
+//
+// A profile is one fixed-layout 1 KiB image. Built-in profiles are generated
+// at compile time; a profile file is the same image on disk, mmapped and used
+// in place after a header check, so selecting one costs no parsing.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+#include "portal_descriptors.h"
+
+#define PORTAL_PROFILE_MAGIC 0x4650504Bu   // "KPPF"
+#define PORTAL_PROFILE_VERSION 1
+
+enum PortalProfileFlags : uint16_t {
+    PORTAL_PROFILE_AUDIO = 1 << 0,      // Trap Team speaker (0x4D reports a speaker)
+    PORTAL_PROFILE_SIDE_LEDS = 1 << 1,  // Traptanium 0x4C left/right/trap LEDs
+    PORTAL_PROFILE_AUDIO_ADPCM = 1 << 2, // speaker stream is IMA ADPCM rather than PCM16
+};
+
+struct PortalProfile {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;                  // sizeof(PortalProfile)
+    char name[16];
+
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+    uint16_t flags;
+    uint16_t sense_interval_ms;     // periodic unsolicited 0x53 status
+    uint8_t variant;                // PortalVariant
+    uint8_t report_size;            // bytes per interrupt IN report
+
+    // Device strings for the gadget (configfs), NUL terminated
+    char manufacturer[32];
+    char product[32];
+    char serial[32];
+
+    // Reply templates, report_size bytes each
+    uint8_t activate_reply[64];     // 0x41
+    uint8_t restart_reply[64];      // 0x52
+
+    // FunctionFS blobs and HID report descriptor
+    uint16_t descriptors_len;
+    uint16_t strings_len;
+    uint16_t hid_report_len;        // 0 for non-HID portals
+    uint16_t reserved;
+    uint8_t descriptors[256];
+    uint8_t strings[128];
+    uint8_t hid_report[128];
+
+    uint8_t padding[1024 - 780];
+};
+
+static_assert(std::is_trivially_copyable<PortalProfile>::value, "profile must be mappable");
+static_assert(sizeof(PortalProfile) == 1024, "profile image is exactly 1 KiB");
+
+// Built-in profile by name ("wii", "ps", "traptanium", "xbox360"), or NULL.
+const PortalProfile *profile_builtin(const char *name);
+
+// Built-in name or path to a profile image. Returns NULL on error.
+const PortalProfile *profile_load(const char *name_or_path);
+
+// Write a profile image to path (to ship or hand-edit a variant). 0 or -errno.
+int profile_write(const PortalProfile *profile, const char *path);
+
+PortalDescriptorBlob profile_descriptors(const PortalProfile *profile);
+
+#endif // PORTAL_PROFILE_H
@@ -0,0 +1,104 @@
+// portal_rt.cpp - real-time scheduling for the I/O thread
+#include "portal_rt.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define PREFAULT_STACK_BYTES (256 * 1024)
+
+static bool g_active;
+static cpu_set_t g_helper_cpus;
+
+// Touch the stack the loop will use, so no page fault happens under FIFO
+__attribute__((noinline)) static void prefault_stack(void) {
+    volatile uint8_t stack[PREFAULT_STACK_BYTES];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) stack[i] = 0;
+}
+
+int rt_enter(const PortalRtConfig *cfg) {
+    if (cfg->priority <= 0 || g_active) return 0;
+
+    CPU_ZERO(&g_helper_cpus);
+    if (cfg->helper_cpu >= 0) {
+        CPU_SET(cfg->helper_cpu, &g_helper_cpus);
+    } else {
+        sched_getaffinity(0, sizeof(g_helper_cpus), &g_helper_cpus);
+        if (cfg->cpu >= 0 && CPU_COUNT(&g_helper_cpus) > 1) CPU_CLR(cfg->cpu, &g_helper_cpus);
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        LOGE("mlockall failed: %s", strerror(errno));
+    }
+    prefault_stack();
+
+    g_active = true;
+    if (cfg->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cfg->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            LOGE("Cannot pin service thread to cpu %d: %s", cfg->cpu, strerror(errno));
+        }
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = cfg->priority;
+    int ret = 0;
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+        ret = -errno;
+        LOGE("Cannot switch to SCHED_FIFO %d: %s", cfg->priority, strerror(errno));
+    }
+
+    LOGI("Real-time mode: SCHED_FIFO %d, cpu %d, helpers on %d core(s)",
+         cfg->priority, cfg->cpu, CPU_COUNT(&g_helper_cpus));
+    return ret;
+}
+
+void rt_helper_thread_init(void) {
+    if (!g_active) return;
+    sched_setaffinity(0, sizeof(g_helper_cpus), &g_helper_cpus);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    sched_setscheduler(0, SCHED_OTHER, &param);
+}
+
+// Values below 8 ns get a bucket each; above, bucket = 8 * (log2 - 2) + the
+// next three bits
+static int latency_bucket(uint64_t ns) {
+    if (ns < 8) return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int index = (msb - 2) * 8 + (int)((ns >> (msb - 3)) & 7);
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+static uint64_t bucket_upper(int index) {
+    if (index < 8) return (uint64_t)index;
+    int msb = index / 8 + 2;
+    uint64_t step = 1ULL << (msb - 3);
+    return (uint64_t)(8 + index % 8) * step + step - 1;
+}
+
+void latency_record(LatencyHistogram *h, uint64_t ns) {
+    h->buckets[latency_bucket(ns)]++;
+    h->count++;
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+
+uint64_t latency_percentile(const LatencyHistogram *h, double p) {
+    if (!h->count) return 0;
+    uint64_t rank = (uint64_t)(p * h->count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
@@ -0,0 +1,44 @@
+#ifndef PORTAL_RT_H
+#define PORTAL_RT_H
+
+// Opt-in real-time mode for the thread that services the endpoints
+// (portal_daemon --rt-priority N [--rt-cpu C] [--helper-cpu C]).
+//
+// rt_enter() runs on that thread before the other stages start (see
+// portal_pipeline.h). It locks the process in memory (slots, queues and
+// all), pre-faults its stack, pins it to one core and switches it to
+// SCHED_FIFO. Threads started afterwards call rt_helper_thread_init() and
+// run SCHED_OTHER on the other cores.
+
+#include <stdint.h>
+
+struct PortalRtConfig {
+    int priority;       // SCHED_FIFO priority 1-99; 0 leaves real-time mode off
+    int cpu;            // core for the service thread, -1 to leave it unpinned
+    int helper_cpu;     // core for the other threads, -1 for all but cpu
+};
+
+// Returns 0, or -errno if the thread could not be switched to SCHED_FIFO
+// (it then runs as before; memory locking and pinning failures are only
+// logged).
+int rt_enter(const PortalRtConfig *cfg);
+
+// First call in any other daemon thread: move to the helper cores and back
+// to SCHED_OTHER. Does nothing unless real-time mode is on.
+void rt_helper_thread_init(void);
+
+// Response latency: log2 buckets split 8 ways, so within 12.5%
+#define LATENCY_BUCKETS 320
+
+struct LatencyHistogram {
+    uint64_t count;
+    uint64_t max_ns;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+void latency_record(LatencyHistogram *h, uint64_t ns);
+
+// Latency that fraction p (0 < p <= 1) of the samples did not exceed
+uint64_t latency_percentile(const LatencyHistogram *h, double p);
+
+#endif // PORTAL_RT_H
@@ -0,0 +1,72 @@
+#ifndef PORTAL_SHM_H
+#define PORTAL_SHM_H
+
+// State the daemon publishes to the app through one shared memfd mapping.
+// The app asks for it with PORTAL_IPC_MAP_SHARED and gets the fd back.
+// Every field is either written by one side only or is an atomic index.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define PORTAL_SHM_MAGIC 0x4D48534Bu   // "KSHM"
+#define PORTAL_SHM_VERSION 3
+
+#define PORTAL_AUDIO_SAMPLE_RATE 8000
+#define PORTAL_AUDIO_RING_SAMPLES 4096  // power of two, 512 ms at 8 kHz
+
+// Decoded speaker audio, mono signed 16-bit. The daemon advances head, the
+// app advances tail.
+struct PortalAudioRing {
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> dropped_frames;   // frames the daemon had to discard
+    std::atomic<int32_t> volume_q15;        // set by the app, 32767 = unity
+    int16_t samples[PORTAL_AUDIO_RING_SAMPLES];
+};
+
+enum PortalLedSide : uint8_t {
+    PORTAL_LED_RIGHT = 0,
+    PORTAL_LED_TRAP = 1,
+    PORTAL_LED_LEFT = 2,
+    PORTAL_LED_SIDES = 3,
+};
+
+struct PortalLedFrame {
+    uint32_t seq;               // bumped on every publish
+    uint32_t fading;            // bit per side with a fade in progress
+    uint8_t rgb[PORTAL_LED_SIDES][3];
+    uint8_t reserved[7];
+};
+
+// Triple buffer: the daemon fills its back frame and swaps it into `latest`
+// with PORTAL_LED_FRESH set; the app swaps its front frame out when it sees
+// that bit. Neither side ever waits and the app always gets a whole frame.
+// Both sides can write these indices, so each one read is checked against
+// PORTAL_LED_FRAMES before use (portal_led_index) rather than masked.
+#define PORTAL_LED_FRAMES 3
+#define PORTAL_LED_FRESH 0x4u
+
+struct PortalLedBuffer {
+    std::atomic<uint32_t> latest;
+    uint32_t back;              // daemon's frame, so a restarted worker can resume
+    PortalLedFrame frames[PORTAL_LED_FRAMES];
+};
+
+// Frame index in a `latest` or `back` value, or PORTAL_LED_FRAMES if it is
+// not one
+static inline uint32_t portal_led_index(uint32_t value) {
+    uint32_t index = value & ~PORTAL_LED_FRESH;
+    return index < PORTAL_LED_FRAMES ? index : PORTAL_LED_FRAMES;
+}
+
+struct PortalShared {
+    uint32_t magic;
+    uint32_t version;
+    PortalAudioRing audio;
+    PortalLedBuffer leds;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+#endif // PORTAL_SHM_H
@@ -0,0 +1,211 @@
+// portal_supervisor.cpp - worker restart with preserved descriptors and slots
+#include "portal_supervisor.h"
+#include "portal_ipc.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+// More than CRASH_BURST restarts inside CRASH_WINDOW_MS means the worker dies
+// on startup; slow down instead of spinning
+#define CRASH_BURST 5
+#define CRASH_WINDOW_MS 10000
+#define CRASH_BACKOFF_MS 1000
+
+static int g_parent_sock = -1;      // our end of the worker socket pair
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int map_state(int fd, PortalWorkerState **state) {
+    void *map = mmap(NULL, sizeof(PortalWorkerState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return -errno;
+    *state = (PortalWorkerState *)map;
+    return 0;
+}
+
+int supervisor_prepare(PortalHandoff *h, PortalWorkerState **state) {
+    for (int i = 0; i < HANDOFF_END; i++) h->fds[i] = -1;
+
+    int fd = (int)syscall(__NR_memfd_create, "kaos_worker_state", MFD_CLOEXEC);
+    if (fd < 0) return -errno;
+    int ret = (ftruncate(fd, sizeof(PortalWorkerState)) < 0) ? -errno : map_state(fd, state);
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+    (*state)->magic = PORTAL_WORKER_STATE_MAGIC;
+    h->fds[HANDOFF_STATE] = fd;
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) return -errno;
+    fcntl(pair[0], F_SETFL, O_NONBLOCK);
+    g_parent_sock = pair[0];
+    h->fds[HANDOFF_SUPERVISOR] = pair[1];
+    return 0;
+}
+
+// Take over the dump fds the worker reported, including any it queued just
+// before dying
+static void take_slot_reports(PortalHandoff *h) {
+    PortalIpcMsg msg;
+    int fd;
+    while (portal_ipc_recv(g_parent_sock, &msg, &fd) > 0) {
+        if (msg.slot < 0 || msg.slot >= MAX_SLOTS) {
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        int *held = &h->fds[HANDOFF_SLOT0 + msg.slot];
+        if (*held >= 0) close(*held);
+        *held = -1;
+        if (msg.op == PORTAL_IPC_LOAD_SLOT) {
+            *held = fd;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+static pid_t spawn_worker(const PortalHandoff *h, PortalWorkerState *state,
+                          char *const argv[], const sigset_t *child_mask) {
+    state->heartbeat_ms.store(monotonic_ms(), std::memory_order_relaxed);
+
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // Child: move every descriptor to its fixed number in two steps, so a
+    // source already sitting on another entry's number is not clobbered
+    int tmp[HANDOFF_END];
+    for (int i = 0; i < HANDOFF_END; i++) {
+        tmp[i] = (h->fds[i] >= 0) ? fcntl(h->fds[i], F_DUPFD_CLOEXEC, HANDOFF_END) : -1;
+    }
+    for (int i = HANDOFF_EP0; i < HANDOFF_END; i++) {
+        if (tmp[i] >= 0) dup2(tmp[i], i);  // clears FD_CLOEXEC on the copy
+        else close(i);
+    }
+    sigprocmask(SIG_SETMASK, child_mask, NULL);
+    execv("/proc/self/exe", argv);
+    _exit(127);
+}
+
+int supervisor_run(PortalHandoff *h, PortalWorkerState *state, char *const argv[]) {
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sfd < 0) {
+        LOGE("signalfd failed: %s", strerror(errno));
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        return 1;
+    }
+
+    uint64_t crashes[CRASH_BURST] = { 0 };
+    int crash_next = 0;
+    bool stopping = false;
+    int exit_code = 1;
+
+    pid_t worker = spawn_worker(h, state, argv, &old_mask);
+    LOGI("Supervisor %d started worker %d", getpid(), worker);
+
+    while (worker > 0) {
+        struct pollfd fds[2] = { { sfd, POLLIN, 0 }, { g_parent_sock, POLLIN, 0 } };
+        poll(fds, 2, 1000);
+        take_slot_reports(h);
+
+        struct signalfd_siginfo si;
+        while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+            if (si.ssi_signo == SIGCHLD || stopping) continue;
+            LOGI("Supervisor received signal %u, stopping worker", si.ssi_signo);
+            stopping = true;
+            kill(worker, SIGTERM);
+        }
+
+        int status;
+        if (waitpid(worker, &status, WNOHANG) == worker) {
+            take_slot_reports(h);
+            if (stopping || (WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+                LOGI("Worker %d finished", worker);
+                exit_code = 0;
+                break;
+            }
+            if (WIFSIGNALED(status)) {
+                LOGE("Worker %d killed by signal %d", worker, WTERMSIG(status));
+            } else {
+                LOGE("Worker %d exited with status %d", worker, WEXITSTATUS(status));
+            }
+
+            uint64_t now = monotonic_ms();
+            uint64_t oldest = crashes[crash_next];
+            crashes[crash_next] = now;
+            crash_next = (crash_next + 1) % CRASH_BURST;
+            if (oldest && now - oldest < CRASH_WINDOW_MS) {
+                LOGE("Worker keeps failing, waiting %d ms before restarting", CRASH_BACKOFF_MS);
+                usleep(CRASH_BACKOFF_MS * 1000);
+            }
+
+            state->restarts++;
+            worker = spawn_worker(h, state, argv, &old_mask);
+            LOGI("Restarted worker %d (restart %u)", worker, state->restarts);
+            continue;
+        }
+
+        // Hung rather than crashed: the loop stopped bumping its heartbeat
+        uint64_t silent = monotonic_ms() - state->heartbeat_ms.load(std::memory_order_relaxed);
+        if (silent > PORTAL_WATCHDOG_MS) {
+            LOGE("Worker %d silent for %llu ms, killing it", worker, (unsigned long long)silent);
+            kill(worker, SIGKILL);
+            state->heartbeat_ms.store(monotonic_ms(), std::memory_order_relaxed);
+        }
+    }
+
+    if (worker < 0) LOGE("Cannot start worker: %s", strerror(errno));
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        int *held = &h->fds[HANDOFF_SLOT0 + i];
+        if (*held >= 0) close(*held);
+        *held = -1;
+    }
+    close(sfd);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    return exit_code;
+}
+
+int supervisor_adopt(PortalHandoff *h, PortalWorkerState **state) {
+    for (int i = 0; i < HANDOFF_END; i++) {
+        h->fds[i] = -1;
+        if (i < HANDOFF_EP0 || fcntl(i, F_GETFD) < 0) continue;
+        fcntl(i, F_SETFD, FD_CLOEXEC);
+        h->fds[i] = i;
+    }
+    if (h->fds[HANDOFF_EP0] < 0 || h->fds[HANDOFF_STATE] < 0) return -EBADF;
+
+    int ret = map_state(h->fds[HANDOFF_STATE], state);
+    if (ret < 0) return ret;
+    if ((*state)->magic != PORTAL_WORKER_STATE_MAGIC) return -EINVAL;
+    return 0;
+}
+
+void supervisor_report_slot(int sock, int slot, int fd) {
+    if (sock < 0) return;
+    PortalIpcMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.op = (fd >= 0) ? PORTAL_IPC_LOAD_SLOT : PORTAL_IPC_UNLOAD_SLOT;
+    msg.slot = slot;
+    if (portal_ipc_send(sock, &msg, fd) < 0) {
+        LOGE("Cannot report slot %d to supervisor: %s", slot, strerror(errno));
+    }
+}
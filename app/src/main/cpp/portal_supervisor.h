@@ -0,0 +1,59 @@
+#ifndef PORTAL_SUPERVISOR_H
+#define PORTAL_SUPERVISOR_H
+
+// portal_daemon --supervise: the parent does the FunctionFS setup once and
+// then only holds state - ep0 and the data endpoints, the control socket,
+// the shared memfd, every loaded dump fd and a PortalWorkerState memfd - while
+// a worker child runs the I/O loop. When the worker dies the parent re-execs
+// it with the same descriptors, so ep0 never closes and the host never sees
+// the function go away. The worker mirrors its slots into the state memfd as
+// it goes (see PortalSlotSave) and reports dump fds it takes on or drops.
+
+#include <stdint.h>
+#include <atomic>
+#include "slot_store.h"
+
+#define PORTAL_WORKER_STATE_MAGIC 0x4B57534Bu  // "KSWK"
+#define PORTAL_WATCHDOG_MS 5000                 // worker loop wakes at least once a second
+
+struct PortalWorkerState {
+    uint32_t magic;
+    uint32_t restarts;
+    std::atomic<uint64_t> heartbeat_ms;         // CLOCK_MONOTONIC, bumped by the worker loop
+    PortalSlotSave slots[MAX_SLOTS];
+};
+
+// Where a worker finds its inherited descriptors after exec
+enum PortalHandoffFd {
+    HANDOFF_EP0 = 3,
+    HANDOFF_EP_IN,
+    HANDOFF_EP_OUT,
+    HANDOFF_CTL_LISTEN,
+    HANDOFF_SHARED,
+    HANDOFF_STATE,
+    HANDOFF_SUPERVISOR,
+    HANDOFF_SLOT0,
+    HANDOFF_END = HANDOFF_SLOT0 + MAX_SLOTS,
+};
+
+struct PortalHandoff {
+    int fds[HANDOFF_END];       // indexed by PortalHandoffFd, -1 when absent
+};
+
+// Parent: create the state memfd and the worker socket pair into h.
+// Returns 0 or -errno.
+int supervisor_prepare(PortalHandoff *h, PortalWorkerState **state);
+
+// Parent: run and restart workers (exec'd as /proc/self/exe with argv) until
+// one exits cleanly or we are asked to stop. Returns the exit code.
+int supervisor_run(PortalHandoff *h, PortalWorkerState *state, char *const argv[]);
+
+// Worker: collect the inherited descriptors and map the state.
+// Returns 0 or -errno.
+int supervisor_adopt(PortalHandoff *h, PortalWorkerState **state);
+
+// Worker: have the parent hold its own copy of a slot's dump fd, or drop the
+// one it holds when fd is -1.
+void supervisor_report_slot(int sock, int slot, int fd);
+
+#endif // PORTAL_SUPERVISOR_H
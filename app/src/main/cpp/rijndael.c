@@ -1,4 +1,7 @@
+/* Define RIJNDAEL_LOOPED to build the compact round loop instead */
+#ifndef RIJNDAEL_LOOPED
 #define FULL_UNROLL
+#endif
 
 #include "rijndael.h"
 
@@ -1,5 +1,7 @@
 #include "skylander_crypto.h"
 #include "rijndael.h"
+#include "aes_ct.h"
+#include "md5.h"
 #include <string.h>
 
 // Skylander encryption keys (these would come from KAOS)
@@ -13,6 +15,7 @@ void skylander_crypto_init(void) {
     // Initialize crypto system if needed
 }
 
+#ifdef SKYLANDER_TABLE_AES
 void skylander_encrypt_block(const uint8_t* key, const uint8_t* input, uint8_t* output) {
     u32 rk[RKLENGTH(KEYBITS)];
     int nrounds = rijndaelSetupEncrypt(rk, (const u8*)key, KEYBITS);
@@ -24,6 +27,22 @@ void skylander_decrypt_block(const uint8_t* key, const uint8_t* input, uint8_t*
     int nrounds = rijndaelSetupDecrypt(rk, (const u8*)key, KEYBITS);
     rijndaelDecrypt(rk, nrounds, (const u8*)input, (u8*)output);
 }
+#else
+// One block in lane 0 of the bitsliced AES. This is what the daemon runs
+// (figure reads, syncs and edits go through the tag block functions
+// below), so it gets the same constant-time path as whole tags.
+void skylander_encrypt_block(const uint8_t* key, const uint8_t* input, uint8_t* output) {
+    aes_ct_schedule s;
+    aes_ct_setup(&s, (const uint8_t (*)[16])key, 1);
+    aes_ct_encrypt(&s, input, output, 1);
+}
+
+void skylander_decrypt_block(const uint8_t* key, const uint8_t* input, uint8_t* output) {
+    aes_ct_schedule s;
+    aes_ct_setup(&s, (const uint8_t (*)[16])key, 1);
+    aes_ct_decrypt(&s, input, output, 1);
+}
+#endif
 
 int skylander_verify_checksum(const uint8_t* data, size_t len) {
     if (len < 2) return 0;
@@ -68,4 +87,193 @@ int skylander_parse_dump(const uint8_t* dump_data, size_t dump_len,
     // specific blocks based on tag type
 
     return (int)dump_len;
+}
+
+static const char BLOCK_KEY_SUFFIX[] = " Copyright (C) 2010 Activision. All Rights Reserved. ";
+
+int skylander_block_encrypted(int block) {
+    return block >= 8 && block < SKYLANDER_BLOCK_COUNT && (block % 4) != 3;
+}
+
+void skylander_block_key(const uint8_t* header, uint8_t block, uint8_t* key) {
+    md5_ctx ctx;
+    md5_init(&ctx);
+    md5_update(&ctx, header, SKYLANDER_HEADER_SIZE);
+    md5_update(&ctx, &block, 1);
+    md5_update(&ctx, (const uint8_t*)BLOCK_KEY_SUFFIX, sizeof(BLOCK_KEY_SUFFIX) - 1);
+    md5_final(&ctx, key);
+}
+
+static int block_is_zero(const uint8_t* data) {
+    uint8_t acc = 0;
+    for (int i = 0; i < SKYLANDER_BLOCK_SIZE; i++) acc |= data[i];
+    return acc == 0;
+}
+
+void skylander_decrypt_tag_block(const uint8_t* header, uint8_t block,
+                                 const uint8_t* input, uint8_t* output) {
+    if (!skylander_block_encrypted(block) || block_is_zero(input)) {
+        memmove(output, input, SKYLANDER_BLOCK_SIZE);
+        return;
+    }
+    uint8_t key[16];
+    skylander_block_key(header, block, key);
+    skylander_decrypt_block(key, input, output);
+}
+
+void skylander_encrypt_tag_block(const uint8_t* header, uint8_t block,
+                                 const uint8_t* input, uint8_t* output) {
+    if (!skylander_block_encrypted(block) || block_is_zero(input)) {
+        memmove(output, input, SKYLANDER_BLOCK_SIZE);
+        return;
+    }
+    uint8_t key[16];
+    skylander_block_key(header, block, key);
+    skylander_encrypt_block(key, input, output);
+}
+
+#ifdef SKYLANDER_TABLE_AES
+// Key schedules for every encrypted block of one tag, set up together so the
+// AES loop below runs without interleaved MD5 work
+typedef struct {
+    u32 rk[SKYLANDER_BLOCK_COUNT][RKLENGTH(KEYBITS)];
+    int nrounds;
+} TagSchedule;
+
+static void tag_schedule(const uint8_t* header, int decrypt, TagSchedule* ts) {
+    uint8_t key[16];
+    for (int b = 0; b < SKYLANDER_BLOCK_COUNT; b++) {
+        if (!skylander_block_encrypted(b)) continue;
+        skylander_block_key(header, (uint8_t)b, key);
+        ts->nrounds = decrypt ? rijndaelSetupDecrypt(ts->rk[b], key, KEYBITS)
+                              : rijndaelSetupEncrypt(ts->rk[b], key, KEYBITS);
+    }
+}
+
+void skylander_decrypt_tag(const uint8_t* in, uint8_t* out) {
+    TagSchedule ts;
+    uint8_t header[SKYLANDER_HEADER_SIZE];
+    memcpy(header, in, sizeof(header));
+    tag_schedule(header, 1, &ts);
+
+    for (int b = 0; b < SKYLANDER_BLOCK_COUNT; b++) {
+        const uint8_t* src = in + b * SKYLANDER_BLOCK_SIZE;
+        uint8_t* dst = out + b * SKYLANDER_BLOCK_SIZE;
+        if (!skylander_block_encrypted(b) || block_is_zero(src)) {
+            memmove(dst, src, SKYLANDER_BLOCK_SIZE);
+            continue;
+        }
+        uint8_t tmp[SKYLANDER_BLOCK_SIZE];
+        rijndaelDecrypt(ts.rk[b], ts.nrounds, src, tmp);
+        memcpy(dst, tmp, sizeof(tmp));
+    }
+}
+
+void skylander_encrypt_tag(const uint8_t* in, uint8_t* out) {
+    TagSchedule ts;
+    uint8_t header[SKYLANDER_HEADER_SIZE];
+    memcpy(header, in, sizeof(header));
+    tag_schedule(header, 0, &ts);
+
+    for (int b = 0; b < SKYLANDER_BLOCK_COUNT; b++) {
+        const uint8_t* src = in + b * SKYLANDER_BLOCK_SIZE;
+        uint8_t* dst = out + b * SKYLANDER_BLOCK_SIZE;
+        if (!skylander_block_encrypted(b) || block_is_zero(src)) {
+            memmove(dst, src, SKYLANDER_BLOCK_SIZE);
+            continue;
+        }
+        uint8_t tmp[SKYLANDER_BLOCK_SIZE];
+        rijndaelEncrypt(ts.rk[b], ts.nrounds, src, tmp);
+        memcpy(dst, tmp, sizeof(tmp));
+    }
+}
+
+#else // !SKYLANDER_TABLE_AES
+
+// Run up to four gathered blocks through the bitsliced AES, each under its
+// own key, and put them back in place
+static void tag_batch(const uint8_t keys[][16], uint8_t* lanes, const int* blocks, int count,
+                      int decrypt, uint8_t* out) {
+    aes_ct_schedule s;
+    aes_ct_setup(&s, keys, count);
+    if (decrypt) aes_ct_decrypt(&s, lanes, lanes, count);
+    else aes_ct_encrypt(&s, lanes, lanes, count);
+    for (int i = 0; i < count; i++) {
+        memcpy(out + blocks[i] * SKYLANDER_BLOCK_SIZE, lanes + i * SKYLANDER_BLOCK_SIZE,
+               SKYLANDER_BLOCK_SIZE);
+    }
+}
+
+// Whole tags take the constant-time path: no key- or data-indexed table
+// lookups, and the one key schedule serves both directions
+static void tag_crypt(const uint8_t* in, uint8_t* out, int decrypt) {
+    uint8_t header[SKYLANDER_HEADER_SIZE];
+    uint8_t keys[AES_CT_LANES][16];
+    uint8_t lanes[AES_CT_LANES * SKYLANDER_BLOCK_SIZE];
+    int blocks[AES_CT_LANES];
+    int count = 0;
+    memcpy(header, in, sizeof(header));
+
+    for (int b = 0; b < SKYLANDER_BLOCK_COUNT; b++) {
+        const uint8_t* src = in + b * SKYLANDER_BLOCK_SIZE;
+        if (!skylander_block_encrypted(b) || block_is_zero(src)) {
+            memmove(out + b * SKYLANDER_BLOCK_SIZE, src, SKYLANDER_BLOCK_SIZE);
+            continue;
+        }
+        // Gathered blocks are copies, so in and out may alias
+        skylander_block_key(header, (uint8_t)b, keys[count]);
+        memcpy(lanes + count * SKYLANDER_BLOCK_SIZE, src, SKYLANDER_BLOCK_SIZE);
+        blocks[count++] = b;
+        if (count == AES_CT_LANES) {
+            tag_batch(keys, lanes, blocks, count, decrypt, out);
+            count = 0;
+        }
+    }
+    if (count) tag_batch(keys, lanes, blocks, count, decrypt, out);
+}
+
+void skylander_decrypt_tag(const uint8_t* in, uint8_t* out) {
+    tag_crypt(in, out, 1);
+}
+
+void skylander_encrypt_tag(const uint8_t* in, uint8_t* out) {
+    tag_crypt(in, out, 0);
+}
+
+#endif // SKYLANDER_TABLE_AES
+
+void skylander_sector_key(const uint8_t* uid, uint8_t sector, uint8_t* key) {
+    static const uint8_t SECTOR0_KEY[6] = { 0x4B, 0x0B, 0x20, 0x10, 0x7C, 0xCB };
+    if (sector == 0) {
+        memcpy(key, SECTOR0_KEY, sizeof(SECTOR0_KEY));
+        return;
+    }
+
+    // CRC48 (ECMA-182 polynomial) over UID || sector
+    const uint64_t poly = 0x42F0E1EBA9EA3693ULL;
+    const uint64_t msb = 0x800000000000ULL;
+    uint64_t crc = 0x9AE903260CC4ULL;
+    uint8_t data[5] = { uid[0], uid[1], uid[2], uid[3], sector };
+    for (int i = 0; i < 5; i++) {
+        crc ^= (uint64_t)data[i] << 40;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & msb) ? (crc << 1) ^ poly : crc << 1;
+        }
+    }
+    crc &= 0xFFFFFFFFFFFFULL;
+    for (int i = 0; i < 6; i++) key[i] = (uint8_t)(crc >> (8 * (5 - i)));
+}
+
+uint16_t skylander_crc16_update(uint16_t crc, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint16_t skylander_crc16(const uint8_t* data, size_t len) {
+    return skylander_crc16_update(0xFFFF, data, len);
 }
\ No newline at end of file
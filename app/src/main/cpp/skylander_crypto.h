@@ -14,7 +14,10 @@ extern "C" {
 // Initialize crypto system
 void skylander_crypto_init(void);
 
-// Encrypt a block of data (16 bytes)
+// Encrypt a block of data (16 bytes). Like everything below, this uses the
+// constant-time bitsliced AES (aes_ct.h) unless built with
+// SKYLANDER_TABLE_AES (-DPORTAL_TABLE_AES=ON), which selects the faster
+// table-based rijndael.c.
 void skylander_encrypt_block(const uint8_t* key, const uint8_t* input, uint8_t* output);
 
 // Decrypt a block of data (16 bytes)
@@ -30,6 +33,39 @@ void skylander_calculate_checksum(uint8_t* data, size_t len);
 int skylander_parse_dump(const uint8_t* dump_data, size_t dump_len, 
                          uint8_t* tag_data, size_t tag_size);
 
+// Tag layout: 64 blocks of 16 bytes. Blocks 0-1 are the plaintext header,
+// data blocks 8-63 are encrypted except sector trailers (every 4th block).
+#define SKYLANDER_BLOCK_SIZE 16
+#define SKYLANDER_BLOCK_COUNT 64
+#define SKYLANDER_HEADER_SIZE 32
+
+// Non-zero if block is stored AES-encrypted on the tag
+int skylander_block_encrypted(int block);
+
+// Per-block AES key: MD5(blocks 0-1 || block number || copyright string)
+void skylander_block_key(const uint8_t* header, uint8_t block, uint8_t* key);
+
+// Decrypt/encrypt one tag block (header = blocks 0-1 of the same tag).
+// Plaintext blocks are copied; an all-zero block stays all zero both ways,
+// matching blank areas on real tags.
+void skylander_decrypt_tag_block(const uint8_t* header, uint8_t block,
+                                 const uint8_t* input, uint8_t* output);
+void skylander_encrypt_tag_block(const uint8_t* header, uint8_t block,
+                                 const uint8_t* input, uint8_t* output);
+
+// Whole-tag variants: derive every block key from the header once and run
+// all encrypted blocks through AES in one pass, four blocks at a time on
+// the bitsliced AES. in and out may alias.
+void skylander_decrypt_tag(const uint8_t* in, uint8_t* out);
+void skylander_encrypt_tag(const uint8_t* in, uint8_t* out);
+
+// MIFARE key A for a sector trailer (6 bytes, as stored on the tag)
+void skylander_sector_key(const uint8_t* uid, uint8_t sector, uint8_t* key);
+
+// CRC16-CCITT (poly 0x1021, init 0xFFFF) used by the tag checksums
+uint16_t skylander_crc16(const uint8_t* data, size_t len);
+uint16_t skylander_crc16_update(uint16_t crc, const uint8_t* data, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
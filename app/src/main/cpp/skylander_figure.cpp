@@ -0,0 +1,230 @@
+// skylander_figure.cpp - typed figure model over the raw tag image
+#include "skylander_figure.h"
+
+#include <string.h>
+
+// Character ID ranges per figure kind. Anything not listed is FIGURE_UNKNOWN,
+// which keeps the permissive write policy (figure_block_writable).
+struct FigureIdRange {
+    uint16_t first;
+    uint16_t last;
+    FigureType type;
+};
+
+static const FigureIdRange FIGURE_ID_RANGES[] = {
+        { 0, 99, FIGURE_CHARACTER },            // Spyro's Adventure
+        { 100, 199, FIGURE_CHARACTER },         // Giants
+        { 200, 209, FIGURE_ITEM },              // Spyro's Adventure / Giants magic items
+        { 210, 229, FIGURE_TRAP },              // Trap Team elemental and Kaos traps
+        { 230, 299, FIGURE_ITEM },              // Trap Team items
+        { 300, 399, FIGURE_ITEM },              // adventure packs
+        { 400, 599, FIGURE_CHARACTER },         // legendaries, Trap Team, minis
+        { 600, 679, FIGURE_CHARACTER },         // Imaginators senseis
+        { 680, 699, FIGURE_CREATION_CRYSTAL },  // Imaginators creation crystals
+        { 1000, 3199, FIGURE_CHARACTER },       // Swap Force halves and cores
+        { 3200, 3299, FIGURE_VEHICLE },         // SuperChargers vehicles
+        { 3300, 3399, FIGURE_ITEM },            // SuperChargers racing packs
+        { 3400, 3499, FIGURE_SUPERCHARGER },    // SuperChargers drivers
+};
+
+static uint16_t load_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t load_le24(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+}
+
+static uint32_t load_le32(const uint8_t *p) {
+    return load_le24(p) | ((uint32_t)p[3] << 24);
+}
+
+FigureType figure_type_for_id(uint16_t character_id) {
+    for (const FigureIdRange &r : FIGURE_ID_RANGES) {
+        if (character_id >= r.first && character_id <= r.last) return r.type;
+    }
+    return FIGURE_UNKNOWN;
+}
+
+const char *figure_type_name(FigureType type) {
+    switch (type) {
+        case FIGURE_CHARACTER: return "character";
+        case FIGURE_TRAP: return "trap";
+        case FIGURE_VEHICLE: return "vehicle";
+        case FIGURE_SUPERCHARGER: return "supercharger";
+        case FIGURE_CREATION_CRYSTAL: return "creation crystal";
+        case FIGURE_ITEM: return "item";
+        default: return "unknown";
+    }
+}
+
+const uint8_t *figure_plain_block(SkylanderFigure *fig, uint8_t block) {
+    if (block >= SKYLANDER_BLOCK_COUNT) return NULL;
+    uint64_t bit = 1ULL << block;
+    if (!(fig->plain_valid & bit)) {
+        skylander_decrypt_tag_block(fig->raw, block, fig->raw + block * SKYLANDER_BLOCK_SIZE,
+                                    fig->plain[block]);
+        if (skylander_block_encrypted(block)) fig->decrypts++;
+        fig->plain_valid |= bit;
+    }
+    return fig->plain[block];
+}
+
+uint8_t *figure_edit_block(SkylanderFigure *fig, uint8_t block) {
+    if (block < 2 || block >= SKYLANDER_BLOCK_COUNT) return NULL;
+    figure_plain_block(fig, block);
+    fig->cipher_stale |= 1ULL << block;
+    return fig->plain[block];
+}
+
+bool figure_sync_block(SkylanderFigure *fig, uint8_t block) {
+    if (block >= SKYLANDER_BLOCK_COUNT) return false;
+    uint64_t bit = 1ULL << block;
+    if (!(fig->cipher_stale & bit)) return false;
+    skylander_encrypt_tag_block(fig->raw, block, fig->plain[block],
+                                fig->raw + block * SKYLANDER_BLOCK_SIZE);
+    if (skylander_block_encrypted(block)) fig->encrypts++;
+    fig->cipher_stale &= ~bit;
+    return true;
+}
+
+uint64_t figure_sync_all(SkylanderFigure *fig) {
+    uint64_t synced = fig->cipher_stale;
+    uint64_t pending = synced;
+    while (pending) {
+        int block = __builtin_ctzll(pending);
+        figure_sync_block(fig, (uint8_t)block);
+        pending &= pending - 1;
+    }
+    return synced;
+}
+
+// The area header block holds the sequence counter; the game writes the
+// other area each save and bumps it, so the newer one (mod 256) is live.
+static void pick_active_area(SkylanderFigure *fig) {
+    static const uint8_t zero[SKYLANDER_BLOCK_SIZE] = { 0 };
+    bool blank[FIGURE_AREA_COUNT];
+    for (int a = 0; a < FIGURE_AREA_COUNT; a++) {
+        const uint8_t *header = figure_plain_block(fig, FIGURE_AREA_START[a]);
+        blank[a] = memcmp(header, zero, sizeof(zero)) == 0;
+        fig->area_sequence[a] = header[FIGURE_SEQUENCE_OFFSET];
+    }
+
+    if (blank[0] && blank[1]) fig->active_area = -1;
+    else if (blank[1]) fig->active_area = 0;
+    else if (blank[0]) fig->active_area = 1;
+    else fig->active_area = ((int8_t)(fig->area_sequence[1] - fig->area_sequence[0]) > 0) ? 1 : 0;
+}
+
+bool figure_attach(SkylanderFigure *fig, uint8_t *raw, size_t size) {
+    memset(fig, 0, sizeof(*fig));
+    fig->active_area = -1;
+    if (!raw || size < SKYLANDER_BLOCK_COUNT * SKYLANDER_BLOCK_SIZE) return false;
+
+    fig->raw = raw;
+    fig->size = size;
+    fig->uid = load_le32(raw);
+    fig->character_id = load_le16(raw + 0x10);
+    fig->variant = load_le16(raw + 0x1C);
+    fig->type = figure_type_for_id(fig->character_id);
+    pick_active_area(fig);
+    return true;
+}
+
+void figure_detach(SkylanderFigure *fig) {
+    memset(fig, 0, sizeof(*fig));
+    fig->active_area = -1;
+}
+
+void figure_invalidate(SkylanderFigure *fig, uint8_t block) {
+    if (!fig->raw || block >= SKYLANDER_BLOCK_COUNT) return;
+
+    // The header feeds every block key, so a header write re-derives it all
+    // (pending edits are dropped: the console's view of the tag wins)
+    if (block < 2) {
+        figure_attach(fig, fig->raw, fig->size);
+        return;
+    }
+
+    uint64_t bit = 1ULL << block;
+    fig->plain_valid &= ~bit;
+    fig->cipher_stale &= ~bit;
+    for (int a = 0; a < FIGURE_AREA_COUNT; a++) {
+        if (block == FIGURE_AREA_START[a]) pick_active_area(fig);
+    }
+}
+
+bool figure_block_writable(const SkylanderFigure *fig, uint8_t block) {
+    if (block >= SKYLANDER_BLOCK_COUNT) return false;
+    // Block 0 (UID) and sector trailers are fixed on real tags
+    if (block == 0 || (block % 4) == 3) return false;
+    if (!fig->raw) return true;
+    // Known figure kinds only keep game data in the two areas
+    if (fig->type != FIGURE_UNKNOWN && block < FIGURE_AREA_START[0]) return false;
+    return true;
+}
+
+const uint8_t *figure_area_block(SkylanderFigure *fig, uint8_t area_block) {
+    if (fig->active_area < 0 || area_block >= FIGURE_AREA_BLOCKS) return NULL;
+    return figure_plain_block(fig, FIGURE_AREA_START[fig->active_area] + area_block);
+}
+
+uint32_t figure_xp(SkylanderFigure *fig) {
+    const uint8_t *b = figure_area_block(fig, 0);
+    return b ? load_le24(b + FIGURE_XP_OFFSET) : 0;
+}
+
+uint16_t figure_gold(SkylanderFigure *fig) {
+    const uint8_t *b = figure_area_block(fig, 0);
+    return b ? load_le16(b + FIGURE_GOLD_OFFSET) : 0;
+}
+
+uint32_t figure_playtime(SkylanderFigure *fig) {
+    const uint8_t *b = figure_area_block(fig, 0);
+    return b ? load_le32(b + FIGURE_PLAYTIME_OFFSET) : 0;
+}
+
+uint16_t figure_upgrades(SkylanderFigure *fig) {
+    const uint8_t *b = figure_area_block(fig, FIGURE_UPGRADES_BLOCK);
+    return b ? load_le16(b + FIGURE_UPGRADES_OFFSET) : 0;
+}
+
+uint8_t figure_hat(SkylanderFigure *fig) {
+    const uint8_t *b = figure_area_block(fig, FIGURE_HAT_BLOCK);
+    return b ? b[FIGURE_HAT_OFFSET] : 0;
+}
+
+size_t figure_nickname(SkylanderFigure *fig, uint16_t *out) {
+    const uint8_t *a = figure_area_block(fig, FIGURE_NICKNAME_BLOCK_A);
+    const uint8_t *b = figure_area_block(fig, FIGURE_NICKNAME_BLOCK_B);
+    size_t n = 0;
+    if (a && b) {
+        for (; n < FIGURE_NICKNAME_CHARS; n++) {
+            const uint8_t *p = (n < 8) ? a + n * 2 : b + (n - 8) * 2;
+            uint16_t c = load_le16(p);
+            if (!c) break;
+            out[n] = c;
+        }
+    }
+    out[n] = 0;
+    return n;
+}
+
+// Trap area block +1 holds four 4-byte villain records
+int figure_trap_villains(SkylanderFigure *fig, FigureVillain *out) {
+    if (fig->type != FIGURE_TRAP) return 0;
+    const uint8_t *b = figure_area_block(fig, FIGURE_TRAP_BLOCK);
+    if (!b) return 0;
+
+    int count = 0;
+    for (int i = 0; i < FIGURE_TRAP_VILLAINS; i++) {
+        const uint8_t *rec = b + i * 4;
+        if (!rec[0]) continue;
+        out[count].villain_id = rec[0];
+        out[count].variant = rec[1];
+        out[count].evolved = rec[2] & 1;
+        out[count].hat = rec[3];
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,129 @@
+#ifndef SKYLANDER_FIGURE_H
+#define SKYLANDER_FIGURE_H
+
+// Typed view of a figure on top of its raw (encrypted) tag image.
+//
+// Every block exists twice: ciphertext in raw (what the console reads and
+// what is flushed to the dump) and a plaintext copy in plain[]. Two bit
+// masks say which side is current:
+//   plain_valid   - plain[b] matches raw; clear means decrypt on first use
+//   cipher_stale  - plain[b] was edited; raw is re-encrypted only when the
+//                   console reads the block or the slot is flushed
+// A 0x57 write replaces the ciphertext, so it clears both bits for that
+// block and nothing else. Each block therefore goes through AES at most
+// once per change, in whichever direction is needed.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "skylander_crypto.h"
+
+enum FigureType : uint8_t {
+    FIGURE_UNKNOWN = 0,
+    FIGURE_CHARACTER,
+    FIGURE_TRAP,
+    FIGURE_VEHICLE,
+    FIGURE_SUPERCHARGER,
+    FIGURE_CREATION_CRYSTAL,
+    FIGURE_ITEM,
+};
+
+#define FIGURE_AREA_COUNT 2
+#define FIGURE_AREA_BLOCKS 28           // 0x08-0x23 and 0x24-0x3F, trailers included
+#define FIGURE_NICKNAME_CHARS 16
+#define FIGURE_TRAP_VILLAINS 4
+
+// First block of each data area
+static const uint8_t FIGURE_AREA_START[FIGURE_AREA_COUNT] = { 0x08, 0x24 };
+
+// Field layout inside a data area. Area block 0 holds the counters, the
+// sequence byte and the three area checksums; block 3 is a sector trailer.
+#define FIGURE_XP_OFFSET 0              // area block 0, 24-bit
+#define FIGURE_GOLD_OFFSET 3            // area block 0, 16-bit
+#define FIGURE_PLAYTIME_OFFSET 5        // area block 0, 32-bit seconds
+#define FIGURE_SEQUENCE_OFFSET 9        // area block 0
+#define FIGURE_CRC3_OFFSET 0x0A         // area block 0, covers blocks 5, 6, 8 + 0xE0 zeros
+#define FIGURE_CRC2_OFFSET 0x0C         // area block 0, covers blocks 1, 2, 4
+#define FIGURE_CRC1_OFFSET 0x0E         // area block 0, covers block 0 itself
+#define FIGURE_UPGRADES_BLOCK 1
+#define FIGURE_UPGRADES_OFFSET 0
+#define FIGURE_HAT_BLOCK 1
+#define FIGURE_HAT_OFFSET 4
+#define FIGURE_TRAP_BLOCK 1             // four 4-byte villain records
+#define FIGURE_NICKNAME_BLOCK_A 2       // characters 0-7
+#define FIGURE_NICKNAME_BLOCK_B 4       // characters 8-15
+
+struct FigureVillain {
+    uint8_t villain_id;     // 0 = empty record
+    uint8_t variant;
+    uint8_t evolved;
+    uint8_t hat;
+};
+
+struct SkylanderFigure {
+    uint8_t *raw;               // tag image as the console sees it
+    size_t size;
+
+    // Header (blocks 0-1, never encrypted)
+    uint32_t uid;
+    uint16_t character_id;
+    uint16_t variant;
+    FigureType type;
+
+    int8_t active_area;         // area with the newer sequence, -1 if both blank
+    uint8_t area_sequence[FIGURE_AREA_COUNT];
+
+    uint64_t plain_valid;
+    uint64_t cipher_stale;
+    uint32_t decrypts;          // AES block operations, for the stats log
+    uint32_t encrypts;
+
+    uint8_t plain[SKYLANDER_BLOCK_COUNT][SKYLANDER_BLOCK_SIZE];
+};
+
+// Decode the header and pick the active area. raw must stay mapped while
+// the figure is attached. Returns false for an image too short to be a tag.
+bool figure_attach(SkylanderFigure *fig, uint8_t *raw, size_t size);
+void figure_detach(SkylanderFigure *fig);
+
+// Block was overwritten in raw (console write); forget its plaintext.
+void figure_invalidate(SkylanderFigure *fig, uint8_t block);
+
+// Plaintext of any block, decrypted on first use
+const uint8_t *figure_plain_block(SkylanderFigure *fig, uint8_t block);
+
+// Plaintext of block for modification; the ciphertext is marked stale.
+// Editing blocks 0-1 (which key every other block) is not supported.
+uint8_t *figure_edit_block(SkylanderFigure *fig, uint8_t block);
+
+// Bring raw up to date for block before the console reads it. Returns true
+// if raw was rewritten (the caller marks it dirty for the next flush).
+bool figure_sync_block(SkylanderFigure *fig, uint8_t block);
+
+// Re-encrypt every stale block; returns the mask of blocks rewritten
+uint64_t figure_sync_all(SkylanderFigure *fig);
+
+// Whether the console may write block on this kind of figure
+bool figure_block_writable(const SkylanderFigure *fig, uint8_t block);
+
+FigureType figure_type_for_id(uint16_t character_id);
+const char *figure_type_name(FigureType type);
+
+// Plaintext of block inside the active area (area_block = 0..27); NULL if
+// the figure has no data area yet.
+const uint8_t *figure_area_block(SkylanderFigure *fig, uint8_t area_block);
+
+// Field accessors, all reading the active area. 0 when there is none.
+uint32_t figure_xp(SkylanderFigure *fig);
+uint16_t figure_gold(SkylanderFigure *fig);         // gearbits on vehicles
+uint32_t figure_playtime(SkylanderFigure *fig);     // seconds on the portal
+uint16_t figure_upgrades(SkylanderFigure *fig);
+uint8_t figure_hat(SkylanderFigure *fig);
+
+// UTF-16 nickname, NUL-terminated; returns its length in characters
+size_t figure_nickname(SkylanderFigure *fig, uint16_t *out);
+
+// Trap contents: record 0 is the villain currently held. Returns the number
+// of non-empty records copied into out (at most FIGURE_TRAP_VILLAINS).
+int figure_trap_villains(SkylanderFigure *fig, FigureVillain *out);
+
+#endif // SKYLANDER_FIGURE_H
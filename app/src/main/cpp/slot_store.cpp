@@ -0,0 +1,336 @@
+// slot_store.cpp - mmap-backed figure slots
+#include "slot_store.h"
+#include "daemon_log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static SlotWriter g_writer;
+
+void slot_set_writer(SlotWriter writer) {
+    g_writer = writer;
+}
+
+void slot_init(PortalSlot *slot) {
+    memset(slot, 0, sizeof(*slot));
+    slot->fd = -1;
+    figure_detach(&slot->figure);
+}
+
+// Copy blocks into the supervisor's save. dirty is stored first, so a crash
+// part way through can only make a flush rewrite bytes the dump already has.
+static void save_blocks(PortalSlot *slot, uint64_t blocks) {
+    PortalSlotSave *save = slot->save;
+    if (!save) return;
+    save->dirty = slot->dirty | slot->writing;
+    while (blocks) {
+        size_t offset = (size_t)__builtin_ctzll(blocks) * PORTAL_BLOCK_SIZE;
+        if (offset + PORTAL_BLOCK_SIZE <= slot->size) {
+            memcpy(save->image + offset, slot->data + offset, PORTAL_BLOCK_SIZE);
+        }
+        blocks &= blocks - 1;
+    }
+}
+
+static uint64_t access_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int gap_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    if (!us) return 0;
+    int bucket = 64 - __builtin_clzll(us);
+    return bucket < SLOT_GAP_BUCKETS ? bucket : SLOT_GAP_BUCKETS - 1;
+}
+
+// One access: bump the block's counter and the gap since the last access
+// of the same kind. Only the I/O thread writes; relaxed is enough for a
+// reader that wants numbers, not ordering.
+static void count_access(uint32_t *blocks, uint32_t *gaps, uint64_t *last_ns, uint8_t block) {
+    __atomic_fetch_add(&blocks[block], 1, __ATOMIC_RELAXED);
+    uint64_t now = access_now_ns();
+    uint64_t last = __atomic_load_n(last_ns, __ATOMIC_RELAXED);
+    if (last) __atomic_fetch_add(&gaps[gap_bucket(now - last)], 1, __ATOMIC_RELAXED);
+    __atomic_store_n(last_ns, now, __ATOMIC_RELAXED);
+}
+
+int slot_attach_fd(PortalSlot *slot, int fd) {
+    slot_detach(slot);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (size > PORTAL_BUFFER_SIZE) size = PORTAL_BUFFER_SIZE;
+
+    // PROT_WRITE on a private mapping is fine even for an O_RDONLY fd;
+    // only slot_flush() needs the fd to be writable.
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    slot->map = (uint8_t *)map;
+    slot->data = slot->map;
+    slot->size = size;
+    slot->fd = fd;
+    slot->dirty = 0;
+    slot->typed = figure_attach(&slot->figure, slot->data, slot->size);
+    if (slot->save) {
+        memcpy(slot->save->image, slot->data, size);
+        slot->save->dirty = 0;
+        slot->save->dev = st.st_dev;
+        slot->save->ino = st.st_ino;
+        slot->save->size = (uint32_t)size;
+    }
+    return 0;
+}
+
+int slot_restore(PortalSlot *slot, int fd) {
+    PortalSlotSave *save = slot->save;
+    struct stat st;
+    if (!save || !save->size || save->size > PORTAL_BUFFER_SIZE || fstat(fd, &st) < 0 ||
+        (uint64_t)st.st_dev != save->dev || (uint64_t)st.st_ino != save->ino) {
+        close(fd);
+        return -ESTALE;
+    }
+
+    void *map = mmap(NULL, save->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    // The saved image is newer than the dump wherever dirty says so
+    slot->map = (uint8_t *)map;
+    slot->data = slot->map;
+    slot->size = save->size;
+    slot->fd = fd;
+    memcpy(slot->data, save->image, slot->size);
+    slot->dirty = save->dirty;
+    slot->typed = figure_attach(&slot->figure, slot->data, slot->size);
+    return 0;
+}
+
+static int flush_runs(PortalSlot *slot, SlotWriter writer) {
+    if (slot->typed) {
+        uint64_t synced = figure_sync_all(&slot->figure);
+        slot->dirty |= synced;
+        save_blocks(slot, synced);
+    }
+    if (!slot->data || !slot->dirty) return 0;
+
+    int status = 0;
+    uint64_t dirty = slot->dirty;
+    while (dirty) {
+        int block = __builtin_ctzll(dirty);
+
+        // Coalesce runs of adjacent dirty blocks into one pwrite
+        int end = block;
+        while (end + 1 < PORTAL_BLOCK_COUNT && (dirty & (1ULL << (end + 1)))) end++;
+
+        size_t offset = (size_t)block * PORTAL_BLOCK_SIZE;
+        size_t len = (size_t)(end - block + 1) * PORTAL_BLOCK_SIZE;
+        if (offset + len > slot->size) len = slot->size - offset;
+
+        uint64_t run = (end - block + 1 == 64) ? ~0ULL : (((1ULL << (end - block + 1)) - 1) << block);
+        dirty &= ~run;
+
+        int ret = writer ? writer(slot, offset, len, run) : -EAGAIN;
+        if (ret == 0 && writer) {
+            slot->dirty &= ~run;
+            slot->writing |= run;
+            continue;
+        }
+        if (ret == -EAGAIN && (slot->writing & run)) {
+            // Writing it here could land before the older queued copy
+            status = -EAGAIN;
+            continue;
+        }
+        if (ret == -EAGAIN) {
+            ret = (pwrite(slot->fd, slot->data + offset, len, offset) < 0) ? -errno : 0;
+        }
+        if (ret < 0) {
+            LOGE("Flush failed for blocks %d-%d: %d (%s)", block, end, -ret, strerror(-ret));
+            save_blocks(slot, 0);
+            return ret;
+        }
+        slot->dirty &= ~run;
+    }
+    save_blocks(slot, 0);
+    return status;
+}
+
+int slot_flush(PortalSlot *slot) {
+    return flush_runs(slot, g_writer);
+}
+
+void slot_write_done(PortalSlot *slot, uint64_t blocks, int status) {
+    slot->writing &= ~blocks;
+    if (status < 0) {
+        LOGE("Deferred flush of blocks %d-%d failed: %s; kept dirty", __builtin_ctzll(blocks),
+             63 - __builtin_clzll(blocks), strerror(-status));
+        slot->dirty |= blocks;
+        if (!slot->write_error) slot->write_error = status;
+    }
+    save_blocks(slot, 0);
+}
+
+int slot_detach(PortalSlot *slot) {
+    int ret = 0;
+    if (slot->data) {
+        if (slot->writing) {
+            LOGE("Slot detached with writes queued; writing them again");
+            slot->dirty |= slot->writing;
+            slot->writing = 0;
+        }
+        ret = flush_runs(slot, NULL);
+        munmap(slot->map, slot->size);
+    }
+    if (slot->fd >= 0) close(slot->fd);
+
+    PortalSlotSave *save = slot->save;
+    slot_init(slot);
+    slot->save = save;
+    if (save) save->size = 0;
+    return ret;
+}
+
+bool slot_copy_block(PortalSlot *slot, uint8_t block, uint8_t *out) {
+    size_t offset = (size_t)block * PORTAL_BLOCK_SIZE;
+    if (!slot->data || offset + PORTAL_BLOCK_SIZE > slot->size) return false;
+    if (slot->typed && figure_sync_block(&slot->figure, block)) {
+        slot->dirty |= 1ULL << block;
+        save_blocks(slot, 1ULL << block);
+    }
+    memcpy(out, slot->data + offset, PORTAL_BLOCK_SIZE);
+    return true;
+}
+
+void slot_note_read(PortalSlot *slot, uint8_t block) {
+    if (block >= PORTAL_BLOCK_COUNT) return;
+    count_access(slot->access.reads, slot->access.read_gaps, &slot->access.last_read_ns, block);
+}
+
+bool slot_read_block(PortalSlot *slot, uint8_t block, uint8_t *out) {
+    if (!slot_copy_block(slot, block, out)) return false;
+    slot_note_read(slot, block);
+    return true;
+}
+
+bool slot_write_block(PortalSlot *slot, uint8_t block, const uint8_t *in) {
+    size_t offset = (size_t)block * PORTAL_BLOCK_SIZE;
+    if (!slot->data || offset + PORTAL_BLOCK_SIZE > slot->size) return false;
+    if (slot->typed && !figure_block_writable(&slot->figure, block)) return false;
+    memcpy(slot->data + offset, in, PORTAL_BLOCK_SIZE);
+    slot->dirty |= 1ULL << block;
+    save_blocks(slot, 1ULL << block);
+    if (slot->typed) figure_invalidate(&slot->figure, block);
+    count_access(slot->access.writes, slot->access.write_gaps, &slot->access.last_write_ns, block);
+    return true;
+}
+
+uint8_t *slot_stage(PortalSlot *slot) {
+    if (!slot->data) return NULL;
+    if (slot->typed) {
+        uint64_t synced = figure_sync_all(&slot->figure);
+        slot->dirty |= synced;
+        save_blocks(slot, synced);
+    }
+
+    uint8_t *stage = (slot->data == slot->map) ? slot->shadow : slot->map;
+    memcpy(stage, slot->data, slot->size);
+    return stage;
+}
+
+void slot_publish(PortalSlot *slot, uint8_t *image, uint64_t changed) {
+    __atomic_store_n(&slot->data, image, __ATOMIC_RELEASE);
+    slot->figure.raw = image;
+    slot->dirty |= changed;
+    save_blocks(slot, changed);
+}
+
+// Upper end of the bucket holding fraction p of the gaps, in microseconds
+static uint64_t gap_percentile(const uint32_t *gaps, double p) {
+    uint64_t total = 0;
+    for (int i = 0; i < SLOT_GAP_BUCKETS; i++) total += __atomic_load_n(&gaps[i], __ATOMIC_RELAXED);
+    if (!total) return 0;
+    uint64_t rank = (uint64_t)(p * total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    int i = 0;
+    for (; i < SLOT_GAP_BUCKETS - 1; i++) {
+        seen += __atomic_load_n(&gaps[i], __ATOMIC_RELAXED);
+        if (seen >= rank) break;
+    }
+    return i ? (1ULL << i) - 1 : 0;
+}
+
+static uint64_t count_blocks(const uint32_t *counts, int *touched, int *hottest) {
+    uint64_t total = 0;
+    uint32_t best = 0;
+    *touched = 0;
+    *hottest = -1;
+    for (int b = 0; b < PORTAL_BLOCK_COUNT; b++) {
+        uint32_t n = __atomic_load_n(&counts[b], __ATOMIC_RELAXED);
+        total += n;
+        if (n) (*touched)++;
+        if (n > best) {
+            best = n;
+            *hottest = b;
+        }
+    }
+    return total;
+}
+
+// 16 blocks per line, rows nobody touched left out
+static void log_heatmap(int index, const char *kind, const uint32_t *counts) {
+    for (int row = 0; row < PORTAL_BLOCK_COUNT; row += 16) {
+        char line[160];
+        int len = 0;
+        bool any = false;
+        for (int b = row; b < row + 16; b++) {
+            uint32_t n = __atomic_load_n(&counts[b], __ATOMIC_RELAXED);
+            any |= n != 0;
+            len += snprintf(line + len, sizeof(line) - len, " %u", n);
+            if (len >= (int)sizeof(line)) break;
+        }
+        if (any) LOGI("  slot %d %s %02d-%02d:%s", index, kind, row, row + 15, line);
+    }
+}
+
+void slot_log_access(int index, PortalSlot *slot, bool heatmap) {
+    SlotAccessStats *a = &slot->access;
+    int read_blocks, write_blocks, hot_read, hot_write;
+    uint64_t reads = count_blocks(a->reads, &read_blocks, &hot_read);
+    uint64_t writes = count_blocks(a->writes, &write_blocks, &hot_write);
+    if (reads + writes == a->reported && !heatmap) return;
+    a->reported = reads + writes;
+
+    LOGI("Slot %d access: %llu reads of %d blocks (most: %d), %llu writes of %d blocks "
+         "(most: %d); read gap p50 <= %llu us, p90 <= %llu us; write gap p50 <= %llu us",
+         index, (unsigned long long)reads, read_blocks, hot_read, (unsigned long long)writes,
+         write_blocks, hot_write, (unsigned long long)gap_percentile(a->read_gaps, 0.5),
+         (unsigned long long)gap_percentile(a->read_gaps, 0.9),
+         (unsigned long long)gap_percentile(a->write_gaps, 0.5));
+    if (!heatmap) return;
+    log_heatmap(index, "reads", a->reads);
+    log_heatmap(index, "writes", a->writes);
+}
@@ -0,0 +1,126 @@
+#ifndef SLOT_STORE_H
+#define SLOT_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "skylander_figure.h"
+
+#define MAX_SLOTS 2
+#define PORTAL_BUFFER_SIZE 1024
+#define PORTAL_BLOCK_SIZE 16
+#define PORTAL_BLOCK_COUNT (PORTAL_BUFFER_SIZE / PORTAL_BLOCK_SIZE)
+#define SLOT_GAP_BUCKETS 24     // log2 microseconds: < 1 us, 1 us, 2-3 us ... >= 4 s
+
+// A figure on the portal. data is a MAP_PRIVATE view of the dump fd the app
+// handed over, so loading costs no read() and 0x57 writes land in private
+// copy-on-write pages until slot_flush() pwrite()s them back. figure is the
+// typed view of the same bytes and holds their plaintext; reads and flushes
+// re-encrypt any block edited through it first.
+//
+// data is the live image and is only ever replaced whole: an edit is built
+// in whichever of map/shadow is not live and swapped in by slot_publish().
+//
+// A flush through the writer (see SlotWriter) moves blocks from dirty to
+// writing; slot_write_done() clears them once they are in the dump, or puts
+// them back in dirty if the write failed, so no write is ever lost.
+//
+// Under the supervisor every change is also mirrored into a PortalSlotSave
+// the parent process keeps, so a restarted worker can slot_restore() it.
+struct PortalSlotSave {
+    uint32_t size;      // 0 while the slot is empty
+    uint32_t reserved;
+    uint64_t dev;       // identity of the dump the image belongs to
+    uint64_t ino;
+    uint64_t dirty;     // dirty | writing of the slot
+    uint8_t image[PORTAL_BUFFER_SIZE];
+};
+
+// How the console uses the figure in a slot: reads and writes per block and
+// the time between one access and the next. Counted with relaxed atomic
+// increments on every 0x51/0x57, so they stay on in production; reset when
+// a figure is attached.
+struct SlotAccessStats {
+    uint32_t reads[PORTAL_BLOCK_COUNT];
+    uint32_t writes[PORTAL_BLOCK_COUNT];
+    uint32_t read_gaps[SLOT_GAP_BUCKETS];
+    uint32_t write_gaps[SLOT_GAP_BUCKETS];
+    uint64_t last_read_ns;
+    uint64_t last_write_ns;
+    uint64_t reported;      // reads + writes at the last slot_log_access()
+};
+
+struct PortalSlot {
+    uint8_t *data;
+    uint8_t *map;
+    size_t size;
+    int fd;
+    uint64_t dirty;     // one bit per 16-byte block written since the last flush
+    uint64_t writing;   // blocks handed to the writer and not yet confirmed
+    int write_error;    // first failed write since the owner last cleared it
+    bool present;
+    bool loaded;
+    bool typed;         // figure is attached (dump is a full 1 KiB tag)
+    SkylanderFigure figure;
+    PortalSlotSave *save;   // NULL unless running under the supervisor
+    SlotAccessStats access;
+    uint8_t shadow[PORTAL_BUFFER_SIZE];
+};
+
+// Reset an unused slot (fd = -1, nothing mapped).
+void slot_init(PortalSlot *slot);
+
+// Map fd into the slot (takes ownership of fd). Returns 0 or -errno.
+int slot_attach_fd(PortalSlot *slot, int fd);
+
+// Rebuild a slot from slot->save after a worker restart (takes ownership of
+// fd). -ESTALE if fd is not the dump the saved image came from.
+int slot_restore(PortalSlot *slot, int fd);
+
+// Write dirty blocks back to the dump, or hand them to the writer. Returns
+// 0 or -errno; with slot->writing set the flush is only done once
+// slot_write_done() has cleared it.
+int slot_flush(PortalSlot *slot);
+
+// How slot_flush() writes one run of dirty bytes (blocks, at offset in
+// slot->data) back to the dump. The default (NULL) pwrite()s on the
+// calling thread; the daemon queues a copy for its persistence thread
+// instead and reports back through slot_write_done(). Returns 0 or -errno;
+// on -EAGAIN slot_flush() writes the run itself, unless an earlier write
+// of the same blocks is still queued, in which case the run stays dirty.
+typedef int (*SlotWriter)(PortalSlot *slot, size_t offset, size_t len, uint64_t blocks);
+void slot_set_writer(SlotWriter writer);
+
+// The writer finished blocks with status (0 or -errno)
+void slot_write_done(PortalSlot *slot, uint64_t blocks, int status);
+
+// Write what is still dirty on the calling thread, unmap and close.
+// Returns the flush's status. Queued writes must have finished first
+// (slot->writing clear).
+int slot_detach(PortalSlot *slot);
+
+// Copy one block out of the figure; false if block is past the dump.
+bool slot_read_block(PortalSlot *slot, uint8_t block, uint8_t *out);
+
+// The two halves of slot_read_block(), for a reply built ahead of the read
+// it answers: copy without counting an access, and count one when the
+// reply is sent.
+bool slot_copy_block(PortalSlot *slot, uint8_t block, uint8_t *out);
+void slot_note_read(PortalSlot *slot, uint8_t block);
+
+// Overwrite one block in the mapping and mark it dirty. Refuses blocks the
+// figure type does not allow the console to write.
+bool slot_write_block(PortalSlot *slot, uint8_t block, const uint8_t *in);
+
+// Log the access counters of the figure in slot index: a one-line summary
+// if anything happened since the last call, or with heatmap the per-block
+// counts too (when the figure leaves the portal).
+void slot_log_access(int index, PortalSlot *slot, bool heatmap);
+
+// Copy of the live image to edit; NULL if no figure is mapped.
+uint8_t *slot_stage(PortalSlot *slot);
+
+// Make a staged image live in one pointer store; changed marks the blocks
+// that differ so the next flush writes them.
+void slot_publish(PortalSlot *slot, uint8_t *image, uint64_t changed);
+
+#endif // SLOT_STORE_H
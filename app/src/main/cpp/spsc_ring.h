@@ -0,0 +1,46 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+// Bounded lock-free single-producer/single-consumer ring.
+// push() and pop() never block; a full ring rejects the push so the producer
+// decides what to drop.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+template <class T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    bool push(const T &item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == N) return false;
+        items_[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) return false;
+        item = items_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called from neither side
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+private:
+    alignas(64) std::atomic<uint32_t> head_{0};
+    alignas(64) std::atomic<uint32_t> tail_{0};
+    alignas(64) T items_[N];
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,113 @@
+#ifndef STAGE_QUEUE_H
+#define STAGE_QUEUE_H
+
+// One hop between two daemon threads: a bounded SPSC ring plus an eventfd
+// that wakes the consumer, and the numbers showing how the hop is doing.
+//
+// push() never blocks; a full queue counts a drop and lets the producer
+// decide what to do. The consumer polls wake_fd(), calls clear_wake() and
+// then pop()s until empty; pop() records how long each item waited.
+// report() logs depth and wait time since the previous report (consumer).
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include "spsc_ring.h"
+#include "portal_rt.h"
+#include "daemon_log.h"
+
+#define STAGE_REPORT_MS 10000
+
+static inline uint64_t stage_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+template <class T, size_t N>
+class StageQueue {
+public:
+    int open(const char *name) {
+        name_ = name;
+        wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        return wake_fd_ < 0 ? -errno : 0;
+    }
+
+    void close_wake() {
+        if (wake_fd_ >= 0) close(wake_fd_);
+        wake_fd_ = -1;
+    }
+
+    // Producer
+    bool push(const T &item) {
+        entry_.item = item;
+        entry_.queued_ns = stage_now_ns();
+        if (!ring_.push(entry_)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint32_t depth = (uint32_t)ring_.size();
+        if (depth > max_depth_.load(std::memory_order_relaxed)) {
+            max_depth_.store(depth, std::memory_order_relaxed);
+        }
+        wake();
+        return true;
+    }
+
+    // Either side: make the consumer look at the queue
+    void wake() {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {}  // only fails once the count is huge
+    }
+
+    // Consumer
+    bool pop(T &item) {
+        if (!ring_.pop(out_)) return false;
+        item = out_.item;
+        latency_record(&wait_, stage_now_ns() - out_.queued_ns);
+        return true;
+    }
+
+    void clear_wake() {
+        uint64_t count;
+        if (read(wake_fd_, &count, sizeof(count)) < 0) {}
+    }
+
+    int wake_fd() const { return wake_fd_; }
+    size_t depth() const { return ring_.size(); }
+    bool full() const { return ring_.size() == N; }
+
+    // Consumer: log what happened since the last report, if anything did
+    void report() {
+        uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        if (!wait_.count && !dropped) return;
+        LOGI("Stage %s: %llu items, depth %zu (max %u of %zu), wait p50 %.1f us, "
+             "p99 %.1f us, max %.1f us, %u dropped",
+             name_, (unsigned long long)wait_.count, ring_.size(),
+             max_depth_.exchange(0, std::memory_order_relaxed), N,
+             latency_percentile(&wait_, 0.5) / 1000.0,
+             latency_percentile(&wait_, 0.99) / 1000.0, wait_.max_ns / 1000.0, dropped);
+        memset(&wait_, 0, sizeof(wait_));
+    }
+
+private:
+    struct Entry {
+        T item;
+        uint64_t queued_ns;
+    };
+
+    SpscRing<Entry, N> ring_;
+    Entry entry_;                       // producer scratch, kept off the stack
+    Entry out_;                         // consumer scratch
+    const char *name_ = "";
+    int wake_fd_ = -1;
+    std::atomic<uint32_t> dropped_{0};
+    std::atomic<uint32_t> max_depth_{0};
+    LatencyHistogram wait_ = {};
+};
+
+#endif // STAGE_QUEUE_H
@@ -0,0 +1,184 @@
+// alloc_audit_test.cpp - the packet path allocates nothing once warm
+//
+// Built with PORTAL_MALLOC_AUDIT, so every malloc and operator new on this
+// thread is counted (portal_mem.cpp). One pass of the traffic a game sends
+// (SETUP requests, 0x51 reads that stage replies ahead, 0x57 writes, sense
+// and LED commands, and a stretch with ep_in stalled so reports queue)
+// warms everything up; further passes must not change
+// mem_thread_allocations(). Exits non-zero otherwise (ctest: alloc_audit).
+#include "portal_commands.h"
+#include "ep0_cache.h"
+#include "figure_generator.h"
+#include "portal_led.h"
+#include "portal_mem.h"
+#include "daemon_log.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define AUDIT_PASSES 50
+
+struct FakePort {
+    const uint8_t *data_stage;      // what the host sends after an OUT SETUP
+    size_t data_stage_len;
+    bool stalled;                   // ep_in writes fail with EAGAIN
+    uint64_t reports;               // written to ep_in
+};
+
+static FakePort g_port;
+static PortalSlot g_slots[MAX_SLOTS];
+static PortalDevice g_dev;
+static MemArena g_mem;
+static MemPool g_reports;
+
+// Format every line, as the daemon's sink does, then drop it
+static void quiet_log(FILE *, const char *, const char *fmt, va_list ap) {
+    char line[256];
+    vsnprintf(line, sizeof(line), fmt, ap);
+}
+
+static ssize_t fake_ep0_read(void *, void *buf, size_t len) {
+    size_t n = len < g_port.data_stage_len ? len : g_port.data_stage_len;
+    if (n) memcpy(buf, g_port.data_stage, n);
+    return (ssize_t)n;
+}
+
+static ssize_t fake_ep0_write(void *, const void *, size_t len) {
+    return (ssize_t)len;
+}
+
+static ssize_t fake_ep_in_write(void *, const void *, size_t len) {
+    if (g_port.stalled) {
+        errno = EAGAIN;
+        return -1;
+    }
+    g_port.reports++;
+    return (ssize_t)len;
+}
+
+static void command(uint8_t a, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) {
+    uint8_t report[32] = { a, b, c, d };
+    handle_portal_command(&g_dev, report, sizeof(report));
+}
+
+static void setup(uint8_t type, uint8_t request, uint16_t value, uint16_t length,
+                  const uint8_t *stage = NULL, size_t stage_len = 0) {
+    struct usb_ctrlrequest req;
+    req.bRequestType = type;
+    req.bRequest = request;
+    req.wValue = htole16(value);
+    req.wIndex = 0;
+    req.wLength = htole16(length);
+    g_port.data_stage = stage;
+    g_port.data_stage_len = stage_len;
+    handle_setup_request(&g_dev, &req);
+}
+
+// What a game does with two figures on the portal
+static void one_pass(void) {
+    static const uint8_t sense[32] = { 0x53 };
+
+    setup(USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DT_DEVICE << 8, 18);
+    setup(USB_DIR_IN, USB_REQ_GET_DESCRIPTOR, USB_DT_CONFIG << 8, 255);
+    setup(USB_DIR_IN | USB_RECIP_INTERFACE, USB_REQ_GET_DESCRIPTOR, 0x22 << 8, 255);
+    setup(USB_TYPE_CLASS | USB_RECIP_INTERFACE, 0x09, 0x0200, sizeof(sense), sense, sizeof(sense));
+    setup(USB_DIR_IN, 0x7F, 0, 8);                  // unknown: stalled
+
+    command(0x41, 0x01);
+    command(0x53);
+    for (uint8_t slot = 0; slot < MAX_SLOTS; slot++) {
+        for (uint8_t block = 0; block < PORTAL_BLOCK_COUNT; block++) command(0x51, 0x10 + slot, block);
+    }
+    command(0x51, 0x10, 9);                         // out of sequence: drops what was staged
+    command(0x57, 0x10, 0x0A, 0x5A);
+    command(0x43, 0x10, 0x20, 0x30);
+    command(0x4A, 0x00, 0x40, 0x50);
+    command(0x4C, 0x02, 0x60, 0x70);
+
+    // The host stops polling ep_in: replies, sense and echoes queue, and
+    // the reply queue overflows
+    g_port.stalled = true;
+    for (uint8_t block = 0; block < 24; block++) command(0x51, 0x11, block);
+    command(0x53);
+    command(0x53);
+    for (int i = 0; i < 6; i++) command(0x43, 0x10, (uint8_t)i, 0x30);
+    g_port.stalled = false;
+    usleep((EP_IN_RETRY_MS + 1) * 1000);
+    portal_flush_in(&g_dev);
+    portal_send_sense(&g_dev);
+}
+
+int main(void) {
+    if (!mem_audit_enabled()) {
+        fprintf(stderr, "FAIL: built without PORTAL_MALLOC_AUDIT\n");
+        return 1;
+    }
+    t_log_sink = quiet_log;
+    led_init(NULL, false);
+
+    uint8_t figure[FIGURE_IMAGE_SIZE];
+    FigureTemplate t = { 0x1A2B3C4Du, 0x0E, 0x3000 };
+    figure_generate(&t, figure);
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        slot_init(&g_slots[i]);
+        int fd = memfd_create("alloc_audit_slot", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, sizeof(figure)) < 0 ||
+            pwrite(fd, figure, sizeof(figure), 0) != (ssize_t)sizeof(figure) ||
+            slot_attach_fd(&g_slots[i], fd) < 0) {
+            fprintf(stderr, "FAIL: slot %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        g_slots[i].present = true;
+        g_slots[i].loaded = true;
+    }
+
+    if (mem_region_init(&g_mem, "audit", 16 * 1024) < 0 ||
+        mem_pool_init(&g_reports, &g_mem, "reports", sizeof(PortalReport),
+                      MAX_SLOTS * PRESTAGE_DEPTH + EP_IN_QUEUE_REPORTS) < 0) {
+        fprintf(stderr, "FAIL: report pool\n");
+        return 1;
+    }
+    g_dev.profile = profile_builtin("wii");
+    PortalDescriptorBlob descriptors = profile_descriptors(g_dev.profile);
+    ep0_cache_init(descriptors.hid_report, descriptors.hid_report_len);
+    g_dev.slots = g_slots;
+    g_dev.reports = &g_reports;
+    g_dev.feedback = true;
+    g_dev.transport.ep0_read = fake_ep0_read;
+    g_dev.transport.ep0_write = fake_ep0_write;
+    g_dev.transport.ep_in_write = fake_ep_in_write;
+
+    one_pass();
+    uint64_t warm = mem_thread_allocations();
+    for (int i = 0; i < AUDIT_PASSES; i++) one_pass();
+    uint64_t steady = mem_thread_allocations() - warm;
+
+    int failures = 0;
+    if (steady) {
+        fprintf(stderr, "FAIL: %llu heap allocations in %d passes after warm-up\n",
+                (unsigned long long)steady, AUDIT_PASSES);
+        failures++;
+    }
+    if (!g_dev.prestage.hits || !g_dev.in.stats.retried || !g_dev.in.stats.overflow) {
+        fprintf(stderr, "FAIL: staging or the ep_in queue was not exercised\n");
+        failures++;
+    }
+
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        portal_drop_staged(&g_dev, i);
+        slot_detach(&g_slots[i]);
+    }
+    portal_drop_in(&g_dev);
+    if (g_reports.in_use.load() != 0) {
+        fprintf(stderr, "FAIL: %u reports not returned to the pool\n", g_reports.in_use.load());
+        failures++;
+    }
+    if (failures) return 1;
+    printf("alloc_audit: ok (%llu reports, %llu staged replies sent)\n",
+           (unsigned long long)g_port.reports, (unsigned long long)g_dev.prestage.hits);
+    return 0;
+}
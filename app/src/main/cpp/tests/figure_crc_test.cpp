@@ -0,0 +1,153 @@
+// figure_crc_test.cpp - area checksums against known-good tag data
+//
+// The fixture is the active data area of a used figure as the game wrote
+// it, checksums included. Its stored CRCs must match what figure_editor
+// recomputes, an edit must store the CRCs the game expects for the new
+// bytes, and a generated figure must carry the checksums of an empty
+// area. Exits non-zero if any check fails (ctest: figure_crc).
+#include "figure_editor.h"
+#include "figure_generator.h"
+#include "skylander_crypto.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Plaintext of area blocks 0-8 (0x08-0x10); the trailers at 3 and 7 are
+// left as generated
+static const uint8_t k_area[9][SKYLANDER_BLOCK_SIZE] = {
+    // xp 2620, gold 1234, 3600 s, sequence 5, CRC3 0x1627, CRC2 0x9042, CRC1 0xafc9
+    { 0x3c, 0x0a, 0x00, 0xd2, 0x04, 0x10, 0x0e, 0x00, 0x00, 0x05, 0x27, 0x16, 0x42, 0x90, 0xc9, 0xaf },
+    // upgrades 0x0123 at byte 0, hat 0x0b at byte 4
+    { 0x23, 0x01, 0x00, 0x00, 0x0b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f },
+    // nickname "Spyro"
+    { 0x53, 0x00, 0x70, 0x00, 0x79, 0x00, 0x72, 0x00, 0x6f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0 },
+    { 0 },
+    { 0x0d, 0x1f, 0x0e, 0x0b, 0x0a, 0x07, 0xe7, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc4, 0x01, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa4, 0x10 },
+    { 0 },
+    { 0x1e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
+
+// Area block 0 after setting xp 100000 and nickname "Sparx": sequence 6,
+// CRC3 unchanged, CRC2 0x089b, CRC1 0xd40f
+static const uint8_t k_edited_block0[SKYLANDER_BLOCK_SIZE] = {
+    0xa0, 0x86, 0x01, 0xd2, 0x04, 0x10, 0x0e, 0x00, 0x00, 0x06, 0x27, 0x16, 0x9b, 0x08, 0x0f, 0xd4
+};
+
+#define FIXTURE_UPGRADES 0x0123
+#define FIXTURE_HAT 0x0b
+
+#define CRC_EMPTY_AREA3 0xE046      // 0x110 zero bytes
+#define CRC_EMPTY_AREA2 0xDF9D      // 0x30 zero bytes
+
+static int g_failures;
+
+static void expect(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAIL: %s\n", what);
+    g_failures++;
+}
+
+static uint16_t load_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Stored checksums of the active area against the recomputed ones
+static void check_area(SkylanderFigure *fig, uint16_t crc3, uint16_t crc2, const char *what) {
+    uint8_t first = FIGURE_AREA_START[fig->active_area];
+    const uint8_t *header = figure_plain_block(fig, first);
+    char line[96];
+
+    snprintf(line, sizeof(line), "%s: stored CRC3 %04x", what, load_le16(header + FIGURE_CRC3_OFFSET));
+    expect(load_le16(header + FIGURE_CRC3_OFFSET) == crc3, line);
+    expect(figure_area_crc3(fig, first) == crc3, "recomputed CRC3");
+    snprintf(line, sizeof(line), "%s: stored CRC2 %04x", what, load_le16(header + FIGURE_CRC2_OFFSET));
+    expect(load_le16(header + FIGURE_CRC2_OFFSET) == crc2, line);
+    expect(figure_area_crc2(fig, first) == crc2, "recomputed CRC2");
+    snprintf(line, sizeof(line), "%s: stored CRC1 %04x", what, load_le16(header + FIGURE_CRC1_OFFSET));
+    expect(load_le16(header + FIGURE_CRC1_OFFSET) == figure_area_crc1(header), line);
+}
+
+static void check_known_good(void) {
+    uint8_t tag[FIGURE_IMAGE_SIZE];
+    FigureTemplate t = { 0x1A2B3C4Du, 0x0E, 0x3000 };
+    figure_generate(&t, tag);
+    for (uint8_t b = 0; b < 9; b++) {
+        if (b == 3 || b == 7) continue;
+        uint8_t block = FIGURE_AREA_START[0] + b;
+        skylander_encrypt_tag_block(tag, block, k_area[b], tag + block * SKYLANDER_BLOCK_SIZE);
+    }
+
+    SkylanderFigure fig;
+    expect(figure_attach(&fig, tag, sizeof(tag)), "attach fixture");
+    expect(fig.active_area == 0, "fixture area 0 active");
+    check_area(&fig, load_le16(k_area[0] + FIGURE_CRC3_OFFSET),
+               load_le16(k_area[0] + FIGURE_CRC2_OFFSET), "fixture");
+    expect(figure_upgrades(&fig) == FIXTURE_UPGRADES, "fixture upgrades");
+    expect(figure_hat(&fig) == FIXTURE_HAT, "fixture hat");
+
+    FigureEdit edit;
+    memset(&edit, 0, sizeof(edit));
+    edit.fields = FIGURE_EDIT_XP | FIGURE_EDIT_NICKNAME;
+    edit.xp = 100000;
+    const char *name = "Sparx";
+    for (int i = 0; name[i]; i++) edit.nickname[i] = (uint16_t)name[i];
+
+    uint8_t stage[FIGURE_IMAGE_SIZE];
+    memcpy(stage, tag, sizeof(stage));
+    uint64_t changed;
+    expect(figure_edit_stage(&fig, &edit, stage, &changed) == 0, "edit");
+
+    uint8_t block0[SKYLANDER_BLOCK_SIZE];
+    uint8_t first = FIGURE_AREA_START[0];
+    skylander_decrypt_tag_block(stage, first, stage + first * SKYLANDER_BLOCK_SIZE, block0);
+    expect(memcmp(block0, k_edited_block0, sizeof(block0)) == 0, "edited area block 0");
+    figure_detach(&fig);
+
+    expect(figure_attach(&fig, stage, sizeof(stage)), "attach edited");
+    check_area(&fig, load_le16(k_edited_block0 + FIGURE_CRC3_OFFSET),
+               load_le16(k_edited_block0 + FIGURE_CRC2_OFFSET), "edited");
+    expect(figure_upgrades(&fig) == FIXTURE_UPGRADES, "upgrades kept by the edit");
+    expect(figure_hat(&fig) == FIXTURE_HAT, "hat kept by the edit");
+
+    // Hat and upgrades land where the getters (and the game) read them
+    memset(&edit, 0, sizeof(edit));
+    edit.fields = FIGURE_EDIT_HAT | FIGURE_EDIT_UPGRADES;
+    edit.hat = 0x2a;
+    edit.upgrades = 0x0fff;
+    uint8_t restage[FIGURE_IMAGE_SIZE];
+    memcpy(restage, stage, sizeof(restage));
+    expect(figure_edit_stage(&fig, &edit, restage, &changed) == 0, "hat edit");
+    figure_detach(&fig);
+
+    expect(figure_attach(&fig, restage, sizeof(restage)), "attach hat edit");
+    expect(figure_upgrades(&fig) == 0x0fff, "edited upgrades");
+    expect(figure_hat(&fig) == 0x2a, "edited hat");
+    uint8_t block1[SKYLANDER_BLOCK_SIZE];
+    skylander_decrypt_tag_block(restage, first + 1, restage + (first + 1) * SKYLANDER_BLOCK_SIZE, block1);
+    expect(load_le16(block1) == 0x0fff && block1[4] == 0x2a, "hat edit layout");
+    check_area(&fig, figure_area_crc3(&fig, first), figure_area_crc2(&fig, first), "hat edit");
+    figure_detach(&fig);
+}
+
+static void check_generated(void) {
+    uint8_t tag[FIGURE_IMAGE_SIZE];
+    FigureTemplate t = { 0x0BADF00Du, 0x1CE, 0x0000 };
+    figure_generate(&t, tag);
+
+    SkylanderFigure fig;
+    expect(figure_attach(&fig, tag, sizeof(tag)), "attach generated");
+    expect(fig.active_area == 0, "generated area 0 active");
+    check_area(&fig, CRC_EMPTY_AREA3, CRC_EMPTY_AREA2, "generated");
+    figure_detach(&fig);
+}
+
+int main(void) {
+    expect(skylander_crc16((const uint8_t *)"123456789", 9) == 0x29B1, "CRC16-CCITT check value");
+    check_known_good();
+    check_generated();
+    if (g_failures) return 1;
+    printf("figure_crc: ok\n");
+    return 0;
+}
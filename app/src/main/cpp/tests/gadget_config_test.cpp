@@ -0,0 +1,201 @@
+// gadget_config_test.cpp - gadget setup and teardown on a fake configfs tree
+//
+// A temporary directory stands in for the configfs gadget directory,
+// /sys/class/udc and the functionfs mount point (mount_ffs off), as the
+// header describes. gadget_up() runs twice (the second call reuses what is
+// there), gadget_bind() picks the configured UDC and gadget_down() must leave
+// the tree as it found it. A failure on the last step of gadget_up() must
+// roll back everything that call created. Exits non-zero if any check
+// fails (ctest: gadget_config).
+#include "gadget_config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_PATH_MAX 256
+
+static int g_failures;
+static char g_root[TEST_PATH_MAX];
+
+static void expect(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAIL: %s\n", what);
+    g_failures++;
+}
+
+static const char *in_root(char *out, const char *rel) {
+    snprintf(out, TEST_PATH_MAX, "%s/%s", g_root, rel);
+    return out;
+}
+
+static bool exists(const char *rel) {
+    char path[TEST_PATH_MAX];
+    struct stat st;
+    return lstat(in_root(path, rel), &st) == 0;
+}
+
+static bool is_link(const char *rel) {
+    char path[TEST_PATH_MAX];
+    struct stat st;
+    return lstat(in_root(path, rel), &st) == 0 && S_ISLNK(st.st_mode);
+}
+
+// Contents of a file without the trailing newline; "" if missing
+static void read_file(const char *rel, char *out, size_t size) {
+    char path[TEST_PATH_MAX];
+    out[0] = '\0';
+    int fd = open(in_root(path, rel), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, out, size - 1);
+    close(fd);
+    if (n < 0) n = 0;
+    while (n > 0 && out[n - 1] == '\n') n--;
+    out[n] = '\0';
+}
+
+static void write_file(const char *rel, const char *value) {
+    char path[TEST_PATH_MAX];
+    int fd = open(in_root(path, rel), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    if (write(fd, value, strlen(value)) < 0) expect(false, "write fixture file");
+    close(fd);
+}
+
+static void make_dir(const char *rel) {
+    char path[TEST_PATH_MAX];
+    expect(mkdir(in_root(path, rel), 0755) == 0, rel);
+}
+
+static int entries(const char *rel) {
+    char path[TEST_PATH_MAX];
+    DIR *dir = opendir(in_root(path, rel));
+    if (!dir) return -1;
+    int count = 0;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+// What gadget_up() builds for instance "portal"
+static const char *const k_tree[] = {
+    "gadgets/portal/idVendor",
+    "gadgets/portal/idProduct",
+    "gadgets/portal/strings/0x409/manufacturer",
+    "gadgets/portal/strings/0x409/product",
+    "gadgets/portal/strings/0x409/serialnumber",
+    "gadgets/portal/configs/c.1/MaxPower",
+    "gadgets/portal/configs/c.1/strings/0x409/configuration",
+    "gadgets/portal/functions/ffs.portal",
+};
+
+static void check_tree(const PortalProfile *profile, const char *what) {
+    char line[TEST_PATH_MAX + 32];
+    for (const char *rel : k_tree) {
+        snprintf(line, sizeof(line), "%s: %s", what, rel);
+        expect(exists(rel), line);
+    }
+    snprintf(line, sizeof(line), "%s: function linked into c.1", what);
+    expect(is_link("gadgets/portal/configs/c.1/ffs.portal"), line);
+
+    char value[64];
+    char want[16];
+    snprintf(want, sizeof(want), "0x%04x", profile->vid);
+    read_file("gadgets/portal/idVendor", value, sizeof(value));
+    snprintf(line, sizeof(line), "%s: idVendor %s", what, value);
+    expect(strcmp(value, want) == 0, line);
+    read_file("gadgets/portal/strings/0x409/product", value, sizeof(value));
+    snprintf(line, sizeof(line), "%s: product \"%s\"", what, value);
+    expect(strcmp(value, profile->product) == 0, line);
+}
+
+static void check_up_bind_down(GadgetConfig *cfg, const PortalProfile *profile) {
+    expect(gadget_up(cfg, profile) == 0, "first gadget_up");
+    check_tree(profile, "first up");
+    char value[64];
+    read_file("gadgets/other/UDC", value, sizeof(value));
+    expect(value[0] == '\0', "other gadget released its UDC");
+
+    expect(gadget_up(cfg, profile) == 0, "second gadget_up");
+    check_tree(profile, "second up");
+
+    expect(gadget_bind(cfg) == 0, "gadget_bind");
+    read_file("gadgets/portal/UDC", value, sizeof(value));
+    expect(strcmp(value, "dummy_udc.1") == 0, "bound to the second UDC");
+    expect(gadget_bind(cfg) == 0, "gadget_bind when bound");
+
+    cfg->udc_index = 2;
+    expect(gadget_bind(cfg) == -ENODEV, "gadget_bind to a missing UDC");
+    cfg->udc_index = 1;
+
+    expect(gadget_down(cfg, false) == 0, "gadget_down");
+    expect(!exists("gadgets/portal"), "gadget removed");
+    expect(entries("gadgets") == 1, "only the other gadget left");
+    expect(gadget_down(cfg, false) == 0, "gadget_down when already down");
+}
+
+// The functionfs mount point's parent is a file, so gadget_up() fails on its
+// last mkdir with everything else in place
+static void check_rollback(GadgetConfig *cfg, const PortalProfile *profile) {
+    char ffs_dir[TEST_PATH_MAX];
+    write_file("blocked", "");
+    cfg->ffs_dir = in_root(ffs_dir, "blocked/portal");
+    cfg->mount_ffs = true;
+
+    expect(gadget_up(cfg, profile) == -ENOTDIR, "gadget_up fails on the mount point");
+    expect(!exists("gadgets/portal"), "rollback removed the gadget");
+    expect(entries("gadgets") == 1, "rollback left the other gadget alone");
+    expect(exists("blocked"), "rollback kept what it did not create");
+}
+
+int main(void) {
+    snprintf(g_root, sizeof(g_root), "/tmp/gadget_config_test.XXXXXX");
+    if (!mkdtemp(g_root)) {
+        fprintf(stderr, "FAIL: mkdtemp: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Configfs root with another (Android's) gadget bound, and two UDCs
+    make_dir("gadgets");
+    make_dir("gadgets/other");
+    write_file("gadgets/other/UDC", "dummy_udc.0\n");
+    make_dir("udc");
+    write_file("udc/dummy_udc.1", "");
+    write_file("udc/dummy_udc.0", "");
+    make_dir("ffs");
+
+    char gadget_dir[TEST_PATH_MAX];
+    char ffs_dir[TEST_PATH_MAX];
+    char udc_dir[TEST_PATH_MAX];
+    GadgetConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.gadget_dir = in_root(gadget_dir, "gadgets/portal");
+    cfg.ffs_dir = in_root(ffs_dir, "ffs/portal");
+    cfg.udc_dir = in_root(udc_dir, "udc");
+    cfg.udc_index = 1;
+
+    const PortalProfile *profile = profile_builtin("wii");
+    expect(profile != NULL, "built-in profile");
+    if (profile) {
+        check_up_bind_down(&cfg, profile);
+        check_rollback(&cfg, profile);
+    }
+
+    nftw(g_root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (g_failures) return 1;
+    printf("gadget_config: ok\n");
+    return 0;
+}
@@ -0,0 +1,408 @@
+// aes_bench.cpp - AES and tag crypto throughput
+//
+//   aes_bench [--figures N] [--seconds S] [--ghz F]
+//   aes_bench --verify                 (bitsliced AES against rijndael.c)
+//
+// Built three times from the same sources: aes_bench against rijndael.c
+// as shipped (FULL_UNROLL), aes_bench_looped with RIJNDAEL_LOOPED, and
+// aes_bench_tables with tag crypto on rijndael instead of aes_ct
+// (SKYLANDER_TABLE_AES), so they can be run on the same host and compared
+// row by row. Cycles come from the TSC on x86, or from --ghz (nanoseconds
+// times the core clock), which also overrides the TSC when it does not
+// tick at the core clock.
+#include "rijndael.h"
+#include "aes_ct.h"
+#include "skylander_crypto.h"
+#include "figure_generator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef RIJNDAEL_LOOPED
+#define RIJNDAEL_VARIANT "rijndael (looped rounds)"
+#else
+#define RIJNDAEL_VARIANT "rijndael (FULL_UNROLL)"
+#endif
+
+#ifdef SKYLANDER_TABLE_AES
+#define TAG_AES RIJNDAEL_VARIANT
+#else
+#define TAG_AES "bitsliced aes_ct"
+#endif
+
+#define BATCH_BYTES 4096
+
+// An AES implementation under test; every entry gets the same rows
+struct AesBackend {
+    const char *name;
+    int (*setup_encrypt)(u32 *rk, const u8 *key, int keybits);
+    int (*setup_decrypt)(u32 *rk, const u8 *key, int keybits);
+    void (*encrypt)(const u32 *rk, int nrounds, const u8 in[16], u8 out[16]);
+    void (*decrypt)(const u32 *rk, int nrounds, const u8 in[16], u8 out[16]);
+};
+
+static const AesBackend BACKENDS[] = {
+    { RIJNDAEL_VARIANT, rijndaelSetupEncrypt, rijndaelSetupDecrypt,
+      rijndaelEncrypt, rijndaelDecrypt },
+};
+
+struct Result {
+    double ns;          // per operation
+    double cycles;      // per operation, < 0 if unknown
+};
+
+static double g_min_seconds = 0.25;
+static double g_ghz;
+static volatile uint8_t g_sink;     // keeps results alive past the optimizer
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Run fn(i) in growing batches until one takes g_min_seconds
+template <class F>
+static Result measure(F &&fn) {
+    uint64_t iters = 16;
+    for (;;) {
+        double start = now_seconds();
+        uint64_t start_cycles = read_cycles();
+        for (uint64_t i = 0; i < iters; i++) fn(i);
+        uint64_t cycles = read_cycles() - start_cycles;
+        double elapsed = now_seconds() - start;
+
+        if (elapsed >= g_min_seconds) {
+            Result r;
+            r.ns = elapsed * 1e9 / iters;
+            if (g_ghz > 0) r.cycles = r.ns * g_ghz;
+            else r.cycles = cycles ? (double)cycles / iters : -1;
+            return r;
+        }
+        double scale = elapsed > 0 ? g_min_seconds / elapsed * 1.2 : 8;
+        iters = (uint64_t)(iters * (scale < 8 ? scale : 8)) + 1;
+    }
+}
+
+static void print_header(void) {
+    printf("%-34s %12s %12s %16s\n", "test", "ns/op", "cycles/byte", "rate");
+}
+
+// bytes: payload per operation, for cycles/byte (0 leaves the column out)
+static void print_row(const char *name, Result r, size_t bytes, double units, const char *unit) {
+    char cpb[32] = "-";
+    if (bytes && r.cycles >= 0) snprintf(cpb, sizeof(cpb), "%.2f", r.cycles / bytes);
+    double rate = units * 1e9 / r.ns;
+    char rate_text[32];
+    if (rate >= 1e6) snprintf(rate_text, sizeof(rate_text), "%.2fM %s", rate / 1e6, unit);
+    else if (rate >= 1e3) snprintf(rate_text, sizeof(rate_text), "%.1fk %s", rate / 1e3, unit);
+    else snprintf(rate_text, sizeof(rate_text), "%.1f %s", rate, unit);
+    printf("%-34s %12.1f %12s %16s\n", name, r.ns, cpb, rate_text);
+}
+
+static void bench_backend(const AesBackend *b) {
+    printf("\n[%s]\n", b->name);
+    print_header();
+
+    u32 rk[RKLENGTH(KEYBITS)];
+    u8 key[16] = { 0 };
+    int nrounds = 0;
+
+    Result r = measure([&](uint64_t i) {
+        key[0] = (u8)i;
+        nrounds = b->setup_encrypt(rk, key, KEYBITS);
+        g_sink = (uint8_t)rk[4 * nrounds];
+    });
+    print_row("key setup, encrypt", r, 0, 1, "keys/s");
+
+    r = measure([&](uint64_t i) {
+        key[0] = (u8)i;
+        nrounds = b->setup_decrypt(rk, key, KEYBITS);
+        g_sink = (uint8_t)rk[4 * nrounds];
+    });
+    print_row("key setup, decrypt", r, 0, 1, "keys/s");
+
+    // Single block: each output feeds the next input, so this is latency
+    u8 block[16] = { 0 };
+    nrounds = b->setup_encrypt(rk, key, KEYBITS);
+    r = measure([&](uint64_t) { b->encrypt(rk, nrounds, block, block); });
+    g_sink = block[0];
+    print_row("encrypt 1 block (chained)", r, 16, 1, "blocks/s");
+
+    nrounds = b->setup_decrypt(rk, key, KEYBITS);
+    r = measure([&](uint64_t) { b->decrypt(rk, nrounds, block, block); });
+    g_sink = block[0];
+    print_row("decrypt 1 block (chained)", r, 16, 1, "blocks/s");
+
+    // Batched: independent blocks under one key
+    static u8 in[BATCH_BYTES], out[BATCH_BYTES];
+    for (size_t i = 0; i < sizeof(in); i++) in[i] = (u8)(i * 131 + 7);
+    nrounds = b->setup_encrypt(rk, key, KEYBITS);
+    r = measure([&](uint64_t) {
+        for (size_t off = 0; off < sizeof(in); off += 16) b->encrypt(rk, nrounds, in + off, out + off);
+        g_sink = out[0];
+    });
+    print_row("encrypt 4 KB batch", r, sizeof(in), sizeof(in) / 16.0, "blocks/s");
+
+    nrounds = b->setup_decrypt(rk, key, KEYBITS);
+    r = measure([&](uint64_t) {
+        for (size_t off = 0; off < sizeof(in); off += 16) b->decrypt(rk, nrounds, in + off, out + off);
+        g_sink = out[0];
+    });
+    print_row("decrypt 4 KB batch", r, sizeof(in), sizeof(in) / 16.0, "blocks/s");
+
+    // The tag case: every block under its own key
+    u8 keys[AES_CT_LANES][16];
+    memcpy(keys, in, sizeof(keys));
+    r = measure([&](uint64_t i) {
+        keys[0][0] = (u8)i;
+        for (int lane = 0; lane < AES_CT_LANES; lane++) {
+            nrounds = b->setup_decrypt(rk, keys[lane], KEYBITS);
+            b->decrypt(rk, nrounds, in + 16 * lane, out + 16 * lane);
+        }
+        g_sink = out[0];
+    });
+    print_row("4 keys + 4 blocks, decrypt", r, 16 * AES_CT_LANES, AES_CT_LANES, "blocks/s");
+}
+
+static void bench_bitsliced(void) {
+    printf("\n[bitsliced aes_ct, %d lanes]\n", AES_CT_LANES);
+    print_header();
+
+    static u8 in[BATCH_BYTES], out[BATCH_BYTES];
+    for (size_t i = 0; i < sizeof(in); i++) in[i] = (u8)(i * 131 + 7);
+    u8 keys[AES_CT_LANES][16];
+    memcpy(keys, in, sizeof(keys));
+    aes_ct_schedule s;
+
+    Result r = measure([&](uint64_t i) {
+        keys[0][0] = (u8)i;
+        aes_ct_setup(&s, keys, AES_CT_LANES);
+        g_sink = (uint8_t)s.rk[AES_CT_ROUNDS][0];
+    });
+    print_row("key setup, 4 keys", r, 0, AES_CT_LANES, "keys/s");
+
+    aes_ct_setup(&s, keys, AES_CT_LANES);
+    r = measure([&](uint64_t) { aes_ct_encrypt(&s, out, out, AES_CT_LANES); });
+    g_sink = out[0];
+    print_row("encrypt 4 blocks (chained)", r, 16 * AES_CT_LANES, AES_CT_LANES, "blocks/s");
+
+    r = measure([&](uint64_t) { aes_ct_decrypt(&s, out, out, AES_CT_LANES); });
+    g_sink = out[0];
+    print_row("decrypt 4 blocks (chained)", r, 16 * AES_CT_LANES, AES_CT_LANES, "blocks/s");
+
+    r = measure([&](uint64_t) {
+        for (size_t off = 0; off < sizeof(in); off += 16 * AES_CT_LANES) {
+            aes_ct_encrypt(&s, in + off, out + off, AES_CT_LANES);
+        }
+        g_sink = out[0];
+    });
+    print_row("encrypt 4 KB batch", r, sizeof(in), sizeof(in) / 16.0, "blocks/s");
+
+    r = measure([&](uint64_t) {
+        for (size_t off = 0; off < sizeof(in); off += 16 * AES_CT_LANES) {
+            aes_ct_decrypt(&s, in + off, out + off, AES_CT_LANES);
+        }
+        g_sink = out[0];
+    });
+    print_row("decrypt 4 KB batch", r, sizeof(in), sizeof(in) / 16.0, "blocks/s");
+
+    r = measure([&](uint64_t i) {
+        keys[0][0] = (u8)i;
+        aes_ct_setup(&s, keys, AES_CT_LANES);
+        aes_ct_decrypt(&s, in, out, AES_CT_LANES);
+        g_sink = out[0];
+    });
+    print_row("4 keys + 4 blocks, decrypt", r, 16 * AES_CT_LANES, AES_CT_LANES, "blocks/s");
+}
+
+// Generated figures with every encrypted block filled, like a well-used
+// figure, so each one goes through AES (a fresh figure is mostly blank
+// blocks, which are copied without key derivation or decryption). The
+// checksums no longer match; the benchmark does not care.
+static std::vector<uint8_t> make_library(size_t count) {
+    std::vector<FigureTemplate> templates(count);
+    for (size_t i = 0; i < count; i++) {
+        templates[i] = { figure_make_uid(0x4B414F53, i), (uint16_t)(i % 3500), 0 };
+    }
+    std::vector<uint8_t> library(count * FIGURE_IMAGE_SIZE);
+    figure_generate_batch(templates.data(), count, library.data(), 0);
+
+    uint8_t plain[FIGURE_IMAGE_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *tag = library.data() + i * FIGURE_IMAGE_SIZE;
+        skylander_decrypt_tag(tag, plain);
+        for (int b = 0; b < SKYLANDER_BLOCK_COUNT; b++) {
+            if (!skylander_block_encrypted(b)) continue;
+            for (int k = 0; k < SKYLANDER_BLOCK_SIZE; k++) {
+                plain[b * SKYLANDER_BLOCK_SIZE + k] = (uint8_t)(i + b * 7 + k * 13 + 1);
+            }
+        }
+        skylander_encrypt_tag(plain, tag);
+    }
+    return library;
+}
+
+// The tag layer on TAG_AES: key derivation, the per-block API (with key
+// setup on every call) and whole figures
+static void bench_tags(size_t figures) {
+    printf("\n[tag crypto on %s]\n", TAG_AES);
+    print_header();
+
+    std::vector<uint8_t> library = make_library(figures);
+    const uint8_t *tag = library.data();
+    uint8_t key[16];
+    uint8_t block[16];
+    memcpy(block, tag + 8 * SKYLANDER_BLOCK_SIZE, sizeof(block));
+
+    Result r = measure([&](uint64_t i) {
+        skylander_block_key(tag, (uint8_t)(8 + i % 56), key);
+        g_sink = key[0];
+    });
+    print_row("block key (MD5)", r, 0, 1, "keys/s");
+
+    // Key setup on every call, as the per-block API does
+    r = measure([&](uint64_t) { skylander_decrypt_block(key, block, block); });
+    g_sink = block[0];
+    print_row("skylander_decrypt_block", r, 16, 1, "blocks/s");
+
+    r = measure([&](uint64_t) { skylander_encrypt_block(key, block, block); });
+    g_sink = block[0];
+    print_row("skylander_encrypt_block", r, 16, 1, "blocks/s");
+
+    r = measure([&](uint64_t i) {
+        skylander_decrypt_tag_block(tag, 8, tag + 8 * SKYLANDER_BLOCK_SIZE, block);
+        g_sink = block[0] ^ (uint8_t)i;
+    });
+    print_row("tag block decrypt (MD5+setup+AES)", r, 16, 1, "blocks/s");
+
+    uint8_t plain[FIGURE_IMAGE_SIZE];
+    r = measure([&](uint64_t i) {
+        skylander_decrypt_tag(library.data() + (i % figures) * FIGURE_IMAGE_SIZE, plain);
+        g_sink = plain[8 * SKYLANDER_BLOCK_SIZE];
+    });
+    print_row("figure decrypt", r, FIGURE_IMAGE_SIZE, 1, "figures/s");
+
+    r = measure([&](uint64_t i) {
+        skylander_encrypt_tag(library.data() + (i % figures) * FIGURE_IMAGE_SIZE, plain);
+        g_sink = plain[8 * SKYLANDER_BLOCK_SIZE];
+    });
+    print_row("figure encrypt", r, FIGURE_IMAGE_SIZE, 1, "figures/s");
+
+    std::vector<uint8_t> out(library.size());
+    r = measure([&](uint64_t) {
+        for (size_t f = 0; f < figures; f++) {
+            skylander_decrypt_tag(library.data() + f * FIGURE_IMAGE_SIZE,
+                                  out.data() + f * FIGURE_IMAGE_SIZE);
+        }
+        g_sink = out[8 * SKYLANDER_BLOCK_SIZE];
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "library decrypt (%zu figures)", figures);
+    print_row(name, r, library.size(), (double)figures, "figures/s");
+}
+
+// Every lane count against rijndael.c on random keys and blocks, the
+// FIPS-197 vector, and whole tags against the per-block path
+static int verify(void) {
+    int failures = 0;
+    uint32_t seed = 0x4B414F53;
+    for (int iter = 0; iter < 20000; iter++) {
+        u8 keys[AES_CT_LANES][16], in[16 * AES_CT_LANES], out[16 * AES_CT_LANES];
+        u8 ref[16 * AES_CT_LANES];
+        int count = 1 + iter % AES_CT_LANES;
+        for (size_t i = 0; i < sizeof(in); i++) {
+            seed = seed * 1103515245 + 12345;
+            in[i] = (u8)(seed >> 16);
+            keys[i / 16][i % 16] = (u8)(seed >> 24);
+        }
+
+        aes_ct_schedule s;
+        aes_ct_setup(&s, keys, count);
+        aes_ct_encrypt(&s, in, out, count);
+        u32 rk[RKLENGTH(KEYBITS)];
+        for (int lane = 0; lane < count; lane++) {
+            int nrounds = rijndaelSetupEncrypt(rk, keys[lane], KEYBITS);
+            rijndaelEncrypt(rk, nrounds, in + 16 * lane, ref + 16 * lane);
+        }
+        if (memcmp(out, ref, 16 * count) != 0) failures++;
+
+        aes_ct_decrypt(&s, out, out, count);
+        if (memcmp(out, in, 16 * count) != 0) failures++;
+    }
+
+    static const u8 FIPS_CIPHER[16] = {
+        0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+        0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a,
+    };
+    u8 key[1][16], block[16];
+    for (int i = 0; i < 16; i++) {
+        key[0][i] = (u8)i;
+        block[i] = (u8)(i * 0x11);
+    }
+    aes_ct_schedule s;
+    aes_ct_setup(&s, key, 1);
+    aes_ct_encrypt(&s, block, block, 1);
+    if (memcmp(block, FIPS_CIPHER, sizeof(block)) != 0) failures++;
+
+    std::vector<uint8_t> library = make_library(64);
+    uint8_t whole[FIGURE_IMAGE_SIZE], blockwise[FIGURE_IMAGE_SIZE];
+    for (size_t f = 0; f < 64; f++) {
+        const uint8_t *tag = library.data() + f * FIGURE_IMAGE_SIZE;
+        skylander_decrypt_tag(tag, whole);
+        for (int b = 0; b < SKYLANDER_BLOCK_COUNT; b++) {
+            skylander_decrypt_tag_block(tag, (uint8_t)b, tag + b * SKYLANDER_BLOCK_SIZE,
+                                        blockwise + b * SKYLANDER_BLOCK_SIZE);
+        }
+        if (memcmp(whole, blockwise, sizeof(whole)) != 0) failures++;
+        skylander_encrypt_tag(whole, whole);
+        if (memcmp(whole, tag, sizeof(whole)) != 0) failures++;
+    }
+
+    printf("aes_bench: verify %s (%d mismatches)\n", failures ? "FAILED" : "ok", failures);
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    size_t figures = 1000;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--figures") == 0 && more) figures = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--seconds") == 0 && more) g_min_seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--ghz") == 0 && more) g_ghz = atof(argv[++i]);
+        else if (strcmp(argv[i], "--verify") == 0) return verify();
+        else {
+            fprintf(stderr, "usage: aes_bench [--figures N] [--seconds S] [--ghz F]\n"
+                            "       aes_bench --verify\n");
+            return 2;
+        }
+    }
+    if (figures == 0 || g_min_seconds <= 0) {
+        fprintf(stderr, "aes_bench: --figures and --seconds must be positive\n");
+        return 2;
+    }
+
+    const char *cycles = g_ghz > 0 ? "--ghz" :
+                         read_cycles() ? "TSC (nominal clock)" : "unavailable, pass --ghz";
+    printf("aes_bench: %s, tag crypto on %s, cycles from %s\n", RIJNDAEL_VARIANT, TAG_AES,
+           cycles);
+
+    for (const AesBackend &b : BACKENDS) bench_backend(&b);
+    bench_bitsliced();
+    bench_tags(figures);
+    return 0;
+}
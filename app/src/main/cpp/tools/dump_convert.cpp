@@ -0,0 +1,109 @@
+// dump_convert.cpp - convert dump libraries between encrypted and decrypted form
+//
+//   dump_convert (--decrypt | --encrypt) -o OUT_DIR FILE|DIR... [-j N]
+//   dump_convert (--decrypt | --encrypt) --packed IN.lib -o OUT.lib [-j N]
+//
+// Directories are expanded to the regular files directly inside them.
+// Reading, crypto (-j workers) and writing overlap; the summary line says
+// which of them the run was waiting on.
+#include "dump_stream.h"
+#include "figure_generator.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: dump_convert (--decrypt | --encrypt) -o OUT_DIR FILE|DIR... [-j THREADS]\n"
+            "       dump_convert (--decrypt | --encrypt) --packed IN -o OUT [-j THREADS]\n");
+}
+
+static bool add_input(const char *path, std::vector<std::string> *out) {
+    struct stat st;
+    if (stat(path, &st) < 0) return false;
+    if (!S_ISDIR(st.st_mode)) {
+        out->push_back(path);
+        return true;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) return false;
+    std::vector<std::string> entries;
+    while (struct dirent *ent = readdir(dir)) {
+        if (ent->d_name[0] == '.') continue;
+        std::string full = std::string(path) + "/" + ent->d_name;
+        if (stat(full.c_str(), &st) == 0 && S_ISREG(st.st_mode)) entries.push_back(full);
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+    out->insert(out->end(), entries.begin(), entries.end());
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int direction = -1;
+    const char *out = NULL;
+    const char *packed = NULL;
+    unsigned threads = 0;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "--decrypt") == 0) direction = DUMP_DECRYPT;
+        else if (strcmp(argv[i], "--encrypt") == 0) direction = DUMP_ENCRYPT;
+        else if (strcmp(argv[i], "-o") == 0 && more) out = argv[++i];
+        else if (strcmp(argv[i], "--packed") == 0 && more) packed = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && more) threads = (unsigned)strtoul(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-') {
+            if (!add_input(argv[i], &inputs)) {
+                fprintf(stderr, "Cannot read %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (direction < 0 || !out || (packed ? !inputs.empty() : inputs.empty())) {
+        usage();
+        return 2;
+    }
+
+    DumpStreamStats stats;
+    int ret;
+    if (packed) {
+        ret = dump_stream_packed(packed, out, (DumpDirection)direction, threads, &stats);
+    } else {
+        std::vector<const char *> paths;
+        paths.reserve(inputs.size());
+        for (const std::string &p : inputs) paths.push_back(p.c_str());
+        ret = dump_stream_files(paths.data(), paths.size(), out, (DumpDirection)direction,
+                                threads, &stats);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Conversion failed after %zu dumps: %s\n", stats.dumps, strerror(-ret));
+        return 1;
+    }
+
+    // The busiest stage is the bottleneck; crypto time is spread over workers
+    double crypt = stats.crypt_seconds / stats.workers;
+    const char *bound = "read";
+    if (crypt > stats.read_seconds && crypt >= stats.write_seconds) bound = "crypto";
+    else if (stats.write_seconds > stats.read_seconds) bound = "write";
+
+    double mb = stats.dumps * (double)FIGURE_IMAGE_SIZE / 1e6;
+    fprintf(stderr,
+            "Converted %zu dumps (%zu skipped) in %.3f s: %.0f dumps/s, %.1f MB/s; "
+            "busy read %.3f s, crypto %.3f s x %u, write %.3f s (%s-bound)\n",
+            stats.dumps, stats.skipped, stats.elapsed_seconds,
+            stats.elapsed_seconds > 0 ? stats.dumps / stats.elapsed_seconds : 0.0,
+            stats.elapsed_seconds > 0 ? mb / stats.elapsed_seconds : 0.0,
+            stats.read_seconds, crypt, stats.workers, stats.write_seconds, bound);
+    return 0;
+}
@@ -0,0 +1,202 @@
+// figure_gen.cpp - bulk figure image generator
+//
+//   figure_gen -o DIR --ids 0-31 --variants 0x0000,0x1801 [--seed N] [-j N]
+//   figure_gen -o DIR --list combos.txt          (lines: "<id> <variant>")
+//   figure_gen --clone SRC.bin --uid 0A1B2C3D -o OUT.bin
+//   figure_gen --bench 100000 [-j N]             (generate in memory only)
+#include "figure_generator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: figure_gen -o DIR (--ids A-B [--variants V,...] | --list FILE)\n"
+            "                  [--seed N] [-j THREADS]\n"
+            "       figure_gen --clone SRC --uid HEX -o OUT\n"
+            "       figure_gen --bench COUNT [-j THREADS]\n");
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_file(const char *path, const uint8_t *data, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -errno;
+    ssize_t n = write(fd, data, len);
+    int err = (n < 0) ? errno : 0;
+    close(fd);
+    if (n < 0) return -err;
+    return (size_t)n == len ? 0 : -EIO;
+}
+
+static int read_file(const char *path, uint8_t *data, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -errno;
+    ssize_t n = read(fd, data, len);
+    int err = (n < 0) ? errno : 0;
+    close(fd);
+    return (n < 0) ? -err : (int)n;
+}
+
+static bool parse_range(const char *arg, unsigned long *first, unsigned long *last) {
+    char *end;
+    *first = strtoul(arg, &end, 0);
+    if (*end == '\0') {
+        *last = *first;
+        return true;
+    }
+    if (*end != '-') return false;
+    *last = strtoul(end + 1, &end, 0);
+    return *end == '\0' && *last >= *first && *last <= 0xFFFF;
+}
+
+static bool parse_variants(const char *arg, std::vector<uint16_t> *out) {
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        unsigned long v = strtoul(p, &end, 0);
+        if (end == p || v > 0xFFFF) return false;
+        out->push_back((uint16_t)v);
+        p = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',') return false;
+    }
+    return !out->empty();
+}
+
+static bool parse_list(const char *path, std::vector<FigureTemplate> *out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long id, variant;
+        char *p = line, *end;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        id = strtoul(p, &end, 0);
+        if (end == p) continue;
+        variant = strtoul(end, NULL, 0);
+        out->push_back({ 0, (uint16_t)id, (uint16_t)variant });
+    }
+    fclose(f);
+    return true;
+}
+
+static int clone_figure(const char *src, const char *uid_hex, const char *out) {
+    uint8_t in[FIGURE_IMAGE_SIZE], image[FIGURE_IMAGE_SIZE];
+    int n = read_file(src, in, sizeof(in));
+    if (n < 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", src, strerror(-n));
+        return 1;
+    }
+
+    // UID as it appears in block 0, byte 0 first
+    unsigned long be = strtoul(uid_hex, NULL, 16);
+    uint32_t uid = ((be >> 24) & 0xFF) | ((be >> 8) & 0xFF00) | ((be << 8) & 0xFF0000) | ((be << 24) & 0xFF000000u);
+    if (figure_clone(in, (size_t)n, uid, image) < 0) {
+        fprintf(stderr, "%s is not a full %d-byte figure image\n", src, FIGURE_IMAGE_SIZE);
+        return 1;
+    }
+
+    int ret = write_file(out, image, sizeof(image));
+    if (ret < 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", out, strerror(-ret));
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_dir = NULL;
+    const char *ids = NULL;
+    const char *variants_arg = "0";
+    const char *list = NULL;
+    const char *clone_src = NULL;
+    const char *clone_uid = NULL;
+    unsigned long bench = 0;
+    unsigned long long seed = 0x4B414F53;      // "KAOS"
+    unsigned threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (strcmp(argv[i], "-o") == 0 && more) out_dir = argv[++i];
+        else if (strcmp(argv[i], "--ids") == 0 && more) ids = argv[++i];
+        else if (strcmp(argv[i], "--variants") == 0 && more) variants_arg = argv[++i];
+        else if (strcmp(argv[i], "--list") == 0 && more) list = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-j") == 0 && more) threads = (unsigned)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--clone") == 0 && more) clone_src = argv[++i];
+        else if (strcmp(argv[i], "--uid") == 0 && more) clone_uid = argv[++i];
+        else if (strcmp(argv[i], "--bench") == 0 && more) bench = strtoul(argv[++i], NULL, 0);
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (clone_src) {
+        if (!clone_uid || !out_dir) {
+            usage();
+            return 2;
+        }
+        return clone_figure(clone_src, clone_uid, out_dir);
+    }
+
+    std::vector<FigureTemplate> templates;
+    if (bench) {
+        templates.resize(bench);
+        for (size_t i = 0; i < bench; i++) templates[i] = { 0, (uint16_t)(i % 3500), 0 };
+    } else if (list) {
+        if (!parse_list(list, &templates)) {
+            fprintf(stderr, "Cannot read %s\n", list);
+            return 1;
+        }
+    } else if (ids) {
+        unsigned long first, last;
+        std::vector<uint16_t> variants;
+        if (!parse_range(ids, &first, &last) || !parse_variants(variants_arg, &variants)) {
+            usage();
+            return 2;
+        }
+        for (unsigned long id = first; id <= last; id++) {
+            for (uint16_t v : variants) templates.push_back({ 0, (uint16_t)id, v });
+        }
+    }
+    if (templates.empty() || (!bench && !out_dir)) {
+        usage();
+        return 2;
+    }
+
+    for (size_t i = 0; i < templates.size(); i++) templates[i].uid = figure_make_uid(seed, i);
+
+    std::vector<uint8_t> images(templates.size() * FIGURE_IMAGE_SIZE);
+    double start = now_seconds();
+    figure_generate_batch(templates.data(), templates.size(), images.data(), threads);
+    double elapsed = now_seconds() - start;
+
+    fprintf(stderr, "Generated %zu figures in %.3f s (%.0f figures/s)\n",
+            templates.size(), elapsed, elapsed > 0 ? templates.size() / elapsed : 0.0);
+    if (bench) return 0;
+
+    char path[4096];
+    for (size_t i = 0; i < templates.size(); i++) {
+        const FigureTemplate &t = templates[i];
+        snprintf(path, sizeof(path), "%s/%04u_%04x_%08x.bin", out_dir,
+                 t.character_id, t.variant, t.uid);
+        int ret = write_file(path, &images[i * FIGURE_IMAGE_SIZE], FIGURE_IMAGE_SIZE);
+        if (ret < 0) {
+            fprintf(stderr, "Cannot write %s: %s\n", path, strerror(-ret));
+            return 1;
+        }
+    }
+    return 0;
+}
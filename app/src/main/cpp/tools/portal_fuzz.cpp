@@ -0,0 +1,249 @@
+// portal_fuzz.cpp - fuzz harnesses for the portal command and SETUP handlers
+//
+//   portal_fuzz_command   input: profile byte, then OUT reports, each a
+//                         length byte followed by that many bytes
+//   portal_fuzz_setup     input: profile byte, then SETUP packets (8 bytes),
+//                         each followed by its data stage for OUT requests
+//
+// Slot 0 holds a generated figure and slot 1 a 40-byte raw dump, both
+// reset before every input, and 0x51 replies are staged as in the daemon.
+// In portal_fuzz_command an empty report stalls ep_in (writes fail with
+// EAGAIN, so reports queue) or, the next time, lets the queue drain. The
+// transport checks what the handlers send:
+// reports are exactly report_size bytes, ep0 never moves more than
+// wLength and a figure reply names a real slot. A violation aborts, so the
+// fuzzer keeps the input.
+//
+// With clang the targets are libFuzzer binaries. Built with
+// PORTAL_FUZZ_STANDALONE they instead run each file (or directory of
+// files) given on the command line, or stdin when there are none, which
+// is what AFL and corpus replays want. Seeds: tools/fuzz_corpus/.
+#include "portal_commands.h"
+#include "ep0_cache.h"
+#include "figure_generator.h"
+#include "portal_led.h"
+#include "portal_mem.h"
+#include "daemon_log.h"
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#define RAW_DUMP_SIZE 40
+
+static const char *const g_profiles[] = { "wii", "ps", "traptanium", "xbox360" };
+
+struct FuzzPort {
+    const uint8_t *data_stage;      // what the host sends after an OUT SETUP
+    size_t data_stage_len;
+    size_t w_length;                // of the SETUP being handled
+    bool stalled;                   // ep_in writes fail with EAGAIN
+};
+
+static FuzzPort g_port;
+static PortalSlot g_slots[MAX_SLOTS];
+static PortalDevice g_dev;
+static MemArena g_mem;
+static MemPool g_reports;
+static int g_dump_fd[MAX_SLOTS] = { -1, -1 };
+static uint8_t g_figure[FIGURE_IMAGE_SIZE];
+
+// Format every line, so bad format arguments still show up, then drop it
+static void quiet_log(FILE *, const char *, const char *fmt, va_list ap) {
+    char line[256];
+    vsnprintf(line, sizeof(line), fmt, ap);
+}
+
+static ssize_t fuzz_ep0_read(void *, void *buf, size_t len) {
+    if (len > g_port.w_length) abort();
+    size_t n = len < g_port.data_stage_len ? len : g_port.data_stage_len;
+    if (n) memcpy(buf, g_port.data_stage, n);
+    return (ssize_t)n;
+}
+
+static ssize_t fuzz_ep0_write(void *, const void *buf, size_t len) {
+    if (len > g_port.w_length || (len && !buf)) abort();
+    return (ssize_t)len;
+}
+
+static ssize_t fuzz_ep_in_write(void *, const void *buf, size_t len) {
+    const uint8_t *report = (const uint8_t *)buf;
+    if (len != g_dev.profile->report_size || len > MAX_REPORT_SIZE) abort();
+    if ((report[0] == 0x51 || report[0] == 0x57) && report[1] != 0x01 &&
+        (report[1] < 0x10 || report[1] >= 0x10 + MAX_SLOTS)) {
+        abort();
+    }
+    if (g_port.stalled) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+static void fuzz_init(void) {
+    t_log_sink = quiet_log;
+    led_init(NULL, false);
+
+    FigureTemplate t = { 0x1A2B3C4Du, 0x0E, 0x3000 };
+    figure_generate(&t, g_figure);
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        slot_init(&g_slots[i]);
+        g_dump_fd[i] = memfd_create("portal_fuzz_slot", MFD_CLOEXEC);
+        if (g_dump_fd[i] < 0) abort();
+    }
+
+    if (mem_region_init(&g_mem, "fuzz", 16 * 1024) < 0 ||
+        mem_pool_init(&g_reports, &g_mem, "reports", sizeof(PortalReport),
+                      MAX_SLOTS * PRESTAGE_DEPTH + EP_IN_QUEUE_REPORTS) < 0) {
+        abort();
+    }
+
+    g_dev.slots = g_slots;
+    g_dev.reports = &g_reports;
+    g_dev.feedback = true;
+    g_dev.transport.ep0_read = fuzz_ep0_read;
+    g_dev.transport.ep0_write = fuzz_ep0_write;
+    g_dev.transport.ep_in_write = fuzz_ep_in_write;
+}
+
+// Same profile, same figures, speaker off, for every input
+static void fuzz_reset(uint8_t profile_byte) {
+    const PortalProfile *profile = profile_builtin(g_profiles[profile_byte % 4]);
+    if (profile != g_dev.profile) {
+        g_dev.profile = profile;
+        PortalDescriptorBlob descriptors = profile_descriptors(profile);
+        ep0_cache_init(descriptors.hid_report, descriptors.hid_report_len);
+    }
+    g_dev.speaker_on = false;
+
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        size_t size = i == 0 ? sizeof(g_figure) : RAW_DUMP_SIZE;
+        if (ftruncate(g_dump_fd[i], size) < 0 || pwrite(g_dump_fd[i], g_figure, size, 0) < 0) {
+            abort();
+        }
+        int fd = dup(g_dump_fd[i]);
+        if (fd < 0 || slot_attach_fd(&g_slots[i], fd) < 0) abort();
+        g_slots[i].present = true;
+        g_slots[i].loaded = true;
+    }
+}
+
+static void fuzz_finish(void) {
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        portal_drop_staged(&g_dev, i);
+        memset(&g_dev.streams[i], 0, sizeof(g_dev.streams[i]));
+        slot_detach(&g_slots[i]);
+    }
+    portal_drop_in(&g_dev);
+    g_port.stalled = false;
+    if (g_reports.in_use.load() != 0) abort();     // a staged or queued report leaked
+}
+
+#ifdef FUZZ_SETUP_REQUEST
+static void run_input(const uint8_t *data, size_t size) {
+    while (size >= sizeof(struct usb_ctrlrequest)) {
+        struct usb_ctrlrequest setup;
+        memcpy(&setup, data, sizeof(setup));
+        data += sizeof(setup);
+        size -= sizeof(setup);
+
+        size_t length = le16toh(setup.wLength);
+        size_t stage = 0;
+        if (!(setup.bRequestType & USB_DIR_IN)) stage = length < size ? length : size;
+        g_port.data_stage = data;
+        g_port.data_stage_len = stage;
+        g_port.w_length = length;
+        handle_setup_request(&g_dev, &setup);
+        data += stage;
+        size -= stage;
+    }
+}
+#else
+static void run_input(const uint8_t *data, size_t size) {
+    g_port.data_stage_len = 0;
+    g_port.w_length = 0;
+    while (size > 0) {
+        size_t len = data[0];
+        data++;
+        size--;
+        if (len > size) len = size;
+        if (len == 0) {
+            g_port.stalled = !g_port.stalled;
+            if (!g_port.stalled) portal_flush_in(&g_dev);
+            continue;
+        }
+        handle_portal_command(&g_dev, data, len);
+        data += len;
+        size -= len;
+    }
+}
+#endif
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static bool initialized;
+    if (!initialized) {
+        fuzz_init();
+        initialized = true;
+    }
+    if (size < 1) return 0;
+
+    fuzz_reset(data[0]);
+    run_input(data + 1, size - 1);
+    fuzz_finish();
+    return 0;
+}
+
+#ifdef PORTAL_FUZZ_STANDALONE
+static bool run_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+    std::vector<uint8_t> input;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) input.insert(input.end(), chunk, chunk + n);
+    fclose(f);
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) return run_file("/dev/stdin") ? 0 : 1;
+
+    int runs = 0;
+    int failures = 0;
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            DIR *dir = opendir(argv[i]);
+            if (!dir) {
+                failures++;
+                continue;
+            }
+            while (struct dirent *ent = readdir(dir)) {
+                if (ent->d_name[0] == '.') continue;
+                std::string full = std::string(argv[i]) + "/" + ent->d_name;
+                if (run_file(full.c_str())) runs++;
+                else failures++;
+            }
+            closedir(dir);
+        } else if (run_file(argv[i])) {
+            runs++;
+        } else {
+            failures++;
+        }
+    }
+    fprintf(stderr, "%d inputs run\n", runs);
+    return failures ? 1 : 0;
+}
+#endif
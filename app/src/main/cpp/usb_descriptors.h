@@ -0,0 +1,208 @@
+#ifndef USB_DESCRIPTORS_H
+#define USB_DESCRIPTORS_H
+
+// Compile-time composition of FunctionFS descriptor and string blobs.
+//
+// Descriptors are byte arrays whose size and descriptor count are part of the
+// type, so concatenating them yields the exact blob size and the per-speed
+// counts the FunctionFS v2 header needs. A malformed chain (bLength not
+// matching the bytes it covers) fails to compile through descriptor_error().
+//
+//     constexpr auto fs = usbdesc::interface(0, 2, 0x03) + usbdesc::hid(29) +
+//                         usbdesc::endpoint(0x81, 0x03, 64, 1) + ...;
+//     constexpr auto blob = usbdesc::ffs_descriptors(fs, fs);
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <linux/usb/functionfs.h>
+
+namespace usbdesc {
+
+// Not constexpr: reaching it during constant evaluation is a compile error
+inline void descriptor_error(const char *) {}
+
+template <size_t N, size_t Count = 1>
+struct Desc {
+    std::array<uint8_t, N> bytes{};
+    static constexpr size_t size = N;
+    static constexpr size_t count = Count;
+};
+
+template <size_t A, size_t CA, size_t B, size_t CB>
+constexpr Desc<A + B, CA + CB> operator+(const Desc<A, CA> &a, const Desc<B, CB> &b) {
+    Desc<A + B, CA + CB> out{};
+    for (size_t i = 0; i < A; i++) out.bytes[i] = a.bytes[i];
+    for (size_t i = 0; i < B; i++) out.bytes[A + i] = b.bytes[i];
+    return out;
+}
+
+// Walks bLength fields: true when they tile the set exactly Count times
+template <size_t N, size_t C>
+constexpr bool well_formed(const Desc<N, C> &d) {
+    size_t pos = 0;
+    size_t n = 0;
+    while (pos < N) {
+        uint8_t len = d.bytes[pos];
+        if (len < 2 || pos + len > N) return false;
+        pos += len;
+        n++;
+    }
+    return n == C;
+}
+
+template <size_t N>
+constexpr void put_le16(std::array<uint8_t, N> &b, size_t at, uint16_t v) {
+    b[at] = v & 0xFF;
+    b[at + 1] = (v >> 8) & 0xFF;
+}
+
+template <size_t N>
+constexpr void put_le32(std::array<uint8_t, N> &b, size_t at, uint32_t v) {
+    for (size_t i = 0; i < 4; i++) b[at + i] = (v >> (8 * i)) & 0xFF;
+}
+
+constexpr Desc<9> interface(uint8_t number, uint8_t num_endpoints, uint8_t cls,
+                            uint8_t subclass = 0, uint8_t protocol = 0, uint8_t string_index = 0) {
+    Desc<9> d{};
+    d.bytes = { 9, 0x04, number, 0, num_endpoints, cls, subclass, protocol, string_index };
+    return d;
+}
+
+// HID class descriptor announcing one report descriptor of report_len bytes
+constexpr Desc<9> hid(uint16_t report_len, uint16_t bcd_hid = 0x0111, uint8_t country = 0) {
+    Desc<9> d{};
+    d.bytes = { 9, 0x21, 0, 0, country, 1, 0x22, 0, 0 };
+    put_le16(d.bytes, 2, bcd_hid);
+    put_le16(d.bytes, 7, report_len);
+    return d;
+}
+
+constexpr Desc<7> endpoint(uint8_t address, uint8_t attributes, uint16_t max_packet, uint8_t interval) {
+    Desc<7> d{};
+    d.bytes = { 7, 0x05, address, attributes, 0, 0, interval };
+    put_le16(d.bytes, 4, max_packet);
+    return d;
+}
+
+// SuperSpeed endpoint companion; must follow each endpoint in the SS set
+constexpr Desc<6> ss_companion(uint8_t max_burst = 0, uint8_t attributes = 0, uint16_t bytes_per_interval = 0) {
+    Desc<6> d{};
+    d.bytes = { 6, 0x30, max_burst, attributes, 0, 0 };
+    put_le16(d.bytes, 4, bytes_per_interval);
+    return d;
+}
+
+// Microsoft OS extended compat ID descriptor (wIndex 4) for one interface
+constexpr Desc<11 + 24> os_ext_compat(uint8_t first_interface, const char (&compatible_id)[7]) {
+    Desc<11 + 24> d{};
+    d.bytes[0] = first_interface;
+    put_le32(d.bytes, 1, 11 + 24);   // dwLength
+    put_le16(d.bytes, 5, 0x0100);    // bcdVersion
+    put_le16(d.bytes, 7, 4);         // wIndex: extended compat ID
+    d.bytes[9] = 1;                  // bCount
+    d.bytes[11] = first_interface;
+    d.bytes[12] = 1;                 // Reserved1, must be 1
+    for (size_t i = 0; i < 6; i++) d.bytes[13 + i] = (uint8_t)compatible_id[i];
+    return d;
+}
+
+struct NoSet {
+    static constexpr size_t size = 0;
+    static constexpr size_t count = 0;
+};
+
+template <size_t N>
+struct Blob {
+    std::array<uint8_t, N> bytes{};
+    uint32_t fs_count = 0;
+    uint32_t hs_count = 0;
+    uint32_t ss_count = 0;
+    uint32_t os_count = 0;
+    static constexpr size_t size = N;
+    const uint8_t *data() const { return bytes.data(); }
+};
+
+template <class Set, size_t N>
+constexpr size_t append(std::array<uint8_t, N> &out, size_t at, const Set &set) {
+    if constexpr (Set::size > 0) {
+        for (size_t i = 0; i < Set::size; i++) out[at + i] = set.bytes[i];
+    }
+    return at + Set::size;
+}
+
+template <class Set>
+constexpr void check_set(const Set &set) {
+    if constexpr (Set::size > 0) {
+        if (!well_formed(set)) descriptor_error("descriptor lengths do not tile the set");
+    }
+}
+
+// FunctionFS v2 descriptor blob. Counts and flags follow from which sets are
+// present; OS descriptors are passed pre-built (their headers carry no bLength).
+template <class FS, class HS, class SS = NoSet, class OS = NoSet>
+constexpr auto ffs_descriptors(const FS &fs, const HS &hs, const SS &ss = SS{}, const OS &os = OS{}) {
+    constexpr size_t counts = (FS::size > 0) + (HS::size > 0) + (SS::size > 0) + (OS::size > 0);
+    constexpr size_t total = 12 + 4 * counts + FS::size + HS::size + SS::size + OS::size;
+
+    check_set(fs);
+    check_set(hs);
+    check_set(ss);
+
+    uint32_t flags = 0;
+    if (FS::size > 0) flags |= FUNCTIONFS_HAS_FS_DESC;
+    if (HS::size > 0) flags |= FUNCTIONFS_HAS_HS_DESC;
+    if (SS::size > 0) flags |= FUNCTIONFS_HAS_SS_DESC;
+    if (OS::size > 0) flags |= FUNCTIONFS_HAS_MS_OS_DESC;
+
+    Blob<total> blob{};
+    put_le32(blob.bytes, 0, FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+    put_le32(blob.bytes, 4, total);
+    put_le32(blob.bytes, 8, flags);
+
+    size_t at = 12;
+    if (FS::size > 0) { put_le32(blob.bytes, at, FS::count); at += 4; }
+    if (HS::size > 0) { put_le32(blob.bytes, at, HS::count); at += 4; }
+    if (SS::size > 0) { put_le32(blob.bytes, at, SS::count); at += 4; }
+    if (OS::size > 0) { put_le32(blob.bytes, at, OS::count); at += 4; }
+
+    at = append(blob.bytes, at, fs);
+    at = append(blob.bytes, at, hs);
+    at = append(blob.bytes, at, ss);
+    at = append(blob.bytes, at, os);
+    if (at != total) descriptor_error("descriptor blob size mismatch");
+
+    blob.fs_count = FS::count;
+    blob.hs_count = HS::count;
+    blob.ss_count = SS::count;
+    blob.os_count = OS::count;
+    return blob;
+}
+
+// FunctionFS strings blob for one language. Strings are packed back to back
+// with their terminators, exactly as the kernel parses them.
+template <size_t... L>
+constexpr auto ffs_strings(uint16_t lang, const char (&...strings)[L]) {
+    constexpr size_t total = 16 + 2 + (L + ... + 0);
+
+    Blob<total> blob{};
+    put_le32(blob.bytes, 0, FUNCTIONFS_STRINGS_MAGIC);
+    put_le32(blob.bytes, 4, total);
+    put_le32(blob.bytes, 8, sizeof...(L));
+    put_le32(blob.bytes, 12, 1);
+    put_le16(blob.bytes, 16, lang);
+
+    size_t at = 18;
+    auto copy = [&](const char *s, size_t len) {
+        for (size_t i = 0; i < len; i++) blob.bytes[at + i] = (uint8_t)s[i];
+        if (s[len - 1] != '\0') descriptor_error("string is not terminated");
+        at += len;
+    };
+    (copy(strings, L), ...);
+    if (at != total) descriptor_error("string blob size mismatch");
+    return blob;
+}
+
+} // namespace usbdesc
+
+#endif // USB_DESCRIPTORS_H
@@ -8,6 +8,7 @@ import androidx.recyclerview.widget.RecyclerView
 import java.io.File
 
 class DumpFileAdapter(
+    private val describe: (Int) -> String? = { null },
     private val onFileClick: (File) -> Unit
 ) : RecyclerView.Adapter<DumpFileAdapter.FileViewHolder>() {
 
@@ -25,7 +26,7 @@ class DumpFileAdapter(
     }
 
     override fun onBindViewHolder(holder: FileViewHolder, position: Int) {
-        holder.bind(files[position])
+        holder.bind(files[position], describe(position))
     }
 
     override fun getItemCount(): Int = files.size
@@ -34,9 +35,9 @@ class DumpFileAdapter(
         private val nameText: TextView = itemView.findViewById(android.R.id.text1)
         private val sizeText: TextView = itemView.findViewById(android.R.id.text2)
 
-        fun bind(file: File) {
+        fun bind(file: File, label: String?) {
             nameText.text = file.name
-            sizeText.text = "${file.length()} bytes"
+            sizeText.text = label ?: "${file.length()} bytes"
             
             itemView.setOnClickListener {
                 onFileClick(file)
@@ -9,6 +9,7 @@ import android.os.Bundle
 import android.os.Environment
 import android.provider.Settings
 import android.util.Log
+import android.view.Choreographer
 import android.widget.Toast
 import androidx.appcompat.app.AlertDialog
 import androidx.appcompat.app.AppCompatActivity
@@ -16,6 +17,8 @@ import androidx.core.content.ContextCompat
 import androidx.recyclerview.widget.LinearLayoutManager
 import com.kaos.portalemulator.databinding.ActivityMainBinding
 import java.io.File
+import java.util.concurrent.CountDownLatch
+import java.util.concurrent.TimeUnit
 
 class MainActivity : AppCompatActivity() {
     private lateinit var binding: ActivityMainBinding
@@ -25,16 +28,49 @@ class MainActivity : AppCompatActivity() {
     private var currentSlotIndex = 0
     private var gadgetActive = false
     private var daemonProcess: Process? = null
-    private var daemonReady = false
-    private var allReady = false
+    // Released by the daemon output reader on READY / ALL_READY
+    private var daemonReady = CountDownLatch(1)
+    private var allReady = CountDownLatch(1)
+    private var selectedProfile = "wii"
+    private var audioPlayer: PortalAudioPlayer? = null
+    private var sharedAttached = false
+    private val ledColors = IntArray(3)
+    private val ledFrameCallback = object : Choreographer.FrameCallback {
+        override fun doFrame(frameTimeNanos: Long) {
+            if (!sharedAttached) return
+            if (nativeReadLeds(ledColors) > 0) binding.portalGlow.setColors(ledColors)
+            Choreographer.getInstance().postFrameCallback(this)
+        }
+    }
 
     private external fun nativeInit(): Int
     private external fun nativeSetSlotFile(slot: Int, path: String): Int
     private external fun nativeLoadSlot(slot: Int): Int
     private external fun nativeUnloadSlot(slot: Int): Int
+    private external fun nativeSyncSlots(): Int
+    private external fun nativeShutdownDaemon(): Int
+    private external fun nativeAttachShared(): Int
+    private external fun nativeDetachShared()
+    private external fun nativeReadAudio(out: ShortArray): Int
+    private external fun nativeReadLeds(out: IntArray): Int
+    private external fun nativeEditFigure(
+        slot: Int, mask: Int, xp: Int, gold: Int, hat: Int,
+        upgrades: Int, playtime: Int, nickname: String?
+    ): Int
+    private external fun nativeIndexCatalog(paths: Array<String>): Int
+    private external fun nativeCatalogLabel(position: Int): String?
 
     companion object {
         private const val TAG = "MainActivity"
+        // Built-in portal_daemon profiles (see portal_profile.cpp)
+        private val PROFILES = arrayOf("wii", "ps", "traptanium", "xbox360")
+        // Profiles with PORTAL_PROFILE_AUDIO set
+        private val AUDIO_PROFILES = setOf("traptanium")
+        // FigureEditField bits (figure_editor.h)
+        private const val EDIT_XP = 1 shl 0
+        private const val EDIT_GOLD = 1 shl 1
+        private const val EDIT_HAT = 1 shl 2
+        private const val EDIT_NICKNAME = 1 shl 3
         init {
             System.loadLibrary("portal_emulator")
         }
@@ -79,7 +115,9 @@ class MainActivity : AppCompatActivity() {
 
     }
     private fun setupUI() {
-        fileAdapter = DumpFileAdapter { file ->
+        fileAdapter = DumpFileAdapter(
+            describe = { position -> nativeCatalogLabel(position) }
+        ) { file ->
             assignFileToCurrentSlot(file)
         }
         binding.fileRecyclerView.apply {
@@ -97,10 +135,12 @@ class MainActivity : AppCompatActivity() {
         binding.btnLoadSlot.setOnClickListener { loadCurrentSlot() }
         binding.btnUnloadSlot.setOnClickListener { unloadCurrentSlot() }
         /// binding.btnSendSense.setOnClickListener { sendSense() }
+        binding.btnEditFigure.setOnClickListener { showEditFigureDialog() }
 
         binding.btnStartGadget.setOnClickListener { startGadget() }
         binding.btnStopGadget.setOnClickListener { stopGadget() }
         binding.btnCleanup.setOnClickListener { performCleanup() }
+        binding.btnProfile.setOnClickListener { showProfileDialog() }
 
         updateSlotDisplay()
     }
@@ -185,11 +225,77 @@ class MainActivity : AppCompatActivity() {
         selectedDirectory = dir
         val files = dir.listFiles { file ->
             file.extension.lowercase() in listOf("bin", "dmp", "dump", "sky")
-        }?.toList() ?: emptyList()
+        }?.sortedBy { it.name } ?: emptyList()
 
+        // Same order as the adapter, so positions match the labels
+        val duplicates = nativeIndexCatalog(files.map { it.absolutePath }.toTypedArray())
         fileAdapter.updateFiles(files)
         binding.tvDirectoryPath.text = "Directory: ${dir.absolutePath}"
-        Toast.makeText(this, "Found ${files.size} dump files", Toast.LENGTH_SHORT).show()
+        val message = if (duplicates > 0) {
+            "Found ${files.size} dump files ($duplicates share a UID)"
+        } else {
+            "Found ${files.size} dump files"
+        }
+        Toast.makeText(this, message, Toast.LENGTH_SHORT).show()
+    }
+
+    private fun showProfileDialog() {
+        if (gadgetActive) {
+            Toast.makeText(this, "Stop the gadget to change profile", Toast.LENGTH_SHORT).show()
+            return
+        }
+        AlertDialog.Builder(this)
+            .setTitle("Portal Profile")
+            .setSingleChoiceItems(PROFILES, PROFILES.indexOf(selectedProfile)) { dialog, which ->
+                selectedProfile = PROFILES[which]
+                binding.btnProfile.text = "Profile: $selectedProfile"
+                dialog.dismiss()
+            }
+            .show()
+    }
+
+    // Blank fields are left as they are on the figure
+    private fun showEditFigureDialog() {
+        if (!gadgetActive || !slots[currentSlotIndex].loaded) {
+            Toast.makeText(this, "Load the figure on a running portal first", Toast.LENGTH_SHORT).show()
+            return
+        }
+
+        val inputType = android.text.InputType.TYPE_CLASS_NUMBER
+        val xpText = android.widget.EditText(this).apply { hint = "XP"; this.inputType = inputType }
+        val goldText = android.widget.EditText(this).apply { hint = "Gold"; this.inputType = inputType }
+        val hatText = android.widget.EditText(this).apply { hint = "Hat ID"; this.inputType = inputType }
+        val nameText = android.widget.EditText(this).apply { hint = "Nickname (max 16)" }
+        val layout = android.widget.LinearLayout(this).apply {
+            orientation = android.widget.LinearLayout.VERTICAL
+            setPadding(48, 16, 48, 0)
+            addView(xpText)
+            addView(goldText)
+            addView(hatText)
+            addView(nameText)
+        }
+
+        AlertDialog.Builder(this)
+            .setTitle("Edit figure in slot ${currentSlotIndex + 1}")
+            .setView(layout)
+            .setPositiveButton("Apply") { _, _ ->
+                var mask = 0
+                val xp = xpText.text.toString().toIntOrNull()?.also { mask = mask or EDIT_XP } ?: 0
+                val gold = goldText.text.toString().toIntOrNull()?.also { mask = mask or EDIT_GOLD } ?: 0
+                val hat = hatText.text.toString().toIntOrNull()?.also { mask = mask or EDIT_HAT } ?: 0
+                val name = nameText.text.toString().take(16).ifEmpty { null }
+                if (name != null) mask = mask or EDIT_NICKNAME
+
+                if (mask == 0) return@setPositiveButton
+                val result = nativeEditFigure(currentSlotIndex, mask, xp, gold, hat, 0, 0, name)
+                Toast.makeText(
+                    this,
+                    if (result == 0) "Figure updated" else "Edit failed ($result)",
+                    Toast.LENGTH_SHORT
+                ).show()
+            }
+            .setNegativeButton("Cancel", null)
+            .show()
     }
 
     private fun selectSlot(index: Int) {
@@ -220,6 +326,8 @@ class MainActivity : AppCompatActivity() {
             slots[currentSlotIndex].loaded = true
             updateSlotDisplay()
             Toast.makeText(this, "Slot ${currentSlotIndex + 1} loaded", Toast.LENGTH_SHORT).show()
+        } else if (result == -17) {     // -EEXIST
+            Toast.makeText(this, "That figure is already on the portal", Toast.LENGTH_SHORT).show()
         } else {
             Toast.makeText(this, "Failed to load slot", Toast.LENGTH_SHORT).show()
         }
@@ -250,164 +358,11 @@ class MainActivity : AppCompatActivity() {
                 logToFile()
 
                 // ========================================
-                // STEP 1: Clean up any existing state
-                // ========================================
-                Log.d(TAG, "Step 1: Cleaning up any existing gadget")
-                runRootScriptWithLogging(getGadgetCleanupScript())
-                Thread.sleep(500)
-
-                // ========================================
-                // STEP 2: Verify UDC availability
-                // ========================================
-                Log.d(TAG, "Step 2: Checking for UDC")
-                val (udcCheck, udcOutput) = runRootScriptWithOutput("ls /sys/class/udc/")
-                if (udcCheck != 0 || udcOutput.trim().isEmpty()) {
-                    runOnUiThread {
-                        showError("No UDC found. Device may not support USB gadget mode.\nOutput: $udcOutput")
-                        resetStartButton()
-                    }
-                    return@Thread
-                }
-                val udcName = udcOutput.trim().lines().first()
-                Log.d(TAG, "UDC available: $udcName")
-
-                // ========================================
-                // STEP 3: Disable Android USB completely
-                // ========================================
-                Log.d(TAG, "Step 3: Disabling Android USB")
-                val (disableResult, disableOutput) = runRootScriptWithOutput("""
-                    # Stop Android USB services
-                    stop adbd
-
-                    # Disable current USB config
-                    setprop sys.usb.config none
-                    setprop sys.usb.state none
-
-                    # Unbind ALL gadgets from UDC
-                    UDC=$(ls /sys/class/udc | head -n1)
-                    echo "Forcefully unbinding UDC: ${'$'}UDC"
-
-                    for gadget in /config/usb_gadget/*/UDC; do
-                        if [ -f "${'$'}gadget" ]; then
-                            CURRENT=$(cat "${'$'}gadget" 2>/dev/null)
-                            if [ -n "${'$'}CURRENT" ]; then
-                                echo "Unbinding gadget: ${'$'}gadget"
-                                echo "" > "${'$'}gadget" 2>&1
-                            fi
-                        fi
-                    done
-
-                    sleep 1
-                    echo "USB disabled"
-                """.trimIndent())
-
-                if (disableResult != 0) {
-                    Log.w(TAG, "USB disable had warnings: $disableOutput")
-                }
-                Log.d(TAG, "USB disable output: $disableOutput")
-                Thread.sleep(1000)
-
-                // ========================================
-                // STEP 4: Setup gadget ConfigFS structure
-                // ========================================
-                Log.d(TAG, "Step 4: Setting up gadget structure")
-                val (setupResult, setupOutput) = runRootScriptWithOutput(getGadgetSetupScript())
-                if (setupResult != 0) {
-                    runOnUiThread {
-                        showError("Failed to setup gadget:\n$setupOutput")
-                        resetStartButton()
-                    }
-                    return@Thread
-                }
-                Log.d(TAG, "Gadget structure created: $setupOutput")
-                Thread.sleep(500)
-
-                // ========================================
-                // STEP 5: Mount FunctionFS AND fix permissions
+                // STEP 1: Extract daemon executable
                 // ========================================
-                Log.d(TAG, "Step 5: Mounting FunctionFS")
-                val (mountResult, mountOutput) = runRootScriptWithOutput("""
-                    # Create mount point
-                    mkdir -p /dev/usb-ffs/portal0
-
-                    # Check if already mounted
-                    if mount | grep -q "portal0"; then
-                        echo "Already mounted, unmounting first..."
-                        umount /dev/usb-ffs/portal0 2>/dev/null || true
-                        sleep 0.5
-                    fi
-
-                    # Mount FunctionFS
-                    mount -t functionfs portal0 /dev/usb-ffs/portal0
-
-                    if [ ${'$'}? -ne 0 ]; then
-                        echo "Failed to mount FunctionFS"
-                        exit 1
-                    fi
-
-                    echo "FunctionFS mounted successfully"
-
-                    # CRITICAL: Fix ep0 permissions immediately
-                    for i in 1 2 3 4 5; do
-                        if [ -e /dev/usb-ffs/portal0/ep0 ]; then
-                            echo "ep0 appeared, setting permissions..."
-                            chmod 666 /dev/usb-ffs/portal0/ep0
-                            chown system:system /dev/usb-ffs/portal0/ep0 2>/dev/null || true
-                            break
-                        fi
-                        echo "Waiting for ep0 to appear (attempt ${'$'}i)..."
-                        sleep 0.2
-                    done
-
-                    # Verify ep0 exists
-                    if [ ! -e /dev/usb-ffs/portal0/ep0 ]; then
-                        echo "ERROR: ep0 did not appear after mount"
-                        exit 1
-                    fi
-
-                    # Set SELinux permissive
-                    setenforce 0 2>/dev/null || echo "Could not set SELinux permissive"
-
-                    echo "Mount and permissions complete"
-                    ls -la /dev/usb-ffs/portal0/
-                    exit 0
-                """.trimIndent())
-
-                if (mountResult != 0) {
-                    runOnUiThread {
-                        showError("Failed to mount FunctionFS:\n$mountOutput")
-                        resetStartButton()
-                    }
-                    return@Thread
-                }
-                Log.d(TAG, "FunctionFS mounted: $mountOutput")
-                Thread.sleep(300)
-
-                // ========================================
-                // STEP 6: Extract and start daemon executable
-                // ========================================
-                Log.d(TAG, "Step 6: Extracting portal daemon")
-
-                val daemonDest = File(filesDir, "portal_daemon")
-
-                try {
-                    // Extract from assets based on ABI
-                    val abi = Build.SUPPORTED_ABIS[0] // e.g., "arm64-v8a"
-                    val assetPath = "$abi/portal_daemon"
-
-                    Log.d(TAG, "Extracting daemon for ABI: $abi from assets: $assetPath")
-
-                    assets.open(assetPath).use { input ->
-                        daemonDest.outputStream().use { output ->
-                            input.copyTo(output)
-                        }
-                    }
-
-                    // Make executable
-                    Runtime.getRuntime().exec(arrayOf("chmod", "755", daemonDest.absolutePath)).waitFor()
-
-                    Log.d(TAG, "Daemon extracted to: ${daemonDest.absolutePath}")
-
+                Log.d(TAG, "Step 1: Extracting portal daemon")
+                val daemonDest = try {
+                    extractDaemon()
                 } catch (e: Exception) {
                     runOnUiThread {
                         showError("Failed to extract daemon: ${e.message}")
@@ -416,27 +371,36 @@ class MainActivity : AppCompatActivity() {
                     return@Thread
                 }
 
-                // Start daemon with su
+                // ========================================
+                // STEP 2: Start daemon
+                // ========================================
+                // --manage-gadget: the daemon builds the configfs gadget, mounts
+                // FunctionFS, binds the UDC once its descriptors are written and
+                // removes it all again when it exits. --supervise keeps the
+                // endpoints and loaded figures in a parent process that restarts
+                // the worker if it dies. --ctl-uid: only this app (and root) may
+                // use the daemon's control socket.
+                Log.d(TAG, "Step 2: Starting portal daemon")
                 daemonProcess = Runtime.getRuntime().exec(arrayOf(
                     "su", "-c",
-                    "nice -n -20 ${daemonDest.absolutePath} 2>/data/local/tmp/portal_daemon_err.log"
+                    "nice -n -20 ${daemonDest.absolutePath} --profile $selectedProfile --supervise --manage-gadget --ctl-uid ${android.os.Process.myUid()} 2>/data/local/tmp/portal_daemon_err.log"
                 ))
 
                 // Monitor daemon output
                 val reader = daemonProcess!!.inputStream.bufferedReader()
-                daemonReady = false
-                allReady = false
+                daemonReady = CountDownLatch(1)
+                allReady = CountDownLatch(1)
 
                 Thread {
                     try {
                         reader.forEachLine { line ->
                             Log.d(TAG, "Daemon: $line")
                             if (line == "READY") {
-                                daemonReady = true
+                                daemonReady.countDown()
                                 Log.d(TAG, "✓ Daemon reports ep0 ready")
                             }
                             if (line == "ALL_READY") {
-                                allReady = true
+                                allReady.countDown()
                                 Log.d(TAG, "✓ Daemon reports all endpoints ready")
                             }
                             if (line.contains("FATAL") || line.contains("ERROR")) {
@@ -450,121 +414,39 @@ class MainActivity : AppCompatActivity() {
                 }.start()
 
                 // ========================================
-                // STEP 7: Wait for daemon ep0 ready
+                // STEP 3: Wait for gadget and ep0 ready
                 // ========================================
-                Log.d(TAG, "Step 7: Waiting for daemon to open ep0...")
-                for (i in 0 until 15) {
-                    if (daemonReady) {
-                        Log.d(TAG, "✓ ep0 ready after ${i + 1} seconds")
-                        break
-                    }
-                    Thread.sleep(1000)
-                }
-
-                if (!daemonReady) {
+                Log.d(TAG, "Step 3: Waiting for daemon to set up the gadget and ep0...")
+                val waitStart = System.currentTimeMillis()
+                if (daemonReady.await(15, TimeUnit.SECONDS)) {
+                    Log.d(TAG, "✓ ep0 ready after ${System.currentTimeMillis() - waitStart} ms")
+                } else {
                     runOnUiThread {
                         showError("Timeout: Daemon failed to initialize ep0")
                         resetStartButton()
                     }
-                    daemonProcess?.destroy()
-                    cleanupFunctionFS()
-                    return@Thread
-                }
-
-                // ========================================
-                // STEP 8: Bind to UDC (creates ep1/ep2)
-                // ========================================
-                Log.d(TAG, "Step 8: Binding to UDC to create data endpoints...")
-                val bindScript = """
-                    UDC=$(ls /sys/class/udc | head -n1)
-                    if [ -z "${'$'}UDC" ]; then
-                        echo "ERROR: No UDC found"
-                        exit 1
-                    fi
-
-                    echo "Using UDC: ${'$'}UDC"
-
-                    # Verify not already bound
-                    CURRENT=$(cat /config/usb_gadget/kaos_portal/UDC 2>/dev/null)
-                    if [ -n "${'$'}CURRENT" ]; then
-                        echo "WARNING: Already bound to ${'$'}CURRENT, unbinding..."
-                        echo "" > /config/usb_gadget/kaos_portal/UDC 2>&1
-                        sleep 0.5
-                    fi
-
-                    # Bind to UDC
-                    echo "Binding to ${'$'}UDC..."
-                    if echo "${'$'}UDC" > /config/usb_gadget/kaos_portal/UDC 2>&1; then
-                        echo "SUCCESS: Bound to UDC"
-                        sleep 1
-
-                        # Verify endpoints created
-                        if [ -e /dev/usb-ffs/portal0/ep1 ] && [ -e /dev/usb-ffs/portal0/ep2 ]; then
-                            echo "Data endpoints created successfully"
-                            exit 0
-                        else
-                            echo "ERROR: Data endpoints not created"
-                            exit 1
-                        fi
-                    else
-                        echo "ERROR: Bind failed"
-                        dmesg | tail -20
-                        exit 1
-                    fi
-                """.trimIndent()
-
-                val (bindResult, bindOutput) = runRootScriptWithOutput(bindScript)
-                Log.d(TAG, "Bind result (exit=$bindResult):\n$bindOutput")
-
-                if (bindResult != 0 || !bindOutput.contains("SUCCESS")) {
-                    runOnUiThread {
-                        showError("Failed to bind to UDC:\n$bindOutput")
-                        resetStartButton()
-                    }
-                    daemonProcess?.destroy()
-                    cleanupFunctionFS()
+                    stopDaemon()
                     return@Thread
                 }
 
                 // ========================================
-                // STEP 9: Fix data endpoint permissions
-                // ========================================
-                Log.d(TAG, "Step 9: Setting permissions for data endpoints...")
-                val (permResult, permOutput) = runRootScriptWithOutput("""
-                    for i in 1 2 3 4 5; do
-                        if [ -e /dev/usb-ffs/portal0/ep1 ] && [ -e /dev/usb-ffs/portal0/ep2 ]; then
-                            chmod 666 /dev/usb-ffs/portal0/ep1 2>&1
-                            chmod 666 /dev/usb-ffs/portal0/ep2 2>&1
-                            chown system:system /dev/usb-ffs/portal0/ep1 2>/dev/null || true
-                            chown system:system /dev/usb-ffs/portal0/ep2 2>/dev/null || true
-                            echo "Permissions set"
-                            break
-                        fi
-                        sleep 0.3
-                    done
-
-                    ls -la /dev/usb-ffs/portal0/
-                """.trimIndent())
-                Log.d(TAG, "Data endpoint permissions: $permOutput")
-                Thread.sleep(500)
-
-                // ========================================
-                // STEP 10: Wait for daemon to open data endpoints
+                // STEP 4: Wait for daemon to bind and open data endpoints
                 // ========================================
-                Log.d(TAG, "Step 10: Waiting for daemon to open data endpoints...")
-                for (i in 0 until 10) {
-                    if (allReady) {
-                        Log.d(TAG, "✓ All endpoints ready after ${i + 1} seconds")
-                        break
-                    }
-                    Thread.sleep(1000)
-                }
+                Log.d(TAG, "Step 4: Waiting for daemon to open data endpoints...")
+                val endpointsReady = allReady.await(10, TimeUnit.SECONDS)
+                if (endpointsReady) Log.d(TAG, "✓ All endpoints ready")
 
                 // ========================================
                 // FINAL: Update UI
                 // ========================================
+                if (!endpointsReady) stopDaemon()
                 runOnUiThread {
-                    if (allReady) {
+                    if (endpointsReady) {
+                        // Hand figures loaded before the daemon started over to it
+                        if (nativeSyncSlots() != 0) {
+                            Log.w(TAG, "Some loaded slots could not be passed to the daemon")
+                        }
+                        startSharedState()
                         gadgetActive = true
                         updateGadgetStatus()
                         binding.btnStartGadget.isEnabled = false  // ADD THIS
@@ -572,8 +454,6 @@ class MainActivity : AppCompatActivity() {
                         Toast.makeText(this, "✓ Gadget started! Connect USB to host.", Toast.LENGTH_LONG).show()
                     } else {
                         showError("Timeout: Data endpoints failed to initialize")
-                        daemonProcess?.destroy()
-                        cleanupFunctionFS()
                         resetStartButton()
                     }
                 }
@@ -586,9 +466,7 @@ class MainActivity : AppCompatActivity() {
                     resetStartButton()
                 }
                 try {
-                    unbindUdc()
-                    daemonProcess?.destroy()
-                    cleanupFunctionFS()
+                    stopDaemon()
                 } catch (cleanupEx: Exception) {
                     Log.e(TAG, "Error during cleanup", cleanupEx)
                 }
@@ -596,6 +474,45 @@ class MainActivity : AppCompatActivity() {
         }.start()
     }
 
+    // Extract the daemon for this ABI from assets into filesDir
+    private fun extractDaemon(): File {
+        val daemonDest = File(filesDir, "portal_daemon")
+        val abi = Build.SUPPORTED_ABIS[0] // e.g., "arm64-v8a"
+        val assetPath = "$abi/portal_daemon"
+
+        Log.d(TAG, "Extracting daemon for ABI: $abi from assets: $assetPath")
+        assets.open(assetPath).use { input ->
+            daemonDest.outputStream().use { output ->
+                input.copyTo(output)
+            }
+        }
+        Runtime.getRuntime().exec(arrayOf("chmod", "755", daemonDest.absolutePath)).waitFor()
+        Log.d(TAG, "Daemon extracted to: ${daemonDest.absolutePath}")
+        return daemonDest
+    }
+
+    // Ask the daemon to exit so it unbinds and removes the gadget itself. If
+    // it does not answer, kill it and remove the gadget with a one-shot run.
+    private fun stopDaemon() {
+        val process = daemonProcess ?: return
+        daemonProcess = null
+        if (nativeShutdownDaemon() == 0 && process.waitFor(5, TimeUnit.SECONDS)) {
+            Log.d(TAG, "Daemon exited")
+            return
+        }
+        Log.w(TAG, "Daemon did not stop on request, killing it")
+        process.destroy()
+        val (result, output) = runGadgetCommand("down")
+        Log.d(TAG, "Gadget teardown (exit=$result): $output")
+    }
+
+    // One-shot "portal_daemon --gadget <args>" as root
+    private fun runGadgetCommand(args: String): Pair<Int, String> {
+        val daemon = File(filesDir, "portal_daemon")
+        if (!daemon.exists()) return Pair(-1, "portal_daemon not extracted")
+        return runRootScriptWithOutput("${daemon.absolutePath} --gadget $args")
+    }
+
     private fun showError(message: String) {
         Log.e(TAG, "Error: $message")
         Toast.makeText(this, message, Toast.LENGTH_LONG).show()
@@ -603,6 +520,33 @@ class MainActivity : AppCompatActivity() {
         binding.btnStartGadget.text = "Start Gadget"
     }
 
+    // Runs on the UI thread once the daemon is up
+    private fun startSharedState() {
+        if (sharedAttached) return
+        if (nativeAttachShared() != 0) {
+            Log.w(TAG, "Portal LEDs/speaker unavailable: daemon shared state not mapped")
+            return
+        }
+        sharedAttached = true
+        Choreographer.getInstance().postFrameCallback(ledFrameCallback)
+        if (selectedProfile in AUDIO_PROFILES) {
+            audioPlayer = PortalAudioPlayer { nativeReadAudio(it) }.also { it.start() }
+        }
+    }
+
+    // The LED callback reads the mapping on the UI thread, so unmap there too
+    private fun stopSharedState() {
+        audioPlayer?.stop()
+        audioPlayer = null
+        runOnUiThread {
+            if (sharedAttached) {
+                sharedAttached = false
+                Choreographer.getInstance().removeFrameCallback(ledFrameCallback)
+                nativeDetachShared()
+            }
+        }
+    }
+
     private fun stopGadget() {
         Log.e(TAG, "stopGadget() called! Stack trace:")
         Log.e(TAG, Thread.currentThread().stackTrace.joinToString("\n") { it.toString() })
@@ -620,47 +564,16 @@ class MainActivity : AppCompatActivity() {
                 Log.d(TAG, "=== STOPPING GADGET ===")
 
                 // ========================================
-                // STEP 1: Unbind from UDC first
-                // ========================================
-                Log.d(TAG, "Step 1: Unbinding from UDC...")
-                unbindUdc()
-                Thread.sleep(500)
-
-                // ========================================
-                // STEP 2: Stop native emulator thread
-                // ========================================
-                Log.d(TAG, "Stopping daemon...")
-                daemonProcess?.destroy()
-                daemonProcess = null
-
-                // ========================================
-                // STEP 3: Cleanup native state
-                // ========================================
-                Log.d(TAG, "Step 3: Cleaning up native state...")
-                daemonProcess?.destroy()
-                Thread.sleep(300)
-
-                // ========================================
-                // STEP 4: Unmount FunctionFS
+                // STEP 1: Release the shared state mapping
                 // ========================================
-                Log.d(TAG, "Step 4: Unmounting FunctionFS...")
-                cleanupFunctionFS()
-                Thread.sleep(300)
+                stopSharedState()
 
                 // ========================================
-                // STEP 5: Re-enable Android USB (optional)
+                // STEP 2: Stop daemon; it unbinds the UDC, unmounts FunctionFS
+                // and removes the gadget on exit
                 // ========================================
-                Log.d(TAG, "Step 5: Re-enabling Android USB...")
-                val (reEnableResult, reEnableOutput) = runRootScriptWithOutput("""
-                # Restart ADB if desired
-                # start adbd
-
-                # Or restore Android's default USB configuration
-                # setprop sys.usb.config adb
-
-                echo "Cleanup complete"
-            """.trimIndent())
-                Log.d(TAG, "Re-enable output: $reEnableOutput")
+                Log.d(TAG, "Step 2: Stopping daemon...")
+                stopDaemon()
 
                 // ========================================
                 // FINAL: Update UI
@@ -697,34 +610,15 @@ class MainActivity : AppCompatActivity() {
         binding.btnStartGadget.text = "Start Gadget"
     }
 
-    private fun unbindUdc() {
-        val (result, output) = runRootScriptWithOutput("""
-            UDC_PATH=/config/usb_gadget/kaos_portal/UDC
-            if [ -f "${'$'}UDC_PATH" ]; then
-                CURRENT=$(cat "${'$'}UDC_PATH" 2>/dev/null)
-                if [ -n "${'$'}CURRENT" ]; then
-                    echo "Unbinding from UDC: ${'$'}CURRENT"
-                    echo "" > "${'$'}UDC_PATH" 2>&1
-                    sleep 0.5
-                    echo "Unbound successfully"
-                else
-                    echo "Already unbound"
-                fi
-            else
-                echo "UDC file not found"
-            fi
-        """.trimIndent())
-        Log.d(TAG, "Unbind UDC: $output")
-    }
-
     private fun performCleanup() {
         AlertDialog.Builder(this)
             .setTitle("Cleanup USB Gadget")
             .setMessage("This will restore normal USB functionality. Continue?")
             .setPositiveButton("Yes") { _, _ ->
                 Thread {
-                    daemonProcess?.destroy()
-                    val (cleanupResult, cleanupOutput) = runRootScriptWithOutput(getGadgetCleanupScript())
+                    stopSharedState()
+                    stopDaemon()
+                    val (cleanupResult, cleanupOutput) = runGadgetCommand("down --restore-usb")
 
                     Log.d(TAG, "Cleanup result: $cleanupOutput")
 
@@ -770,14 +664,6 @@ class MainActivity : AppCompatActivity() {
         binding.btnStopGadget.isEnabled = gadgetActive     // Stop enabled only when active
     }
 
-    private fun runRootScriptWithLogging(script: String): Int {
-        val (exitCode, output) = runRootScriptWithOutput(script)
-        if (exitCode != 0 || output.isNotEmpty()) {
-            Log.d(TAG, "Script output (exit=$exitCode): $output")
-        }
-        return exitCode
-    }
-
     private fun runRootScriptWithOutput(script: String): Pair<Int, String> {
         return try {
             val process = Runtime.getRuntime().exec(arrayOf("su", "-c", script))
@@ -799,193 +685,9 @@ class MainActivity : AppCompatActivity() {
         }
     }
 
-    private fun getGadgetSetupScript(): String {
-        return """
-            set -e
-
-            GADGET_DIR="/config/usb_gadget/kaos_portal"
-
-            if [ -d "${'$'}GADGET_DIR" ]; then
-                echo "Cleaning up existing gadget..."
-                if [ -f "${'$'}GADGET_DIR/UDC" ]; then
-                    echo "" > "${'$'}GADGET_DIR/UDC" 2>/dev/null || true
-                fi
-                rm -rf "${'$'}GADGET_DIR/configs/c.1/ffs.portal0" 2>/dev/null || true
-                rmdir "${'$'}GADGET_DIR/functions/ffs.portal0" 2>/dev/null || true
-                rmdir "${'$'}GADGET_DIR/configs/c.1/strings/0x409" 2>/dev/null || true
-                rmdir "${'$'}GADGET_DIR/configs/c.1" 2>/dev/null || true
-                rmdir "${'$'}GADGET_DIR/strings/0x409" 2>/dev/null || true
-                rmdir "${'$'}GADGET_DIR" 2>/dev/null || true
-            fi
-
-            echo "Creating gadget directory..."
-            mkdir -p "${'$'}GADGET_DIR"
-            cd "${'$'}GADGET_DIR"
-
-            # Device descriptor
-            echo 0x1430 > idVendor
-            echo 0x0150 > idProduct
-            echo 0x0200 > bcdUSB
-            echo 0x0100 > bcdDevice
-            echo 0x00 > bDeviceClass
-            echo 0x00 > bDeviceSubClass
-            echo 0x00 > bDeviceProtocol
-            echo 64 > bMaxPacketSize0
-
-            # Device strings - THESE ARE WHAT WINDOWS SEES
-            mkdir -p strings/0x409
-            echo "Activision" > strings/0x409/manufacturer
-            echo "Spyro Porta" > strings/0x409/product
-            echo "99B3f9C9E6" > strings/0x409/serialnumber
-
-            # Configuration
-            mkdir -p configs/c.1/strings/0x409
-            echo "Portal Config" > configs/c.1/strings/0x409/configuration
-            echo 250 > configs/c.1/MaxPower
-            echo 0x80 > configs/c.1/bmAttributes
-
-            # FunctionFS function
-            mkdir -p functions/ffs.portal0
-
-            # Link function
-            ln -s "${'$'}GADGET_DIR/functions/ffs.portal0" "${'$'}GADGET_DIR/configs/c.1/ffs.portal0"
-
-            # Verify
-            if [ -L "${'$'}GADGET_DIR/configs/c.1/ffs.portal0" ]; then
-                echo "✓ Setup complete"
-            else
-                echo "✗ Setup failed"
-                exit 1
-            fi
-        """.trimIndent()
-    }
-
-    private fun getGadgetCleanupScript(): String {
-        return """
-            set -x
-
-            GADGET=/config/usb_gadget/kaos_portal
-
-            # Unbind from UDC
-            if [ -f "${'$'}GADGET/UDC" ]; then
-                echo "" > "${'$'}GADGET/UDC" 2>/dev/null || true
-                sleep 0.5
-            fi
-
-            # Unmount FunctionFS
-            umount /dev/usb-ffs/portal0 2>/dev/null || true
-            rmdir /dev/usb-ffs/portal0 2>/dev/null || true
-
-            # Remove symlink
-            rm -f "${'$'}GADGET/configs/c.1/ffs.portal0" 2>/dev/null || true
-
-            # Remove function
-            rmdir "${'$'}GADGET/functions/ffs.portal0" 2>/dev/null || true
-
-            # Remove config
-            rmdir "${'$'}GADGET/configs/c.1/strings/0x409" 2>/dev/null || true
-            rmdir "${'$'}GADGET/configs/c.1" 2>/dev/null || true
-
-            # Remove device strings
-            rmdir "${'$'}GADGET/strings/0x409" 2>/dev/null || true
-
-            # Remove gadget
-            rmdir "${'$'}GADGET" 2>/dev/null || true
-
-            # Restore Android USB
-            setprop sys.usb.config mtp,adb
-            start adbd
-
-            echo "Cleanup complete"
-        """.trimIndent()
-    }
-
-    private fun setupFunctionFS(): Boolean {
-        try {
-            Log.i(TAG, "Setting up FunctionFS for portal0...")
-
-            // Create mount point
-            val createDir = Runtime.getRuntime().exec(arrayOf(
-                "su", "-c", "mkdir -p /dev/usb-ffs/portal0"
-            ))
-            createDir.waitFor()
-
-            // Check if already mounted
-            val checkMount = Runtime.getRuntime().exec(arrayOf(
-                "su", "-c", "mount | grep portal0"
-            ))
-            checkMount.waitFor()
-
-            val mountOutput = checkMount.inputStream.bufferedReader().readText()
-            if (mountOutput.contains("portal0")) {
-                Log.i(TAG, "FunctionFS already mounted for portal0")
-                return true
-            }
-
-            // Mount functionfs
-            val mount = Runtime.getRuntime().exec(arrayOf(
-                "su", "-c", "mount -t functionfs portal0 /dev/usb-ffs/portal0"
-            ))
-            val mountResult = mount.waitFor()
-
-            if (mountResult != 0) {
-                val error = mount.errorStream.bufferedReader().readText()
-                Log.e(TAG, "Failed to mount functionfs: $error")
-                return false
-            }
-
-            Log.i(TAG, "FunctionFS mounted successfully")
-
-            // Verify mount
-            val verify = Runtime.getRuntime().exec(arrayOf(
-                "su", "-c", "ls -la /dev/usb-ffs/portal0"
-            ))
-            verify.waitFor()
-            val verifyOutput = verify.inputStream.bufferedReader().readText()
-            Log.i(TAG, "Mount verification: $verifyOutput")
-
-            return true
-
-        } catch (e: Exception) {
-            Log.e(TAG, "Exception setting up FunctionFS: ${e.message}")
-            return false
-        }
-    }
-
-    private fun cleanupFunctionFS() {
-        val (result, output) = runRootScriptWithOutput("""
-            # Check if mounted
-            if mount | grep -q "portal0"; then
-                echo "Unmounting FunctionFS..."
-                umount /dev/usb-ffs/portal0 2>&1
-
-                if [ ${'$'}? -eq 0 ]; then
-                    echo "Unmounted successfully"
-                else
-                    echo "Unmount failed or already unmounted"
-                fi
-            else
-                echo "FunctionFS not mounted"
-            fi
-
-            # Remove directory if it exists
-            if [ -d /dev/usb-ffs/portal0 ]; then
-                rmdir /dev/usb-ffs/portal0 2>&1 || echo "Directory cleanup done"
-            fi
-
-            # Verify
-            if [ -d /dev/usb-ffs/portal0 ]; then
-                echo "WARNING: Directory still exists"
-                ls -la /dev/usb-ffs/portal0/ 2>&1 || true
-            else
-                echo "Cleanup complete"
-            fi
-        """.trimIndent())
-        Log.d(TAG, "FunctionFS cleanup: $output")
-    }
-
     override fun onDestroy() {
         super.onDestroy()
+        stopSharedState()
         if (gadgetActive) {
             daemonProcess?.destroy()
         }
@@ -0,0 +1,78 @@
+package com.kaos.portalemulator
+
+import android.media.AudioAttributes
+import android.media.AudioFormat
+import android.media.AudioTrack
+import android.util.Log
+
+/**
+ * Plays the portal speaker stream the daemon decodes into shared memory.
+ * [readSamples] drains up to buffer.size samples and returns how many it copied.
+ */
+class PortalAudioPlayer(
+    private val readSamples: (ShortArray) -> Int
+) {
+    companion object {
+        private const val TAG = "PortalAudioPlayer"
+        private const val SAMPLE_RATE = 8000
+        private const val POLL_MS = 10L
+    }
+
+    @Volatile
+    private var running = false
+    private var thread: Thread? = null
+
+    fun start() {
+        if (running) return
+        running = true
+        thread = Thread({ playLoop() }, "portal-audio").apply { start() }
+    }
+
+    fun stop() {
+        running = false
+        thread?.join(500)
+        thread = null
+    }
+
+    private fun playLoop() {
+        val minBuffer = AudioTrack.getMinBufferSize(
+            SAMPLE_RATE, AudioFormat.CHANNEL_OUT_MONO, AudioFormat.ENCODING_PCM_16BIT
+        )
+        val track = AudioTrack.Builder()
+            .setAudioAttributes(
+                AudioAttributes.Builder()
+                    .setUsage(AudioAttributes.USAGE_GAME)
+                    .setContentType(AudioAttributes.CONTENT_TYPE_SONIFICATION)
+                    .build()
+            )
+            .setAudioFormat(
+                AudioFormat.Builder()
+                    .setSampleRate(SAMPLE_RATE)
+                    .setChannelMask(AudioFormat.CHANNEL_OUT_MONO)
+                    .setEncoding(AudioFormat.ENCODING_PCM_16BIT)
+                    .build()
+            )
+            .setBufferSizeInBytes(minBuffer)
+            .setPerformanceMode(AudioTrack.PERFORMANCE_MODE_LOW_LATENCY)
+            .build()
+
+        val buffer = ShortArray(minBuffer / 2)
+        try {
+            track.play()
+            while (running) {
+                val count = readSamples(buffer)
+                if (count < 0) break
+                if (count == 0) {
+                    Thread.sleep(POLL_MS)
+                    continue
+                }
+                track.write(buffer, 0, count)
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Audio playback stopped: ${e.message}")
+        } finally {
+            track.stop()
+            track.release()
+        }
+    }
+}
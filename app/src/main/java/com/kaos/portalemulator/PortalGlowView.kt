@@ -0,0 +1,44 @@
+package com.kaos.portalemulator
+
+import android.content.Context
+import android.graphics.Canvas
+import android.graphics.Color
+import android.graphics.Paint
+import android.graphics.RectF
+import android.util.AttributeSet
+import android.view.View
+
+/**
+ * Draws the portal's left, trap and right LEDs from the colours the daemon
+ * publishes. [setColors] takes them in the daemon's order: right, trap, left.
+ */
+class PortalGlowView @JvmOverloads constructor(
+    context: Context,
+    attrs: AttributeSet? = null
+) : View(context, attrs) {
+
+    private val colors = IntArray(3) { Color.BLACK }
+    private val paint = Paint(Paint.ANTI_ALIAS_FLAG)
+    private val rect = RectF()
+
+    fun setColors(rgb: IntArray) {
+        if (rgb.contentEquals(colors)) return
+        rgb.copyInto(colors)
+        invalidate()
+    }
+
+    override fun onDraw(canvas: Canvas) {
+        super.onDraw(canvas)
+        val gap = height / 4f
+        val segment = (width - 2 * gap) / 3f
+        val radius = height / 2f
+
+        // Left to right on screen: left side, trap, right side
+        for ((position, side) in intArrayOf(2, 1, 0).withIndex()) {
+            val left = position * (segment + gap)
+            rect.set(left, 0f, left + segment, height.toFloat())
+            paint.color = colors[side] or 0xFF000000.toInt()
+            canvas.drawRoundRect(rect, radius, radius, paint)
+        }
+    }
+}